@@ -60,6 +60,7 @@
 #include "compositor-x11.h"
 #include "compositor-wayland.h"
 #include "windowed-output-api.h"
+#include "weston-debug.h"
 
 #define WINDOW_TITLE "Weston Compositor"
 
@@ -84,12 +85,61 @@ struct wet_compositor {
 	struct wl_listener heads_changed_listener;
 	int (*simple_output_configure)(struct weston_output *output);
 	bool init_failed;
+	struct wl_event_source *config_watch_source;
+	struct weston_config_listener config_listener;
 };
 
 static FILE *weston_logfile = NULL;
+static struct weston_debug_scope *log_scope;
 
 static int cached_tm_mday = -1;
 
+/* All log output goes through here: to the log file, via the log
+ * writer thread once it runs, and to subscribers of the "log" scope.
+ * This runs on helper threads too, which weston_debug_scope_write()
+ * allows. */
+static void
+log_write(const char *data, size_t len)
+{
+	weston_log_write(fileno(weston_logfile), data, len);
+	weston_debug_scope_write(log_scope, data, len);
+}
+
+static int
+log_vprintf(const char *fmt, va_list ap)
+{
+	char buf[512];
+	char *str = buf;
+	va_list aq;
+	int len;
+
+	va_copy(aq, ap);
+	len = vsnprintf(buf, sizeof buf, fmt, ap);
+	if (len >= (int) sizeof buf && vasprintf(&str, fmt, aq) < 0)
+		len = -1;
+	va_end(aq);
+
+	if (len > 0)
+		log_write(str, len);
+	if (str != buf && len >= 0)
+		free(str);
+
+	return len;
+}
+
+static int __attribute__ ((format (printf, 1, 2)))
+log_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = log_vprintf(fmt, ap);
+	va_end(ap);
+
+	return len;
+}
+
 static int weston_log_timestamp(void)
 {
 	struct timeval tv;
@@ -100,26 +150,26 @@ static int weston_log_timestamp(void)
 
 	brokendown_time = localtime(&tv.tv_sec);
 	if (brokendown_time == NULL)
-		return fprintf(weston_logfile, "[(NULL)localtime] ");
+		return log_printf("[(NULL)localtime] ");
 
 	if (brokendown_time->tm_mday != cached_tm_mday) {
 		strftime(string, sizeof string, "%Y-%m-%d %Z", brokendown_time);
-		fprintf(weston_logfile, "Date: %s\n", string);
+		log_printf("Date: %s\n", string);
 
 		cached_tm_mday = brokendown_time->tm_mday;
 	}
 
 	strftime(string, sizeof string, "%H:%M:%S", brokendown_time);
 
-	return fprintf(weston_logfile, "[%s.%03li] ", string, tv.tv_usec/1000);
+	return log_printf("[%s.%03li] ", string, tv.tv_usec/1000);
 }
 
 static void
 custom_handler(const char *fmt, va_list arg)
 {
 	weston_log_timestamp();
-	fprintf(weston_logfile, "libwayland: ");
-	vfprintf(weston_logfile, fmt, arg);
+	log_printf("libwayland: ");
+	log_vprintf(fmt, arg);
 }
 
 static void
@@ -135,13 +185,19 @@ weston_log_file_open(const char *filename)
 
 	if (weston_logfile == NULL)
 		weston_logfile = stderr;
-	else
-		setvbuf(weston_logfile, NULL, _IOLBF, 256);
+
+	/* From here on a slow log file or terminal can't hold up
+	 * the compositor; output is written by a separate thread. */
+	if (weston_log_writer_start() < 0)
+		fprintf(stderr, "failed to start the log writer thread, "
+			"logging synchronously\n");
 }
 
 static void
 weston_log_file_close(void)
 {
+	weston_log_writer_stop();
+
 	if ((weston_logfile != stderr) && (weston_logfile != NULL))
 		fclose(weston_logfile);
 	weston_logfile = stderr;
@@ -153,7 +209,7 @@ vlog(const char *fmt, va_list ap)
 	int l;
 
 	l = weston_log_timestamp();
-	l += vfprintf(weston_logfile, fmt, ap);
+	l += log_vprintf(fmt, ap);
 
 	return l;
 }
@@ -161,7 +217,7 @@ vlog(const char *fmt, va_list ap)
 static int
 vlog_continue(const char *fmt, va_list argp)
 {
-	return vfprintf(weston_logfile, fmt, argp);
+	return log_vprintf(fmt, argp);
 }
 
 static struct wl_list child_process_list;
@@ -475,6 +531,7 @@ usage(int error_code)
 		"  -c, --config=FILE\tConfig file to load, defaults to weston.ini\n"
 		"  --no-config\t\tDo not read weston.ini\n"
 		"  --wait-for-debugger\tRaise SIGSTOP on start-up\n"
+		"  --debug\t\tEnable debug extension\n"
 		"  -h, --help\t\tThis help message\n\n");
 
 #if defined(BUILD_DRM_COMPOSITOR)
@@ -504,6 +561,7 @@ usage(int error_code)
 		"\tnormal 90 180 270 flipped flipped-90 flipped-180 flipped-270\n"
 		"  --use-pixman\t\tUse the pixman (CPU) renderer (default: no rendering)\n"
 		"  --no-outputs\t\tDo not create any virtual outputs\n"
+		"  --output-count=N\tCreate N virtual outputs side by side\n"
 		"\n");
 #endif
 
@@ -519,6 +577,8 @@ usage(int error_code)
 		"  --rdp4-key=FILE\tThe file containing the key for RDP4 encryption\n"
 		"  --rdp-tls-cert=FILE\tThe file containing the certificate for TLS encryption\n"
 		"  --rdp-tls-key=FILE\tThe file containing the private key for TLS encryption\n"
+		"  --rdp-encoder-threads=N\tNumber of threads encoding updates, 0 to encode\n"
+		"\t\t\t\ton the compositor thread (default: one per CPU)\n"
 		"\n");
 #endif
 
@@ -532,6 +592,8 @@ usage(int error_code)
 		"  --use-pixman\t\tUse the pixman (CPU) renderer\n"
 		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"  --sprawl\t\tCreate one fullscreen output for every parent output\n"
+		"  --subsurfaces\t\tPass suitable client buffers to the parent as\n"
+		"\t\t\t\tsubsurfaces instead of compositing them\n"
 		"  --display=DISPLAY\tWayland display to connect to\n\n");
 #endif
 
@@ -772,6 +834,7 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct weston_config_section *s;
 	int repaint_msec;
 	int vt_switching;
+	uint32_t texture_budget;
 
 	s = weston_config_get_section(config, "keyboard", NULL, NULL);
 	weston_config_section_get_string(s, "keymap_rules",
@@ -809,6 +872,9 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_uint(s, "texture-budget", &texture_budget, 0);
+	ec->texture_budget = (uint64_t) texture_budget * 1024 * 1024;
+
 	return 0;
 }
 
@@ -865,6 +931,67 @@ weston_transform_to_string(uint32_t output_transform)
 	return "<illegal value>";
 }
 
+static void
+wet_config_changed(struct weston_config_listener *listener,
+		   struct weston_config *config,
+		   const struct weston_config_change *change)
+{
+	struct wet_compositor *wet =
+		container_of(listener, struct wet_compositor, config_listener);
+	struct weston_compositor *ec = wet->compositor;
+	struct weston_config_section *s;
+	int32_t rate, delay;
+
+	/* Most settings are only read at startup; pick up the ones that
+	 * can change under a running compositor. */
+	if (strcmp(change->section_name, "keyboard") != 0 ||
+	    (strcmp(change->key, "repeat-rate") != 0 &&
+	     strcmp(change->key, "repeat-delay") != 0))
+		return;
+
+	s = weston_config_get_section(config, "keyboard", NULL, NULL);
+	weston_config_section_get_int(s, "repeat-rate", &rate, 40);
+	weston_config_section_get_int(s, "repeat-delay", &delay, 400);
+	weston_compositor_set_kb_repeat_info(ec, rate, delay);
+}
+
+static int
+on_config_file_changed(int fd, uint32_t mask, void *data)
+{
+	struct wet_compositor *wet = data;
+	const char *path = weston_config_get_full_path(wet->config);
+	int ret;
+
+	ret = weston_config_dispatch_watch(wet->config);
+	if (ret < 0)
+		weston_log("failed to reload config file '%s', "
+			   "keeping the current settings\n", path);
+	else if (ret > 0)
+		weston_log("reloaded config file '%s', %d key(s) changed\n",
+			   path, ret);
+
+	return 0;
+}
+
+static void
+wet_watch_config(struct wet_compositor *wet, struct wl_event_loop *loop)
+{
+	int fd;
+
+	wet->config_listener.changed = wet_config_changed;
+	weston_config_add_listener(wet->config, &wet->config_listener);
+
+	fd = weston_config_watch(wet->config);
+	if (fd < 0) {
+		weston_log("not watching config file for changes: %m\n");
+		return;
+	}
+
+	wet->config_watch_source =
+		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+				     on_config_file_changed, wet);
+}
+
 static int
 load_configuration(struct weston_config **config, int32_t noconfig,
 		   const char *config_file)
@@ -1342,7 +1469,9 @@ load_headless_backend(struct weston_compositor *c,
 	const struct weston_windowed_output_api *api;
 	struct weston_headless_backend_config config = {{ 0, }};
 	int no_outputs = 0;
+	int output_count = 1;
 	int ret = 0;
+	int i;
 	char *transform = NULL;
 
 	struct wet_output_config *parsed_options = wet_init_parsed_options(c);
@@ -1355,10 +1484,17 @@ load_headless_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &config.use_pixman },
 		{ WESTON_OPTION_STRING, "transform", 0, &transform },
 		{ WESTON_OPTION_BOOLEAN, "no-outputs", 0, &no_outputs },
+		{ WESTON_OPTION_INTEGER, "output-count", 0, &output_count },
 	};
 
 	parse_options(options, ARRAY_LENGTH(options), argc, argv);
 
+	if (output_count < 1 || output_count > 32) {
+		weston_log("Invalid output count %d, must be 1-32\n",
+			   output_count);
+		return -1;
+	}
+
 	if (transform) {
 		if (weston_parse_transform(transform, &parsed_options->transform) < 0) {
 			weston_log("Invalid transform \"%s\"\n", transform);
@@ -1389,6 +1525,14 @@ load_headless_backend(struct weston_compositor *c,
 
 		if (api->create_head(c, "headless") < 0)
 			return -1;
+
+		for (i = 1; i < output_count; i++) {
+			char name[32];
+
+			snprintf(name, sizeof name, "headless-%d", i);
+			if (api->create_head(c, name) < 0)
+				return -1;
+		}
 	}
 
 	return 0;
@@ -1441,6 +1585,7 @@ weston_rdp_backend_config_init(struct weston_rdp_backend_config *config)
 	config->server_key = NULL;
 	config->env_socket = 0;
 	config->no_clients_resize = 0;
+	config->encoder_threads = -1;
 }
 
 static int
@@ -1465,7 +1610,8 @@ load_rdp_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_BOOLEAN, "no-clients-resize", 0, &config.no_clients_resize },
 		{ WESTON_OPTION_STRING,  "rdp4-key", 0, &config.rdp_key },
 		{ WESTON_OPTION_STRING,  "rdp-tls-cert", 0, &config.server_cert },
-		{ WESTON_OPTION_STRING,  "rdp-tls-key", 0, &config.server_key }
+		{ WESTON_OPTION_STRING,  "rdp-tls-key", 0, &config.server_key },
+		{ WESTON_OPTION_INTEGER, "rdp-encoder-threads", 0, &config.encoder_threads }
 	};
 
 	parse_options(rdp_options, ARRAY_LENGTH(rdp_options), argc, argv);
@@ -1661,6 +1807,7 @@ load_wayland_backend(struct weston_compositor *c,
 	int32_t use_pixman_ = 0;
 	int32_t sprawl_ = 0;
 	int32_t fullscreen_ = 0;
+	int32_t subsurfaces_ = 0;
 
 	struct wet_output_config *parsed_options = wet_init_parsed_options(c);
 	if (!parsed_options)
@@ -1679,12 +1826,14 @@ load_wayland_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_INTEGER, "output-count", 0, &count },
 		{ WESTON_OPTION_BOOLEAN, "fullscreen", 0, &fullscreen_ },
 		{ WESTON_OPTION_BOOLEAN, "sprawl", 0, &sprawl_ },
+		{ WESTON_OPTION_BOOLEAN, "subsurfaces", 0, &subsurfaces_ },
 	};
 
 	parse_options(wayland_options, ARRAY_LENGTH(wayland_options), argc, argv);
 	config.sprawl = sprawl_;
 	config.use_pixman = use_pixman_;
 	config.fullscreen = fullscreen_;
+	config.use_subsurfaces = subsurfaces_;
 
 	section = weston_config_get_section(wc, "shell", NULL, NULL);
 	weston_config_section_get_string(section, "cursor-theme",
@@ -1834,6 +1983,7 @@ int main(int argc, char *argv[])
 	struct wet_compositor wet = { 0 };
 	int require_input;
 	int32_t wait_for_debugger = 0;
+	int32_t debug_protocol = 0;
 
 	const struct weston_option core_options[] = {
 		{ WESTON_OPTION_STRING, "backend", 'B', &backend },
@@ -1848,6 +1998,7 @@ int main(int argc, char *argv[])
 		{ WESTON_OPTION_BOOLEAN, "no-config", 0, &noconfig },
 		{ WESTON_OPTION_STRING, "config", 'c', &config_file },
 		{ WESTON_OPTION_BOOLEAN, "wait-for-debugger", 0, &wait_for_debugger },
+		{ WESTON_OPTION_BOOLEAN, "debug", 0, &debug_protocol },
 	};
 
 	if (os_fd_set_cloexec(fileno(stdin))) {
@@ -1933,6 +2084,12 @@ int main(int argc, char *argv[])
 	}
 	segv_compositor = wet.compositor;
 
+	log_scope = weston_compositor_add_debug_scope(wet.compositor, "log",
+			"Weston and Wayland log\n", NULL, NULL);
+
+	if (debug_protocol)
+		weston_compositor_enable_debug_protocol(wet.compositor);
+
 	if (weston_compositor_init_config(wet.compositor, config) < 0)
 		goto out;
 
@@ -2024,6 +2181,9 @@ int main(int argc, char *argv[])
 	if (argc > 1)
 		goto out;
 
+	if (config)
+		wet_watch_config(&wet, loop);
+
 	weston_compositor_wake(wet.compositor);
 
 	wl_display_run(display);
@@ -2037,9 +2197,14 @@ int main(int argc, char *argv[])
 	ret = wet.compositor->exit_code;
 
 out:
+	if (wet.config_watch_source)
+		wl_event_source_remove(wet.config_watch_source);
+
 	/* free(NULL) is valid, and it won't be NULL if it's used */
 	free(wet.parsed_options);
 
+	weston_debug_scope_destroy(log_scope);
+	log_scope = NULL;
 	weston_compositor_destroy(wet.compositor);
 
 out_signals:
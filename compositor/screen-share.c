@@ -75,6 +75,10 @@ struct shared_output {
 		struct wl_list free_buffers;
 	} shm;
 
+	/* Damage since the last commit, in output coordinates */
+	pixman_region32_t damage;
+	struct weston_damage_history damage_history;
+
 	int cache_dirty;
 	pixman_image_t *cache_image;
 	uint32_t *tmp_data;
@@ -104,7 +108,9 @@ struct ss_shm_buffer {
 	struct wl_buffer *buffer;
 	void *data;
 	size_t size;
-	pixman_region32_t damage;
+	/* Commits since this buffer was last attached, 0 if its content
+	 * is undefined. */
+	int age;
 
 	pixman_image_t *pm_image;
 };
@@ -398,8 +404,6 @@ ss_shm_buffer_destroy(struct ss_shm_buffer *buffer)
 	wl_buffer_destroy(buffer->buffer);
 	munmap(buffer->data, buffer->size);
 
-	pixman_region32_fini(&buffer->damage);
-
 	wl_list_remove(&buffer->link);
 	wl_list_remove(&buffer->free_link);
 	free(buffer);
@@ -480,8 +484,6 @@ shared_output_get_shm_buffer(struct shared_output *so)
 	wl_list_init(&sb->free_link);
 	wl_list_insert(&so->shm.buffers, &sb->link);
 
-	pixman_region32_init_rect(&sb->damage, 0, 0, width, height);
-
 	sb->data = data;
 	sb->size = height * stride;
 
@@ -506,7 +508,9 @@ shared_output_get_shm_buffer(struct shared_output *so)
 	return sb;
 
 out_pixman_error:
-	pixman_region32_fini(&sb->damage);
+	wl_buffer_destroy(sb->buffer);
+	wl_list_remove(&sb->link);
+	free(sb);
 out_unmap:
 	munmap(data, height * stride);
 out_close:
@@ -624,10 +628,49 @@ static const struct wl_callback_listener shared_output_frame_listener = {
 	shared_output_frame_callback
 };
 
+static void
+shared_output_flush(struct shared_output *so)
+{
+	/* If the socket is full, finish the flush once it is writable
+	 * again rather than waiting for the parent here. */
+	if (wl_display_flush(so->parent.display) < 0 && errno == EAGAIN)
+		wl_event_source_fd_update(so->event_source,
+					  WL_EVENT_READABLE |
+					  WL_EVENT_WRITABLE);
+}
+
+static void
+shared_output_get_buffer_damage(struct shared_output *so,
+				struct ss_shm_buffer *sb,
+				pixman_region32_t *buffer_damage)
+{
+	pixman_region32_init(buffer_damage);
+	if (!weston_damage_history_get(&so->damage_history, sb->age,
+				       &so->damage, buffer_damage))
+		pixman_region32_union_rect(buffer_damage, buffer_damage, 0, 0,
+					   so->output->width,
+					   so->output->height);
+}
+
+static void
+shared_output_rotate_damage(struct shared_output *so,
+			    struct ss_shm_buffer *sb)
+{
+	struct ss_shm_buffer *b;
+
+	weston_damage_history_push(&so->damage_history, &so->damage);
+	pixman_region32_clear(&so->damage);
+
+	wl_list_for_each(b, &so->shm.buffers, link)
+		b->age = weston_damage_history_age(b->age);
+	sb->age = 1;
+}
+
 static void
 shared_output_update(struct shared_output *so)
 {
 	struct ss_shm_buffer *sb;
+	pixman_region32_t buffer_damage;
 	pixman_box32_t *r;
 	int i, nrects;
 	pixman_transform_t transform;
@@ -645,8 +688,6 @@ shared_output_update(struct shared_output *so)
 	output_compute_transform(so->output, &transform);
 	pixman_image_set_transform(so->cache_image, &transform);
 
-	pixman_image_set_clip_region32(sb->pm_image, &sb->damage);
-
 	if (so->output->current_scale == 1) {
 		pixman_image_set_filter(so->cache_image,
 					PIXMAN_FILTER_NEAREST, NULL, 0);
@@ -655,20 +696,26 @@ shared_output_update(struct shared_output *so)
 					PIXMAN_FILTER_BILINEAR, NULL, 0);
 	}
 
-	pixman_image_composite32(PIXMAN_OP_SRC,
-				 so->cache_image, /* src */
-				 NULL, /* mask */
-				 sb->pm_image, /* dest */
-				 0, 0, /* src_x, src_y */
-				 0, 0, /* mask_x, mask_y */
-				 0, 0, /* dest_x, dest_y */
-				 so->output->width, /* width */
-				 so->output->height /* height */);
-
-	pixman_image_set_transform(sb->pm_image, NULL);
-	pixman_image_set_clip_region32(sb->pm_image, NULL);
+	/* Only copy what changed since this buffer was last attached */
+	shared_output_get_buffer_damage(so, sb, &buffer_damage);
 
-	r = pixman_region32_rectangles(&sb->damage, &nrects);
+	r = pixman_region32_rectangles(&buffer_damage, &nrects);
+	for (i = 0; i < nrects; ++i)
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 so->cache_image, /* src */
+					 NULL, /* mask */
+					 sb->pm_image, /* dest */
+					 r[i].x1, r[i].y1, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 r[i].x1, r[i].y1, /* dest_x, dest_y */
+					 r[i].x2 - r[i].x1, /* width */
+					 r[i].y2 - r[i].y1 /* height */);
+
+	pixman_region32_fini(&buffer_damage);
+
+	/* The parent only needs to know what changed since the last commit,
+	 * whatever buffer it was in. */
+	r = pixman_region32_rectangles(&so->damage, &nrects);
 	for (i = 0; i < nrects; ++i)
 		wl_surface_damage(so->parent.surface, r[i].x1, r[i].y1,
 				  r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
@@ -680,12 +727,10 @@ shared_output_update(struct shared_output *so)
 				 &shared_output_frame_listener, so);
 
 	wl_surface_commit(so->parent.surface);
-	wl_callback_destroy(wl_display_sync(so->parent.display));
-	wl_display_flush(so->parent.display);
+	shared_output_flush(so);
 
-	/* Clear the buffer damage */
-	pixman_region32_fini(&sb->damage);
-	pixman_region32_init(&sb->damage);
+	shared_output_rotate_damage(so, sb);
+	so->cache_dirty = 0;
 }
 
 static void
@@ -754,8 +799,11 @@ shared_output_handle_event(int fd, uint32_t mask, void *data)
 
 	if (mask & WL_EVENT_READABLE)
 		count = wl_display_dispatch(so->parent.display);
-	if (mask & WL_EVENT_WRITABLE)
-		wl_display_flush(so->parent.display);
+	if (mask & WL_EVENT_WRITABLE) {
+		if (wl_display_flush(so->parent.display) >= 0)
+			wl_event_source_fd_update(so->event_source,
+						  WL_EVENT_READABLE);
+	}
 
 	if (mask == 0) {
 		count = wl_display_dispatch_pending(so->parent.display);
@@ -818,9 +866,8 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 				  &so->output->previous_damage);
 	pixman_region32_translate(&damage, -so->output->x, -so->output->y);
 
-	/* Apply damage to all buffers */
-	wl_list_for_each(sb, &so->shm.buffers, link)
-		pixman_region32_union(&sb->damage, &sb->damage, &damage);
+	/* Accumulate until the next commit to the parent */
+	pixman_region32_union(&so->damage, &so->damage, &damage);
 
 	/* Transform to buffer coordinates */
 	weston_transformed_region(so->output->width, so->output->height,
@@ -849,6 +896,15 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 
 		pixman_region32_fini(&damage);
 		pixman_region32_init_rect(&damage, 0, 0, width, height);
+
+		/* The parent has to be told about the whole output too */
+		pixman_region32_union_rect(&so->damage, &so->damage, 0, 0,
+					   so->output->width,
+					   so->output->height);
+
+		/* Contents of all buffers are stale now */
+		wl_list_for_each(sb, &so->shm.buffers, link)
+			sb->age = 0;
 	}
 
 	if (shared_output_ensure_tmp_data(so, &damage) < 0) {
@@ -972,6 +1028,9 @@ shared_output_create(struct weston_output *output, int parent_fd)
 	wl_list_init(&so->shm.buffers);
 	wl_list_init(&so->shm.free_buffers);
 
+	pixman_region32_init(&so->damage);
+	weston_damage_history_init(&so->damage_history);
+
 	so->output = output;
 	so->output_destroyed.notify = output_destroyed;
 	wl_signal_add(&so->output->destroy_signal, &so->output_destroyed);
@@ -1015,6 +1074,9 @@ shared_output_destroy(struct shared_output *so)
 	pixman_image_unref(so->cache_image);
 	free(so->tmp_data);
 
+	pixman_region32_fini(&so->damage);
+	weston_damage_history_release(&so->damage_history);
+
 	free(so);
 }
 
@@ -26,6 +26,8 @@
 #include "config.h"
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <linux/input.h>
 
 #include "compositor.h"
@@ -143,6 +145,9 @@ recorder_binding(struct weston_keyboard *keyboard, const struct timespec *time,
 	struct screenshooter *shooter = data;
 	struct weston_recorder *recorder = shooter->recorder;;
 	static const char filename[] = "capture.wcap";
+	struct weston_recorder_options options = { 0 };
+	struct weston_config_section *section;
+	char *compression;
 
 	if (recorder) {
 		weston_recorder_stop(recorder);
@@ -154,7 +159,24 @@ recorder_binding(struct weston_keyboard *keyboard, const struct timespec *time,
 			output = container_of(ec->output_list.next,
 					      struct weston_output, link);
 
-		shooter->recorder = weston_recorder_start(output, filename);
+		section = weston_config_get_section(wet_get_config(ec),
+						    "recorder", NULL, NULL);
+		weston_config_section_get_uint(section, "keyframe-interval",
+					       &options.keyframe_interval, 0);
+		weston_config_section_get_string(section, "compression",
+						 &compression, "none");
+		if (strcmp(compression, "lz4") == 0)
+			options.compression = WESTON_RECORDER_COMPRESSION_LZ4;
+		else if (strcmp(compression, "zstd") == 0)
+			options.compression = WESTON_RECORDER_COMPRESSION_ZSTD;
+		else if (strcmp(compression, "none") != 0)
+			weston_log("unknown recorder compression %s\n",
+				   compression);
+		free(compression);
+
+		shooter->recorder =
+			weston_recorder_start_with_options(output, filename,
+							   &options);
 	}
 }
 
@@ -31,6 +31,11 @@
 #include "shell.h"
 #include "shared/helpers.h"
 
+/* Windows other than the highlighted one only get frame callbacks a few
+ * times per second while shown as thumbnails.  They are still drawn from
+ * the client's own buffer: there are no compositor side snapshots. */
+#define EXPOSAY_THUMBNAIL_FRAME_INTERVAL 250
+
 struct exposay_surface {
 	struct desktop_shell *shell;
 	struct exposay_output *eoutput;
@@ -63,6 +68,8 @@ static void exposay_check_state(struct desktop_shell *shell);
 static void
 exposay_surface_destroy(struct exposay_surface *esurface)
 {
+	esurface->surface->frame_callback_interval = 0;
+
 	wl_list_remove(&esurface->link);
 	wl_list_remove(&esurface->view_destroy_listener.link);
 
@@ -159,6 +166,12 @@ exposay_highlight_surface(struct desktop_shell *shell,
 	if (shell->exposay.focus_current == view)
 		return;
 
+	/* Only the highlighted window is kept live */
+	if (shell->exposay.focus_current)
+		shell->exposay.focus_current->surface->frame_callback_interval =
+			EXPOSAY_THUMBNAIL_FRAME_INTERVAL;
+	view->surface->frame_callback_interval = 0;
+
 	shell->exposay.row_current = esurface->row;
 	shell->exposay.column_current = esurface->column;
 	shell->exposay.cur_output = esurface->eoutput;
@@ -297,6 +310,9 @@ exposay_layout(struct desktop_shell *shell, struct shell_output *shell_output)
 		esurface->shell = shell;
 		esurface->eoutput = eoutput;
 		esurface->view = view;
+		esurface->surface = view->surface;
+		esurface->surface->frame_callback_interval =
+			EXPOSAY_THUMBNAIL_FRAME_INTERVAL;
 
 		esurface->row = i / eoutput->grid_size;
 		esurface->column = i % eoutput->grid_size;
@@ -454,6 +454,20 @@ get_animation_type(char *animation)
 		return ANIMATION_NONE;
 }
 
+static enum weston_hidden_frame_policy
+get_hidden_frame_policy(char *policy)
+{
+	if (!policy)
+		return WESTON_HIDDEN_FRAME_POLICY_THROTTLE;
+
+	if (!strcmp("normal", policy))
+		return WESTON_HIDDEN_FRAME_POLICY_NORMAL;
+	else if (!strcmp("hold", policy))
+		return WESTON_HIDDEN_FRAME_POLICY_HOLD;
+	else
+		return WESTON_HIDDEN_FRAME_POLICY_THROTTLE;
+}
+
 static void
 shell_configuration(struct desktop_shell *shell)
 {
@@ -461,6 +475,8 @@ shell_configuration(struct desktop_shell *shell)
 	char *s, *client;
 	int ret;
 	int allow_zap;
+	enum weston_hidden_frame_policy hidden_frame_policy;
+	uint32_t hidden_frame_interval;
 
 	section = weston_config_get_section(wet_get_config(shell->compositor),
 					    "shell", NULL, NULL);
@@ -505,6 +521,16 @@ shell_configuration(struct desktop_shell *shell)
 	weston_config_section_get_uint(section, "num-workspaces",
 				       &shell->workspaces.num,
 				       DEFAULT_NUM_WORKSPACES);
+
+	weston_config_section_get_string(section,
+					 "hidden-frame-policy", &s, "throttle");
+	hidden_frame_policy = get_hidden_frame_policy(s);
+	free(s);
+	weston_config_section_get_uint(section, "hidden-frame-interval",
+				       &hidden_frame_interval, 1000);
+	weston_compositor_set_hidden_frame_policy(shell->compositor,
+						  hidden_frame_policy,
+						  hidden_frame_interval);
 }
 
 struct weston_output *
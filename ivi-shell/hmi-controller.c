@@ -124,6 +124,8 @@ struct hmi_controller {
 
 	int32_t                             workspace_count;
 	struct wl_array                     ui_widgets;
+	/* reused by switch_mode(), see get_application_surfaces() */
+	struct wl_array                     application_surfaces;
 	int32_t                             is_initialized;
 
 	struct weston_compositor           *compositor;
@@ -174,6 +176,37 @@ is_surf_in_ui_widget(struct hmi_controller *hmi_ctrl,
 	return 0;
 }
 
+/**
+ * Collect the application ivi_surfaces, i.e. all but the ui widgets, into
+ * an array which is kept around so that switching modes does not allocate
+ * once it has grown to the number of surfaces.
+ */
+static int32_t
+get_application_surfaces(struct hmi_controller *hmi_ctrl,
+			 struct ivi_layout_surface ***pp_surface)
+{
+	struct wl_array *surfaces = &hmi_ctrl->application_surfaces;
+	struct ivi_layout_surface *ivisurf = NULL;
+	struct ivi_layout_surface **entry;
+
+	surfaces->size = 0;
+
+	while ((ivisurf = hmi_ctrl->interface->get_next_surface(ivisurf))) {
+		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
+			continue;
+
+		entry = wl_array_add(surfaces, sizeof *entry);
+		if (entry == NULL)
+			break;
+
+		*entry = ivisurf;
+	}
+
+	*pp_surface = surfaces->data;
+
+	return surfaces->size / sizeof *entry;
+}
+
 static int
 compare_launcher_info(const void *lhs, const void *rhs)
 {
@@ -211,39 +244,24 @@ mode_divided_into_tiling(struct hmi_controller *hmi_ctrl,
 	int32_t surface_x = 0;
 	int32_t surface_y = 0;
 	struct ivi_layout_surface *ivisurf  = NULL;
-	struct ivi_layout_surface **surfaces;
-	struct ivi_layout_surface **new_order;
+	struct ivi_layout_surface *new_order[8];
 	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
 	struct ivi_layout_layer *ivilayer = NULL;
 
 	int32_t i = 0;
-	int32_t surf_num = 0;
 	int32_t idx = 0;
 
-	surfaces = MEM_ALLOC(sizeof(*surfaces) * surface_length);
-	new_order = MEM_ALLOC(sizeof(*surfaces) * surface_length);
-
-	for (i = 0; i < surface_length; i++) {
-		ivisurf = pp_surface[i];
-
-		/* skip ui widgets */
-		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
-			continue;
-
-		surfaces[surf_num++] = ivisurf;
-	}
-
 	wl_list_for_each_reverse(layer, layer_list, link) {
-		if (idx >= surf_num)
+		if (idx >= surface_length)
 			break;
 
 		ivilayer = layer->ivilayer;
 
 		for (i = 0; i < 8; i++, idx++) {
-			if (idx >= surf_num)
+			if (idx >= surface_length)
 				break;
 
-			ivisurf = surfaces[idx];
+			ivisurf = pp_surface[idx];
 			new_order[i] = ivisurf;
 			if (i < 4) {
 				surface_x = (int32_t)(i * (surface_width));
@@ -269,11 +287,8 @@ mode_divided_into_tiling(struct hmi_controller *hmi_ctrl,
 					IVI_LAYOUT_TRANSITION_LAYER_VIEW_ORDER,
 					duration);
 	}
-	for (i = idx; i < surf_num; i++)
-		hmi_ctrl->interface->surface_set_visibility(surfaces[i], false);
-
-	free(surfaces);
-	free(new_order);
+	for (i = idx; i < surface_length; i++)
+		hmi_ctrl->interface->surface_set_visibility(pp_surface[i], false);
 }
 
 static void
@@ -289,36 +304,21 @@ mode_divided_into_sidebyside(struct hmi_controller *hmi_ctrl,
 
 	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
 	int32_t i = 0;
-	struct ivi_layout_surface **surfaces;
-	struct ivi_layout_surface **new_order;
+	struct ivi_layout_surface *new_order[2];
 	struct ivi_layout_layer *ivilayer = NULL;
-	int32_t surf_num = 0;
 	int32_t idx = 0;
 
-	surfaces = MEM_ALLOC(sizeof(*surfaces) * surface_length);
-	new_order = MEM_ALLOC(sizeof(*surfaces) * surface_length);
-
-	for (i = 0; i < surface_length; i++) {
-		ivisurf = pp_surface[i];
-
-		/* skip ui widgets */
-		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
-			continue;
-
-		surfaces[surf_num++] = ivisurf;
-	}
-
 	wl_list_for_each_reverse(layer, layer_list, link) {
-		if (idx >= surf_num)
+		if (idx >= surface_length)
 			break;
 
 		ivilayer = layer->ivilayer;
 
 		for (i = 0; i < 2; i++, idx++) {
-			if (idx >= surf_num)
+			if (idx >= surface_length)
 				break;
 
-			ivisurf = surfaces[idx];
+			ivisurf = pp_surface[idx];
 			new_order[i] = ivisurf;
 
 			hmi_ctrl->interface->surface_set_transition(ivisurf,
@@ -334,15 +334,12 @@ mode_divided_into_sidebyside(struct hmi_controller *hmi_ctrl,
 		hmi_ctrl->interface->layer_set_render_order(ivilayer, new_order, i);
 	}
 
-	for (i = idx; i < surf_num; i++) {
-		hmi_ctrl->interface->surface_set_transition(surfaces[i],
+	for (i = idx; i < surface_length; i++) {
+		hmi_ctrl->interface->surface_set_transition(pp_surface[i],
 						IVI_LAYOUT_TRANSITION_VIEW_FADE_ONLY,
 						duration);
-		hmi_ctrl->interface->surface_set_visibility(surfaces[i], false);
+		hmi_ctrl->interface->surface_set_visibility(pp_surface[i], false);
 	}
-
-	free(surfaces);
-	free(new_order);
 }
 
 static void
@@ -357,25 +354,13 @@ mode_fullscreen_someone(struct hmi_controller *hmi_ctrl,
 	struct ivi_layout_surface *ivisurf  = NULL;
 	int32_t i = 0;
 	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
-	int32_t surf_num = 0;
-	struct ivi_layout_surface **surfaces;
 
-	surfaces = MEM_ALLOC(sizeof(*surfaces) * surface_length);
+	hmi_ctrl->interface->layer_set_render_order(layer->ivilayer, pp_surface,
+						    surface_length);
 
 	for (i = 0; i < surface_length; i++) {
 		ivisurf = pp_surface[i];
 
-		/* skip ui widgets */
-		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
-			continue;
-
-		surfaces[surf_num++] = ivisurf;
-	}
-	hmi_ctrl->interface->layer_set_render_order(layer->ivilayer, surfaces, surf_num);
-
-	for (i = 0; i < surf_num; i++) {
-		ivisurf = surfaces[i];
-
 		if ((i > 0) && (i < hmi_ctrl->screen_num)) {
 			layer = wl_container_of(layer->link.prev, layer, link);
 			hmi_ctrl->interface->layer_set_render_order(layer->ivilayer, &ivisurf, 1);
@@ -389,8 +374,6 @@ mode_fullscreen_someone(struct hmi_controller *hmi_ctrl,
 							     surface_width,
 							     surface_height);
 	}
-
-	free(surfaces);
 }
 
 static void
@@ -400,7 +383,6 @@ mode_random_replace(struct hmi_controller *hmi_ctrl,
 		    struct wl_list *layer_list)
 {
 	struct hmi_controller_layer *application_layer = NULL;
-	struct hmi_controller_layer **layers = NULL;
 	int32_t surface_width  = 0;
 	int32_t surface_height = 0;
 	int32_t surface_x = 0;
@@ -410,22 +392,15 @@ mode_random_replace(struct hmi_controller *hmi_ctrl,
 	int32_t i = 0;
 	int32_t layer_idx = 0;
 
-	layers = MEM_ALLOC(sizeof(*layers) * hmi_ctrl->screen_num);
-
-	wl_list_for_each(application_layer, layer_list, link) {
-		layers[layer_idx] = application_layer;
-		layer_idx++;
-	}
-
 	for (i = 0; i < surface_length; i++) {
 		ivisurf = pp_surface[i];
 
-		/* skip ui widgets */
-		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
-			continue;
-
 		/* surface determined at random a layer that belongs */
 		layer_idx = rand() % hmi_ctrl->screen_num;
+		wl_list_for_each(application_layer, layer_list, link) {
+			if (layer_idx-- == 0)
+				break;
+		}
 
 		hmi_ctrl->interface->surface_set_transition(ivisurf,
 					IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
@@ -433,10 +408,10 @@ mode_random_replace(struct hmi_controller *hmi_ctrl,
 
 		hmi_ctrl->interface->surface_set_visibility(ivisurf, true);
 
-		surface_width  = (int32_t)(layers[layer_idx]->width * 0.25f);
-		surface_height = (int32_t)(layers[layer_idx]->height * 0.25f);
-		surface_x = rand() % (layers[layer_idx]->width - surface_width);
-		surface_y = rand() % (layers[layer_idx]->height - surface_height);
+		surface_width  = (int32_t)(application_layer->width * 0.25f);
+		surface_height = (int32_t)(application_layer->height * 0.25f);
+		surface_x = rand() % (application_layer->width - surface_width);
+		surface_y = rand() % (application_layer->height - surface_height);
 
 		hmi_ctrl->interface->surface_set_destination_rectangle(ivisurf,
 							     surface_x,
@@ -444,31 +419,8 @@ mode_random_replace(struct hmi_controller *hmi_ctrl,
 							     surface_width,
 							     surface_height);
 
-		hmi_ctrl->interface->layer_add_surface(layers[layer_idx]->ivilayer, ivisurf);
-	}
-
-	free(layers);
-}
-
-static int32_t
-has_application_surface(struct hmi_controller *hmi_ctrl,
-			struct ivi_layout_surface **pp_surface,
-			int32_t surface_length)
-{
-	struct ivi_layout_surface *ivisurf  = NULL;
-	int32_t i = 0;
-
-	for (i = 0; i < surface_length; i++) {
-		ivisurf = pp_surface[i];
-
-		/* skip ui widgets */
-		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
-			continue;
-
-		return 1;
+		hmi_ctrl->interface->layer_add_surface(application_layer->ivilayer, ivisurf);
 	}
-
-	return 0;
 }
 
 /**
@@ -482,21 +434,15 @@ switch_mode(struct hmi_controller *hmi_ctrl,
 	struct wl_list *layer = &hmi_ctrl->application_layer_list;
 	struct ivi_layout_surface **pp_surface = NULL;
 	int32_t surface_length = 0;
-	int32_t ret = 0;
 
 	if (!hmi_ctrl->is_initialized)
 		return;
 
 	hmi_ctrl->layout_mode = layout_mode;
 
-	ret = hmi_ctrl->interface->get_surfaces(&surface_length, &pp_surface);
-	assert(!ret);
-
-	if (!has_application_surface(hmi_ctrl, pp_surface, surface_length)) {
-		free(pp_surface);
-		pp_surface = NULL;
+	surface_length = get_application_surfaces(hmi_ctrl, &pp_surface);
+	if (surface_length == 0)
 		return;
-	}
 
 	switch (layout_mode) {
 	case IVI_HMI_CONTROLLER_LAYOUT_MODE_TILING:
@@ -518,7 +464,6 @@ switch_mode(struct hmi_controller *hmi_ctrl,
 	}
 
 	hmi_ctrl->interface->commit_changes();
-	free(pp_surface);
 }
 
 /**
@@ -619,9 +564,7 @@ set_notification_configure_surface(struct wl_listener *listener, void *data)
 	struct hmi_controller_layer *layer_link = NULL;
 	struct ivi_layout_layer *application_layer = NULL;
 	struct weston_surface *surface;
-	struct ivi_layout_surface **ivisurfs = NULL;
-	int32_t length = 0;
-	int32_t i;
+	struct ivi_layout_surface *layer_surf;
 
 	/* return if the surface is not application content */
 	if (is_surf_in_ui_widget(hmi_ctrl, ivisurf)) {
@@ -645,21 +588,18 @@ set_notification_configure_surface(struct wl_listener *listener, void *data)
 	 */
 	wl_list_for_each_reverse(layer_link, &hmi_ctrl->application_layer_list, link) {
 		application_layer = layer_link->ivilayer;
-		hmi_ctrl->interface->get_surfaces_on_layer(application_layer,
-							&length, &ivisurfs);
-		for (i = 0; i < length; i++) {
-			if (ivisurf == ivisurfs[i]) {
+		layer_surf = NULL;
+		while ((layer_surf = hmi_ctrl->interface->get_next_surface_on_layer(
+					application_layer, layer_surf))) {
+			if (ivisurf == layer_surf) {
 				/*
 				 * if it is non new invoked application, just call
 				 * commit_changes to apply source_rectangle.
 				 */
 				hmi_ctrl->interface->commit_changes();
-				free(ivisurfs);
 				return;
 			}
 		}
-		free(ivisurfs);
-		ivisurfs = NULL;
 	}
 
 	switch_mode(hmi_ctrl, hmi_ctrl->layout_mode);
@@ -740,6 +680,7 @@ hmi_controller_destroy(struct wl_listener *listener, void *data)
 	}
 
 	wl_array_release(&hmi_ctrl->ui_widgets);
+	wl_array_release(&hmi_ctrl->application_surfaces);
 	free(hmi_ctrl->hmi_setting);
 	free(hmi_ctrl);
 }
@@ -782,6 +723,7 @@ hmi_controller_create(struct weston_compositor *ec)
 	i = 0;
 
 	wl_array_init(&hmi_ctrl->ui_widgets);
+	wl_array_init(&hmi_ctrl->application_surfaces);
 	hmi_ctrl->layout_mode = IVI_HMI_CONTROLLER_LAYOUT_MODE_TILING;
 	hmi_ctrl->hmi_setting = hmi_server_setting_create(ec);
 	hmi_ctrl->compositor = ec;
@@ -573,6 +573,76 @@ struct ivi_layout_interface {
 	 */
 	int32_t (*screen_remove_layer)(struct weston_output *output,
 				       struct ivi_layout_layer *removelayer);
+
+	/**
+	 * allocation-free iterators
+	 *
+	 * These walk the same committed state as the get_* functions
+	 * returning arrays, in the same order, without allocating. Each one
+	 * returns the element following prev, the first element if prev is
+	 * NULL, and NULL past the last element or if prev is not part of
+	 * the iterated set. The layout must not be committed, and the
+	 * returned objects not destroyed, while iterating:
+	 *
+	 *	for (ivisurf = lyt->get_next_surface_on_layer(ivilayer, NULL);
+	 *	     ivisurf != NULL;
+	 *	     ivisurf = lyt->get_next_surface_on_layer(ivilayer, ivisurf))
+	 *		...
+	 */
+	struct ivi_layout_surface *
+		(*get_next_surface)(struct ivi_layout_surface *prev);
+
+	struct ivi_layout_layer *
+		(*get_next_layer)(struct ivi_layout_layer *prev);
+
+	struct ivi_layout_surface *
+		(*get_next_surface_on_layer)(struct ivi_layout_layer *ivilayer,
+					     struct ivi_layout_surface *prev);
+
+	struct ivi_layout_layer *
+		(*get_next_layer_on_screen)(struct weston_output *output,
+					    struct ivi_layout_layer *prev);
+
+	struct ivi_layout_layer *
+		(*get_next_layer_under_surface)(struct ivi_layout_surface *ivisurf,
+						struct ivi_layout_layer *prev);
+
+	struct weston_output *
+		(*get_next_screen_under_layer)(struct ivi_layout_layer *ivilayer,
+					       struct weston_output *prev);
+
+	/**
+	 * read-only snapshots into caller-owned storage
+	 *
+	 * Copy at most size elements into array and return the total number
+	 * of elements, which may be larger than size. Pass a NULL array and
+	 * a size of 0 to only count them. The copy stays valid across
+	 * commits, so it may be used to modify the layout while walking it.
+	 *
+	 * \return the number of elements
+	 * \return IVI_FAILED if the method call was failed
+	 */
+	int32_t (*get_surfaces_snapshot)(struct ivi_layout_surface **array,
+					 int32_t size);
+
+	int32_t (*get_layers_snapshot)(struct ivi_layout_layer **array,
+				       int32_t size);
+
+	int32_t (*get_surfaces_on_layer_snapshot)(struct ivi_layout_layer *ivilayer,
+						  struct ivi_layout_surface **array,
+						  int32_t size);
+
+	int32_t (*get_layers_on_screen_snapshot)(struct weston_output *output,
+						 struct ivi_layout_layer **array,
+						 int32_t size);
+
+	int32_t (*get_layers_under_surface_snapshot)(struct ivi_layout_surface *ivisurf,
+						     struct ivi_layout_layer **array,
+						     int32_t size);
+
+	int32_t (*get_screens_under_layer_snapshot)(struct ivi_layout_layer *ivilayer,
+						    struct weston_output **array,
+						    int32_t size);
 };
 
 static inline const struct ivi_layout_interface *
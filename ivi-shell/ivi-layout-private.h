@@ -46,6 +46,7 @@ struct ivi_layout_view {
 
 struct ivi_layout_surface {
 	struct wl_list link;	/* ivi_layout::surface_list */
+	struct wl_list dirty_link;	/* ivi_layout::dirty_surface_list */
 	struct wl_signal property_changed;
 	int32_t update_count;
 	uint32_t id_surface;
@@ -64,6 +65,7 @@ struct ivi_layout_surface {
 
 struct ivi_layout_layer {
 	struct wl_list link;	/* ivi_layout::layer_list */
+	struct wl_list dirty_link;	/* ivi_layout::dirty_layer_list */
 	struct wl_signal property_changed;
 	uint32_t id_layer;
 
@@ -95,6 +97,16 @@ struct ivi_layout {
 	struct wl_list screen_list;	/* ivi_layout_screen::link */
 	struct wl_list view_list;	/* ivi_layout_view::link */
 
+	/* objects touched since the last commit_changes() */
+	struct wl_list dirty_surface_list;	/* ivi_layout_surface::dirty_link */
+	struct wl_list dirty_layer_list;	/* ivi_layout_layer::dirty_link */
+	/* layout_layer has to be rebuilt on the next commit */
+	bool view_list_dirty;
+
+	/* views on a moved or resized output have to be recomputed */
+	struct wl_listener output_moved;
+	struct wl_listener output_resized;
+
 	struct {
 		struct wl_signal created;
 		struct wl_signal removed;
@@ -117,8 +129,16 @@ struct ivi_layout *get_instance(void);
 struct ivi_layout_transition;
 
 struct ivi_layout_transition_set {
-	struct wl_event_source  *event_source;
+	struct weston_compositor *compositor;
 	struct wl_list          transition_list;
+
+	/* transitions are ticked from the repaint of this output */
+	struct weston_output    *output;
+	struct weston_animation animation;	/* weston_output::animation_list */
+	struct wl_listener      output_destroyed;
+
+	/* fallback clock while no output exists */
+	struct wl_event_source  *event_source;
 };
 
 typedef void (*ivi_layout_transition_destroy_user_func)(void *user_data);
@@ -126,6 +146,9 @@ typedef void (*ivi_layout_transition_destroy_user_func)(void *user_data);
 struct ivi_layout_transition_set *
 ivi_layout_transition_set_create(struct weston_compositor *ec);
 
+void
+ivi_layout_transition_set_start(struct ivi_layout_transition_set *transitions);
+
 void
 ivi_layout_transition_move_resize_view(struct ivi_layout_surface *surface,
 				       int32_t dest_x, int32_t dest_y,
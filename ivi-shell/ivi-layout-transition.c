@@ -35,6 +35,8 @@
 #include "ivi-shell.h"
 #include "ivi-layout-export.h"
 #include "ivi-layout-private.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
 
 struct ivi_layout_transition;
 
@@ -156,15 +158,60 @@ do_transition_frame(struct ivi_layout_transition *transition,
 		layout_transition_destroy(transition);
 }
 
+/*
+ * Advance every running transition to the same timestamp and commit the
+ * result once, however many transitions are active.
+ */
+static void
+layout_transition_tick(struct ivi_layout_transition_set *transitions,
+		       const struct timespec *time)
+{
+	uint32_t msec = timespec_to_msec(time);
+	struct transition_node *node = NULL;
+	struct transition_node *next = NULL;
+
+	wl_list_for_each_safe(node, next, &transitions->transition_list, link) {
+		do_transition_frame(node->transition, msec);
+	}
+
+	ivi_layout_commit_changes();
+}
+
+static void
+layout_transition_stop(struct ivi_layout_transition_set *transitions)
+{
+	wl_list_remove(&transitions->animation.link);
+	wl_list_init(&transitions->animation.link);
+	transitions->output = NULL;
+
+	wl_event_source_timer_update(transitions->event_source, 0);
+}
+
+static void
+layout_transition_animation_frame(struct weston_animation *animation,
+				  struct weston_output *output,
+				  const struct timespec *time)
+{
+	struct ivi_layout_transition_set *transitions =
+		container_of(animation, struct ivi_layout_transition_set,
+			     animation);
+
+	if (!wl_list_empty(&transitions->transition_list))
+		layout_transition_tick(transitions, time);
+
+	/* keep the output repainting until the last transition is done */
+	if (wl_list_empty(&transitions->transition_list))
+		layout_transition_stop(transitions);
+	else
+		weston_output_schedule_repaint(output);
+}
+
 static int32_t
 layout_transition_frame(void *data)
 {
 	struct ivi_layout_transition_set *transitions = data;
 	uint32_t fps = 30;
-	struct timespec timestamp = {};
-	uint32_t msec = 0;
-	struct transition_node *node = NULL;
-	struct transition_node *next = NULL;
+	struct timespec timestamp;
 
 	if (wl_list_empty(&transitions->transition_list)) {
 		wl_event_source_timer_update(transitions->event_source, 0);
@@ -173,15 +220,65 @@ layout_transition_frame(void *data)
 
 	wl_event_source_timer_update(transitions->event_source, 1000 / fps);
 
-	clock_gettime(CLOCK_MONOTONIC, &timestamp);/* FIXME */
-	msec = (1e+3 * timestamp.tv_sec + 1e-6 * timestamp.tv_nsec);
+	weston_compositor_read_presentation_clock(transitions->compositor,
+						  &timestamp);
+	layout_transition_tick(transitions, &timestamp);
 
-	wl_list_for_each_safe(node, next, &transitions->transition_list, link) {
-		do_transition_frame(node->transition, msec);
+	return 1;
+}
+
+/**
+ * Make sure the running transitions get ticked.
+ *
+ * Transitions follow the frame clock of the first output: they are
+ * advanced from its repaint, so all of them move in lock-step with what
+ * is shown and cost one commit per frame. Without any output the old
+ * 30 Hz timer is used instead.
+ */
+void
+ivi_layout_transition_set_start(struct ivi_layout_transition_set *transitions)
+{
+	struct weston_compositor *ec = transitions->compositor;
+	struct weston_output *output;
+
+	if (wl_list_empty(&transitions->transition_list))
+		return;
+
+	if (transitions->output) {
+		weston_output_schedule_repaint(transitions->output);
+		return;
 	}
 
-	ivi_layout_commit_changes();
-	return 1;
+	if (wl_list_empty(&ec->output_list)) {
+		wl_event_source_timer_update(transitions->event_source, 1);
+		return;
+	}
+
+	output = container_of(ec->output_list.next, struct weston_output, link);
+
+	wl_event_source_timer_update(transitions->event_source, 0);
+
+	transitions->output = output;
+	transitions->animation.frame_counter = 0;
+	wl_list_insert(output->animation_list.prev,
+		       &transitions->animation.link);
+
+	weston_output_schedule_repaint(output);
+}
+
+static void
+layout_transition_output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct ivi_layout_transition_set *transitions =
+		container_of(listener, struct ivi_layout_transition_set,
+			     output_destroyed);
+	struct weston_output *output = data;
+
+	if (transitions->output != output)
+		return;
+
+	layout_transition_stop(transitions);
+	ivi_layout_transition_set_start(transitions);
 }
 
 struct ivi_layout_transition_set *
@@ -190,14 +287,23 @@ ivi_layout_transition_set_create(struct weston_compositor *ec)
 	struct ivi_layout_transition_set *transitions;
 	struct wl_event_loop *loop;
 
-	transitions = malloc(sizeof(*transitions));
+	transitions = zalloc(sizeof(*transitions));
 	if (transitions == NULL) {
 		weston_log("%s: memory allocation fails\n", __func__);
 		return NULL;
 	}
 
+	transitions->compositor = ec;
 	wl_list_init(&transitions->transition_list);
 
+	transitions->animation.frame = layout_transition_animation_frame;
+	wl_list_init(&transitions->animation.link);
+
+	transitions->output_destroyed.notify =
+		layout_transition_output_destroyed;
+	wl_signal_add(&ec->output_destroyed_signal,
+		      &transitions->output_destroyed);
+
 	loop = wl_display_get_event_loop(ec->wl_display);
 	transitions->event_source =
 		wl_event_loop_add_timer(loop, layout_transition_frame,
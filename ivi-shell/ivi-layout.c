@@ -209,6 +209,33 @@ get_ivi_view(struct ivi_layout_layer *ivilayer,
 	return NULL;
 }
 
+/**
+ * Queue an object for the next commit. Only objects on the dirty lists
+ * are looked at by ivi_layout_commit_changes(), so every function writing
+ * pending state or pending order has to call these.
+ */
+static bool
+surface_is_dirty(struct ivi_layout_surface *ivisurf)
+{
+	return !wl_list_empty(&ivisurf->dirty_link);
+}
+
+static void
+surface_mark_dirty(struct ivi_layout_surface *ivisurf)
+{
+	if (!surface_is_dirty(ivisurf))
+		wl_list_insert(&ivisurf->layout->dirty_surface_list,
+			       &ivisurf->dirty_link);
+}
+
+static void
+layer_mark_dirty(struct ivi_layout_layer *ivilayer)
+{
+	if (wl_list_empty(&ivilayer->dirty_link))
+		wl_list_insert(&ivilayer->layout->dirty_layer_list,
+			       &ivilayer->dirty_link);
+}
+
 static struct ivi_layout_screen *
 get_screen_from_output(struct weston_output *output)
 {
@@ -238,6 +265,7 @@ ivi_layout_surface_destroy(struct ivi_layout_surface *ivisurf)
 	}
 
 	wl_list_remove(&ivisurf->link);
+	wl_list_remove(&ivisurf->dirty_link);
 
 	wl_list_for_each_safe(ivi_view, next, &ivisurf->view_list, surf_link) {
 		ivi_view_destroy(ivi_view);
@@ -280,6 +308,40 @@ create_screen(struct weston_compositor *ec)
 	}
 }
 
+/*
+ * Views are positioned and clipped relative to their output, so every
+ * surface shown on a moved or resized output has to be recomputed on
+ * the next commit.
+ */
+static void
+screen_mark_surfaces_dirty(struct weston_output *output)
+{
+	struct ivi_layout_screen *iviscrn = get_screen_from_output(output);
+	struct ivi_layout_layer *ivilayer;
+	struct ivi_layout_view *ivi_view;
+
+	if (iviscrn == NULL)
+		return;
+
+	wl_list_for_each(ivilayer, &iviscrn->order.layer_list, order.link) {
+		wl_list_for_each(ivi_view, &ivilayer->order.view_list,
+				 order_link)
+			surface_mark_dirty(ivi_view->ivisurf);
+	}
+}
+
+static void
+layout_output_moved(struct wl_listener *listener, void *data)
+{
+	screen_mark_surfaces_dirty(data);
+}
+
+static void
+layout_output_resized(struct wl_listener *listener, void *data)
+{
+	screen_mark_surfaces_dirty(data);
+}
+
 /**
  * Internal APIs to initialize properties of ivi_surface/ivi_layer when they are created.
  */
@@ -586,45 +648,65 @@ update_prop(struct ivi_layout_view *ivi_view)
 	weston_view_schedule_repaint(ivi_view->view);
 }
 
+static void
+commit_view(struct ivi_layout_view *ivi_view)
+{
+	struct ivi_layout_surface *ivisurf = ivi_view->ivisurf;
+	struct ivi_layout_layer *ivilayer = ivi_view->on_layer;
+	struct ivi_layout_screen *iviscrn = ivilayer->on_screen;
+
+	/*
+	 * If the view is not on the currently rendered scenegraph,
+	 * we do not need to update its properties.
+	 */
+	if (wl_list_empty(&ivi_view->order_link) || !iviscrn)
+		return;
+
+	/*
+	 * If the view's layer or surface is invisible, we do not need
+	 * to update its properties.
+	 */
+	if (!ivilayer->prop.visibility || !ivisurf->prop.visibility) {
+		/*
+		* If ivilayer or ivisurf of ivi_view is made invisible
+		* in this commit_changes call, we have to damage
+		* the weston_view below this ivi_view. Otherwise content
+		* of this ivi_view will stay visible.
+		*/
+		if ((ivilayer->prop.event_mask | ivisurf->prop.event_mask) &
+		    IVI_NOTIFICATION_VISIBILITY)
+			weston_view_damage_below(ivi_view->view);
+
+		return;
+	}
+
+	update_prop(ivi_view);
+}
+
+/*
+ * A view only has to be recomputed when its surface or its layer changed,
+ * so walk the views hanging off the dirty objects instead of every view.
+ * Views of a dirty surface are handled in the first pass and skipped in
+ * the second one.
+ */
 static void
 commit_changes(struct ivi_layout *layout)
 {
-	struct ivi_layout_screen *iviscrn = NULL;
 	struct ivi_layout_layer *ivilayer = NULL;
 	struct ivi_layout_surface *ivisurf = NULL;
 	struct ivi_layout_view *ivi_view  = NULL;
 
-	wl_list_for_each(ivi_view, &layout->view_list, link) {
-		ivisurf = ivi_view->ivisurf;
-		ivilayer = ivi_view->on_layer;
-		iviscrn = ivilayer->on_screen;
-
-		/*
-		 * If the view is not on the currently rendered scenegraph,
-		 * we do not need to update its properties.
-		 */
-		if (wl_list_empty(&ivi_view->order_link) || !iviscrn)
-			continue;
-
-		/*
-		 * If the view's layer or surface is invisible, we do not need
-		 * to update its properties.
-		 */
-		if (!ivilayer->prop.visibility || !ivisurf->prop.visibility) {
-			/*
-			* If ivilayer or ivisurf of ivi_view is made invisible
-			* in this commit_changes call, we have to damage
-			* the weston_view below this ivi_view. Otherwise content
-			* of this ivi_view will stay visible.
-			*/
-			if ((ivilayer->prop.event_mask | ivisurf->prop.event_mask) &
-			    IVI_NOTIFICATION_VISIBILITY)
-				weston_view_damage_below(ivi_view->view);
+	wl_list_for_each(ivisurf, &layout->dirty_surface_list, dirty_link) {
+		wl_list_for_each(ivi_view, &ivisurf->view_list, surf_link)
+			commit_view(ivi_view);
+	}
 
-			continue;
+	wl_list_for_each(ivilayer, &layout->dirty_layer_list, dirty_link) {
+		wl_list_for_each(ivi_view, &ivilayer->order.view_list,
+				 order_link) {
+			if (!surface_is_dirty(ivi_view->ivisurf))
+				commit_view(ivi_view);
 		}
-
-		update_prop(ivi_view);
 	}
 }
 
@@ -638,7 +720,7 @@ commit_surface_list(struct ivi_layout *layout)
 	int32_t dest_height = 0;
 	int32_t configured = 0;
 
-	wl_list_for_each(ivisurf, &layout->surface_list, link) {
+	wl_list_for_each(ivisurf, &layout->dirty_surface_list, dirty_link) {
 		if (ivisurf->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_VIEW_DEFAULT) {
 			dest_x = ivisurf->prop.dest_x;
 			dest_y = ivisurf->prop.dest_y;
@@ -727,6 +809,9 @@ commit_surface_list(struct ivi_layout *layout)
 							     ivisurf->prop.dest_height);
 			}
 		}
+
+		if (ivisurf->prop.event_mask & IVI_NOTIFICATION_VISIBILITY)
+			layout->view_list_dirty = true;
 	}
 }
 
@@ -737,7 +822,7 @@ commit_layer_list(struct ivi_layout *layout)
 	struct ivi_layout_layer   *ivilayer = NULL;
 	struct ivi_layout_view *next     = NULL;
 
-	wl_list_for_each(ivilayer, &layout->layer_list, link) {
+	wl_list_for_each(ivilayer, &layout->dirty_layer_list, dirty_link) {
 		if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_MOVE) {
 			ivi_layout_transition_move_layer(ivilayer, ivilayer->pending.prop.dest_x, ivilayer->pending.prop.dest_y, ivilayer->pending.prop.transition_duration);
 		} else if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_FADE) {
@@ -750,6 +835,9 @@ commit_layer_list(struct ivi_layout *layout)
 
 		ivilayer->prop = ivilayer->pending.prop;
 
+		if (ivilayer->prop.event_mask & IVI_NOTIFICATION_VISIBILITY)
+			layout->view_list_dirty = true;
+
 		if (!ivilayer->order.dirty) {
 			continue;
 		}
@@ -759,6 +847,7 @@ commit_layer_list(struct ivi_layout *layout)
 			wl_list_remove(&ivi_view->order_link);
 			wl_list_init(&ivi_view->order_link);
 			ivi_view->ivisurf->prop.event_mask |= IVI_NOTIFICATION_REMOVE;
+			surface_mark_dirty(ivi_view->ivisurf);
 		}
 
 		assert(wl_list_empty(&ivilayer->order.view_list));
@@ -768,9 +857,11 @@ commit_layer_list(struct ivi_layout *layout)
 			wl_list_remove(&ivi_view->order_link);
 			wl_list_insert(&ivilayer->order.view_list, &ivi_view->order_link);
 			ivi_view->ivisurf->prop.event_mask |= IVI_NOTIFICATION_ADD;
+			surface_mark_dirty(ivi_view->ivisurf);
 		}
 
 		ivilayer->order.dirty = 0;
+		layout->view_list_dirty = true;
 	}
 }
 
@@ -781,9 +872,7 @@ commit_screen_list(struct ivi_layout *layout)
 	struct ivi_layout_layer   *ivilayer = NULL;
 	struct ivi_layout_layer   *next     = NULL;
 	struct ivi_layout_view *ivi_view = NULL;
-
-	/* Clear view list of layout ivi_layer */
-	wl_list_init(&layout->layout_layer.view_list.link);
+	struct weston_view *view, *view_next;
 
 	wl_list_for_each(iviscrn, &layout->screen_list, link) {
 		if (iviscrn->order.dirty) {
@@ -793,6 +882,7 @@ commit_screen_list(struct ivi_layout *layout)
 				wl_list_remove(&ivilayer->order.link);
 				wl_list_init(&ivilayer->order.link);
 				ivilayer->prop.event_mask |= IVI_NOTIFICATION_REMOVE;
+				layer_mark_dirty(ivilayer);
 			}
 
 			assert(wl_list_empty(&iviscrn->order.layer_list));
@@ -806,11 +896,30 @@ commit_screen_list(struct ivi_layout *layout)
 					       &ivilayer->order.link);
 				ivilayer->on_screen = iviscrn;
 				ivilayer->prop.event_mask |= IVI_NOTIFICATION_ADD;
+				layer_mark_dirty(ivilayer);
 			}
 
 			iviscrn->order.dirty = 0;
+			layout->view_list_dirty = true;
 		}
+	}
+
+	/*
+	 * The stacking of layout_layer only depends on render orders and
+	 * visibilities; keep it as is when none of them changed.
+	 */
+	if (!layout->view_list_dirty)
+		return;
 
+	layout->view_list_dirty = false;
+
+	/* Clear view list of layout ivi_layer */
+	wl_list_for_each_safe(view, view_next,
+			      &layout->layout_layer.view_list.link,
+			      layer_link.link)
+		weston_layer_entry_remove(&view->layer_link);
+
+	wl_list_for_each(iviscrn, &layout->screen_list, link) {
 		wl_list_for_each(ivilayer, &iviscrn->order.layer_list, order.link) {
 			if (ivilayer->prop.visibility == false)
 				continue;
@@ -841,7 +950,7 @@ commit_transition(struct ivi_layout* layout)
 
 	wl_list_init(&layout->pending_transition_list);
 
-	wl_event_source_timer_update(layout->transitions->event_source, 1);
+	ivi_layout_transition_set_start(layout->transitions);
 }
 
 static void
@@ -858,20 +967,44 @@ send_layer_prop(struct ivi_layout_layer *ivilayer)
 	ivilayer->pending.prop.event_mask = 0;
 }
 
+/*
+ * Notify and retire the objects of this commit. The dirty lists are
+ * detached first, so listeners changing properties again queue their
+ * objects for the next commit.
+ */
 static void
 send_prop(struct ivi_layout *layout)
 {
 	struct ivi_layout_layer   *ivilayer = NULL;
 	struct ivi_layout_surface *ivisurf  = NULL;
+	struct wl_list layers, surfaces;
+
+	wl_list_init(&layers);
+	wl_list_insert_list(&layers, &layout->dirty_layer_list);
+	wl_list_init(&layout->dirty_layer_list);
+
+	wl_list_init(&surfaces);
+	wl_list_insert_list(&surfaces, &layout->dirty_surface_list);
+	wl_list_init(&layout->dirty_surface_list);
+
+	while (!wl_list_empty(&layers)) {
+		ivilayer = wl_container_of(layers.prev, ivilayer, dirty_link);
+		wl_list_remove(&ivilayer->dirty_link);
+		wl_list_init(&ivilayer->dirty_link);
 
-	wl_list_for_each_reverse(ivilayer, &layout->layer_list, link) {
 		if (ivilayer->prop.event_mask)
 			send_layer_prop(ivilayer);
+		ivilayer->prop.event_mask = 0;
 	}
 
-	wl_list_for_each_reverse(ivisurf, &layout->surface_list, link) {
+	while (!wl_list_empty(&surfaces)) {
+		ivisurf = wl_container_of(surfaces.prev, ivisurf, dirty_link);
+		wl_list_remove(&ivisurf->dirty_link);
+		wl_list_init(&ivisurf->dirty_link);
+
 		if (ivisurf->prop.event_mask)
 			send_surface_prop(ivisurf);
+		ivisurf->prop.event_mask = 0;
 	}
 }
 
@@ -1244,6 +1377,283 @@ ivi_layout_get_surfaces_on_layer(struct ivi_layout_layer *ivilayer,
 	return IVI_SUCCEEDED;
 }
 
+/**
+ * Allocation-free iterators, the counterparts of the get_* functions above.
+ */
+static struct ivi_layout_surface *
+ivi_layout_get_next_surface(struct ivi_layout_surface *prev)
+{
+	struct ivi_layout *layout = get_instance();
+	struct ivi_layout_surface *ivisurf;
+	struct wl_list *link;
+
+	link = prev ? prev->link.next : layout->surface_list.next;
+	if (link == &layout->surface_list)
+		return NULL;
+
+	return wl_container_of(link, ivisurf, link);
+}
+
+static struct ivi_layout_layer *
+ivi_layout_get_next_layer(struct ivi_layout_layer *prev)
+{
+	struct ivi_layout *layout = get_instance();
+	struct ivi_layout_layer *ivilayer;
+	struct wl_list *link;
+
+	link = prev ? prev->link.next : layout->layer_list.next;
+	if (link == &layout->layer_list)
+		return NULL;
+
+	return wl_container_of(link, ivilayer, link);
+}
+
+static struct ivi_layout_surface *
+ivi_layout_get_next_surface_on_layer(struct ivi_layout_layer *ivilayer,
+				     struct ivi_layout_surface *prev)
+{
+	struct ivi_layout_view *ivi_view;
+	struct wl_list *link;
+
+	if (ivilayer == NULL) {
+		weston_log("%s: invalid argument\n", __func__);
+		return NULL;
+	}
+
+	if (prev == NULL) {
+		link = ivilayer->order.view_list.next;
+	} else {
+		ivi_view = get_ivi_view(ivilayer, prev);
+		if (!ivi_view || !ivi_view_is_rendered(ivi_view))
+			return NULL;
+
+		link = ivi_view->order_link.next;
+	}
+
+	if (link == &ivilayer->order.view_list)
+		return NULL;
+
+	ivi_view = wl_container_of(link, ivi_view, order_link);
+
+	return ivi_view->ivisurf;
+}
+
+static struct ivi_layout_layer *
+ivi_layout_get_next_layer_on_screen(struct weston_output *output,
+				    struct ivi_layout_layer *prev)
+{
+	struct ivi_layout_screen *iviscrn;
+	struct ivi_layout_layer *ivilayer;
+	struct wl_list *link;
+
+	if (output == NULL) {
+		weston_log("%s: invalid argument\n", __func__);
+		return NULL;
+	}
+
+	iviscrn = get_screen_from_output(output);
+	if (iviscrn == NULL)
+		return NULL;
+
+	if (prev == NULL) {
+		link = iviscrn->order.layer_list.next;
+	} else {
+		if (prev->on_screen != iviscrn)
+			return NULL;
+
+		link = prev->order.link.next;
+	}
+
+	if (link == &iviscrn->order.layer_list)
+		return NULL;
+
+	return wl_container_of(link, ivilayer, order.link);
+}
+
+static struct ivi_layout_layer *
+ivi_layout_get_next_layer_under_surface(struct ivi_layout_surface *ivisurf,
+					struct ivi_layout_layer *prev)
+{
+	struct ivi_layout_view *ivi_view;
+	struct wl_list *link;
+
+	if (ivisurf == NULL) {
+		weston_log("%s: invalid argument\n", __func__);
+		return NULL;
+	}
+
+	/* same order as ivi_layout_get_layers_under_surface() */
+	if (prev == NULL) {
+		link = ivisurf->view_list.prev;
+	} else {
+		ivi_view = get_ivi_view(prev, ivisurf);
+		if (!ivi_view)
+			return NULL;
+
+		link = ivi_view->surf_link.prev;
+	}
+
+	for (; link != &ivisurf->view_list; link = link->prev) {
+		ivi_view = wl_container_of(link, ivi_view, surf_link);
+		if (ivi_view_is_rendered(ivi_view))
+			return ivi_view->on_layer;
+	}
+
+	return NULL;
+}
+
+static struct weston_output *
+ivi_layout_get_next_screen_under_layer(struct ivi_layout_layer *ivilayer,
+				       struct weston_output *prev)
+{
+	if (ivilayer == NULL) {
+		weston_log("%s: invalid argument\n", __func__);
+		return NULL;
+	}
+
+	/* a layer is on one screen at most */
+	if (prev != NULL || ivilayer->on_screen == NULL)
+		return NULL;
+
+	return ivilayer->on_screen->output;
+}
+
+/**
+ * Snapshots into caller-owned arrays, built on the iterators above.
+ */
+static int32_t
+ivi_layout_get_surfaces_snapshot(struct ivi_layout_surface **array,
+				 int32_t size)
+{
+	struct ivi_layout_surface *ivisurf = NULL;
+	int32_t n = 0;
+
+	if (size < 0 || (array == NULL && size > 0)) {
+		weston_log("%s: invalid argument\n", __func__);
+		return IVI_FAILED;
+	}
+
+	while ((ivisurf = ivi_layout_get_next_surface(ivisurf))) {
+		if (n < size)
+			array[n] = ivisurf;
+		n++;
+	}
+
+	return n;
+}
+
+static int32_t
+ivi_layout_get_layers_snapshot(struct ivi_layout_layer **array, int32_t size)
+{
+	struct ivi_layout_layer *ivilayer = NULL;
+	int32_t n = 0;
+
+	if (size < 0 || (array == NULL && size > 0)) {
+		weston_log("%s: invalid argument\n", __func__);
+		return IVI_FAILED;
+	}
+
+	while ((ivilayer = ivi_layout_get_next_layer(ivilayer))) {
+		if (n < size)
+			array[n] = ivilayer;
+		n++;
+	}
+
+	return n;
+}
+
+static int32_t
+ivi_layout_get_surfaces_on_layer_snapshot(struct ivi_layout_layer *ivilayer,
+					  struct ivi_layout_surface **array,
+					  int32_t size)
+{
+	struct ivi_layout_surface *ivisurf = NULL;
+	int32_t n = 0;
+
+	if (ivilayer == NULL || size < 0 || (array == NULL && size > 0)) {
+		weston_log("%s: invalid argument\n", __func__);
+		return IVI_FAILED;
+	}
+
+	while ((ivisurf = ivi_layout_get_next_surface_on_layer(ivilayer,
+							       ivisurf))) {
+		if (n < size)
+			array[n] = ivisurf;
+		n++;
+	}
+
+	return n;
+}
+
+static int32_t
+ivi_layout_get_layers_on_screen_snapshot(struct weston_output *output,
+					 struct ivi_layout_layer **array,
+					 int32_t size)
+{
+	struct ivi_layout_layer *ivilayer = NULL;
+	int32_t n = 0;
+
+	if (output == NULL || size < 0 || (array == NULL && size > 0)) {
+		weston_log("%s: invalid argument\n", __func__);
+		return IVI_FAILED;
+	}
+
+	while ((ivilayer = ivi_layout_get_next_layer_on_screen(output,
+							       ivilayer))) {
+		if (n < size)
+			array[n] = ivilayer;
+		n++;
+	}
+
+	return n;
+}
+
+static int32_t
+ivi_layout_get_layers_under_surface_snapshot(struct ivi_layout_surface *ivisurf,
+					     struct ivi_layout_layer **array,
+					     int32_t size)
+{
+	struct ivi_layout_layer *ivilayer = NULL;
+	int32_t n = 0;
+
+	if (ivisurf == NULL || size < 0 || (array == NULL && size > 0)) {
+		weston_log("%s: invalid argument\n", __func__);
+		return IVI_FAILED;
+	}
+
+	while ((ivilayer = ivi_layout_get_next_layer_under_surface(ivisurf,
+								   ivilayer))) {
+		if (n < size)
+			array[n] = ivilayer;
+		n++;
+	}
+
+	return n;
+}
+
+static int32_t
+ivi_layout_get_screens_under_layer_snapshot(struct ivi_layout_layer *ivilayer,
+					    struct weston_output **array,
+					    int32_t size)
+{
+	struct weston_output *output = NULL;
+	int32_t n = 0;
+
+	if (ivilayer == NULL || size < 0 || (array == NULL && size > 0)) {
+		weston_log("%s: invalid argument\n", __func__);
+		return IVI_FAILED;
+	}
+
+	while ((output = ivi_layout_get_next_screen_under_layer(ivilayer,
+								output))) {
+		if (n < size)
+			array[n] = output;
+		n++;
+	}
+
+	return n;
+}
+
 static struct ivi_layout_layer *
 ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 				       int32_t width, int32_t height)
@@ -1277,6 +1687,7 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 
 	wl_list_init(&ivilayer->order.view_list);
 	wl_list_init(&ivilayer->order.link);
+	wl_list_init(&ivilayer->dirty_link);
 
 	wl_list_insert(&layout->layer_list, &ivilayer->link);
 
@@ -1309,6 +1720,7 @@ ivi_layout_layer_destroy(struct ivi_layout_layer *ivilayer)
 
 	wl_list_remove(&ivilayer->pending.link);
 	wl_list_remove(&ivilayer->order.link);
+	wl_list_remove(&ivilayer->dirty_link);
 	wl_list_remove(&ivilayer->link);
 
 	free(ivilayer);
@@ -1326,6 +1738,7 @@ ivi_layout_layer_set_visibility(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	layer_mark_dirty(ivilayer);
 	prop->visibility = newVisibility;
 
 	if (ivilayer->prop.visibility != newVisibility)
@@ -1350,6 +1763,7 @@ ivi_layout_layer_set_opacity(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	layer_mark_dirty(ivilayer);
 	prop->opacity = opacity;
 
 	if (ivilayer->prop.opacity != opacity)
@@ -1373,6 +1787,7 @@ ivi_layout_layer_set_source_rectangle(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	layer_mark_dirty(ivilayer);
 	prop->source_x = x;
 	prop->source_y = y;
 	prop->source_width = width;
@@ -1401,6 +1816,7 @@ ivi_layout_layer_set_destination_rectangle(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	layer_mark_dirty(ivilayer);
 	prop->dest_x = x;
 	prop->dest_y = y;
 	prop->dest_width = width;
@@ -1443,6 +1859,7 @@ ivi_layout_layer_set_render_order(struct ivi_layout_layer *ivilayer,
 	}
 
 	ivilayer->order.dirty = 1;
+	layer_mark_dirty(ivilayer);
 
 	return IVI_SUCCEEDED;
 }
@@ -1459,6 +1876,7 @@ ivi_layout_surface_set_visibility(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	surface_mark_dirty(ivisurf);
 	prop->visibility = newVisibility;
 
 	if (ivisurf->prop.visibility != newVisibility)
@@ -1483,6 +1901,7 @@ ivi_layout_surface_set_opacity(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	surface_mark_dirty(ivisurf);
 	prop->opacity = opacity;
 
 	if (ivisurf->prop.opacity != opacity)
@@ -1506,6 +1925,7 @@ ivi_layout_surface_set_destination_rectangle(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	surface_mark_dirty(ivisurf);
 	prop->start_x = prop->dest_x;
 	prop->start_y = prop->dest_y;
 	prop->dest_x = x;
@@ -1691,6 +2111,7 @@ ivi_layout_layer_add_surface(struct ivi_layout_layer *ivilayer,
 	wl_list_insert(&ivilayer->pending.view_list, &ivi_view->pending_link);
 
 	ivilayer->order.dirty = 1;
+	layer_mark_dirty(ivilayer);
 
 	return IVI_SUCCEEDED;
 }
@@ -1712,6 +2133,7 @@ ivi_layout_layer_remove_surface(struct ivi_layout_layer *ivilayer,
 		wl_list_init(&ivi_view->pending_link);
 
 		ivilayer->order.dirty = 1;
+		layer_mark_dirty(ivilayer);
 	}
 }
 
@@ -1728,6 +2150,7 @@ ivi_layout_surface_set_source_rectangle(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	surface_mark_dirty(ivisurf);
 	prop->source_x = x;
 	prop->source_y = y;
 	prop->source_width = width;
@@ -1772,6 +2195,7 @@ ivi_layout_layer_set_transition(struct ivi_layout_layer *ivilayer,
 
 	ivilayer->pending.prop.transition_type = type;
 	ivilayer->pending.prop.transition_duration = duration;
+	layer_mark_dirty(ivilayer);
 
 	return 0;
 }
@@ -1789,6 +2213,7 @@ ivi_layout_layer_set_fade_info(struct ivi_layout_layer* ivilayer,
 	ivilayer->pending.prop.is_fade_in = is_fade_in;
 	ivilayer->pending.prop.start_alpha = start_alpha;
 	ivilayer->pending.prop.end_alpha = end_alpha;
+	layer_mark_dirty(ivilayer);
 
 	return 0;
 }
@@ -1805,6 +2230,7 @@ ivi_layout_surface_set_transition_duration(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	surface_mark_dirty(ivisurf);
 	prop->transition_duration = duration*10;
 	return 0;
 }
@@ -1822,6 +2248,7 @@ ivi_layout_surface_set_transition(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	surface_mark_dirty(ivisurf);
 	prop->transition_type = type;
 	prop->transition_duration = duration;
 	return 0;
@@ -1856,6 +2283,9 @@ ivi_layout_surface_configure(struct ivi_layout_surface *ivisurf,
 {
 	struct ivi_layout *layout = get_instance();
 
+	/* the transformation and mask depend on the surface size */
+	surface_mark_dirty(ivisurf);
+
 	/* emit callback which is set by ivi-layout api user */
 	wl_signal_emit(&layout->surface_notification.configure_changed,
 		       ivisurf);
@@ -1901,6 +2331,7 @@ ivi_layout_surface_create(struct weston_surface *wl_surface,
 	ivisurf->pending.prop = ivisurf->prop;
 
 	wl_list_init(&ivisurf->view_list);
+	wl_list_init(&ivisurf->dirty_link);
 
 	wl_list_insert(&layout->surface_list, &ivisurf->link);
 
@@ -1922,6 +2353,8 @@ ivi_layout_init_with_compositor(struct weston_compositor *ec)
 	wl_list_init(&layout->layer_list);
 	wl_list_init(&layout->screen_list);
 	wl_list_init(&layout->view_list);
+	wl_list_init(&layout->dirty_surface_list);
+	wl_list_init(&layout->dirty_layer_list);
 
 	wl_signal_init(&layout->layer_notification.created);
 	wl_signal_init(&layout->layer_notification.removed);
@@ -1937,6 +2370,11 @@ ivi_layout_init_with_compositor(struct weston_compositor *ec)
 
 	create_screen(ec);
 
+	layout->output_moved.notify = layout_output_moved;
+	wl_signal_add(&ec->output_moved_signal, &layout->output_moved);
+	layout->output_resized.notify = layout_output_resized;
+	wl_signal_add(&ec->output_resized_signal, &layout->output_resized);
+
 	layout->transitions = ivi_layout_transition_set_create(ec);
 	wl_list_init(&layout->pending_transition_list);
 
@@ -2014,4 +2452,20 @@ static struct ivi_layout_interface ivi_layout_interface = {
 	 */
 	.surface_get_size		= ivi_layout_surface_get_size,
 	.surface_dump			= ivi_layout_surface_dump,
+
+	/**
+	 * allocation-free iterators and snapshots
+	 */
+	.get_next_surface		= ivi_layout_get_next_surface,
+	.get_next_layer			= ivi_layout_get_next_layer,
+	.get_next_surface_on_layer	= ivi_layout_get_next_surface_on_layer,
+	.get_next_layer_on_screen	= ivi_layout_get_next_layer_on_screen,
+	.get_next_layer_under_surface	= ivi_layout_get_next_layer_under_surface,
+	.get_next_screen_under_layer	= ivi_layout_get_next_screen_under_layer,
+	.get_surfaces_snapshot		= ivi_layout_get_surfaces_snapshot,
+	.get_layers_snapshot		= ivi_layout_get_layers_snapshot,
+	.get_surfaces_on_layer_snapshot	= ivi_layout_get_surfaces_on_layer_snapshot,
+	.get_layers_on_screen_snapshot	= ivi_layout_get_layers_on_screen_snapshot,
+	.get_layers_under_surface_snapshot = ivi_layout_get_layers_under_surface_snapshot,
+	.get_screens_under_layer_snapshot = ivi_layout_get_screens_under_layer_snapshot,
 };
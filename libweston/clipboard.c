@@ -31,18 +31,59 @@
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 
 #include "compositor.h"
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+
+/* The clipboard keeps every offered MIME type in an anonymous file (a
+ * memfd where available) instead of on the heap.  Data is spliced in
+ * from the source pipe, the file is sealed once complete, and pastes
+ * are served from it with sendfile().
+ */
+#define CLIPBOARD_MAX_MIME_TYPES 16
+#define CLIPBOARD_MAX_SIZE (256 * 1024 * 1024)
+/* All MIME types of a selection are read right away, so they share one
+ * budget on top of the per-type limit. */
+#define CLIPBOARD_MAX_TOTAL_SIZE (512 * 1024 * 1024)
+#define CLIPBOARD_INITIAL_SIZE (64 * 1024)
+#define CLIPBOARD_MAX_PIPE_SIZE (1024 * 1024)
 
 struct clipboard_source {
 	struct weston_data_source base;
-	struct wl_array contents;
+	struct wl_list contents_list;	/* clipboard_contents::link */
 	struct clipboard *clipboard;
-	struct wl_event_source *event_source;
 	uint32_t serial;
 	int refcount;
+	off_t reserved;			/* file space of all contents */
+};
+
+struct clipboard_contents {
+	struct wl_list link;
+	struct clipboard_source *source;
+	char *mime_type;
+	struct wl_list client_list;	/* clipboard_client::link */
+
+	/* reading from the data source */
+	struct wl_event_source *event_source;
+	int pipe_fd;
+	int pipe_size;
+
+	int fd;
+	off_t size;
+	off_t capacity;
+	bool complete;
+	bool failed;
+};
+
+struct clipboard_client {
+	struct wl_list link;		/* clipboard_contents::client_list */
+	struct wl_event_source *event_source;
+	struct clipboard_contents *contents;
+	off_t offset;
 	int fd;
 };
 
@@ -53,60 +94,316 @@ struct clipboard {
 	struct clipboard_source *source;
 };
 
-static void clipboard_client_create(struct clipboard_source *source, int fd);
+static void clipboard_client_create(struct clipboard_contents *contents,
+				    int fd);
+
+/* Used when splice() or sendfile() are not supported for a pair of
+ * fds.  A NULL offset means the fd's own file position. */
+static ssize_t
+copy_fd_range(int in_fd, off_t *in_offset, int out_fd, off_t *out_offset,
+	      size_t count)
+{
+	char buffer[16 * 1024];
+	ssize_t len, written;
+
+	if (count > sizeof buffer)
+		count = sizeof buffer;
+
+	if (in_offset)
+		len = pread(in_fd, buffer, count, *in_offset);
+	else
+		len = read(in_fd, buffer, count);
+	if (len <= 0)
+		return len;
+
+	if (out_offset)
+		written = pwrite(out_fd, buffer, len, *out_offset);
+	else
+		written = write(out_fd, buffer, len);
+	if (written < 0)
+		return written;
+
+	/* A short write to a non-blocking pipe is fine as long as we
+	 * only advance by what went out; reading from a pipe can't be
+	 * undone, so out_fd must be a file in that case. */
+	if (in_offset)
+		*in_offset += written;
+	if (out_offset)
+		*out_offset += written;
+
+	return written;
+}
 
 static void
 clipboard_source_unref(struct clipboard_source *source)
 {
-	char **s;
+	struct clipboard_contents *contents, *next;
 
 	source->refcount--;
 	if (source->refcount > 0)
 		return;
 
-	if (source->event_source) {
-		wl_event_source_remove(source->event_source);
-		close(source->fd);
-	}
 	wl_signal_emit(&source->base.destroy_signal,
 		       &source->base);
-	s = source->base.mime_types.data;
-	free(*s);
+
+	wl_list_for_each_safe(contents, next, &source->contents_list, link) {
+		if (contents->event_source) {
+			wl_event_source_remove(contents->event_source);
+			close(contents->pipe_fd);
+		}
+		if (contents->fd >= 0)
+			close(contents->fd);
+		free(contents->mime_type);
+		free(contents);
+	}
+
+	/* the strings are owned by the contents */
 	wl_array_release(&source->base.mime_types);
-	wl_array_release(&source->contents);
 	free(source);
 }
 
-static int
-clipboard_source_data(int fd, uint32_t mask, void *data)
+static void
+clipboard_contents_wake_clients(struct clipboard_contents *contents)
 {
-	struct clipboard_source *source = data;
+	struct clipboard_client *client;
+
+	wl_list_for_each(client, &contents->client_list, link)
+		wl_event_source_fd_update(client->event_source,
+					  WL_EVENT_WRITABLE);
+}
+
+static void
+clipboard_contents_stop_reading(struct clipboard_contents *contents)
+{
+	wl_event_source_remove(contents->event_source);
+	contents->event_source = NULL;
+	close(contents->pipe_fd);
+	contents->pipe_fd = -1;
+}
+
+static void
+clipboard_contents_fail(struct clipboard_contents *contents,
+			const char *reason)
+{
+	struct clipboard_source *source = contents->source;
 	struct clipboard *clipboard = source->clipboard;
-	char *p;
-	int len, size;
+	struct clipboard_contents *other;
+	const char **p, **end;
+
+	weston_log("clipboard: dropping %s: %s\n", contents->mime_type, reason);
+
+	clipboard_contents_stop_reading(contents);
+	close(contents->fd);
+	contents->fd = -1;
+	source->reserved -= contents->capacity;
+	contents->capacity = 0;
+	contents->failed = true;
+
+	/* Stop offering it; waiting clients see the failure and give up. */
+	end = (const char **) ((char *) source->base.mime_types.data +
+			       source->base.mime_types.size);
+	for (p = source->base.mime_types.data; p < end; p++) {
+		if (*p != contents->mime_type)
+			continue;
+		memmove(p, p + 1, (char *) end - (char *) (p + 1));
+		source->base.mime_types.size -= sizeof *p;
+		break;
+	}
+	clipboard_contents_wake_clients(contents);
 
-	if (source->contents.alloc - source->contents.size < 1024) {
-		wl_array_add(&source->contents, 1024);
-		source->contents.size -= 1024;
+	wl_list_for_each(other, &source->contents_list, link)
+		if (!other->failed)
+			return;
+
+	/* Nothing left worth keeping. */
+	if (clipboard->source == source) {
+		clipboard->source = NULL;
+		clipboard_source_unref(source);
 	}
+}
+
+static void
+clipboard_contents_finish(struct clipboard_contents *contents)
+{
+	int ret;
+
+	clipboard_contents_stop_reading(contents);
+
+	/* Give back the unused part of the last growth step and make the
+	 * contents immutable; seals are only supported on memfds. */
+	do {
+		ret = ftruncate(contents->fd, contents->size);
+	} while (ret < 0 && errno == EINTR);
+	contents->source->reserved -= contents->capacity - contents->size;
+	contents->capacity = contents->size;
+#ifdef F_ADD_SEALS
+	fcntl(contents->fd, F_ADD_SEALS,
+	      F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+
+	contents->complete = true;
+	clipboard_contents_wake_clients(contents);
+}
+
+/* Grow the file towards size, as far as the per-type and the total
+ * limit allow.  Returns the room left past the current end of the
+ * contents, or -1 if the file could not be grown. */
+static off_t
+clipboard_contents_reserve(struct clipboard_contents *contents, off_t size)
+{
+	struct clipboard_source *source = contents->source;
+	off_t capacity = contents->capacity;
+	off_t limit;
+
+	if (size <= capacity)
+		return capacity - contents->size;
 
-	p = source->contents.data + source->contents.size;
-	size = source->contents.alloc - source->contents.size;
-	len = read(fd, p, size);
+	while (capacity < size)
+		capacity *= 2;
+
+	limit = contents->capacity + CLIPBOARD_MAX_TOTAL_SIZE -
+		source->reserved;
+	if (limit > CLIPBOARD_MAX_SIZE)
+		limit = CLIPBOARD_MAX_SIZE;
+	if (capacity > limit)
+		capacity = limit;
+
+	if (capacity > contents->capacity) {
+		if (os_resize_anonymous_file(contents->fd, capacity) < 0)
+			return -1;
+
+		source->reserved += capacity - contents->capacity;
+		contents->capacity = capacity;
+	}
+
+	return contents->capacity - contents->size;
+}
+
+static int
+clipboard_contents_data(int fd, uint32_t mask, void *data)
+{
+	struct clipboard_contents *contents = data;
+	off_t offset = contents->size;
+	off_t room;
+	ssize_t len;
+	int size;
+
+	/* Room for a full pipe, growing the file geometrically. */
+	room = clipboard_contents_reserve(contents, contents->size +
+					  contents->pipe_size);
+	if (room <= 0) {
+		clipboard_contents_fail(contents,
+					room < 0 ? "out of space" :
+					contents->size >= CLIPBOARD_MAX_SIZE ?
+					"too large" : "clipboard full");
+		return 1;
+	}
+	if (room > contents->pipe_size)
+		room = contents->pipe_size;
+
+	len = splice(fd, NULL, contents->fd, &offset, room,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len < 0 && errno == EINVAL)
+		len = copy_fd_range(fd, NULL, contents->fd, &offset, room);
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 1;
+	if (len < 0) {
+		clipboard_contents_fail(contents, strerror(errno));
+		return 1;
+	}
 	if (len == 0) {
-		wl_event_source_remove(source->event_source);
-		close(fd);
-		source->event_source = NULL;
-	} else if (len < 0) {
-		clipboard_source_unref(source);
-		clipboard->source = NULL;
-	} else {
-		source->contents.size += len;
+		clipboard_contents_finish(contents);
+		return 1;
+	}
+
+	contents->size += len;
+
+	/* The source fills the pipe faster than we wake up, give it
+	 * more room so big transfers take fewer round-trips. */
+	if (len == contents->pipe_size &&
+	    contents->pipe_size < CLIPBOARD_MAX_PIPE_SIZE) {
+		size = fcntl(fd, F_SETPIPE_SZ, contents->pipe_size * 2);
+		if (size > contents->pipe_size)
+			contents->pipe_size = size;
 	}
 
+	clipboard_contents_wake_clients(contents);
+
 	return 1;
 }
 
+static int
+clipboard_contents_create(struct clipboard_source *source,
+			  struct weston_data_source *data_source,
+			  const char *mime_type)
+{
+	struct wl_display *display =
+		source->clipboard->seat->compositor->wl_display;
+	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	struct clipboard_contents *contents;
+	const char **s;
+	int p[2];
+
+	if (source->reserved + CLIPBOARD_INITIAL_SIZE > CLIPBOARD_MAX_TOTAL_SIZE)
+		return -1;
+
+	contents = zalloc(sizeof *contents);
+	if (contents == NULL)
+		return -1;
+
+	contents->mime_type = strdup(mime_type);
+	if (contents->mime_type == NULL)
+		goto err_strdup;
+
+	contents->fd = os_create_anonymous_file(CLIPBOARD_INITIAL_SIZE);
+	if (contents->fd < 0)
+		goto err_file;
+	contents->capacity = CLIPBOARD_INITIAL_SIZE;
+
+	s = wl_array_add(&source->base.mime_types, sizeof *s);
+	if (s == NULL)
+		goto err_add;
+
+	if (pipe2(p, O_CLOEXEC) == -1)
+		goto err_pipe;
+	fcntl(p[0], F_SETFL, O_NONBLOCK);
+	contents->pipe_fd = p[0];
+	contents->pipe_size = fcntl(p[0], F_GETPIPE_SZ);
+	if (contents->pipe_size <= 0)
+		contents->pipe_size = 64 * 1024;
+
+	contents->event_source =
+		wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+				     clipboard_contents_data, contents);
+	if (contents->event_source == NULL)
+		goto err_source;
+
+	*s = contents->mime_type;
+	contents->source = source;
+	source->reserved += contents->capacity;
+	wl_list_init(&contents->client_list);
+	wl_list_insert(source->contents_list.prev, &contents->link);
+
+	data_source->send(data_source, mime_type, p[1]);
+
+	return 0;
+
+ err_source:
+	close(p[0]);
+	close(p[1]);
+ err_pipe:
+	source->base.mime_types.size -= sizeof *s;
+ err_add:
+	close(contents->fd);
+ err_file:
+	free(contents->mime_type);
+ err_strdup:
+	free(contents);
+
+	return -1;
+}
+
 static void
 clipboard_source_accept(struct weston_data_source *source,
 			uint32_t time, const char *mime_type)
@@ -119,13 +416,17 @@ clipboard_source_send(struct weston_data_source *base,
 {
 	struct clipboard_source *source =
 		container_of(base, struct clipboard_source, base);
-	char **s;
+	struct clipboard_contents *contents;
+
+	wl_list_for_each(contents, &source->contents_list, link) {
+		if (!contents->failed &&
+		    strcmp(mime_type, contents->mime_type) == 0) {
+			clipboard_client_create(contents, fd);
+			return;
+		}
+	}
 
-	s = source->base.mime_types.data;
-	if (strcmp(mime_type, s[0]) == 0)
-		clipboard_client_create(source, fd);
-	else
-		close(fd);
+	close(fd);
 }
 
 static void
@@ -135,18 +436,18 @@ clipboard_source_cancel(struct weston_data_source *source)
 
 static struct clipboard_source *
 clipboard_source_create(struct clipboard *clipboard,
-			const char *mime_type, uint32_t serial, int fd)
+			struct weston_data_source *data_source,
+			uint32_t serial)
 {
-	struct wl_display *display = clipboard->seat->compositor->wl_display;
-	struct wl_event_loop *loop = wl_display_get_event_loop(display);
 	struct clipboard_source *source;
-	char **s;
+	const char **mime_types;
+	size_t i, count;
 
 	source = zalloc(sizeof *source);
 	if (source == NULL)
 		return NULL;
 
-	wl_array_init(&source->contents);
+	wl_list_init(&source->contents_list);
 	wl_array_init(&source->base.mime_types);
 	source->base.resource = NULL;
 	source->base.accept = clipboard_source_accept;
@@ -156,79 +457,113 @@ clipboard_source_create(struct clipboard *clipboard,
 	source->refcount = 1;
 	source->clipboard = clipboard;
 	source->serial = serial;
-	source->fd = fd;
 
-	s = wl_array_add(&source->base.mime_types, sizeof *s);
-	if (s == NULL)
-		goto err_add;
-	*s = strdup(mime_type);
-	if (*s == NULL)
-		goto err_strdup;
-	source->event_source =
-		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
-				     clipboard_source_data, source);
-	if (source->event_source == NULL)
-		goto err_source;
+	mime_types = data_source->mime_types.data;
+	count = data_source->mime_types.size / sizeof *mime_types;
+	if (count > CLIPBOARD_MAX_MIME_TYPES) {
+		weston_log("clipboard: keeping only the first %d of %zu "
+			   "mime types\n", CLIPBOARD_MAX_MIME_TYPES, count);
+		count = CLIPBOARD_MAX_MIME_TYPES;
+	}
 
-	return source;
+	for (i = 0; i < count; i++)
+		clipboard_contents_create(source, data_source, mime_types[i]);
 
- err_source:
-	free(*s);
- err_strdup:
-	wl_array_release(&source->base.mime_types);
- err_add:
-	free(source);
+	if (wl_list_empty(&source->contents_list)) {
+		clipboard_source_unref(source);
+		return NULL;
+	}
 
-	return NULL;
+	return source;
 }
 
-struct clipboard_client {
-	struct wl_event_source *event_source;
-	size_t offset;
-	struct clipboard_source *source;
-};
+static void
+clipboard_client_destroy(struct clipboard_client *client)
+{
+	close(client->fd);
+	wl_event_source_remove(client->event_source);
+	wl_list_remove(&client->link);
+	clipboard_source_unref(client->contents->source);
+	free(client);
+}
 
 static int
 clipboard_client_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_client *client = data;
-	char *p;
-	size_t size;
-	int len;
+	struct clipboard_contents *contents = client->contents;
+	ssize_t len;
+
+	/* Also reported while parked waiting for the source, where
+	 * nothing else would ever get rid of the client. */
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		clipboard_client_destroy(client);
+		return 1;
+	}
 
-	size = client->source->contents.size;
-	p = client->source->contents.data;
-	len = write(fd, p + client->offset, size - client->offset);
-	if (len > 0)
-		client->offset += len;
+	if (contents->failed) {
+		clipboard_client_destroy(client);
+		return 1;
+	}
 
-	if (client->offset == size || len <= 0) {
-		close(fd);
-		wl_event_source_remove(client->event_source);
-		clipboard_source_unref(client->source);
-		free(client);
+	if (client->offset < contents->size) {
+		len = sendfile(fd, contents->fd, &client->offset,
+			       contents->size - client->offset);
+		if (len < 0 && (errno == EINVAL || errno == ENOSYS))
+			len = copy_fd_range(contents->fd, &client->offset,
+					    fd, NULL,
+					    contents->size - client->offset);
+
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return 1;
+		if (len <= 0) {
+			clipboard_client_destroy(client);
+			return 1;
+		}
 	}
 
+	if (client->offset < contents->size)
+		return 1;
+
+	if (contents->complete)
+		clipboard_client_destroy(client);
+	else
+		/* Caught up with the source, wait for more. */
+		wl_event_source_fd_update(client->event_source, 0);
+
 	return 1;
 }
 
 static void
-clipboard_client_create(struct clipboard_source *source, int fd)
+clipboard_client_create(struct clipboard_contents *contents, int fd)
 {
-	struct weston_seat *seat = source->clipboard->seat;
+	struct weston_seat *seat = contents->source->clipboard->seat;
 	struct clipboard_client *client;
 	struct wl_event_loop *loop =
 		wl_display_get_event_loop(seat->compositor->wl_display);
 
 	client = zalloc(sizeof *client);
-	if (client == NULL)
+	if (client == NULL) {
+		close(fd);
 		return;
+	}
 
-	client->source = source;
-	source->refcount++;
+	/* Never block the compositor on a slow reader. */
+	fcntl(fd, F_SETFL, O_WRONLY | O_NONBLOCK);
+
+	client->fd = fd;
+	client->contents = contents;
 	client->event_source =
 		wl_event_loop_add_fd(loop, fd, WL_EVENT_WRITABLE,
 				     clipboard_client_data, client);
+	if (client->event_source == NULL) {
+		close(fd);
+		free(client);
+		return;
+	}
+
+	contents->source->refcount++;
+	wl_list_insert(&contents->client_list, &client->link);
 }
 
 static void
@@ -238,8 +573,6 @@ clipboard_set_selection(struct wl_listener *listener, void *data)
 		container_of(listener, struct clipboard, selection_listener);
 	struct weston_seat *seat = data;
 	struct weston_data_source *source = seat->selection_data_source;
-	const char **mime_types;
-	int p[2];
 
 	if (source == NULL) {
 		if (clipboard->source)
@@ -257,20 +590,12 @@ clipboard_set_selection(struct wl_listener *listener, void *data)
 
 	clipboard->source = NULL;
 
-	mime_types = source->mime_types.data;
-
-	if (!mime_types || pipe2(p, O_CLOEXEC) == -1)
+	if (!source->mime_types.data)
 		return;
 
-	source->send(source, mime_types[0], p[1]);
-
 	clipboard->source =
-		clipboard_source_create(clipboard, mime_types[0],
-					seat->selection_serial, p[0]);
-	if (clipboard->source == NULL) {
-		close(p[0]);
-		return;
-	}
+		clipboard_source_create(clipboard, source,
+					seat->selection_serial);
 }
 
 static void
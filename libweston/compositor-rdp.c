@@ -30,7 +30,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <linux/input.h>
+#include <linux/sockios.h>
 
 #if HAVE_FREERDP_VERSION_H
 #include <freerdp/version.h>
@@ -49,6 +55,10 @@
 #define HAVE_SKIP_COMPRESSION
 #endif
 
+#if FREERDP_VERSION_MAJOR >= 2
+#define HAVE_FRAME_ACKNOWLEDGE
+#endif
+
 #if FREERDP_VERSION_NUMBER < 0x10202
 #	define FREERDP_CB_RET_TYPE void
 #	define FREERDP_CB_RETURN(V) return
@@ -90,6 +100,18 @@
 #define DEFAULT_AXIS_STEP_DISTANCE 10
 #define RDP_MODE_FREQ 60 * 1000
 
+/* RemoteFX encodes 64x64 tiles; the bands handed to the encoder threads
+ * are cut on that grid so that no tile is split between two messages. */
+#define RDP_TILE_SIZE 64
+#define RDP_MAX_ENCODER_THREADS 8
+
+/* Flow control: a peer doesn't get a new frame while it has this many
+ * unacknowledged frames, or while this many bytes are still queued on
+ * its socket. The damage is accumulated and retried meanwhile. */
+#define RDP_MAX_FRAMES_IN_FLIGHT 4
+#define RDP_MAX_SOCKET_BACKLOG (256 * 1024)
+#define RDP_CONGESTION_RETRY_MS 10
+
 #if FREERDP_VERSION_MAJOR >= 2 && defined(PIXEL_FORMAT_BGRA32) && !defined(PIXEL_FORMAT_B8G8R8A8)
 	/* The RDP API is truly wonderful: the pixel format definition changed
 	 * from BGRA32 to B8G8R8A8, but some versions ship with a definition of
@@ -101,6 +123,7 @@
 #endif
 
 struct rdp_output;
+struct rdp_encoder;
 
 struct rdp_backend {
 	struct weston_backend base;
@@ -115,6 +138,8 @@ struct rdp_backend {
 	char *rdp_key;
 	int tls_enabled;
 	int no_clients_resize;
+
+	struct rdp_encoder *encoder;
 };
 
 enum peer_item_flags {
@@ -142,6 +167,16 @@ struct rdp_output {
 	struct wl_list peers;
 };
 
+struct rdp_peer_stats {
+	struct timespec start;
+	uint64_t frames_sent;
+	uint64_t frames_acked;
+	uint64_t frames_deferred;
+	uint64_t bytes_sent;
+	uint64_t latency_total_usec;
+	uint64_t latency_max_usec;
+};
+
 struct rdp_peer_context {
 	rdpContext _p;
 
@@ -152,10 +187,92 @@ struct rdp_peer_context {
 	RFX_RECT *rfx_rects;
 	NSC_CONTEXT *nsc_context;
 
+	/* Peers sharing the output of the encoder threads */
+	struct rdp_encode_group *group;
+	struct wl_list group_link;
+	/* Frame of the group being encoded for this peer, if any */
+	struct rdp_encode_frame *encoding;
+	/* Damage accumulated until the peer can take a new frame */
+	pixman_region32_t pending_damage;
+	/* Set while choosing the peers of a group frame */
+	bool selected;
+
+	/* Frame acknowledgement is only relied upon once the client has
+	 * been seen sending one; until then max_frames_in_flight is 0 and
+	 * only the socket backlog is looked at. */
+	uint32_t max_frames_in_flight;
+	UINT32 last_acked_frame;
+	struct timespec frame_sent[RDP_MAX_FRAMES_IN_FLIGHT];
+	struct wl_event_source *retry_timer;
+	struct rdp_peer_stats stats;
+
 	struct rdp_peers_item item;
 };
 typedef struct rdp_peer_context RdpPeerContext;
 
+/* The encoder threads only ever see a snapshot of the damaged part of the
+ * shadow surface and the codec contexts of a slot, everything touching
+ * the FreeRDP peer itself stays on the compositor thread. */
+struct rdp_encoder_slot {
+	RFX_CONTEXT *rfx_context;
+	NSC_CONTEXT *nsc_context;
+	wStream *encode_stream;
+	RFX_RECT *rfx_rects;
+};
+
+struct rdp_encode_task {
+	struct wl_list link;		/* rdp_encoder::queue */
+	struct rdp_encode_frame *frame;
+	struct rdp_encoder_slot *slot;
+	pixman_region32_t region;	/* snapshot coordinates */
+	pixman_box32_t dest;		/* output coordinates */
+};
+
+/* Peers whose codec settings are identical get the very same encoded
+ * messages, so N viewers of the output cost one encode rather than N. */
+struct rdp_encode_group {
+	struct wl_list link;		/* rdp_encoder::groups */
+	struct wl_list peers;		/* rdp_peer_context::group_link */
+
+	bool rfx;
+	UINT32 codec_id;
+	UINT32 width, height;
+
+	/* One codec context per band */
+	struct rdp_encoder_slot *slots;
+	int nslots;
+	/* At most one frame in flight per group */
+	struct rdp_encode_frame *encoding;
+};
+
+struct rdp_encode_frame {
+	struct wl_list link;		/* rdp_encoder::done */
+	struct rdp_encode_group *group;
+	pixman_image_t *image;
+	int x, y;			/* snapshot origin on the output */
+	int ntasks;
+	int pending;			/* protected by rdp_encoder::mutex */
+	struct rdp_encode_task *tasks;
+};
+
+struct rdp_encoder {
+	struct rdp_backend *backend;
+	pthread_t *threads;
+	int nthreads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t queue_cond;
+	pthread_cond_t done_cond;
+	struct wl_list queue;
+	struct wl_list done;
+	bool destroying;
+
+	struct wl_list groups;		/* compositor thread only */
+
+	int done_fd;
+	struct wl_event_source *done_source;
+};
+
 static inline struct rdp_head *
 to_rdp_head(struct weston_head *base)
 {
@@ -174,6 +291,54 @@ to_rdp_backend(struct weston_compositor *base)
 	return container_of(base->backend, struct rdp_backend, base);
 }
 
+static void
+rdp_peer_begin_frame(RdpPeerContext *context)
+{
+	rdpUpdate *update = context->item.peer->update;
+	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
+
+	marker->frameId++;
+	marker->frameAction = SURFACECMD_FRAMEACTION_BEGIN;
+	update->SurfaceFrameMarker(&context->_p, marker);
+}
+
+static void
+rdp_peer_end_frame(RdpPeerContext *context)
+{
+	rdpUpdate *update = context->item.peer->update;
+	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
+
+	marker->frameAction = SURFACECMD_FRAMEACTION_END;
+	update->SurfaceFrameMarker(&context->_p, marker);
+
+	weston_compositor_read_presentation_clock(context->rdpBackend->compositor,
+			&context->frame_sent[marker->frameId % RDP_MAX_FRAMES_IN_FLIGHT]);
+	context->stats.frames_sent++;
+}
+
+/* A peer is congested when it hasn't acknowledged as many frames as we
+ * allow in flight, or when the kernel still holds a large backlog for its
+ * socket; either way a new frame would only add latency. */
+static bool
+rdp_peer_is_congested(RdpPeerContext *context)
+{
+	freerdp_peer *peer = context->item.peer;
+	UINT32 in_flight;
+	int queued;
+
+	in_flight = peer->update->surface_frame_marker.frameId -
+		    context->last_acked_frame;
+	if (context->max_frames_in_flight &&
+	    in_flight >= context->max_frames_in_flight)
+		return true;
+
+	if (ioctl(peer->sockfd, SIOCOUTQ, &queued) == 0 &&
+	    queued > RDP_MAX_SOCKET_BACKLOG)
+		return true;
+
+	return false;
+}
+
 static void
 rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
 {
@@ -228,6 +393,7 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 
 	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
 	cmd->bitmapData = Stream_Buffer(context->encode_stream);
+	context->stats.bytes_sent += cmd->bitmapDataLength;
 
 	update->SurfaceBits(update->context, cmd);
 }
@@ -270,6 +436,7 @@ rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 			pixman_image_get_stride(image));
 	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
 	cmd->bitmapData = Stream_Buffer(context->encode_stream);
+	context->stats.bytes_sent += cmd->bitmapDataLength;
 	update->SurfaceBits(update->context, cmd);
 }
 
@@ -292,7 +459,7 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 {
 	rdpUpdate *update = peer->update;
 	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 	pixman_box32_t *rect, subrect;
 	int nrects, i;
 	int heightIncrement, remainingHeight, top;
@@ -301,10 +468,6 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	if (!nrects)
 		return;
 
-	marker->frameId++;
-	marker->frameAction = SURFACECMD_FRAMEACTION_BEGIN;
-	update->SurfaceFrameMarker(peer->context, marker);
-
 	memset(cmd, 0, sizeof(*cmd));
 	cmd->bpp = 32;
 	cmd->codecID = 0;
@@ -335,29 +498,678 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 
 			   /*weston_log("*  sending (%d,%d, %d,%d)\n", subrect.x1, subrect.y1, subrect.x2, subrect.y2); */
 			   update->SurfaceBits(peer->context, cmd);
+			   context->stats.bytes_sent += cmd->bitmapDataLength;
 
 			   remainingHeight -= cmd->height;
 			   top += cmd->height;
 		}
 	}
+}
 
-	marker->frameAction = SURFACECMD_FRAMEACTION_END;
-	update->SurfaceFrameMarker(peer->context, marker);
+static int
+rdp_encoder_slot_init(struct rdp_encoder_slot *slot, UINT32 width, UINT32 height)
+{
+#if FREERDP_VERSION_MAJOR == 1 && FREERDP_VERSION_MINOR == 1
+	slot->rfx_context = rfx_context_new();
+#else
+	slot->rfx_context = rfx_context_new(TRUE);
+#endif
+	if (!slot->rfx_context)
+		return -1;
+
+	slot->rfx_context->mode = RLGR3;
+	slot->rfx_context->width = width;
+	slot->rfx_context->height = height;
+	rfx_context_set_pixel_format(slot->rfx_context, DEFAULT_PIXEL_FORMAT);
+
+	slot->nsc_context = nsc_context_new();
+	if (!slot->nsc_context)
+		goto out_error_nsc;
+
+	nsc_context_set_pixel_format(slot->nsc_context, DEFAULT_PIXEL_FORMAT);
+
+	slot->encode_stream = Stream_New(NULL, 65536);
+	if (!slot->encode_stream)
+		goto out_error_stream;
+
+	return 0;
+
+out_error_stream:
+	nsc_context_free(slot->nsc_context);
+out_error_nsc:
+	rfx_context_free(slot->rfx_context);
+	return -1;
 }
 
 static void
-rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+rdp_encoder_slot_release(struct rdp_encoder_slot *slot)
 {
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
-	struct rdp_output *output = context->rdpBackend->output;
+	Stream_Free(slot->encode_stream, TRUE);
+	nsc_context_free(slot->nsc_context);
+	rfx_context_free(slot->rfx_context);
+	free(slot->rfx_rects);
+}
+
+static int
+rdp_encode_group_ensure_slots(struct rdp_encode_group *group, int nslots)
+{
+	struct rdp_encoder_slot *slots;
+
+	if (group->nslots >= nslots)
+		return 0;
+
+	slots = realloc(group->slots, nslots * sizeof *slots);
+	if (!slots)
+		return -1;
+	group->slots = slots;
+
+	for (; group->nslots < nslots; group->nslots++) {
+		memset(&slots[group->nslots], 0, sizeof *slots);
+		if (rdp_encoder_slot_init(&slots[group->nslots],
+					  group->width, group->height) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static inline bool
+rdp_peer_is_ready(RdpPeerContext *context)
+{
+	return (context->item.flags & RDP_PEER_ACTIVATED) &&
+	       (context->item.flags & RDP_PEER_OUTPUT_ENABLED);
+}
+
+/* Whether a new frame can be sent to the peer right now. When it can't
+ * only because of congestion, a retry is scheduled so the damage
+ * accumulated meanwhile doesn't wait for the next repaint. */
+static bool
+rdp_peer_can_send(RdpPeerContext *context)
+{
+	if (!rdp_peer_is_ready(context))
+		return false;
+
+	if (!rdp_peer_is_congested(context))
+		return true;
+
+	context->stats.frames_deferred++;
+	wl_event_source_timer_update(context->retry_timer,
+				     RDP_CONGESTION_RETRY_MS);
+	return false;
+}
+
+static void
+rdp_encode_frame_destroy(struct rdp_encode_frame *frame)
+{
+	int i;
+
+	for (i = 0; i < frame->ntasks; i++)
+		pixman_region32_fini(&frame->tasks[i].region);
+	pixman_image_unref(frame->image);
+	free(frame->tasks);
+	free(frame);
+}
+
+/* Gives the damage of a frame that won't be sent to a peer back to it,
+ * so that it goes out with the next one. */
+static void
+rdp_peer_return_damage(RdpPeerContext *context, struct rdp_encode_frame *frame)
+{
+	pixman_region32_t region;
+	int i;
+
+	pixman_region32_init(&region);
+	for (i = 0; i < frame->ntasks; i++) {
+		pixman_region32_copy(&region, &frame->tasks[i].region);
+		pixman_region32_translate(&region, frame->x, frame->y);
+		pixman_region32_union(&context->pending_damage,
+				      &context->pending_damage, &region);
+	}
+	pixman_region32_fini(&region);
+
+	context->encoding = NULL;
+}
+
+/* Runs on an encoder thread. */
+static void
+rdp_encode_task_run(struct rdp_encode_task *task)
+{
+	struct rdp_encode_frame *frame = task->frame;
+	struct rdp_encoder_slot *slot = task->slot;
+	pixman_box32_t *extents, *rects;
+	RFX_RECT *rfx_rects;
+	int stride, width, height, nrects, i;
+	uint32_t *ptr;
+
+	Stream_Clear(slot->encode_stream);
+	Stream_SetPosition(slot->encode_stream, 0);
+
+	extents = pixman_region32_extents(&task->region);
+	width = extents->x2 - extents->x1;
+	height = extents->y2 - extents->y1;
+	stride = pixman_image_get_stride(frame->image);
+	ptr = pixman_image_get_data(frame->image) + extents->x1 +
+		extents->y1 * (stride / sizeof(uint32_t));
+
+	task->dest.x1 = frame->x + extents->x1;
+	task->dest.y1 = frame->y + extents->y1;
+	task->dest.x2 = frame->x + extents->x2;
+	task->dest.y2 = frame->y + extents->y2;
+
+	if (!frame->group->rfx) {
+		nsc_compose_message(slot->nsc_context, slot->encode_stream,
+				    (BYTE *)ptr, width, height, stride);
+		return;
+	}
+
+	rects = pixman_region32_rectangles(&task->region, &nrects);
+	rfx_rects = realloc(slot->rfx_rects, nrects * sizeof *rfx_rects);
+	if (!rfx_rects)
+		return;
+	slot->rfx_rects = rfx_rects;
+
+	for (i = 0; i < nrects; i++) {
+		rfx_rects[i].x = rects[i].x1 - extents->x1;
+		rfx_rects[i].y = rects[i].y1 - extents->y1;
+		rfx_rects[i].width = rects[i].x2 - rects[i].x1;
+		rfx_rects[i].height = rects[i].y2 - rects[i].y1;
+	}
+
+	rfx_compose_message(slot->rfx_context, slot->encode_stream,
+			    rfx_rects, nrects, (BYTE *)ptr, width, height,
+			    stride);
+}
+
+static void *
+rdp_encoder_worker(void *data)
+{
+	struct rdp_encoder *encoder = data;
+	struct rdp_encode_task *task;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&encoder->mutex);
+	for (;;) {
+		while (wl_list_empty(&encoder->queue) && !encoder->destroying)
+			pthread_cond_wait(&encoder->queue_cond,
+					  &encoder->mutex);
+
+		/* Drain the queue before leaving so nobody waits forever
+		 * on a frame. */
+		if (wl_list_empty(&encoder->queue))
+			break;
+
+		task = container_of(encoder->queue.next,
+				    struct rdp_encode_task, link);
+		wl_list_remove(&task->link);
+		pthread_mutex_unlock(&encoder->mutex);
+
+		rdp_encode_task_run(task);
+
+		pthread_mutex_lock(&encoder->mutex);
+		if (--task->frame->pending == 0) {
+			wl_list_insert(encoder->done.prev, &task->frame->link);
+			if (write(encoder->done_fd, &one, sizeof one) < 0)
+				weston_log("rdp: failed to signal encoded frame\n");
+			pthread_cond_broadcast(&encoder->done_cond);
+		}
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return NULL;
+}
+
+static void
+rdp_peer_send_frame(RdpPeerContext *context, struct rdp_encode_frame *frame)
+{
+	freerdp_peer *peer = context->item.peer;
+	rdpUpdate *update = peer->update;
+	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
+	struct rdp_encode_task *task;
+	int i;
+
+	rdp_peer_begin_frame(context);
+
+	for (i = 0; i < frame->ntasks; i++) {
+		task = &frame->tasks[i];
+		if (Stream_GetPosition(task->slot->encode_stream) == 0)
+			continue;
+
+#ifdef HAVE_SKIP_COMPRESSION
+		cmd->skipCompression = TRUE;
+#else
+		memset(cmd, 0, sizeof(*cmd));
+#endif
+		cmd->destLeft = task->dest.x1;
+		cmd->destTop = task->dest.y1;
+		cmd->destRight = task->dest.x2;
+		cmd->destBottom = task->dest.y2;
+		cmd->bpp = 32;
+		cmd->codecID = frame->group->codec_id;
+		cmd->width = task->dest.x2 - task->dest.x1;
+		cmd->height = task->dest.y2 - task->dest.y1;
+		cmd->bitmapDataLength = Stream_GetPosition(task->slot->encode_stream);
+		cmd->bitmapData = Stream_Buffer(task->slot->encode_stream);
+		context->stats.bytes_sent += cmd->bitmapDataLength;
+
+		update->SurfaceBits(update->context, cmd);
+	}
+
+	rdp_peer_end_frame(context);
+}
+
+/* Snapshots the damage accumulated by the ready peers of a group and
+ * queues it to the encoder threads, split into horizontal bands of whole
+ * tiles. */
+static void
+rdp_encode_group_submit(struct rdp_encode_group *group, struct rdp_backend *b)
+{
+	struct rdp_encoder *encoder = b->encoder;
+	struct rdp_encode_frame *frame;
+	struct rdp_encode_task *task;
+	RdpPeerContext *context;
+	pixman_image_t *shadow;
+	pixman_region32_t damage;
+	pixman_box32_t *extents, *rects;
+	int width, height, nrects, nbands, ntasks, band_height, i;
+
+	if (!b->output || group->encoding)
+		return;
+	shadow = b->output->shadow_surface;
+
+	/* Only the peers which have something to update and can take it
+	 * now take part in the frame, the others keep accumulating damage. */
+	pixman_region32_init(&damage);
+	wl_list_for_each(context, &group->peers, group_link) {
+		context->selected =
+			pixman_region32_not_empty(&context->pending_damage) &&
+			rdp_peer_can_send(context);
+		if (context->selected)
+			pixman_region32_union(&damage, &damage,
+					      &context->pending_damage);
+	}
+	pixman_region32_intersect_rect(&damage, &damage, 0, 0,
+				       pixman_image_get_width(shadow),
+				       pixman_image_get_height(shadow));
+	if (!pixman_region32_not_empty(&damage))
+		goto out;
+
+	extents = pixman_region32_extents(&damage);
+	width = extents->x2 - extents->x1;
+	height = extents->y2 - extents->y1;
+
+	nbands = (height + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	ntasks = MIN(nbands, encoder->nthreads);
+	band_height = (nbands + ntasks - 1) / ntasks * RDP_TILE_SIZE;
+
+	if (rdp_encode_group_ensure_slots(group, ntasks) < 0) {
+		weston_log("rdp: failed to create encoder contexts\n");
+		goto out;
+	}
+
+	frame = zalloc(sizeof *frame);
+	if (!frame)
+		goto out;
+	frame->tasks = zalloc(ntasks * sizeof *frame->tasks);
+	frame->image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+						width, height, NULL, 0);
+	if (!frame->tasks || !frame->image) {
+		if (frame->image)
+			pixman_image_unref(frame->image);
+		free(frame->tasks);
+		free(frame);
+		goto out;
+	}
+
+	frame->group = group;
+	frame->x = extents->x1;
+	frame->y = extents->y1;
+
+	rects = pixman_region32_rectangles(&damage, &nrects);
+	for (i = 0; i < nrects; i++)
+		pixman_image_composite32(PIXMAN_OP_SRC, shadow, NULL,
+					 frame->image,
+					 rects[i].x1, rects[i].y1, 0, 0,
+					 rects[i].x1 - frame->x,
+					 rects[i].y1 - frame->y,
+					 rects[i].x2 - rects[i].x1,
+					 rects[i].y2 - rects[i].y1);
+
+	pixman_region32_translate(&damage, -frame->x, -frame->y);
+	for (i = 0; i < ntasks; i++) {
+		task = &frame->tasks[frame->ntasks];
+		pixman_region32_init(&task->region);
+		pixman_region32_intersect_rect(&task->region, &damage,
+					       0, i * band_height,
+					       width, band_height);
+		if (!pixman_region32_not_empty(&task->region)) {
+			pixman_region32_fini(&task->region);
+			continue;
+		}
+
+		task->frame = frame;
+		task->slot = &group->slots[frame->ntasks];
+		frame->ntasks++;
+	}
+
+	wl_list_for_each(context, &group->peers, group_link) {
+		if (!context->selected)
+			continue;
+
+		pixman_region32_clear(&context->pending_damage);
+		context->encoding = frame;
+	}
+
+	group->encoding = frame;
+	frame->pending = frame->ntasks;
+
+	pthread_mutex_lock(&encoder->mutex);
+	for (i = 0; i < frame->ntasks; i++)
+		wl_list_insert(encoder->queue.prev, &frame->tasks[i].link);
+	pthread_cond_broadcast(&encoder->queue_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+
+out:
+	pixman_region32_fini(&damage);
+}
+
+/* Waits for the frame a group has in flight and drops it, used before
+ * resetting the codec contexts of the slots or freeing the group. */
+static void
+rdp_encode_group_cancel(struct rdp_encode_group *group,
+			struct rdp_encoder *encoder)
+{
+	struct rdp_encode_frame *frame = group->encoding;
+	RdpPeerContext *context;
+
+	if (!frame)
+		return;
+
+	pthread_mutex_lock(&encoder->mutex);
+	while (frame->pending)
+		pthread_cond_wait(&encoder->done_cond, &encoder->mutex);
+	wl_list_remove(&frame->link);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	wl_list_for_each(context, &group->peers, group_link) {
+		if (context->encoding == frame)
+			rdp_peer_return_damage(context, frame);
+	}
+
+	group->encoding = NULL;
+	rdp_encode_frame_destroy(frame);
+}
+
+static int
+rdp_encoder_done(int fd, uint32_t mask, void *data)
+{
+	struct rdp_encoder *encoder = data;
+	struct rdp_encode_frame *frame, *next;
+	struct rdp_encode_group *group;
+	RdpPeerContext *context;
+	struct wl_list done;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		weston_log("rdp: failed to read encoder notification\n");
+
+	wl_list_init(&done);
+	pthread_mutex_lock(&encoder->mutex);
+	wl_list_insert_list(&done, &encoder->done);
+	wl_list_init(&encoder->done);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	wl_list_for_each_safe(frame, next, &done, link) {
+		wl_list_remove(&frame->link);
+		group = frame->group;
+		group->encoding = NULL;
+
+		wl_list_for_each(context, &group->peers, group_link) {
+			if (context->encoding != frame)
+				continue;
+
+			if (rdp_peer_is_ready(context)) {
+				rdp_peer_send_frame(context, frame);
+				context->encoding = NULL;
+			} else {
+				rdp_peer_return_damage(context, frame);
+			}
+		}
+
+		rdp_encode_frame_destroy(frame);
+		rdp_encode_group_submit(group, encoder->backend);
+	}
+
+	return 0;
+}
+
+static void
+rdp_encode_group_destroy(struct rdp_encode_group *group)
+{
+	int i;
+
+	for (i = 0; i < group->nslots; i++)
+		rdp_encoder_slot_release(&group->slots[i]);
+	free(group->slots);
+	wl_list_remove(&group->link);
+	free(group);
+}
+
+static void
+rdp_peer_leave_group(RdpPeerContext *context)
+{
+	struct rdp_encode_group *group = context->group;
+
+	if (!group)
+		return;
+
+	wl_list_remove(&context->group_link);
+	wl_list_init(&context->group_link);
+	context->group = NULL;
+	context->encoding = NULL;
+
+	if (wl_list_empty(&group->peers)) {
+		rdp_encode_group_cancel(group, context->rdpBackend->encoder);
+		rdp_encode_group_destroy(group);
+	}
+}
+
+/* Puts a peer in the group matching its codec settings, creating it if
+ * needed. The codec contexts of the group are reset so that the next
+ * message carries the RemoteFX headers the new peer hasn't seen yet. */
+static int
+rdp_peer_join_group(RdpPeerContext *context)
+{
+	struct rdp_encoder *encoder = context->rdpBackend->encoder;
+	rdpSettings *settings = context->_p.settings;
+	struct rdp_encode_group *group;
+	bool rfx = settings->RemoteFxCodec;
+	UINT32 codec_id = rfx ? settings->RemoteFxCodecId : settings->NSCodecId;
+	int i;
+
+	rdp_peer_leave_group(context);
+
+	wl_list_for_each(group, &encoder->groups, link) {
+		if (group->rfx == rfx && group->codec_id == codec_id &&
+		    group->width == settings->DesktopWidth &&
+		    group->height == settings->DesktopHeight)
+			goto found;
+	}
+
+	group = zalloc(sizeof *group);
+	if (!group)
+		return -1;
+
+	wl_list_init(&group->peers);
+	group->rfx = rfx;
+	group->codec_id = codec_id;
+	group->width = settings->DesktopWidth;
+	group->height = settings->DesktopHeight;
+	wl_list_insert(&encoder->groups, &group->link);
+
+found:
+	rdp_encode_group_cancel(group, encoder);
+	for (i = 0; i < group->nslots; i++) {
+		RFX_RESET(group->slots[i].rfx_context, group->width, group->height);
+		NSC_RESET(group->slots[i].nsc_context, group->width, group->height);
+	}
+
+	wl_list_insert(&group->peers, &context->group_link);
+	context->group = group;
+
+	return 0;
+}
+
+static struct rdp_encoder *
+rdp_encoder_create(struct rdp_backend *b, int nthreads)
+{
+	struct rdp_encoder *encoder;
+	struct wl_event_loop *loop;
+
+	encoder = zalloc(sizeof *encoder);
+	if (!encoder)
+		return NULL;
+	encoder->backend = b;
+
+	encoder->threads = zalloc(nthreads * sizeof *encoder->threads);
+	if (!encoder->threads)
+		goto err_free;
+
+	encoder->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (encoder->done_fd < 0)
+		goto err_free;
+
+	loop = wl_display_get_event_loop(b->compositor->wl_display);
+	encoder->done_source = wl_event_loop_add_fd(loop, encoder->done_fd,
+						    WL_EVENT_READABLE,
+						    rdp_encoder_done, encoder);
+	if (!encoder->done_source)
+		goto err_fd;
+
+	wl_list_init(&encoder->queue);
+	wl_list_init(&encoder->done);
+	wl_list_init(&encoder->groups);
+	pthread_mutex_init(&encoder->mutex, NULL);
+	pthread_cond_init(&encoder->queue_cond, NULL);
+	pthread_cond_init(&encoder->done_cond, NULL);
+
+	for (; encoder->nthreads < nthreads; encoder->nthreads++) {
+		if (pthread_create(&encoder->threads[encoder->nthreads], NULL,
+				   rdp_encoder_worker, encoder) != 0)
+			break;
+	}
+
+	if (encoder->nthreads == 0) {
+		pthread_mutex_destroy(&encoder->mutex);
+		pthread_cond_destroy(&encoder->queue_cond);
+		pthread_cond_destroy(&encoder->done_cond);
+		wl_event_source_remove(encoder->done_source);
+		goto err_fd;
+	}
+
+	return encoder;
+
+err_fd:
+	close(encoder->done_fd);
+err_free:
+	free(encoder->threads);
+	free(encoder);
+	return NULL;
+}
+
+static void
+rdp_encoder_destroy(struct rdp_encoder *encoder)
+{
+	struct rdp_encode_frame *frame, *next;
+	struct rdp_encode_group *group, *gnext;
+	RdpPeerContext *context, *cnext;
+	int i;
+
+	pthread_mutex_lock(&encoder->mutex);
+	encoder->destroying = true;
+	pthread_cond_broadcast(&encoder->queue_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	for (i = 0; i < encoder->nthreads; i++)
+		pthread_join(encoder->threads[i], NULL);
+
+	wl_list_for_each_safe(frame, next, &encoder->done, link) {
+		frame->group->encoding = NULL;
+		rdp_encode_frame_destroy(frame);
+	}
+
+	wl_list_for_each_safe(group, gnext, &encoder->groups, link) {
+		wl_list_for_each_safe(context, cnext, &group->peers, group_link) {
+			wl_list_remove(&context->group_link);
+			wl_list_init(&context->group_link);
+			context->group = NULL;
+			context->encoding = NULL;
+		}
+		rdp_encode_group_destroy(group);
+	}
+
+	pthread_mutex_destroy(&encoder->mutex);
+	pthread_cond_destroy(&encoder->queue_cond);
+	pthread_cond_destroy(&encoder->done_cond);
+	wl_event_source_remove(encoder->done_source);
+	close(encoder->done_fd);
+	free(encoder->threads);
+	free(encoder);
+}
+
+/* Sends the damage accumulated by a peer, if it can take a new frame. */
+static void
+rdp_peer_flush(RdpPeerContext *context)
+{
+	struct rdp_backend *b = context->rdpBackend;
+	freerdp_peer *peer = context->item.peer;
 	rdpSettings *settings = peer->settings;
+	pixman_image_t *shadow;
 
+	if (context->group) {
+		rdp_encode_group_submit(context->group, b);
+		return;
+	}
+
+	if (!b->output ||
+	    !pixman_region32_not_empty(&context->pending_damage) ||
+	    !rdp_peer_can_send(context))
+		return;
+
+	shadow = b->output->shadow_surface;
+	pixman_region32_intersect_rect(&context->pending_damage,
+				       &context->pending_damage, 0, 0,
+				       pixman_image_get_width(shadow),
+				       pixman_image_get_height(shadow));
+	if (!pixman_region32_not_empty(&context->pending_damage))
+		return;
+
+	rdp_peer_begin_frame(context);
 	if (settings->RemoteFxCodec)
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
+		rdp_peer_refresh_rfx(&context->pending_damage, shadow, peer);
 	else if (settings->NSCodec)
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
+		rdp_peer_refresh_nsc(&context->pending_damage, shadow, peer);
 	else
-		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+		rdp_peer_refresh_raw(&context->pending_damage, shadow, peer);
+	rdp_peer_end_frame(context);
+
+	pixman_region32_clear(&context->pending_damage);
+}
+
+static int
+rdp_peer_retry(void *data)
+{
+	rdp_peer_flush(data);
+	return 0;
+}
+
+static void
+rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+
+	pixman_region32_union(&context->pending_damage,
+			      &context->pending_damage, region);
+	rdp_peer_flush(context);
 }
 
 static void
@@ -376,17 +1188,28 @@ rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage,
 	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
 	struct weston_compositor *ec = output->base.compositor;
 	struct rdp_peers_item *outputPeer;
+	RdpPeerContext *context;
 
 	pixman_renderer_output_set_buffer(output_base, output->shadow_surface);
 	ec->renderer->repaint_output(&output->base, damage);
 
 	if (pixman_region32_not_empty(damage)) {
+		/* Peers which can't take the update now (output suppressed,
+		 * congested) keep the damage until they can. All the damage
+		 * is recorded before flushing so that a group frame covers
+		 * every peer of the group. */
 		wl_list_for_each(outputPeer, &output->peers, link) {
-			if ((outputPeer->flags & RDP_PEER_ACTIVATED) &&
-					(outputPeer->flags & RDP_PEER_OUTPUT_ENABLED))
-			{
-				rdp_peer_refresh_region(damage, outputPeer->peer);
-			}
+			if (!(outputPeer->flags & RDP_PEER_ACTIVATED))
+				continue;
+
+			context = (RdpPeerContext *)outputPeer->peer->context;
+			pixman_region32_union(&context->pending_damage,
+					      &context->pending_damage, damage);
+		}
+
+		wl_list_for_each(outputPeer, &output->peers, link) {
+			if (outputPeer->flags & RDP_PEER_ACTIVATED)
+				rdp_peer_flush((RdpPeerContext *)outputPeer->peer->context);
 		}
 	}
 
@@ -641,6 +1464,9 @@ rdp_destroy(struct weston_compositor *ec)
 
 	weston_compositor_shutdown(ec);
 
+	if (b->encoder)
+		rdp_encoder_destroy(b->encoder);
+
 	wl_list_for_each_safe(base, next, &ec->head_list, compositor_link)
 		rdp_head_destroy(to_rdp_head(base));
 
@@ -726,6 +1552,9 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 	if (!context->encode_stream)
 		goto out_error_stream;
 
+	pixman_region32_init(&context->pending_damage);
+	wl_list_init(&context->group_link);
+
 	FREERDP_CB_RETURN(TRUE);
 
 out_error_nsc:
@@ -735,6 +1564,36 @@ out_error_stream:
 	FREERDP_CB_RETURN(FALSE);
 }
 
+static void
+rdp_peer_log_stats(RdpPeerContext *context)
+{
+	struct rdp_peer_stats *stats = &context->stats;
+	const char *address = context->_p.settings->ClientAddress;
+	struct timespec now;
+	int64_t msecs;
+
+	if (!stats->frames_sent)
+		return;
+
+	weston_compositor_read_presentation_clock(context->rdpBackend->compositor,
+						  &now);
+	msecs = timespec_sub_to_msec(&now, &stats->start);
+	if (msecs <= 0)
+		msecs = 1;
+
+	weston_log("RDP peer %s: %" PRIu64 " frames in %" PRId64 " ms, "
+		   "%" PRIu64 " KiB/s, %" PRIu64 " updates deferred\n",
+		   address ? address : "(unknown)", stats->frames_sent, msecs,
+		   stats->bytes_sent * 1000 / 1024 / msecs,
+		   stats->frames_deferred);
+	if (stats->frames_acked)
+		weston_log_continue(STAMP_SPACE "%" PRIu64 " frames acknowledged, "
+				    "latency avg %" PRIu64 " ms max %" PRIu64 " ms\n",
+				    stats->frames_acked,
+				    stats->latency_total_usec / stats->frames_acked / 1000,
+				    stats->latency_max_usec / 1000);
+}
+
 static void
 rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 {
@@ -755,6 +1614,13 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 		 * but it would crash on reconnect */
 	}
 
+	if (context->retry_timer)
+		wl_event_source_remove(context->retry_timer);
+	rdp_peer_log_stats(context);
+
+	rdp_peer_leave_group(context);
+	pixman_region32_fini(&context->pending_damage);
+
 	Stream_Free(context->encode_stream, TRUE);
 	nsc_context_free(context->nsc_context);
 	rfx_context_free(context->rfx_context);
@@ -984,10 +1850,18 @@ xf_peer_activate(freerdp_peer* client)
 	RFX_RESET(peerCtx->rfx_context, weston_output->width, weston_output->height);
 	NSC_RESET(peerCtx->nsc_context, weston_output->width, weston_output->height);
 
+	if (b->encoder && (settings->RemoteFxCodec || settings->NSCodec) &&
+	    rdp_peer_join_group(peerCtx) < 0)
+		weston_log("%s: unable to share encoding, encoding on the compositor thread\n", __FUNCTION__);
+
+	/* the client has to show again that it acknowledges frames */
+	peerCtx->max_frames_in_flight = 0;
+
 	if (peersItem->flags & RDP_PEER_ACTIVATED)
 		return TRUE;
 
 	/* when here it's the first reactivation, we need to setup a little more */
+	weston_compositor_read_presentation_clock(b->compositor, &peerCtx->stats.start);
 	weston_log("kbd_layout:0x%x kbd_type:0x%x kbd_subType:0x%x kbd_functionKeys:0x%x\n",
 			settings->KeyboardLayout, settings->KeyboardType, settings->KeyboardSubType,
 			settings->KeyboardFunctionKey);
@@ -1218,13 +2092,56 @@ xf_suppress_output(rdpContext *context, BYTE allow, const RECTANGLE_16 *area)
 {
 	RdpPeerContext *peerContext = (RdpPeerContext *)context;
 
-	if (allow)
+	if (allow) {
 		peerContext->item.flags |= RDP_PEER_OUTPUT_ENABLED;
-	else
+		/* send what was damaged while the output was suppressed */
+		rdp_peer_flush(peerContext);
+	} else {
 		peerContext->item.flags &= (~RDP_PEER_OUTPUT_ENABLED);
+	}
+
+	FREERDP_CB_RETURN(TRUE);
+}
+
+#ifdef HAVE_FRAME_ACKNOWLEDGE
+static BOOL
+xf_surface_frame_acknowledge(rdpContext *context, UINT32 frameId)
+{
+	RdpPeerContext *peerContext = (RdpPeerContext *)context;
+	struct rdp_peer_stats *stats = &peerContext->stats;
+	UINT32 last_frame = context->update->surface_frame_marker.frameId;
+	struct timespec now;
+	uint64_t latency;
+
+	/* ignore stale or bogus acknowledgements */
+	if (last_frame - frameId >= last_frame - peerContext->last_acked_frame)
+		FREERDP_CB_RETURN(TRUE);
 
+	/* acknowledgements may be cumulative, only trust the clock of
+	 * frames still in the history */
+	if (last_frame - frameId < RDP_MAX_FRAMES_IN_FLIGHT) {
+		weston_compositor_read_presentation_clock(peerContext->rdpBackend->compositor,
+				&now);
+		latency = timespec_sub_to_nsec(&now,
+				&peerContext->frame_sent[frameId % RDP_MAX_FRAMES_IN_FLIGHT]) / 1000;
+		stats->latency_total_usec += latency;
+		stats->latency_max_usec = MAX(stats->latency_max_usec, latency);
+		stats->frames_acked++;
+	}
+
+	peerContext->last_acked_frame = frameId;
+	if (!peerContext->max_frames_in_flight) {
+		peerContext->max_frames_in_flight = RDP_MAX_FRAMES_IN_FLIGHT;
+		if (context->settings->FrameAcknowledge)
+			peerContext->max_frames_in_flight =
+				MIN(context->settings->FrameAcknowledge,
+				    RDP_MAX_FRAMES_IN_FLIGHT);
+	}
+
+	rdp_peer_flush(peerContext);
 	FREERDP_CB_RETURN(TRUE);
 }
+#endif
 
 static int
 rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
@@ -1276,6 +2193,10 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	client->Activate = xf_peer_activate;
 
 	client->update->SuppressOutput = (pSuppressOutput)xf_suppress_output;
+#ifdef HAVE_FRAME_ACKNOWLEDGE
+	settings->FrameAcknowledge = RDP_MAX_FRAMES_IN_FLIGHT;
+	client->update->SurfaceFrameAcknowledge = xf_surface_frame_acknowledge;
+#endif
 
 	input = client->input;
 	input->SynchronizeEvent = xf_input_synchronize_event;
@@ -1299,6 +2220,9 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	for ( ; i < MAX_FREERDP_FDS; i++)
 		peerCtx->events[i] = 0;
 
+	peerCtx->retry_timer = wl_event_loop_add_timer(loop, rdp_peer_retry,
+						       peerCtx);
+
 	wl_list_insert(&b->output->peers, &peerCtx->item.link);
 	return 0;
 
@@ -1331,7 +2255,7 @@ rdp_backend_create(struct weston_compositor *compositor,
 	struct rdp_backend *b;
 	char *fd_str;
 	char *fd_tail;
-	int fd, ret;
+	int fd, ret, nthreads;
 
 	b = zalloc(sizeof *b);
 	if (b == NULL)
@@ -1366,6 +2290,21 @@ rdp_backend_create(struct weston_compositor *compositor,
 
 	compositor->capabilities |= WESTON_CAP_ARBITRARY_MODES;
 
+	nthreads = config->encoder_threads;
+	if (nthreads < 0) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = MAX(1, MIN(nthreads, RDP_MAX_ENCODER_THREADS));
+	}
+	if (nthreads > 0) {
+		b->encoder = rdp_encoder_create(b, nthreads);
+		if (b->encoder)
+			weston_log("RDP encoding on %d threads\n",
+				   b->encoder->nthreads);
+		else
+			weston_log("failed to start the RDP encoder threads, "
+				   "encoding on the compositor thread\n");
+	}
+
 	if (!config->env_socket) {
 		b->listener = freerdp_listener_new();
 		b->listener->PeerAccepted = rdp_incoming_peer;
@@ -1407,6 +2346,8 @@ err_output:
 	weston_output_release(&b->output->base);
 err_compositor:
 	weston_compositor_shutdown(compositor);
+	if (b->encoder)
+		rdp_encoder_destroy(b->encoder);
 err_free_strings:
 	free(b->rdp_key);
 	free(b->server_cert);
@@ -1425,6 +2366,7 @@ config_init_to_defaults(struct weston_rdp_backend_config *config)
 	config->server_key = NULL;
 	config->env_socket = 0;
 	config->no_clients_resize = 0;
+	config->encoder_threads = -1;
 }
 
 WL_EXPORT int
@@ -54,7 +54,7 @@ weston_rdp_output_get_api(struct weston_compositor *compositor)
 	return (const struct weston_rdp_output_api *)api;
 }
 
-#define WESTON_RDP_BACKEND_CONFIG_VERSION 2
+#define WESTON_RDP_BACKEND_CONFIG_VERSION 3
 
 struct weston_rdp_backend_config {
 	struct weston_backend_config base;
@@ -65,6 +65,10 @@ struct weston_rdp_backend_config {
 	char *server_key;
 	int env_socket;
 	int no_clients_resize;
+	/* Number of threads encoding RemoteFX/NSCodec updates: 0 encodes
+	 * on the compositor thread, a negative value picks one thread per
+	 * online CPU. */
+	int encoder_threads;
 };
 
 #ifdef  __cplusplus
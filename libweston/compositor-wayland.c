@@ -56,12 +56,16 @@
 #include "shared/timespec-util.h"
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
 #include "xdg-shell-unstable-v6-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
 #include "presentation-time-server-protocol.h"
 #include "linux-dmabuf.h"
 #include "windowed-output-api.h"
 
 #define WINDOW_TITLE "Weston Compositor"
 
+/* Subsurfaces per output available for passing client buffers through */
+#define WAYLAND_MAX_PLANES 4
+
 struct wayland_backend {
 	struct weston_backend base;
 	struct weston_compositor *compositor;
@@ -74,6 +78,9 @@ struct wayland_backend {
 		struct zxdg_shell_v6 *xdg_shell;
 		struct zwp_fullscreen_shell_v1 *fshell;
 		struct wl_shm *shm;
+		struct wl_subcompositor *subcompositor;
+		struct zwp_linux_dmabuf_v1 *dmabuf;
+		struct wl_array dmabuf_formats;	/**< wayland_dmabuf_format */
 
 		struct wl_list output_list;
 
@@ -84,6 +91,7 @@ struct wayland_backend {
 	bool use_pixman;
 	bool sprawl_across_outputs;
 	bool fullscreen;
+	bool use_subsurfaces;
 
 	struct theme *theme;
 	cairo_device_t *frame_device;
@@ -128,11 +136,58 @@ struct wayland_output {
 	struct {
 		struct wl_list buffers;
 		struct wl_list free_buffers;
+
+		/* Output damage of past frames, in global coords */
+		struct weston_damage_history damage;
 	} shm;
 
 	struct weston_mode mode;
 
 	struct wl_callback *frame_cb;
+
+	struct wl_list planes;		/**< wayland_plane::link */
+	/* Planes in use this frame, topmost first */
+	struct wayland_plane *plane_stack[WAYLAND_MAX_PLANES];
+	int plane_count;
+};
+
+/* A subsurface of the output surface showing one client buffer, the
+ * nested equivalent of a hardware overlay plane. */
+struct wayland_plane {
+	struct weston_plane base;
+	struct wayland_output *output;
+	struct wl_list link;
+
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+	bool mapped;
+
+	struct weston_view *view;	/**< assigned for the coming frame */
+	struct weston_view *last_view;	/**< shown by the parent */
+
+	struct wl_list buffers;		/**< wayland_plane_buffer::link */
+	struct wl_list free_buffers;	/**< wayland_plane_buffer::free_link */
+};
+
+/* A parent wl_buffer, either a copy of a client SHM buffer or an import
+ * of a client dmabuf. */
+struct wayland_plane_buffer {
+	struct wayland_plane *plane;	/**< NULL once orphaned */
+	struct wl_list link;
+	struct wl_list free_link;
+
+	struct wl_buffer *buffer;
+	struct weston_buffer_reference client_ref;
+
+	void *data;
+	size_t size;
+	int32_t width, height, stride;
+	uint32_t format;
+};
+
+struct wayland_dmabuf_format {
+	uint32_t format;
+	uint64_t modifier;
 };
 
 struct wayland_parent_output {
@@ -174,7 +229,8 @@ struct wayland_shm_buffer {
 	struct wl_buffer *buffer;
 	void *data;
 	size_t size;
-	pixman_region32_t damage;		/**< in global coords */
+	/** frames since this buffer was last attached, 0 if undefined */
+	int age;
 	int frame_damaged;
 
 	pixman_image_t *pm_image;
@@ -242,8 +298,6 @@ wayland_shm_buffer_destroy(struct wayland_shm_buffer *buffer)
 	wl_buffer_destroy(buffer->buffer);
 	munmap(buffer->data, buffer->size);
 
-	pixman_region32_fini(&buffer->damage);
-
 	wl_list_remove(&buffer->link);
 	wl_list_remove(&buffer->free_link);
 	free(buffer);
@@ -271,7 +325,7 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 	struct wayland_backend *b =
 		to_wayland_backend(output->base.compositor);
 	struct wl_shm *shm = b->parent.shm;
-	struct wayland_shm_buffer *sb;
+	struct wayland_shm_buffer *sb, *free_sb = NULL;
 
 	struct wl_shm_pool *pool;
 	int width, height, stride;
@@ -279,13 +333,18 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 	int fd;
 	unsigned char *data;
 
-	if (!wl_list_empty(&output->shm.free_buffers)) {
-		sb = container_of(output->shm.free_buffers.next,
-				  struct wayland_shm_buffer, free_link);
-		wl_list_remove(&sb->free_link);
-		wl_list_init(&sb->free_link);
+	/* The most recently used free buffer needs the least repainting */
+	wl_list_for_each(sb, &output->shm.free_buffers, free_link) {
+		if (!free_sb ||
+		    (sb->age > 0 && (free_sb->age == 0 || sb->age < free_sb->age)))
+			free_sb = sb;
+	}
+
+	if (free_sb) {
+		wl_list_remove(&free_sb->free_link);
+		wl_list_init(&free_sb->free_link);
 
-		return sb;
+		return free_sb;
 	}
 
 	if (output->frame) {
@@ -323,8 +382,7 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 	wl_list_init(&sb->free_link);
 	wl_list_insert(&output->shm.buffers, &sb->link);
 
-	pixman_region32_init(&sb->damage);
-	pixman_region32_copy(&sb->damage, &output->base.region);
+	sb->age = 0;
 	sb->frame_damaged = 1;
 
 	sb->data = data;
@@ -403,6 +461,520 @@ draw_initial_frame(struct wayland_output *output)
 			  output->base.current_mode->height);
 }
 
+static void
+wayland_plane_buffer_destroy(struct wayland_plane_buffer *pb)
+{
+	weston_buffer_reference(&pb->client_ref, NULL);
+	wl_buffer_destroy(pb->buffer);
+	if (pb->data)
+		munmap(pb->data, pb->size);
+
+	wl_list_remove(&pb->link);
+	wl_list_remove(&pb->free_link);
+	free(pb);
+}
+
+static void
+plane_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct wayland_plane_buffer *pb = data;
+
+	/* Copies are recycled, imported client buffers are not */
+	if (pb->data && pb->plane)
+		wl_list_insert(&pb->plane->free_buffers, &pb->free_link);
+	else
+		wayland_plane_buffer_destroy(pb);
+}
+
+static const struct wl_buffer_listener plane_buffer_listener = {
+	plane_buffer_release
+};
+
+static struct wayland_plane_buffer *
+wayland_plane_buffer_create(struct wayland_plane *plane)
+{
+	struct wayland_plane_buffer *pb;
+
+	pb = zalloc(sizeof *pb);
+	if (!pb)
+		return NULL;
+
+	pb->plane = plane;
+	wl_list_insert(&plane->buffers, &pb->link);
+	wl_list_init(&pb->free_link);
+
+	return pb;
+}
+
+static struct wayland_plane_buffer *
+wayland_plane_import_dmabuf(struct wayland_plane *plane,
+			    struct linux_dmabuf_buffer *dmabuf,
+			    struct weston_buffer *buffer)
+{
+	struct wayland_backend *b =
+		to_wayland_backend(plane->output->base.compositor);
+	struct dmabuf_attributes *attributes = &dmabuf->attributes;
+	struct zwp_linux_buffer_params_v1 *params;
+	struct wayland_plane_buffer *pb;
+	int i;
+
+	pb = wayland_plane_buffer_create(plane);
+	if (!pb)
+		return NULL;
+
+	params = zwp_linux_dmabuf_v1_create_params(b->parent.dmabuf);
+	for (i = 0; i < attributes->n_planes; i++)
+		zwp_linux_buffer_params_v1_add(params, attributes->fd[i], i,
+					       attributes->offset[i],
+					       attributes->stride[i],
+					       attributes->modifier[i] >> 32,
+					       attributes->modifier[i] & 0xffffffff);
+	pb->buffer = zwp_linux_buffer_params_v1_create_immed(params,
+							     attributes->width,
+							     attributes->height,
+							     attributes->format,
+							     attributes->flags);
+	zwp_linux_buffer_params_v1_destroy(params);
+	wl_buffer_add_listener(pb->buffer, &plane_buffer_listener, pb);
+
+	/* The parent reads straight from the client's buffer, so keep it
+	 * busy until the parent releases our import. */
+	weston_buffer_reference(&pb->client_ref, buffer);
+
+	return pb;
+}
+
+static struct wayland_plane_buffer *
+wayland_plane_copy_shm(struct wayland_plane *plane,
+		       struct wl_shm_buffer *shm_buffer)
+{
+	struct wayland_backend *b =
+		to_wayland_backend(plane->output->base.compositor);
+	struct wayland_plane_buffer *pb, *next;
+	struct wl_shm_pool *pool;
+	int32_t width, height, stride;
+	uint32_t format;
+	uint8_t *src, *dst;
+	int fd, y;
+
+	width = wl_shm_buffer_get_width(shm_buffer);
+	height = wl_shm_buffer_get_height(shm_buffer);
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+	format = wl_shm_buffer_get_format(shm_buffer);
+
+	/* Drop copies that no longer match the client's buffer */
+	wl_list_for_each_safe(pb, next, &plane->free_buffers, free_link) {
+		if (pb->width == width && pb->height == height &&
+		    pb->stride == stride && pb->format == format) {
+			wl_list_remove(&pb->free_link);
+			wl_list_init(&pb->free_link);
+			goto copy;
+		}
+		wayland_plane_buffer_destroy(pb);
+	}
+
+	pb = wayland_plane_buffer_create(plane);
+	if (!pb)
+		return NULL;
+
+	pb->size = height * stride;
+	fd = os_create_anonymous_file(pb->size);
+	if (fd < 0) {
+		weston_log("could not create an anonymous file buffer: %m\n");
+		goto err;
+	}
+
+	pb->data = mmap(NULL, pb->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0);
+	if (pb->data == MAP_FAILED) {
+		weston_log("could not mmap %d memory for data: %m\n", fd);
+		pb->data = NULL;
+		close(fd);
+		goto err;
+	}
+
+	pool = wl_shm_create_pool(b->parent.shm, fd, pb->size);
+	pb->buffer = wl_shm_pool_create_buffer(pool, 0, width, height,
+					       stride, format);
+	wl_buffer_add_listener(pb->buffer, &plane_buffer_listener, pb);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	pb->width = width;
+	pb->height = height;
+	pb->stride = stride;
+	pb->format = format;
+
+copy:
+	src = wl_shm_buffer_get_data(shm_buffer);
+	dst = pb->data;
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	for (y = 0; y < height; y++)
+		memcpy(dst + y * stride, src + y * stride, stride);
+	wl_shm_buffer_end_access(shm_buffer);
+
+	return pb;
+
+err:
+	wl_list_remove(&pb->link);
+	free(pb);
+	return NULL;
+}
+
+static bool
+wayland_backend_dmabuf_supported(struct wayland_backend *b,
+				 struct dmabuf_attributes *attributes)
+{
+	struct wayland_dmabuf_format *f;
+	int i;
+
+	for (i = 1; i < attributes->n_planes; i++)
+		if (attributes->modifier[i] != attributes->modifier[0])
+			return false;
+
+	wl_array_for_each(f, &b->parent.dmabuf_formats) {
+		if (f->format == attributes->format &&
+		    f->modifier == attributes->modifier[0])
+			return true;
+	}
+
+	return false;
+}
+
+/* Whether the view can be shown by handing its buffer to the parent
+ * compositor instead of compositing it. */
+static bool
+wayland_output_view_passthrough_supported(struct wayland_output *output,
+					  struct weston_view *ev)
+{
+	struct wayland_backend *b =
+		to_wayland_backend(output->base.compositor);
+	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct wl_shm_buffer *shm_buffer;
+	pixman_region32_t outside;
+	bool contained;
+
+	if (!buffer || !buffer->resource)
+		return false;
+
+	if (ev->output_mask != (1u << output->base.id))
+		return false;
+
+	/* The output surface is not scaled or transformed in the parent,
+	 * so only plain translations map onto a subsurface. */
+	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    output->base.current_scale != 1)
+		return false;
+	if (ev->transform.enabled &&
+	    ev->transform.matrix.type > WESTON_MATRIX_TRANSFORM_TRANSLATE)
+		return false;
+	if (ev->geometry.scissor_enabled)
+		return false;
+	if (ev->alpha != 1.0f)
+		return false;
+	if (viewport->buffer.src_width != wl_fixed_from_int(-1) ||
+	    viewport->surface.width != -1)
+		return false;
+	if ((viewport->buffer.scale != 1 ||
+	     viewport->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL) &&
+	    wl_compositor_get_version(b->parent.compositor) <
+	    WL_SURFACE_SET_BUFFER_SCALE_SINCE_VERSION)
+		return false;
+
+	/* Subsurfaces are not clipped to the output surface */
+	pixman_region32_init(&outside);
+	pixman_region32_subtract(&outside, &ev->transform.boundingbox,
+				 &output->base.region);
+	contained = !pixman_region32_not_empty(&outside);
+	pixman_region32_fini(&outside);
+	if (!contained)
+		return false;
+
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	if (dmabuf)
+		return b->parent.dmabuf &&
+		       wayland_backend_dmabuf_supported(b, &dmabuf->attributes);
+
+	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	if (shm_buffer) {
+		switch (wl_shm_buffer_get_format(shm_buffer)) {
+		case WL_SHM_FORMAT_ARGB8888:
+		case WL_SHM_FORMAT_XRGB8888:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	return false;
+}
+
+static struct wayland_plane *
+wayland_output_pick_plane(struct wayland_output *output,
+			  struct weston_view *ev)
+{
+	struct wayland_plane *plane, *found = NULL;
+
+	/* Prefer the plane that showed this view last frame, so that its
+	 * content survives. */
+	wl_list_for_each(plane, &output->planes, link) {
+		if (plane->view)
+			continue;
+		if (plane->last_view == ev)
+			return plane;
+		if (!found)
+			found = plane;
+	}
+
+	return found;
+}
+
+static void
+wayland_output_assign_planes(struct weston_output *output_base,
+			     void *repaint_data)
+{
+	struct wayland_output *output = to_wayland_output(output_base);
+	struct weston_compositor *ec = output->base.compositor;
+	struct weston_plane *primary = &ec->primary_plane;
+	struct weston_plane *next_plane;
+	struct wayland_plane *plane;
+	struct weston_view *ev;
+	pixman_region32_t surface_overlap, renderer_region;
+	bool supported;
+
+	wl_list_for_each(plane, &output->planes, link)
+		plane->view = NULL;
+	output->plane_count = 0;
+
+	pixman_region32_init(&renderer_region);
+
+	wl_list_for_each(ev, &ec->view_list, link) {
+		if (!(ev->output_mask & (1u << output->base.id)))
+			continue;
+
+		supported = wayland_output_view_passthrough_supported(output,
+								      ev);
+
+		/* Copying from SHM happens at repaint time, after the core
+		 * would otherwise have released the buffer. */
+		ev->surface->keep_buffer = supported;
+
+		pixman_region32_init(&surface_overlap);
+		pixman_region32_intersect(&surface_overlap, &renderer_region,
+					  &ev->transform.boundingbox);
+
+		next_plane = primary;
+		if (supported && !pixman_region32_not_empty(&surface_overlap)) {
+			plane = wayland_output_pick_plane(output, ev);
+			if (plane) {
+				plane->view = ev;
+				output->plane_stack[output->plane_count++] = plane;
+				next_plane = &plane->base;
+			}
+		}
+
+		weston_view_move_to_plane(ev, next_plane);
+
+		if (next_plane == primary) {
+			pixman_region32_union(&renderer_region,
+					      &renderer_region,
+					      &ev->transform.boundingbox);
+			ev->psf_flags = 0;
+		} else if (linux_dmabuf_buffer_get(ev->surface->buffer_ref.buffer->resource)) {
+			ev->psf_flags = WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+		} else {
+			ev->psf_flags = 0;
+		}
+
+		pixman_region32_fini(&surface_overlap);
+	}
+
+	pixman_region32_fini(&renderer_region);
+}
+
+static void
+wayland_plane_update(struct wayland_plane *plane, int32_t ix, int32_t iy)
+{
+	struct wayland_output *output = plane->output;
+	struct weston_view *ev = plane->view;
+	struct weston_surface *es = ev->surface;
+	struct weston_buffer *buffer = es->buffer_ref.buffer;
+	struct wayland_plane_buffer *pb = NULL;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct wl_shm_buffer *shm_buffer;
+	pixman_region32_t damage;
+	pixman_box32_t *rects;
+	float fx, fy;
+	int32_t x, y;
+	int i, n;
+
+	weston_view_to_global_float(ev, 0, 0, &fx, &fy);
+	x = (int32_t) fx;
+	y = (int32_t) fy;
+
+	wl_subsurface_set_position(plane->subsurface,
+				   x - output->base.x + ix,
+				   y - output->base.y + iy);
+
+	if (plane->last_view == ev &&
+	    !pixman_region32_not_empty(&plane->base.damage))
+		goto out;
+
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	if (dmabuf) {
+		pb = wayland_plane_import_dmabuf(plane, dmabuf, buffer);
+	} else {
+		shm_buffer = wl_shm_buffer_get(buffer->resource);
+		if (shm_buffer)
+			pb = wayland_plane_copy_shm(plane, shm_buffer);
+	}
+	if (!pb) {
+		weston_log("failed to pass a buffer on to the parent\n");
+		goto out;
+	}
+
+	if (wl_surface_get_version(plane->surface) >=
+	    WL_SURFACE_SET_BUFFER_SCALE_SINCE_VERSION) {
+		wl_surface_set_buffer_scale(plane->surface,
+					    es->buffer_viewport.buffer.scale);
+		wl_surface_set_buffer_transform(plane->surface,
+						es->buffer_viewport.buffer.transform);
+	}
+	wl_surface_attach(plane->surface, pb->buffer, 0, 0);
+
+	pixman_region32_init(&damage);
+	if (plane->last_view != ev) {
+		pixman_region32_init_rect(&damage, 0, 0,
+					  es->width, es->height);
+	} else {
+		pixman_region32_intersect(&damage, &plane->base.damage,
+					  &ev->transform.boundingbox);
+		pixman_region32_translate(&damage, -x, -y);
+	}
+
+	rects = pixman_region32_rectangles(&damage, &n);
+	for (i = 0; i < n; i++)
+		wl_surface_damage(plane->surface, rects[i].x1, rects[i].y1,
+				  rects[i].x2 - rects[i].x1,
+				  rects[i].y2 - rects[i].y1);
+	pixman_region32_fini(&damage);
+
+out:
+	pixman_region32_clear(&plane->base.damage);
+	plane->last_view = ev;
+	plane->mapped = true;
+
+	/* Applied along with the next commit of the output surface */
+	wl_surface_commit(plane->surface);
+}
+
+static void
+wayland_output_update_planes(struct wayland_output *output)
+{
+	struct wayland_plane *plane;
+	struct wl_surface *below;
+	int32_t ix = 0, iy = 0;
+	int i;
+
+	if (output->frame)
+		frame_interior(output->frame, &ix, &iy, NULL, NULL);
+
+	wl_list_for_each(plane, &output->planes, link) {
+		if (plane->view) {
+			wayland_plane_update(plane, ix, iy);
+		} else if (plane->mapped) {
+			wl_surface_attach(plane->surface, NULL, 0, 0);
+			wl_surface_commit(plane->surface);
+			plane->last_view = NULL;
+			plane->mapped = false;
+		}
+	}
+
+	/* plane_stack is ordered top to bottom */
+	below = output->parent.surface;
+	for (i = output->plane_count - 1; i >= 0; i--) {
+		wl_subsurface_place_above(output->plane_stack[i]->subsurface,
+					  below);
+		below = output->plane_stack[i]->surface;
+	}
+}
+
+static void
+wayland_plane_destroy(struct wayland_plane *plane)
+{
+	struct wayland_plane_buffer *pb, *next;
+
+	wl_list_for_each_safe(pb, next, &plane->free_buffers, free_link)
+		wayland_plane_buffer_destroy(pb);
+	/* The rest go away when the parent releases them */
+	wl_list_for_each(pb, &plane->buffers, link)
+		pb->plane = NULL;
+
+	wl_subsurface_destroy(plane->subsurface);
+	wl_surface_destroy(plane->surface);
+
+	weston_plane_release(&plane->base);
+	wl_list_remove(&plane->link);
+	free(plane);
+}
+
+static void
+wayland_output_destroy_planes(struct wayland_output *output)
+{
+	struct wayland_plane *plane, *next;
+
+	wl_list_for_each_safe(plane, next, &output->planes, link)
+		wayland_plane_destroy(plane);
+	output->plane_count = 0;
+}
+
+static int
+wayland_output_create_planes(struct wayland_output *output)
+{
+	struct wayland_backend *b =
+		to_wayland_backend(output->base.compositor);
+	struct weston_compositor *ec = output->base.compositor;
+	struct wayland_plane *plane;
+	struct wl_region *region;
+	int i;
+
+	for (i = 0; i < WAYLAND_MAX_PLANES; i++) {
+		plane = zalloc(sizeof *plane);
+		if (!plane)
+			goto err;
+
+		plane->output = output;
+		wl_list_init(&plane->buffers);
+		wl_list_init(&plane->free_buffers);
+
+		plane->surface =
+			wl_compositor_create_surface(b->parent.compositor);
+		plane->subsurface =
+			wl_subcompositor_get_subsurface(b->parent.subcompositor,
+							plane->surface,
+							output->parent.surface);
+
+		/* The planes must not intercept input meant for the output */
+		region = wl_compositor_create_region(b->parent.compositor);
+		wl_surface_set_input_region(plane->surface, region);
+		wl_region_destroy(region);
+
+		weston_plane_init(&plane->base, ec, 0, 0);
+		weston_compositor_stack_plane(ec, &plane->base,
+					      &ec->primary_plane);
+		wl_list_insert(output->planes.prev, &plane->link);
+	}
+
+	return 0;
+
+err:
+	wayland_output_destroy_planes(output);
+	return -1;
+}
+
 #ifdef ENABLE_EGL
 static void
 wayland_output_update_gl_border(struct wayland_output *output)
@@ -512,6 +1084,7 @@ wayland_output_repaint_gl(struct weston_output *output_base,
 	wl_callback_add_listener(output->frame_cb, &frame_listener, output);
 
 	wayland_output_update_gl_border(output);
+	wayland_output_update_planes(output);
 
 	ec->renderer->repaint_output(&output->base, damage);
 
@@ -562,15 +1135,19 @@ wayland_output_update_shm_border(struct wayland_shm_buffer *buffer)
 }
 
 static void
-wayland_shm_buffer_attach(struct wayland_shm_buffer *sb)
+wayland_shm_buffer_attach(struct wayland_shm_buffer *sb,
+			  pixman_region32_t *output_damage)
 {
+	struct wl_surface *surface = sb->output->parent.surface;
 	pixman_region32_t damage;
 	pixman_box32_t *rects;
 	int32_t ix, iy, iwidth, iheight, fwidth, fheight;
 	int i, n;
 
+	/* The parent only needs what changed since the previous frame,
+	 * not what this buffer had to catch up on. */
 	pixman_region32_init(&damage);
-	pixman_region32_copy(&damage, &sb->damage);
+	pixman_region32_copy(&damage, output_damage);
 	pixman_region32_translate(&damage, -sb->output->base.x,
 				  -sb->output->base.y);
 
@@ -602,14 +1179,47 @@ wayland_shm_buffer_attach(struct wayland_shm_buffer *sb)
 	}
 
 	rects = pixman_region32_rectangles(&damage, &n);
-	wl_surface_attach(sb->output->parent.surface, sb->buffer, 0, 0);
-	for (i = 0; i < n; ++i)
-		wl_surface_damage(sb->output->parent.surface, rects[i].x1,
-				  rects[i].y1, rects[i].x2 - rects[i].x1,
-				  rects[i].y2 - rects[i].y1);
+	wl_surface_attach(surface, sb->buffer, 0, 0);
+	for (i = 0; i < n; ++i) {
+		if (wl_surface_get_version(surface) >=
+		    WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+			wl_surface_damage_buffer(surface, rects[i].x1,
+						 rects[i].y1,
+						 rects[i].x2 - rects[i].x1,
+						 rects[i].y2 - rects[i].y1);
+		else
+			wl_surface_damage(surface, rects[i].x1,
+					  rects[i].y1,
+					  rects[i].x2 - rects[i].x1,
+					  rects[i].y2 - rects[i].y1);
+	}
+
+	pixman_region32_fini(&damage);
+}
+
+static void
+wayland_output_get_shm_damage(struct wayland_output *output,
+			      struct wayland_shm_buffer *sb,
+			      pixman_region32_t *output_damage,
+			      pixman_region32_t *buffer_damage)
+{
+	if (!weston_damage_history_get(&output->shm.damage, sb->age,
+				       output_damage, buffer_damage))
+		pixman_region32_copy(buffer_damage, &output->base.region);
+}
 
-	if (sb->output->frame)
-		pixman_region32_fini(&damage);
+static void
+wayland_output_rotate_shm_damage(struct wayland_output *output,
+				 struct wayland_shm_buffer *sb,
+				 pixman_region32_t *output_damage)
+{
+	struct wayland_shm_buffer *b;
+
+	weston_damage_history_push(&output->shm.damage, output_damage);
+
+	wl_list_for_each(b, &output->shm.buffers, link)
+		b->age = weston_damage_history_age(b->age);
+	sb->age = 1;
 }
 
 static int
@@ -621,6 +1231,7 @@ wayland_output_repaint_pixman(struct weston_output *output_base,
 	struct wayland_backend *b =
 		to_wayland_backend(output->base.compositor);
 	struct wayland_shm_buffer *sb;
+	pixman_region32_t buffer_damage;
 
 	if (output->frame) {
 		if (frame_status(output->frame) & FRAME_STATUS_REPAINT)
@@ -628,24 +1239,28 @@ wayland_output_repaint_pixman(struct weston_output *output_base,
 				sb->frame_damaged = 1;
 	}
 
-	wl_list_for_each(sb, &output->shm.buffers, link)
-		pixman_region32_union(&sb->damage, &sb->damage, damage);
-
 	sb = wayland_output_get_shm_buffer(output);
+	if (!sb)
+		return -1;
+
+	/* Only repaint what this buffer missed since it was last shown */
+	pixman_region32_init(&buffer_damage);
+	wayland_output_get_shm_damage(output, sb, damage, &buffer_damage);
 
 	wayland_output_update_shm_border(sb);
 	pixman_renderer_output_set_buffer(output_base, sb->pm_image);
-	b->compositor->renderer->repaint_output(output_base, &sb->damage);
+	b->compositor->renderer->repaint_output(output_base, &buffer_damage);
+	pixman_region32_fini(&buffer_damage);
 
-	wayland_shm_buffer_attach(sb);
+	wayland_shm_buffer_attach(sb, damage);
+	wayland_output_update_planes(output);
 
 	output->frame_cb = wl_surface_frame(output->parent.surface);
 	wl_callback_add_listener(output->frame_cb, &frame_listener, output);
 	wl_surface_commit(output->parent.surface);
 	wl_display_flush(b->parent.wl_display);
 
-	pixman_region32_fini(&sb->damage);
-	pixman_region32_init(&sb->damage);
+	wayland_output_rotate_shm_damage(output, sb, damage);
 	sb->frame_damaged = 0;
 
 	pixman_region32_subtract(&b->compositor->primary_plane.damage,
@@ -709,6 +1324,8 @@ wayland_output_disable(struct weston_output *base)
 	}
 
 	wayland_output_destroy_shm_buffers(output);
+	weston_damage_history_release(&output->shm.damage);
+	wayland_output_destroy_planes(output);
 
 	wayland_backend_destroy_output_surface(output);
 
@@ -1232,6 +1849,8 @@ wayland_output_enable(struct weston_output *base)
 
 	wl_list_init(&output->shm.buffers);
 	wl_list_init(&output->shm.free_buffers);
+	weston_damage_history_init(&output->shm.damage);
+	wl_list_init(&output->planes);
 
 	if (b->use_pixman) {
 		if (wayland_output_init_pixman_renderer(output) < 0)
@@ -1253,6 +1872,15 @@ wayland_output_enable(struct weston_output *base)
 	output->base.set_dpms = NULL;
 	output->base.switch_mode = wayland_output_switch_mode;
 
+	if (b->use_subsurfaces && b->parent.subcompositor) {
+		if (wayland_output_create_planes(output) == 0)
+			output->base.assign_planes =
+				wayland_output_assign_planes;
+		else
+			weston_log("Failed to create subsurfaces for output, "
+				   "compositing all clients\n");
+	}
+
 	if (b->sprawl_across_outputs) {
 		if (b->parent.fshell) {
 			wayland_output_resize_surface(output);
@@ -1281,6 +1909,7 @@ wayland_output_enable(struct weston_output *base)
 	return 0;
 
 err_output:
+	weston_damage_history_release(&output->shm.damage);
 	wayland_backend_destroy_output_surface(output);
 
 	return -1;
@@ -2515,6 +3144,46 @@ static const struct zxdg_shell_v6_listener xdg_shell_listener = {
 	xdg_shell_ping,
 };
 
+static void
+wayland_backend_add_dmabuf_format(struct wayland_backend *b,
+				  uint32_t format, uint64_t modifier)
+{
+	struct wayland_dmabuf_format *f;
+
+	f = wl_array_add(&b->parent.dmabuf_formats, sizeof *f);
+	if (!f)
+		return;
+
+	f->format = format;
+	f->modifier = modifier;
+}
+
+static void
+linux_dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+		    uint32_t format)
+{
+	struct wayland_backend *b = data;
+
+	wayland_backend_add_dmabuf_format(b, format, DRM_FORMAT_MOD_INVALID);
+}
+
+static void
+linux_dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+		      uint32_t format, uint32_t modifier_hi,
+		      uint32_t modifier_lo)
+{
+	struct wayland_backend *b = data;
+
+	wayland_backend_add_dmabuf_format(b, format,
+					  ((uint64_t) modifier_hi << 32) |
+					  modifier_lo);
+}
+
+static const struct zwp_linux_dmabuf_v1_listener linux_dmabuf_listener = {
+	linux_dmabuf_format,
+	linux_dmabuf_modifier
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 		       const char *interface, uint32_t version)
@@ -2547,6 +3216,20 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 	} else if (strcmp(interface, "wl_shm") == 0) {
 		b->parent.shm =
 			wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0 &&
+		   b->use_subsurfaces) {
+		b->parent.subcompositor =
+			wl_registry_bind(registry, name,
+					 &wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0 &&
+		   b->use_subsurfaces && version >= 2) {
+		/* create_immed needs version 2 */
+		b->parent.dmabuf =
+			wl_registry_bind(registry, name,
+					 &zwp_linux_dmabuf_v1_interface,
+					 MIN(version, 3));
+		zwp_linux_dmabuf_v1_add_listener(b->parent.dmabuf,
+						 &linux_dmabuf_listener, b);
 	}
 }
 
@@ -2607,6 +3290,13 @@ wayland_destroy(struct weston_compositor *ec)
 	if (b->parent.shm)
 		wl_shm_destroy(b->parent.shm);
 
+	if (b->parent.subcompositor)
+		wl_subcompositor_destroy(b->parent.subcompositor);
+
+	if (b->parent.dmabuf)
+		zwp_linux_dmabuf_v1_destroy(b->parent.dmabuf);
+	wl_array_release(&b->parent.dmabuf_formats);
+
 	if (b->parent.xdg_shell)
 		zxdg_shell_v6_destroy(b->parent.xdg_shell);
 
@@ -2716,6 +3406,8 @@ wayland_backend_create(struct weston_compositor *compositor,
 
 	wl_list_init(&b->parent.output_list);
 	wl_list_init(&b->input_list);
+	wl_array_init(&b->parent.dmabuf_formats);
+	b->use_subsurfaces = new_config->use_subsurfaces;
 	b->parent.registry = wl_display_get_registry(b->parent.wl_display);
 	wl_registry_add_listener(b->parent.registry, &registry_listener, b);
 	wl_display_roundtrip(b->parent.wl_display);
@@ -34,7 +34,7 @@ extern "C" {
 
 #include <stdint.h>
 
-#define WESTON_WAYLAND_BACKEND_CONFIG_VERSION 2
+#define WESTON_WAYLAND_BACKEND_CONFIG_VERSION 3
 
 struct weston_wayland_backend_config {
 	struct weston_backend_config base;
@@ -44,6 +44,9 @@ struct weston_wayland_backend_config {
 	bool fullscreen;
 	char *cursor_theme;
 	int cursor_size;
+	/* Show suitable client buffers as subsurfaces of the output
+	 * surface instead of compositing them */
+	bool use_subsurfaces;
 };
 
 #ifdef  __cplusplus
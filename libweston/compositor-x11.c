@@ -44,6 +44,10 @@
 #ifdef HAVE_XCB_XKB
 #include <xcb/xkb.h>
 #endif
+#ifdef HAVE_XCB_PRESENT
+#include <xcb/present.h>
+#include <xcb/xfixes.h>
+#endif
 
 #include <X11/Xlib.h>
 #include <X11/Xlib-xcb.h>
@@ -72,6 +76,14 @@
 #define WINDOW_MAX_WIDTH 8192
 #define WINDOW_MAX_HEIGHT 8192
 
+/* With the Present extension the pixman path double-buffers its SHM
+ * pixmaps; without it a single buffer is copied with ShmPutImage. */
+#define X11_SHM_BUFFERS 2
+
+/* Fallback in case the X server never completes a presentation, e.g.
+ * because it is shutting down. */
+#define X11_PRESENT_TIMEOUT_MS 250
+
 struct x11_backend {
 	struct weston_backend	 base;
 	struct weston_compositor *compositor;
@@ -88,6 +100,10 @@ struct x11_backend {
 	int			 fullscreen;
 	int			 no_input;
 	int			 use_pixman;
+#ifdef HAVE_XCB_PRESENT
+	unsigned int		 has_present;
+	uint8_t			 present_opcode;
+#endif
 
 	int			 has_net_wm_state_fullscreen;
 
@@ -120,6 +136,18 @@ struct x11_head {
 	struct weston_head	base;
 };
 
+struct x11_shm_buffer {
+	xcb_shm_seg_t		segment;
+	int			shm_id;
+	void		       *buf;
+	pixman_image_t	       *image;
+	xcb_pixmap_t		pixmap;
+	/* Damage this buffer missed while the other one was drawn */
+	pixman_region32_t	damage;
+	bool			reset;
+	bool			busy;
+};
+
 struct x11_output {
 	struct weston_output	base;
 
@@ -129,11 +157,16 @@ struct x11_output {
 	struct wl_event_source *finish_frame_timer;
 
 	xcb_gc_t		gc;
-	xcb_shm_seg_t		segment;
-	pixman_image_t	       *hw_surface;
-	int			shm_id;
-	void		       *buf;
+	struct x11_shm_buffer	shm[X11_SHM_BUFFERS];
+	int			nshm;
+	int			current_shm;
 	uint8_t			depth;
+#ifdef HAVE_XCB_PRESENT
+	xcb_present_event_t	present_eid;
+	xcb_xfixes_region_t	present_region;
+	uint32_t		present_serial;
+	bool			present_pending;
+#endif
 	int32_t                 scale;
 	bool			resize_pending;
 	bool			window_resized;
@@ -425,18 +458,16 @@ x11_output_repaint_gl(struct weston_output *output_base,
 	return 0;
 }
 
-static void
-set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+/* Returns the rectangles of a global region in window coordinates, to be
+ * freed by the caller. */
+static xcb_rectangle_t *
+output_region_to_rectangles(struct weston_output *output_base,
+			    pixman_region32_t *region, int *nrects_out)
 {
-	struct x11_output *output = to_x11_output(output_base);
-	struct weston_compositor *ec = output->base.compositor;
-	struct x11_backend *b = to_x11_backend(ec);
 	pixman_region32_t transformed_region;
 	pixman_box32_t *rects;
 	xcb_rectangle_t *output_rects;
-	xcb_void_cookie_t cookie;
 	int nrects, i;
-	xcb_generic_error_t *err;
 
 	pixman_region32_init(&transformed_region);
 	pixman_region32_copy(&transformed_region, region);
@@ -452,7 +483,7 @@ set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region
 
 	if (output_rects == NULL) {
 		pixman_region32_fini(&transformed_region);
-		return;
+		return NULL;
 	}
 
 	for (i = 0; i < nrects; i++) {
@@ -464,19 +495,113 @@ set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region
 
 	pixman_region32_fini(&transformed_region);
 
-	cookie = xcb_set_clip_rectangles_checked(b->conn, XCB_CLIP_ORDERING_UNSORTED,
-					output->gc,
-					0, 0, nrects,
-					output_rects);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to set clip rects, err: %d\n", err->error_code);
-		free(err);
-	}
+	*nrects_out = nrects;
+	return output_rects;
+}
+
+static void
+set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+{
+	struct x11_output *output = to_x11_output(output_base);
+	struct weston_compositor *ec = output->base.compositor;
+	struct x11_backend *b = to_x11_backend(ec);
+	xcb_rectangle_t *output_rects;
+	int nrects;
+
+	output_rects = output_region_to_rectangles(output_base, region, &nrects);
+	if (output_rects == NULL)
+		return;
+
+	/* Errors come back as events, no need to wait for them here */
+	xcb_set_clip_rectangles(b->conn, XCB_CLIP_ORDERING_UNSORTED,
+				output->gc, 0, 0, nrects, output_rects);
 	free(output_rects);
 }
 
 
+#ifdef HAVE_XCB_PRESENT
+static struct x11_shm_buffer *
+x11_output_next_shm_buffer(struct x11_output *output)
+{
+	int i, n;
+
+	/* Take the first idle buffer after the one presented last; if the
+	 * server still holds all of them, reuse the oldest one. */
+	for (i = 1; i <= output->nshm; i++) {
+		n = (output->current_shm + i) % output->nshm;
+		if (!output->shm[n].busy)
+			break;
+	}
+	if (i > output->nshm)
+		n = (output->current_shm + 1) % output->nshm;
+
+	output->current_shm = n;
+	return &output->shm[n];
+}
+
+static int
+x11_output_repaint_present(struct x11_output *output,
+			   pixman_region32_t *damage)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct x11_backend *b = to_x11_backend(ec);
+	struct x11_shm_buffer *sb;
+	pixman_region32_t repaint;
+	xcb_xfixes_region_t update = XCB_NONE;
+	xcb_rectangle_t *rects;
+	int nrects, i;
+
+	sb = x11_output_next_shm_buffer(output);
+
+	/* Bring the buffer up to date: it missed whatever was drawn into
+	 * the other buffers since it was last presented. */
+	pixman_region32_init(&repaint);
+	if (sb->reset)
+		pixman_region32_copy(&repaint, &output->base.region);
+	else
+		pixman_region32_union(&repaint, &sb->damage, damage);
+	pixman_region32_clear(&sb->damage);
+	sb->reset = false;
+
+	for (i = 0; i < output->nshm; i++) {
+		if (&output->shm[i] == sb)
+			continue;
+		pixman_region32_union(&output->shm[i].damage,
+				      &output->shm[i].damage, damage);
+	}
+
+	pixman_renderer_output_set_buffer(&output->base, sb->image);
+	ec->renderer->repaint_output(&output->base, &repaint);
+	pixman_region32_fini(&repaint);
+
+	pixman_region32_subtract(&ec->primary_plane.damage,
+				 &ec->primary_plane.damage, damage);
+
+	/* Only the new damage differs from what is on screen */
+	rects = output_region_to_rectangles(&output->base, damage, &nrects);
+	if (rects) {
+		xcb_xfixes_set_region(b->conn, output->present_region,
+				      nrects, rects);
+		update = output->present_region;
+		free(rects);
+	}
+
+	xcb_present_pixmap(b->conn, output->window, sb->pixmap,
+			   ++output->present_serial, XCB_NONE, update, 0, 0,
+			   XCB_NONE, XCB_NONE, XCB_NONE,
+			   XCB_PRESENT_OPTION_NONE, 0, 0, 0, 0, NULL);
+	xcb_flush(b->conn);
+
+	sb->busy = true;
+	output->present_pending = true;
+
+	/* finish_frame normally comes from CompleteNotify */
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     X11_PRESENT_TIMEOUT_MS);
+	return 0;
+}
+#endif
+
 static int
 x11_output_repaint_shm(struct weston_output *output_base,
 		       pixman_region32_t *damage,
@@ -485,28 +610,28 @@ x11_output_repaint_shm(struct weston_output *output_base,
 	struct x11_output *output = to_x11_output(output_base);
 	struct weston_compositor *ec = output->base.compositor;
 	struct x11_backend *b = to_x11_backend(ec);
-	xcb_void_cookie_t cookie;
-	xcb_generic_error_t *err;
+	pixman_image_t *image = output->shm[0].image;
+
+#ifdef HAVE_XCB_PRESENT
+	if (b->has_present)
+		return x11_output_repaint_present(output, damage);
+#endif
 
-	pixman_renderer_output_set_buffer(output_base, output->hw_surface);
+	pixman_renderer_output_set_buffer(output_base, image);
 	ec->renderer->repaint_output(output_base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 	set_clip_for_output(output_base, damage);
-	cookie = xcb_shm_put_image_checked(b->conn, output->window, output->gc,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0, output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
-					0, output->segment, 0);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to put shm image, err: %d\n", err->error_code);
-		free(err);
-	}
+	xcb_shm_put_image(b->conn, output->window, output->gc,
+			  pixman_image_get_width(image),
+			  pixman_image_get_height(image),
+			  0, 0,
+			  pixman_image_get_width(image),
+			  pixman_image_get_height(image),
+			  0, 0, output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+			  0, output->shm[0].segment, 0);
+	xcb_flush(b->conn);
 
 	wl_event_source_timer_update(output->finish_frame_timer, 10);
 	return 0;
@@ -518,6 +643,11 @@ finish_frame_handler(void *data)
 	struct x11_output *output = data;
 	struct timespec ts;
 
+#ifdef HAVE_XCB_PRESENT
+	/* a late completion of this frame is ignored */
+	output->present_pending = false;
+#endif
+
 	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
 	weston_output_finish_frame(&output->base, &ts, 0);
 
@@ -525,21 +655,42 @@ finish_frame_handler(void *data)
 }
 
 static void
-x11_output_deinit_shm(struct x11_backend *b, struct x11_output *output)
+x11_shm_buffer_release(struct x11_backend *b, struct x11_shm_buffer *sb)
 {
 	xcb_void_cookie_t cookie;
 	xcb_generic_error_t *err;
-	xcb_free_gc(b->conn, output->gc);
 
-	pixman_image_unref(output->hw_surface);
-	output->hw_surface = NULL;
-	cookie = xcb_shm_detach_checked(b->conn, output->segment);
+	if (sb->pixmap)
+		xcb_free_pixmap(b->conn, sb->pixmap);
+	pixman_region32_fini(&sb->damage);
+	pixman_image_unref(sb->image);
+	sb->image = NULL;
+	cookie = xcb_shm_detach_checked(b->conn, sb->segment);
 	err = xcb_request_check(b->conn, cookie);
 	if (err) {
 		weston_log("xcb_shm_detach failed, error %d\n", err->error_code);
 		free(err);
 	}
-	shmdt(output->buf);
+	shmdt(sb->buf);
+}
+
+static void
+x11_output_deinit_shm(struct x11_backend *b, struct x11_output *output)
+{
+	int i;
+
+	xcb_free_gc(b->conn, output->gc);
+
+#ifdef HAVE_XCB_PRESENT
+	if (output->present_region) {
+		xcb_xfixes_destroy_region(b->conn, output->present_region);
+		output->present_region = 0;
+	}
+#endif
+
+	for (i = 0; i < output->nshm; i++)
+		x11_shm_buffer_release(b, &output->shm[i]);
+	output->nshm = 0;
 }
 
 static void
@@ -692,6 +843,62 @@ get_depth_of_visual(xcb_screen_t *screen,
 	return 0;
 }
 
+static int
+x11_shm_buffer_init(struct x11_backend *b, struct x11_output *output,
+		    struct x11_shm_buffer *sb, int width, int height,
+		    int bitsperpixel, pixman_format_code_t pixman_format)
+{
+	xcb_void_cookie_t cookie;
+	xcb_generic_error_t *err;
+
+	memset(sb, 0, sizeof *sb);
+
+	/* Create SHM segment and attach it */
+	sb->shm_id = shmget(IPC_PRIVATE, width * height * (bitsperpixel / 8), IPC_CREAT | S_IRWXU);
+	if (sb->shm_id == -1) {
+		weston_log("x11shm: failed to allocate SHM segment\n");
+		return -1;
+	}
+	sb->buf = shmat(sb->shm_id, NULL, 0 /* read/write */);
+	if (-1 == (long)sb->buf) {
+		weston_log("x11shm: failed to attach SHM segment\n");
+		shmctl(sb->shm_id, IPC_RMID, NULL);
+		return -1;
+	}
+	sb->segment = xcb_generate_id(b->conn);
+	cookie = xcb_shm_attach_checked(b->conn, sb->segment, sb->shm_id, 1);
+	err = xcb_request_check(b->conn, cookie);
+	if (err) {
+		weston_log("x11shm: xcb_shm_attach error %d, op code %d, resource id %d\n",
+			   err->error_code, err->major_code, err->minor_code);
+		free(err);
+		shmdt(sb->buf);
+		shmctl(sb->shm_id, IPC_RMID, NULL);
+		return -1;
+	}
+
+	shmctl(sb->shm_id, IPC_RMID, NULL);
+
+	/* Now create pixman image */
+	sb->image = pixman_image_create_bits(pixman_format, width, height, sb->buf,
+		width * (bitsperpixel / 8));
+
+#ifdef HAVE_XCB_PRESENT
+	if (b->has_present) {
+		sb->pixmap = xcb_generate_id(b->conn);
+		xcb_shm_create_pixmap(b->conn, sb->pixmap, output->window,
+				      width, height, output->depth,
+				      sb->segment, 0);
+	}
+#endif
+
+	/* The content is undefined until the whole buffer is drawn once */
+	pixman_region32_init(&sb->damage);
+	sb->reset = true;
+
+	return 0;
+}
+
 static int
 x11_output_init_shm(struct x11_backend *b, struct x11_output *output,
 	int width, int height)
@@ -699,11 +906,10 @@ x11_output_init_shm(struct x11_backend *b, struct x11_output *output,
 	xcb_visualtype_t *visual_type;
 	xcb_screen_t *screen;
 	xcb_format_iterator_t fmt;
-	xcb_void_cookie_t cookie;
-	xcb_generic_error_t *err;
 	const xcb_query_extension_reply_t *ext;
 	int bitsperpixel = 0;
 	pixman_format_code_t pixman_format;
+	int i;
 
 	/* Check if SHM is available */
 	ext = xcb_get_extension_data(b->conn, &xcb_shm_id);
@@ -759,36 +965,35 @@ x11_output_init_shm(struct x11_backend *b, struct x11_output *output,
 	}
 
 
-	/* Create SHM segment and attach it */
-	output->shm_id = shmget(IPC_PRIVATE, width * height * (bitsperpixel / 8), IPC_CREAT | S_IRWXU);
-	if (output->shm_id == -1) {
-		weston_log("x11shm: failed to allocate SHM segment\n");
-		return -1;
-	}
-	output->buf = shmat(output->shm_id, NULL, 0 /* read/write */);
-	if (-1 == (long)output->buf) {
-		weston_log("x11shm: failed to attach SHM segment\n");
-		return -1;
-	}
-	output->segment = xcb_generate_id(b->conn);
-	cookie = xcb_shm_attach_checked(b->conn, output->segment, output->shm_id, 1);
-	err = xcb_request_check(b->conn, cookie);
-	if (err) {
-		weston_log("x11shm: xcb_shm_attach error %d, op code %d, resource id %d\n",
-			   err->error_code, err->major_code, err->minor_code);
-		free(err);
-		return -1;
+	output->nshm = 1;
+#ifdef HAVE_XCB_PRESENT
+	if (b->has_present)
+		output->nshm = X11_SHM_BUFFERS;
+#endif
+	output->current_shm = 0;
+
+	for (i = 0; i < output->nshm; i++) {
+		if (x11_shm_buffer_init(b, output, &output->shm[i],
+					width, height, bitsperpixel,
+					pixman_format) < 0) {
+			while (i--)
+				x11_shm_buffer_release(b, &output->shm[i]);
+			output->nshm = 0;
+			return -1;
+		}
 	}
 
-	shmctl(output->shm_id, IPC_RMID, NULL);
-
-	/* Now create pixman image */
-	output->hw_surface = pixman_image_create_bits(pixman_format, width, height, output->buf,
-		width * (bitsperpixel / 8));
-
 	output->gc = xcb_generate_id(b->conn);
 	xcb_create_gc(b->conn, output->gc, output->window, 0, NULL);
 
+#ifdef HAVE_XCB_PRESENT
+	if (b->has_present) {
+		output->present_region = xcb_generate_id(b->conn);
+		xcb_xfixes_create_region(b->conn, output->present_region,
+					 0, NULL);
+	}
+#endif
+
 	return 0;
 }
 
@@ -1027,6 +1232,16 @@ x11_output_enable(struct weston_output *base)
 			goto err;
 		}
 
+#ifdef HAVE_XCB_PRESENT
+		if (b->has_present) {
+			output->present_eid = xcb_generate_id(b->conn);
+			xcb_present_select_input(b->conn, output->present_eid,
+						 output->window,
+						 XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY |
+						 XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+		}
+#endif
+
 		output->base.repaint = x11_output_repaint_shm;
 	} else {
 		/* eglCreatePlatformWindowSurfaceEXT takes a Window*
@@ -1428,6 +1643,129 @@ x11_backend_deliver_enter_event(struct x11_backend *b,
 	b->prev_y = y;
 }
 
+#ifdef HAVE_XCB_PRESENT
+static void
+x11_backend_setup_present(struct x11_backend *b)
+{
+	const xcb_query_extension_reply_t *ext;
+	xcb_present_query_version_reply_t *present;
+	xcb_xfixes_query_version_reply_t *xfixes;
+
+	b->has_present = 0;
+
+	ext = xcb_get_extension_data(b->conn, &xcb_present_id);
+	if (!ext || !ext->present) {
+		weston_log("Present extension not available, "
+			   "using ShmPutImage\n");
+		return;
+	}
+	b->present_opcode = ext->major_opcode;
+
+	ext = xcb_get_extension_data(b->conn, &xcb_xfixes_id);
+	if (!ext || !ext->present) {
+		weston_log("XFixes extension not available, "
+			   "using ShmPutImage\n");
+		return;
+	}
+
+	present = xcb_present_query_version_reply(b->conn,
+		xcb_present_query_version(b->conn,
+					  XCB_PRESENT_MAJOR_VERSION,
+					  XCB_PRESENT_MINOR_VERSION),
+		NULL);
+	xfixes = xcb_xfixes_query_version_reply(b->conn,
+		xcb_xfixes_query_version(b->conn,
+					 XCB_XFIXES_MAJOR_VERSION,
+					 XCB_XFIXES_MINOR_VERSION),
+		NULL);
+
+	/* Regions need XFixes 2 */
+	if (present && xfixes && xfixes->major_version >= 2) {
+		b->has_present = 1;
+		weston_log("Using Present extension %u.%u for the pixman "
+			   "renderer\n", present->major_version,
+			   present->minor_version);
+
+		/* CompleteNotify timestamps are CLOCK_MONOTONIC */
+		weston_compositor_set_presentation_clock(b->compositor,
+							 CLOCK_MONOTONIC);
+	}
+
+	free(present);
+	free(xfixes);
+}
+
+static void
+x11_output_present_complete(struct x11_output *output,
+			    xcb_present_complete_notify_event_t *complete)
+{
+	struct timespec ts;
+	uint32_t flags;
+
+	output->present_pending = false;
+	wl_event_source_timer_update(output->finish_frame_timer, 0);
+
+	if (complete->ust)
+		timespec_from_usec(&ts, complete->ust);
+	else
+		weston_compositor_read_presentation_clock(output->base.compositor,
+							  &ts);
+
+	switch (complete->mode) {
+	case XCB_PRESENT_COMPLETE_MODE_FLIP:
+		flags = WP_PRESENTATION_FEEDBACK_KIND_VSYNC |
+			WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK |
+			WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION |
+			WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+		break;
+	case XCB_PRESENT_COMPLETE_MODE_SKIP:
+		flags = 0;
+		break;
+	default:
+		flags = WP_PRESENTATION_FEEDBACK_KIND_VSYNC |
+			WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK |
+			WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION;
+		break;
+	}
+
+	output->base.msc = complete->msc;
+	weston_output_finish_frame(&output->base, &ts, flags);
+}
+
+static void
+x11_backend_deliver_present_event(struct x11_backend *b,
+				  xcb_generic_event_t *event)
+{
+	xcb_present_generic_event_t *ge =
+		(xcb_present_generic_event_t *) event;
+	xcb_present_complete_notify_event_t *complete;
+	xcb_present_idle_notify_event_t *idle;
+	struct x11_output *output;
+	int i;
+
+	switch (ge->evtype) {
+	case XCB_PRESENT_COMPLETE_NOTIFY:
+		complete = (xcb_present_complete_notify_event_t *) event;
+		output = x11_backend_find_output(b, complete->window);
+		if (!output || !output->present_pending ||
+		    complete->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP ||
+		    complete->serial != output->present_serial)
+			break;
+		x11_output_present_complete(output, complete);
+		break;
+	case XCB_PRESENT_IDLE_NOTIFY:
+		idle = (xcb_present_idle_notify_event_t *) event;
+		output = x11_backend_find_output(b, idle->window);
+		if (!output)
+			break;
+		for (i = 0; i < output->nshm; i++)
+			if (output->shm[i].pixmap == idle->pixmap)
+				output->shm[i].busy = false;
+		break;
+	}
+}
+#endif
+
 static int
 x11_backend_next_event(struct x11_backend *b,
 		       xcb_generic_event_t **event, uint32_t mask)
@@ -1671,6 +2009,13 @@ x11_backend_handle_event(int fd, uint32_t mask, void *data)
 		}
 #endif
 
+#ifdef HAVE_XCB_PRESENT
+		if (b->has_present && response_type == XCB_GE_GENERIC &&
+		    ((xcb_present_generic_event_t *) event)->extension ==
+		    b->present_opcode)
+			x11_backend_deliver_present_event(b, event);
+#endif
+
 		count++;
 		if (prev != event)
 			free (event);
@@ -1865,6 +2210,9 @@ x11_backend_create(struct weston_compositor *compositor,
 			weston_log("Failed to initialize pixman renderer for X11 backend\n");
 			goto err_xdisplay;
 		}
+#ifdef HAVE_XCB_PRESENT
+		x11_backend_setup_present(b);
+#endif
 	}
 	else if (init_gl_renderer(b) < 0) {
 		goto err_xdisplay;
@@ -1320,11 +1320,17 @@ weston_view_update_transform_enable(struct weston_view *view)
 	return 0;
 }
 
-static struct weston_layer *
-get_view_layer(struct weston_view *view)
+/** Get the layer a view is drawn in
+ *
+ * \param view The view
+ * \return The layer of the view, or of its top-most parent view for
+ * sub-surfaces, or NULL if the view is not in any layer.
+ */
+WL_EXPORT struct weston_layer *
+weston_view_get_layer(struct weston_view *view)
 {
 	if (view->parent_view)
-		return get_view_layer(view->parent_view);
+		return weston_view_get_layer(view->parent_view);
 	return view->layer_link.layer;
 }
 
@@ -1343,6 +1349,10 @@ weston_view_update_transform(struct weston_view *view)
 
 	view->transform.dirty = 0;
 
+	layer = weston_view_get_layer(view);
+	if (layer)
+		layer->content_serial++;
+
 	weston_view_damage_below(view);
 
 	pixman_region32_fini(&view->transform.boundingbox);
@@ -1361,7 +1371,6 @@ weston_view_update_transform(struct weston_view *view)
 			weston_view_update_transform_disable(view);
 	}
 
-	layer = get_view_layer(view);
 	if (layer) {
 		pixman_region32_init_with_extents(&mask, &layer->mask);
 		pixman_region32_intersect(&view->transform.boundingbox,
@@ -2124,7 +2133,14 @@ static void
 view_accumulate_damage(struct weston_view *view,
 		       pixman_region32_t *opaque)
 {
-	pixman_region32_t damage;
+	struct weston_layer *layer;
+	pixman_region32_t damage, visible;
+
+	if (pixman_region32_not_empty(&view->surface->damage)) {
+		layer = weston_view_get_layer(view);
+		if (layer)
+			layer->content_serial++;
+	}
 
 	pixman_region32_init(&damage);
 	if (view->transform.enabled) {
@@ -2144,6 +2160,19 @@ view_accumulate_damage(struct weston_view *view,
 	pixman_region32_union(&view->plane->damage,
 			      &view->plane->damage, &damage);
 	pixman_region32_fini(&damage);
+
+	view->occluded = false;
+	if (view->surface->compositor->hidden_frame_policy !=
+	    WESTON_HIDDEN_FRAME_POLICY_NORMAL) {
+		pixman_region32_init(&visible);
+		pixman_region32_subtract(&visible,
+					 &view->transform.boundingbox, opaque);
+		pixman_region32_subtract(&visible, &visible,
+					 &view->plane->clip);
+		view->occluded = !pixman_region32_not_empty(&visible);
+		pixman_region32_fini(&visible);
+	}
+
 	pixman_region32_copy(&view->clip, opaque);
 	pixman_region32_union(opaque, opaque, &view->transform.opaque);
 }
@@ -2354,6 +2383,54 @@ weston_output_take_feedback_list(struct weston_output *output,
 	wl_list_init(&surface->feedback_list);
 }
 
+static int
+output_frame_callback_timer_handler(void *data)
+{
+	struct weston_output *output = data;
+
+	weston_output_schedule_repaint(output);
+
+	return 0;
+}
+
+/* Whether the frame callbacks of the surface are to be sent in this
+ * repaint of the output.  If they are held back for a while, *wait_msec
+ * is lowered to when they are due. */
+static bool
+surface_frame_callbacks_due(struct weston_surface *surface,
+			    struct weston_output *output, int64_t *wait_msec)
+{
+	struct weston_compositor *ec = surface->compositor;
+	uint32_t interval = surface->frame_callback_interval;
+	int64_t remaining;
+
+	if (surface->occluded) {
+		switch (ec->hidden_frame_policy) {
+		case WESTON_HIDDEN_FRAME_POLICY_NORMAL:
+			break;
+		case WESTON_HIDDEN_FRAME_POLICY_HOLD:
+			return false;
+		case WESTON_HIDDEN_FRAME_POLICY_THROTTLE:
+			interval = MAX(interval, ec->hidden_frame_interval);
+			break;
+		}
+	}
+
+	if (interval == 0)
+		return true;
+
+	remaining = interval -
+		    timespec_sub_to_msec(&output->frame_time,
+					 &surface->frame_callback_time);
+	if (remaining <= 0)
+		return true;
+
+	if (*wait_msec < 0 || remaining < *wait_msec)
+		*wait_msec = remaining;
+
+	return false;
+}
+
 static int
 weston_output_repaint(struct weston_output *output, void *repaint_data)
 {
@@ -2362,7 +2439,9 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 	struct weston_animation *animation, *next;
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
+	struct wl_event_loop *loop;
 	pixman_region32_t output_damage;
+	int64_t frame_callback_wait_msec = -1;
 	int r;
 	uint32_t frame_time_msec;
 
@@ -2383,21 +2462,48 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 		}
 	}
 
+	compositor_accumulate_damage(ec);
+
+	/* A surface is hidden if none of its views are visible. */
+	wl_list_for_each(ev, &ec->view_list, link)
+		ev->surface->occluded = true;
+	wl_list_for_each(ev, &ec->view_list, link)
+		if (!ev->occluded)
+			ev->surface->occluded = false;
+
 	wl_list_init(&frame_callback_list);
 	wl_list_for_each(ev, &ec->view_list, link) {
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
-		if (ev->surface->output == output) {
-			wl_list_insert_list(&frame_callback_list,
-					    &ev->surface->frame_callback_list);
-			wl_list_init(&ev->surface->frame_callback_list);
+		if (ev->surface->output != output)
+			continue;
 
-			weston_output_take_feedback_list(output, ev->surface);
-		}
+		weston_output_take_feedback_list(output, ev->surface);
+
+		if (wl_list_empty(&ev->surface->frame_callback_list) ||
+		    !surface_frame_callbacks_due(ev->surface, output,
+						 &frame_callback_wait_msec))
+			continue;
+
+		wl_list_insert_list(&frame_callback_list,
+				    &ev->surface->frame_callback_list);
+		wl_list_init(&ev->surface->frame_callback_list);
+		ev->surface->frame_callback_time = output->frame_time;
 	}
 
-	compositor_accumulate_damage(ec);
+	if (frame_callback_wait_msec > 0) {
+		if (!output->frame_callback_timer) {
+			loop = wl_display_get_event_loop(ec->wl_display);
+			output->frame_callback_timer =
+				wl_event_loop_add_timer(loop,
+					output_frame_callback_timer_handler,
+					output);
+		}
+		if (output->frame_callback_timer)
+			wl_event_source_timer_update(output->frame_callback_timer,
+						     frame_callback_wait_msec);
+	}
 
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
@@ -2646,11 +2752,14 @@ weston_layer_entry_insert(struct weston_layer_entry *list,
 {
 	wl_list_insert(&list->link, &entry->link);
 	entry->layer = list->layer;
+	entry->layer->content_serial++;
 }
 
 WL_EXPORT void
 weston_layer_entry_remove(struct weston_layer_entry *entry)
 {
+	if (entry->layer)
+		entry->layer->content_serial++;
 	wl_list_remove(&entry->link);
 	wl_list_init(&entry->link);
 	entry->layer = NULL;
@@ -5848,6 +5957,9 @@ weston_output_release(struct weston_output *output)
 	if (output->idle_repaint_source)
 		wl_event_source_remove(output->idle_repaint_source);
 
+	if (output->frame_callback_timer)
+		wl_event_source_remove(output->frame_callback_timer);
+
 	if (output->enabled)
 		weston_compositor_remove_output(output);
 
@@ -6309,6 +6421,9 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	ec->wl_display = display;
 	ec->user_data = user_data;
+	if (weston_debug_compositor_create(ec) < 0)
+		goto fail;
+
 	wl_signal_init(&ec->destroy_signal);
 	wl_signal_init(&ec->create_surface_signal);
 	wl_signal_init(&ec->activate_signal);
@@ -6395,6 +6510,8 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	return ec;
 
 fail:
+	if (ec->weston_debug)
+		weston_debug_compositor_destroy(ec);
 	free(ec);
 	return NULL;
 }
@@ -6494,6 +6611,33 @@ weston_compositor_set_presentation_clock_software(
 	return -1;
 }
 
+/** Choose how frame callbacks are sent to hidden surfaces
+ *
+ * \param compositor The compositor instance.
+ * \param policy The policy for surfaces without any visible view.
+ * \param interval_msec Minimum time between frame callbacks with
+ * WESTON_HIDDEN_FRAME_POLICY_THROTTLE, ignored otherwise.
+ *
+ * A surface is hidden when each of its views is covered by opaque views
+ * above it, which includes views in a WESTON_LAYER_POSITION_HIDDEN layer
+ * below the background. Throttling frame callbacks for such surfaces
+ * keeps clients from rendering at full rate when nothing of what they
+ * draw can be seen. The default is WESTON_HIDDEN_FRAME_POLICY_NORMAL.
+ *
+ * \memberof weston_compositor
+ */
+WL_EXPORT void
+weston_compositor_set_hidden_frame_policy(struct weston_compositor *compositor,
+					  enum weston_hidden_frame_policy policy,
+					  uint32_t interval_msec)
+{
+	compositor->hidden_frame_policy = policy;
+	compositor->hidden_frame_interval = interval_msec;
+
+	/* Release any frame callbacks held under the previous policy */
+	weston_compositor_schedule_repaint(compositor);
+}
+
 /** Read the current time from the Presentation clock
  *
  * \param compositor
@@ -6643,6 +6787,8 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	if (compositor->heads_changed_source)
 		wl_event_source_remove(compositor->heads_changed_source);
 
+	weston_debug_compositor_destroy(compositor);
+
 	free(compositor);
 }
 
@@ -125,6 +125,15 @@ struct weston_spring {
 	uint32_t clip;
 };
 
+/* Number of past frames whose damage is remembered for buffer reuse.
+ * A buffer older than this is redrawn entirely. */
+#define WESTON_DAMAGE_HISTORY 4
+
+struct weston_damage_history {
+	pixman_region32_t damage[WESTON_DAMAGE_HISTORY];
+	int index;
+};
+
 struct weston_output_zoom {
 	bool active;
 	float increment;
@@ -221,6 +230,11 @@ struct weston_output {
 	/** For cancelling the idle_repaint callback on output destruction. */
 	struct wl_event_source *idle_repaint_source;
 
+	/** Repaints the output when held back frame callbacks are due,
+	 *  see weston_compositor_set_hidden_frame_policy() and
+	 *  weston_surface::frame_callback_interval. */
+	struct wl_event_source *frame_callback_timer;
+
 	struct weston_output_zoom zoom;
 	int dirty;
 	struct wl_signal frame_signal;
@@ -763,12 +777,33 @@ enum weston_layer_position {
 	WESTON_LAYER_POSITION_FADE       = 0xffffffff,
 };
 
+/**
+ * How frame callbacks are sent to surfaces none of whose views are
+ * visible, e.g. because they are covered by opaque views or are in a
+ * WESTON_LAYER_POSITION_HIDDEN layer.
+ */
+enum weston_hidden_frame_policy {
+	/* Same as visible surfaces, on every repaint of their output. */
+	WESTON_HIDDEN_FRAME_POLICY_NORMAL = 0,
+
+	/* At most once per interval. */
+	WESTON_HIDDEN_FRAME_POLICY_THROTTLE,
+
+	/* Not until the surface becomes visible again. */
+	WESTON_HIDDEN_FRAME_POLICY_HOLD,
+};
+
 struct weston_layer {
 	struct weston_compositor *compositor;
 	struct wl_list link; /* weston_compositor::layer_list */
 	enum weston_layer_position position;
 	pixman_box32_t mask;
 	struct weston_layer_entry view_list;
+
+	/* Bumped whenever a view in the layer is added, removed, moved
+	 * or damaged, so renderers can tell when a cached rendering of
+	 * the layer is stale. */
+	uint32_t content_serial;
 };
 
 struct weston_plane {
@@ -926,10 +961,13 @@ struct weston_backend {
 struct weston_desktop_xwayland;
 struct weston_desktop_xwayland_interface;
 
+struct weston_debug_compositor;
+
 struct weston_compositor {
 	struct wl_signal destroy_signal;
 
 	struct wl_display *wl_display;
+	struct weston_debug_compositor *weston_debug;
 	struct weston_desktop_xwayland *xwayland;
 	const struct weston_desktop_xwayland_interface *xwayland_interface;
 
@@ -1013,6 +1051,11 @@ struct weston_compositor {
 	clockid_t presentation_clock;
 	int32_t repaint_msec;
 
+	/* Upper bound in bytes for copies of client buffers that renderers
+	 * keep in their own memory, e.g. GL textures of wl_shm buffers.
+	 * 0 means no limit. */
+	uint64_t texture_budget;
+
 	unsigned int activate_serial;
 
 	struct wl_global *pointer_constraints;
@@ -1030,6 +1073,10 @@ struct weston_compositor {
 	 */
 	struct wl_signal heads_changed_signal;
 	struct wl_event_source *heads_changed_source;
+
+	/* Frame callbacks of surfaces with no visible view */
+	enum weston_hidden_frame_policy hidden_frame_policy;
+	uint32_t hidden_frame_interval; /* msec */
 };
 
 struct weston_buffer {
@@ -1195,6 +1242,10 @@ struct weston_view {
 	uint32_t psf_flags;
 
 	bool is_mapped;
+
+	/* Completely covered by opaque views above, as of the last
+	 * damage accumulation. */
+	bool occluded;
 };
 
 struct weston_surface_state {
@@ -1300,6 +1351,15 @@ struct weston_surface {
 	struct wl_list frame_callback_list;
 	struct wl_list feedback_list;
 
+	/* No view of the surface was visible in the last repaint */
+	bool occluded;
+	/* Output frame time of the last frame callbacks sent */
+	struct timespec frame_callback_time;
+	/* Minimum time in msec between frame callbacks even while the
+	 * surface is visible, e.g. for shells showing it as a thumbnail;
+	 * 0 for none. */
+	uint32_t frame_callback_interval;
+
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
 	int32_t width_from_buffer; /* before applying viewport */
@@ -1515,6 +1575,9 @@ weston_layer_set_mask(struct weston_layer *layer, int x, int y, int width, int h
 void
 weston_layer_set_mask_infinite(struct weston_layer *layer);
 
+struct weston_layer *
+weston_view_get_layer(struct weston_view *view);
+
 void
 weston_plane_init(struct weston_plane *plane,
 			struct weston_compositor *ec,
@@ -1789,6 +1852,10 @@ int
 weston_compositor_set_presentation_clock_software(
 					struct weston_compositor *compositor);
 void
+weston_compositor_set_hidden_frame_policy(struct weston_compositor *compositor,
+					  enum weston_hidden_frame_policy policy,
+					  uint32_t interval_msec);
+void
 weston_compositor_read_presentation_clock(
 			const struct weston_compositor *compositor,
 			struct timespec *ts);
@@ -1844,6 +1911,9 @@ void
 weston_seat_repick(struct weston_seat *seat);
 void
 weston_seat_update_keymap(struct weston_seat *seat, struct xkb_keymap *keymap);
+void
+weston_compositor_set_kb_repeat_info(struct weston_compositor *ec,
+				     int32_t rate, int32_t delay);
 
 void
 weston_seat_release(struct weston_seat *seat);
@@ -1870,6 +1940,20 @@ int
 weston_log_continue(const char *fmt, ...)
 	__attribute__ ((format (printf, 1, 2)));
 
+void
+weston_log_write(int fd, const char *data, size_t len);
+void
+weston_log_write_close(int fd);
+int
+weston_log_writer_start(void);
+void
+weston_log_writer_stop(void);
+
+int
+weston_debug_compositor_create(struct weston_compositor *compositor);
+void
+weston_debug_compositor_destroy(struct weston_compositor *compositor);
+
 enum {
 	TTY_ENTER_VT,
 	TTY_LEAVE_VT
@@ -1898,8 +1982,29 @@ typedef void (*weston_screenshooter_done_func_t)(void *data,
 int
 weston_screenshooter_shoot(struct weston_output *output, struct weston_buffer *buffer,
 			   weston_screenshooter_done_func_t done, void *data);
+
+enum weston_recorder_compression {
+	WESTON_RECORDER_COMPRESSION_NONE = 0,
+	WESTON_RECORDER_COMPRESSION_LZ4,
+	WESTON_RECORDER_COMPRESSION_ZSTD,
+};
+
+struct weston_recorder_options {
+	/** Write a seekable WCAP v2 file with a keyframe every
+	 * keyframe_interval frames and a trailing frame index.
+	 * 0 writes a plain v1 delta stream. */
+	uint32_t keyframe_interval;
+	/** Compress each frame on a worker thread, implies WCAP v2.
+	 * Falls back to no compression if not supported by the build. */
+	enum weston_recorder_compression compression;
+};
+
 struct weston_recorder *
 weston_recorder_start(struct weston_output *output, const char *filename);
+struct weston_recorder *
+weston_recorder_start_with_options(struct weston_output *output,
+				   const char *filename,
+				   const struct weston_recorder_options *options);
 void
 weston_recorder_stop(struct weston_recorder *recorder);
 
@@ -1993,6 +2098,20 @@ weston_transformed_region(int width, int height,
 			  int32_t scale,
 			  pixman_region32_t *src, pixman_region32_t *dest);
 
+void
+weston_damage_history_init(struct weston_damage_history *history);
+void
+weston_damage_history_release(struct weston_damage_history *history);
+bool
+weston_damage_history_get(struct weston_damage_history *history, int age,
+			  pixman_region32_t *damage,
+			  pixman_region32_t *buffer_damage);
+void
+weston_damage_history_push(struct weston_damage_history *history,
+			   pixman_region32_t *damage);
+int
+weston_damage_history_age(int age);
+
 void *
 weston_load_module(const char *name, const char *entrypoint);
 
@@ -0,0 +1,105 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "compositor.h"
+
+/* Damage bookkeeping for outputs that cycle through a set of buffers and
+ * only want to redraw what a buffer missed since it was last used.  Each
+ * buffer carries an age: the number of frames since it was last
+ * attached, or 0 if its content is undefined. */
+
+WL_EXPORT void
+weston_damage_history_init(struct weston_damage_history *history)
+{
+	int i;
+
+	for (i = 0; i < WESTON_DAMAGE_HISTORY; i++)
+		pixman_region32_init(&history->damage[i]);
+	history->index = 0;
+}
+
+WL_EXPORT void
+weston_damage_history_release(struct weston_damage_history *history)
+{
+	int i;
+
+	for (i = 0; i < WESTON_DAMAGE_HISTORY; i++)
+		pixman_region32_fini(&history->damage[i]);
+}
+
+/** Compute what a buffer of the given age needs to have redrawn
+ *
+ * \param history The damage history.
+ * \param age Age of the buffer.
+ * \param damage Damage of the frame being drawn.
+ * \param buffer_damage Set to \p damage plus the damage of the frames the
+ * buffer missed.
+ * \return false if the buffer content is undefined or older than the
+ * history, in which case it needs a full redraw and \p buffer_damage is
+ * left alone.
+ */
+WL_EXPORT bool
+weston_damage_history_get(struct weston_damage_history *history, int age,
+			  pixman_region32_t *damage,
+			  pixman_region32_t *buffer_damage)
+{
+	int i;
+
+	if (age == 0 || age - 1 > WESTON_DAMAGE_HISTORY)
+		return false;
+
+	pixman_region32_copy(buffer_damage, damage);
+	for (i = 0; i < age - 1; i++)
+		pixman_region32_union(buffer_damage, buffer_damage,
+				      &history->damage[(history->index + i) %
+						       WESTON_DAMAGE_HISTORY]);
+
+	return true;
+}
+
+/** Remember the damage of a frame that has just been committed
+ *
+ * The buffer it was drawn into now has age 1, every other buffer should
+ * be aged with weston_damage_history_age().
+ */
+WL_EXPORT void
+weston_damage_history_push(struct weston_damage_history *history,
+			   pixman_region32_t *damage)
+{
+	history->index += WESTON_DAMAGE_HISTORY - 1;
+	history->index %= WESTON_DAMAGE_HISTORY;
+
+	pixman_region32_copy(&history->damage[history->index], damage);
+}
+
+/** Age of a buffer that was not used by the frame just pushed */
+WL_EXPORT int
+weston_damage_history_age(int age)
+{
+	if (age > 0 && age <= WESTON_DAMAGE_HISTORY + 1)
+		age++;
+
+	return age;
+}
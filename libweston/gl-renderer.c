@@ -32,10 +32,12 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <float.h>
+#include <math.h>
 #include <assert.h>
 #include <linux/input.h>
 #include <drm_fourcc.h>
@@ -78,6 +80,22 @@ struct gl_shader {
 
 #define BUFFER_DAMAGE_COUNT 2
 
+/* Surfaces not drawn for this many repaints may lose their textures
+ * when over the texture budget. */
+#define TEXTURE_EVICT_IDLE_REPAINTS 60
+
+/* Views drawn at less than this many output pixels per buffer texel are
+ * sampled from mipmaps. */
+#define MIPMAP_SCALE_THRESHOLD 0.5f
+
+/* A layer whose contents did not change for this many repaints is
+ * rendered into an offscreen texture and then composited as one quad. */
+#define LAYER_CACHE_STABLE_FRAMES 10
+/* Layers with fewer views than this gain nothing from being cached. */
+#define LAYER_CACHE_MIN_VIEWS 2
+/* Upper bound of offscreen layer textures per output. */
+#define LAYER_CACHE_MAX_TEXTURES 4
+
 enum gl_border_status {
 	BORDER_STATUS_CLEAN = 0,
 	BORDER_TOP_DIRTY = 1 << GL_RENDERER_BORDER_TOP,
@@ -107,6 +125,38 @@ struct gl_output_state {
 
 	/* struct timeline_render_point::link */
 	struct wl_list timeline_render_point_list;
+
+	/* struct gl_layer_cache::link */
+	struct wl_list layer_cache_list;
+	int layer_cache_textures;
+};
+
+struct gl_layer_cache {
+	struct wl_list link;
+	struct weston_layer *layer;
+
+	/* What the layer looked like when last checked */
+	uint32_t content_serial;
+	uint32_t signature;
+	struct weston_matrix output_matrix;
+	int stable_frames;
+
+	/* The layer's views in this repaint; valid only if contiguous */
+	uint32_t view_signature;
+	struct weston_view *top_view;
+	struct weston_view *bottom_view;
+	int view_count;
+	bool seen;
+	bool contiguous;
+	bool all_primary;
+
+	GLuint fbo;
+	GLuint tex;
+	int32_t width, height;
+	bool failed;
+
+	/* tex holds the current contents of the layer */
+	bool valid;
 };
 
 enum buffer_type {
@@ -188,6 +238,19 @@ struct gl_surface_state {
 
 	struct weston_surface *surface;
 
+	/* Texture memory accounting for SHM surfaces. While evicted, the
+	 * textures have no storage and are uploaded again from buffer_ref
+	 * when the surface is drawn. */
+	struct wl_list lru_link; /* gl_renderer::texture_lru */
+	uint64_t texture_size; /* of the base level */
+	uint32_t last_drawn;
+	bool evicted;
+
+	/* SHM textures get mipmaps once drawn heavily minified; they are
+	 * regenerated lazily after uploads. */
+	bool mipmapped;
+	bool mipmaps_dirty;
+
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
@@ -238,6 +301,8 @@ struct gl_renderer {
 
 	int has_gl_texture_rg;
 
+	int has_npot_mipmap;
+
 	struct gl_shader texture_shader_rgba;
 	struct gl_shader texture_shader_rgbx;
 	struct gl_shader texture_shader_egl_external;
@@ -260,6 +325,15 @@ struct gl_renderer {
 	PFNEGLCREATESYNCKHRPROC create_sync;
 	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
 	PFNEGLDUPNATIVEFENCEFDANDROIDPROC dup_native_fence_fd;
+
+	/* SHM texture memory, see weston_compositor::texture_budget */
+	uint64_t texture_budget;
+	uint64_t texture_size; /* resident */
+	struct wl_list texture_lru; /* most recently drawn first */
+	uint32_t repaint_counter;
+	uint64_t texture_evictions;
+	uint64_t texture_restores;
+	struct weston_binding *texture_stats_binding;
 };
 
 enum timeline_render_point_type {
@@ -889,9 +963,195 @@ shader_uniforms(struct gl_shader *shader,
 		glUniform1i(shader->tex_uniforms[i], i);
 }
 
+static void
+gl_renderer_flush_damage(struct weston_surface *surface);
+
+static void
+ensure_textures(struct gl_surface_state *gs, int num_textures);
+
+static uint64_t
+surface_state_resident_size(struct gl_surface_state *gs)
+{
+	if (gs->evicted)
+		return 0;
+
+	/* A full mipmap chain adds a third */
+	if (gs->mipmapped)
+		return gs->texture_size + gs->texture_size / 3;
+
+	return gs->texture_size;
+}
+
+/* Account for a change in the textures of an SHM surface, keeping it on
+ * the LRU list while they have storage. */
+static void
+surface_state_account_textures(struct gl_surface_state *gs, uint64_t old)
+{
+	struct gl_renderer *gr = get_renderer(gs->surface->compositor);
+	uint64_t size = surface_state_resident_size(gs);
+
+	gr->texture_size = gr->texture_size - old + size;
+
+	if (size != 0 && old == 0) {
+		wl_list_insert(&gr->texture_lru, &gs->lru_link);
+		gs->last_drawn = gr->repaint_counter;
+	} else if (size == 0 && old != 0) {
+		wl_list_remove(&gs->lru_link);
+		wl_list_init(&gs->lru_link);
+	}
+}
+
+static void
+surface_state_set_texture_size(struct gl_surface_state *gs,
+			       uint64_t size, bool evicted)
+{
+	uint64_t old = surface_state_resident_size(gs);
+
+	gs->texture_size = size;
+	gs->evicted = evicted;
+	surface_state_account_textures(gs, old);
+}
+
+/* Replace the textures with fresh ones without storage, which also gets
+ * rid of any mipmap levels. */
+static void
+surface_state_reset_textures(struct gl_surface_state *gs)
+{
+	uint64_t old = surface_state_resident_size(gs);
+	int num_textures = gs->num_textures;
+
+	glDeleteTextures(gs->num_textures, gs->textures);
+	gs->num_textures = 0;
+	ensure_textures(gs, num_textures);
+
+	gs->mipmapped = false;
+	gs->mipmaps_dirty = true;
+	gs->needs_full_upload = true;
+	surface_state_account_textures(gs, old);
+}
+
+static void
+surface_state_evict_textures(struct gl_surface_state *gs)
+{
+	struct gl_renderer *gr = get_renderer(gs->surface->compositor);
+
+	surface_state_reset_textures(gs);
+	surface_state_set_texture_size(gs, gs->texture_size, true);
+	gr->texture_evictions++;
+}
+
+/* Output pixels per buffer texel along the more minified axis */
+static float
+view_texel_scale(struct weston_view *ev, struct weston_output *output)
+{
+	struct weston_surface *es = ev->surface;
+	struct weston_matrix m;
+	float sx, sy, buffer_scale;
+
+	if (es->width == 0 || es->height == 0 ||
+	    es->width_from_buffer == 0 || es->height_from_buffer == 0)
+		return 1.0f;
+
+	if (ev->transform.enabled)
+		m = ev->transform.matrix;
+	else
+		weston_matrix_init(&m);
+	weston_matrix_multiply(&m, &output->matrix);
+
+	buffer_scale = es->buffer_viewport.buffer.scale;
+	sx = hypotf(m.d[0], m.d[1]) * es->width /
+	     (es->width_from_buffer * buffer_scale);
+	sy = hypotf(m.d[4], m.d[5]) * es->height /
+	     (es->height_from_buffer * buffer_scale);
+
+	return MIN(sx, sy);
+}
+
+/* Whether to sample the view from mipmaps, generating them first if the
+ * texture has changed since. */
+static bool
+surface_state_prepare_mipmaps(struct gl_surface_state *gs,
+			      struct weston_view *ev,
+			      struct weston_output *output)
+{
+	struct gl_renderer *gr = get_renderer(ev->surface->compositor);
+	uint64_t old;
+	int i;
+
+	if (!gr->has_npot_mipmap || gs->buffer_type != BUFFER_TYPE_SHM ||
+	    gs->target != GL_TEXTURE_2D)
+		return false;
+
+	if (view_texel_scale(ev, output) >= MIPMAP_SCALE_THRESHOLD)
+		return false;
+
+	if (gs->mipmaps_dirty || !gs->mipmapped) {
+		for (i = 0; i < gs->num_textures; i++) {
+			glBindTexture(GL_TEXTURE_2D, gs->textures[i]);
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+
+		old = surface_state_resident_size(gs);
+		gs->mipmapped = true;
+		gs->mipmaps_dirty = false;
+		surface_state_account_textures(gs, old);
+	}
+
+	return true;
+}
+
+static bool
+surface_state_restore_textures(struct gl_surface_state *gs)
+{
+	struct gl_renderer *gr = get_renderer(gs->surface->compositor);
+
+	if (!gs->buffer_ref.buffer)
+		return false;
+
+	surface_state_set_texture_size(gs, gs->texture_size, false);
+	gl_renderer_flush_damage(gs->surface);
+	gr->texture_restores++;
+
+	return true;
+}
+
+static void
+surface_state_touch(struct gl_surface_state *gs)
+{
+	struct gl_renderer *gr = get_renderer(gs->surface->compositor);
+
+	if (!wl_list_empty(&gs->lru_link)) {
+		wl_list_remove(&gs->lru_link);
+		wl_list_insert(&gr->texture_lru, &gs->lru_link);
+	}
+	gs->last_drawn = gr->repaint_counter;
+}
+
+/* Release the textures of the surfaces drawn least recently until the
+ * resident texture memory fits the budget again. */
+static void
+enforce_texture_budget(struct gl_renderer *gr)
+{
+	struct gl_surface_state *gs, *tmp;
+
+	if (gr->texture_budget == 0)
+		return;
+
+	wl_list_for_each_reverse_safe(gs, tmp, &gr->texture_lru, lru_link) {
+		if (gr->texture_size <= gr->texture_budget)
+			break;
+		if (gr->repaint_counter - gs->last_drawn <
+		    TEXTURE_EVICT_IDLE_REPAINTS)
+			break;
+		if (gs->buffer_ref.buffer)
+			surface_state_evict_textures(gs);
+	}
+}
+
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
-	  pixman_region32_t *damage) /* in global coordinates */
+	  pixman_region32_t *damage, /* in global coordinates */
+	  pixman_region32_t *clip)
 {
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
@@ -902,7 +1162,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	pixman_region32_t surface_opaque;
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
-	GLint filter;
+	GLint filter, min_filter;
 	int i;
 
 	/* In case of a runtime switch of renderers, we may not have received
@@ -914,11 +1174,15 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
 				  &ev->transform.boundingbox, damage);
-	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
+	pixman_region32_subtract(&repaint, &repaint, clip);
 
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
+	if (gs->evicted && !surface_state_restore_textures(gs))
+		goto out;
+	surface_state_touch(gs);
+
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
 	if (gr->fan_debug) {
@@ -935,10 +1199,15 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	else
 		filter = GL_NEAREST;
 
+	min_filter = filter;
+	if (filter == GL_LINEAR &&
+	    surface_state_prepare_mipmaps(gs, ev, output))
+		min_filter = GL_LINEAR_MIPMAP_LINEAR;
+
 	for (i = 0; i < gs->num_textures; i++) {
 		glActiveTexture(GL_TEXTURE0 + i);
 		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, min_filter);
 		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
 	}
 
@@ -992,15 +1261,315 @@ out:
 	pixman_region32_fini(&repaint);
 }
 
+static struct gl_layer_cache *
+get_layer_cache(struct gl_output_state *go, struct weston_layer *layer)
+{
+	struct gl_layer_cache *cache;
+
+	wl_list_for_each(cache, &go->layer_cache_list, link)
+		if (cache->layer == layer)
+			return cache;
+
+	return NULL;
+}
+
+static void
+layer_cache_release(struct gl_output_state *go, struct gl_layer_cache *cache)
+{
+	if (cache->tex) {
+		glDeleteFramebuffers(1, &cache->fbo);
+		glDeleteTextures(1, &cache->tex);
+		go->layer_cache_textures--;
+	}
+
+	cache->fbo = 0;
+	cache->tex = 0;
+	cache->valid = false;
+}
+
+static void
+layer_cache_destroy(struct gl_output_state *go, struct gl_layer_cache *cache)
+{
+	layer_cache_release(go, cache);
+	wl_list_remove(&cache->link);
+	free(cache);
+}
+
+static uint32_t
+layer_cache_hash(uint32_t hash, uint32_t value)
+{
+	/* FNV-1a, one word at a time */
+	return (hash ^ value) * 16777619u;
+}
+
+/* Render all views of the layer, bottom to top, into the cache texture.
+ * Only the views of the layer itself can occlude each other here, so
+ * the clip from the layers above is not applied. */
+static bool
+layer_cache_render(struct weston_output *output, struct gl_layer_cache *cache)
+{
+	struct gl_output_state *go = get_output_state(output);
+	int32_t width = output->current_mode->width;
+	int32_t height = output->current_mode->height;
+	struct weston_view *view;
+	pixman_region32_t clip;
+	GLenum status;
+
+	if (cache->tex && (cache->width != width || cache->height != height))
+		layer_cache_release(go, cache);
+
+	if (!cache->tex) {
+		if (go->layer_cache_textures >= LAYER_CACHE_MAX_TEXTURES)
+			return false;
+
+		glGenTextures(1, &cache->tex);
+		glBindTexture(GL_TEXTURE_2D, cache->tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+		glGenFramebuffers(1, &cache->fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, cache->fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				       GL_TEXTURE_2D, cache->tex, 0);
+		go->layer_cache_textures++;
+
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE) {
+			weston_log("layer cache framebuffer incomplete: "
+				   "0x%04x\n", status);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			layer_cache_release(go, cache);
+			cache->failed = true;
+			return false;
+		}
+
+		cache->width = width;
+		cache->height = height;
+	} else {
+		glBindFramebuffer(GL_FRAMEBUFFER, cache->fbo);
+	}
+
+	glViewport(0, 0, width, height);
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	pixman_region32_init(&clip);
+	view = cache->bottom_view;
+	while (true) {
+		draw_view(view, output, &output->region, &clip);
+		if (view == cache->top_view)
+			break;
+		view = container_of(view->link.prev, struct weston_view, link);
+	}
+	pixman_region32_fini(&clip);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return true;
+}
+
+/* Decide, for each layer on the output, whether it can be drawn from its
+ * cached texture in this repaint, and refresh the textures of layers that
+ * have just become static. A layer is invalidated by anything that bumps
+ * its content serial, by a change in its views or their alpha, or by a
+ * change of the output transformation. */
+static void
+update_layer_caches(struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct weston_compositor *compositor = output->compositor;
+	struct gl_renderer *gr = get_renderer(compositor);
+	struct gl_layer_cache *cache, *tmp;
+	struct weston_layer *layer;
+	struct weston_view *view;
+	union { float f; uint32_t u; } alpha;
+	bool changed, cacheable;
+
+	wl_list_for_each(cache, &go->layer_cache_list, link) {
+		cache->seen = false;
+		cache->contiguous = true;
+		cache->all_primary = true;
+		cache->view_count = 0;
+		cache->view_signature = 2166136261u;
+	}
+
+	cache = NULL;
+	wl_list_for_each(view, &compositor->view_list, link) {
+		layer = weston_view_get_layer(view);
+		if (!layer)
+			continue;
+
+		if (!cache || cache->layer != layer) {
+			cache = get_layer_cache(go, layer);
+			if (cache && cache->seen) {
+				cache->contiguous = false;
+			} else if (!cache) {
+				cache = zalloc(sizeof *cache);
+				if (!cache)
+					continue;
+				cache->layer = layer;
+				cache->content_serial = layer->content_serial;
+				cache->contiguous = true;
+				cache->all_primary = true;
+				cache->view_signature = 2166136261u;
+				wl_list_insert(&go->layer_cache_list,
+					       &cache->link);
+			}
+
+			if (!cache->seen)
+				cache->top_view = view;
+			cache->seen = true;
+		}
+
+		alpha.f = view->alpha;
+		cache->view_signature = layer_cache_hash(cache->view_signature,
+							 (uintptr_t) view);
+		cache->view_signature = layer_cache_hash(cache->view_signature,
+							 alpha.u);
+		cache->bottom_view = view;
+		cache->view_count++;
+		if (view->plane != &compositor->primary_plane)
+			cache->all_primary = false;
+	}
+
+	wl_list_for_each_safe(cache, tmp, &go->layer_cache_list, link) {
+		if (!cache->seen) {
+			layer_cache_destroy(go, cache);
+			continue;
+		}
+
+		changed = cache->content_serial != cache->layer->content_serial ||
+			  cache->signature != cache->view_signature ||
+			  memcmp(cache->output_matrix.d, go->output_matrix.d,
+				 sizeof go->output_matrix.d) != 0;
+
+		cacheable = cache->contiguous && cache->all_primary &&
+			    cache->view_count >= LAYER_CACHE_MIN_VIEWS &&
+			    !output->zoom.active && !gr->fan_debug &&
+			    !cache->failed;
+
+		if (changed) {
+			cache->content_serial = cache->layer->content_serial;
+			cache->signature = cache->view_signature;
+			cache->output_matrix = go->output_matrix;
+			cache->stable_frames = 0;
+			cache->valid = false;
+		} else if (cache->stable_frames < LAYER_CACHE_STABLE_FRAMES) {
+			cache->stable_frames++;
+		}
+
+		if (!cacheable) {
+			cache->valid = false;
+			continue;
+		}
+
+		if (!cache->valid &&
+		    cache->stable_frames >= LAYER_CACHE_STABLE_FRAMES)
+			cache->valid = layer_cache_render(output, cache);
+	}
+}
+
+/* Composite a cached layer, clipped by the opaque views above it. */
+static void
+draw_layer_cache(struct weston_output *output, struct gl_layer_cache *cache,
+		 pixman_region32_t *damage)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_shader *shader = &gr->texture_shader_rgba;
+	pixman_region32_t repaint;
+	pixman_box32_t *rects;
+	struct weston_vector corner;
+	GLfloat *v, *p;
+	int i, j, nrects;
+
+	pixman_region32_init(&repaint);
+	pixman_region32_intersect(&repaint, &output->region, damage);
+	pixman_region32_subtract(&repaint, &repaint, &cache->top_view->clip);
+
+	rects = pixman_region32_rectangles(&repaint, &nrects);
+	if (nrects == 0)
+		goto out;
+
+	v = wl_array_add(&gr->vertices, nrects * 4 * 4 * sizeof *v);
+	if (!v)
+		goto out;
+
+	for (i = 0, p = v; i < nrects; i++) {
+		for (j = 0; j < 4; j++) {
+			corner.f[0] = (j == 0 || j == 3) ?
+				      rects[i].x1 : rects[i].x2;
+			corner.f[1] = j < 2 ? rects[i].y1 : rects[i].y2;
+			corner.f[2] = 0.0f;
+			corner.f[3] = 1.0f;
+
+			/* position: */
+			*(p++) = corner.f[0];
+			*(p++) = corner.f[1];
+
+			/* texcoord: the texture was rendered with the same
+			 * matrix, so normalized device coordinates map
+			 * straight onto it. */
+			weston_matrix_transform(&go->output_matrix, &corner);
+			*(p++) = (corner.f[0] / corner.f[3] + 1.0f) * 0.5f;
+			*(p++) = (corner.f[1] / corner.f[3] + 1.0f) * 0.5f;
+		}
+	}
+
+	use_shader(gr, shader);
+	glUniformMatrix4fv(shader->proj_uniform,
+			   1, GL_FALSE, go->output_matrix.d);
+	glUniform1f(shader->alpha_uniform, 1.0);
+	glUniform1i(shader->tex_uniforms[0], 0);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, cache->tex);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
+	glEnableVertexAttribArray(1);
+
+	for (i = 0; i < nrects; i++)
+		glDrawArrays(GL_TRIANGLE_FAN, i * 4, 4);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+	gr->vertices.size = 0;
+
+out:
+	pixman_region32_fini(&repaint);
+}
+
 static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_layer_cache *cache;
 	struct weston_view *view;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	wl_list_for_each_reverse(view, &compositor->view_list, link) {
+		if (view->plane != &compositor->primary_plane)
+			continue;
+
+		cache = get_layer_cache(go, weston_view_get_layer(view));
+		if (cache && cache->valid) {
+			if (view == cache->bottom_view)
+				draw_layer_cache(output, cache, damage);
+			continue;
+		}
+
+		draw_view(view, output, damage, &view->clip);
+	}
 }
 
 static void
@@ -1258,13 +1827,9 @@ gl_renderer_repaint_output(struct weston_output *output,
 	if (use_output(output) < 0)
 		return;
 
-	begin_render_sync = timeline_create_render_sync(gr);
+	gr->repaint_counter++;
 
-	/* Calculate the viewport */
-	glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
-		   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
-		   output->current_mode->width,
-		   output->current_mode->height);
+	begin_render_sync = timeline_create_render_sync(gr);
 
 	/* Calculate the global GL matrix */
 	go->output_matrix = output->matrix;
@@ -1275,6 +1840,15 @@ gl_renderer_repaint_output(struct weston_output *output,
 			    2.0 / output->current_mode->width,
 			    -2.0 / output->current_mode->height, 1);
 
+	/* May render offscreen, so do this before setting the viewport */
+	update_layer_caches(output);
+
+	/* Calculate the viewport */
+	glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
+		   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
+		   output->current_mode->width,
+		   output->current_mode->height);
+
 	/* if debugging, redraw everything outside the damage to clean up
 	 * debug lines from the previous draw on this buffer:
 	 */
@@ -1363,6 +1937,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 				    TIMELINE_RENDER_POINT_TYPE_BEGIN);
 	timeline_submit_render_sync(gr, compositor, output, end_render_sync,
 				    TIMELINE_RENDER_POINT_TYPE_END);
+
+	enforce_texture_budget(gr);
 }
 
 static int
@@ -1428,6 +2004,10 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	if (!buffer)
 		return;
 
+	/* Evicted textures are uploaded in full once drawn again. */
+	if (gs->evicted)
+		return;
+
 	/* Avoid upload, if the texture won't be used this time.
 	 * We still accumulate the damage in texture_damage, and
 	 * hold the reference to the buffer, in case the surface
@@ -1448,6 +2028,7 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		goto done;
 
 	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	gs->mipmaps_dirty = true;
 
 	if (!gr->has_unpack_subimage) {
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
@@ -1520,7 +2101,10 @@ done:
 	pixman_region32_init(&gs->texture_damage);
 	gs->needs_full_upload = false;
 
-	weston_buffer_reference(&gs->buffer_ref, NULL);
+	/* With a texture budget, keep the buffer so that the textures
+	 * can be released and uploaded again later. */
+	if (gr->texture_budget == 0)
+		weston_buffer_reference(&gs->buffer_ref, NULL);
 }
 
 static void
@@ -1543,6 +2127,30 @@ ensure_textures(struct gl_surface_state *gs, int num_textures)
 	glBindTexture(gs->target, 0);
 }
 
+static uint64_t
+shm_texture_size(struct gl_surface_state *gs, int num_planes)
+{
+	uint64_t size = 0;
+	int i, texel;
+
+	for (i = 0; i < num_planes; i++) {
+		if (gs->gl_pixel_type == GL_UNSIGNED_SHORT_5_6_5)
+			texel = 2;
+		else if (gs->gl_format[i] == GL_BGRA_EXT)
+			texel = 4;
+		else if (gs->gl_format[i] == GL_RG8_EXT ||
+			 gs->gl_format[i] == GL_LUMINANCE_ALPHA)
+			texel = 2;
+		else
+			texel = 1;
+
+		size += (uint64_t) (gs->pitch / gs->hsub[i]) *
+			(gs->height / gs->vsub[i]) * texel;
+	}
+
+	return size;
+}
+
 static void
 gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 		       struct wl_shm_buffer *shm_buffer)
@@ -1652,7 +2260,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	    gl_format[1] != gs->gl_format[1] ||
 	    gl_format[2] != gs->gl_format[2] ||
 	    gl_pixel_type != gs->gl_pixel_type ||
-	    gs->buffer_type != BUFFER_TYPE_SHM) {
+	    gs->buffer_type != BUFFER_TYPE_SHM || gs->evicted) {
 		gs->pitch = pitch;
 		gs->height = buffer->height;
 		gs->target = GL_TEXTURE_2D;
@@ -1666,7 +2274,12 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 
 		gs->surface = es;
 
+		if (gs->mipmapped)
+			surface_state_reset_textures(gs);
 		ensure_textures(gs, num_planes);
+		surface_state_set_texture_size(gs,
+					       shm_texture_size(gs, num_planes),
+					       false);
 	}
 }
 
@@ -2320,6 +2933,7 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	weston_buffer_reference(&gs->buffer_ref, buffer);
 
 	if (!buffer) {
+		surface_state_set_texture_size(gs, 0, false);
 		for (i = 0; i < gs->num_images; i++) {
 			egl_image_unref(gs->images[i]);
 			gs->images[i] = NULL;
@@ -2333,6 +2947,8 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	}
 
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	if (!shm_buffer)
+		surface_state_set_texture_size(gs, 0, false);
 
 	if (shm_buffer)
 		gl_renderer_attach_shm(es, buffer, shm_buffer);
@@ -2523,6 +3139,7 @@ surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 
 	gs->surface->renderer_state = NULL;
 
+	surface_state_set_texture_size(gs, 0, false);
 	glDeleteTextures(gs->num_textures, gs->textures);
 
 	for (i = 0; i < gs->num_images; i++)
@@ -2579,6 +3196,7 @@ gl_renderer_create_surface(struct weston_surface *surface)
 	gs->y_inverted = 1;
 
 	gs->surface = surface;
+	wl_list_init(&gs->lru_link);
 
 	pixman_region32_init(&gs->texture_damage);
 	surface->renderer_state = gs;
@@ -3028,6 +3646,7 @@ gl_renderer_output_create(struct weston_output *output,
 		pixman_region32_init(&go->buffer_damage[i]);
 
 	wl_list_init(&go->timeline_render_point_list);
+	wl_list_init(&go->layer_cache_list);
 
 	output->renderer_state = go;
 
@@ -3070,11 +3689,15 @@ gl_renderer_output_destroy(struct weston_output *output)
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
 	struct timeline_render_point *trp, *tmp;
+	struct gl_layer_cache *cache, *next;
 	int i;
 
 	for (i = 0; i < 2; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
+	wl_list_for_each_safe(cache, next, &go->layer_cache_list, link)
+		layer_cache_destroy(go, cache);
+
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
 		       EGL_NO_CONTEXT);
@@ -3133,6 +3756,8 @@ gl_renderer_destroy(struct weston_compositor *ec)
 		weston_binding_destroy(gr->fragment_binding);
 	if (gr->fan_binding)
 		weston_binding_destroy(gr->fan_binding);
+	if (gr->texture_stats_binding)
+		weston_binding_destroy(gr->texture_stats_binding);
 
 	free(gr);
 }
@@ -3613,6 +4238,22 @@ fan_debug_repaint_binding(struct weston_keyboard *keyboard,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+texture_stats_binding(struct weston_keyboard *keyboard,
+		      const struct timespec *time,
+		      uint32_t key, void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct gl_renderer *gr = get_renderer(compositor);
+
+	weston_log("GL SHM textures: %" PRIu64 " KiB resident in %d surfaces, "
+		   "budget %" PRIu64 " KiB, %" PRIu64 " evictions, "
+		   "%" PRIu64 " restores\n",
+		   gr->texture_size / 1024, wl_list_length(&gr->texture_lru),
+		   gr->texture_budget / 1024, gr->texture_evictions,
+		   gr->texture_restores);
+}
+
 static uint32_t
 get_gl_version(void)
 {
@@ -3742,6 +4383,10 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	    weston_check_egl_extension(extensions, "GL_EXT_texture_rg"))
 		gr->has_gl_texture_rg = 1;
 
+	if (gr->gl_version >= GR_GL_VERSION(3, 0) ||
+	    weston_check_egl_extension(extensions, "GL_OES_texture_npot"))
+		gr->has_npot_mipmap = 1;
+
 	if (weston_check_egl_extension(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
@@ -3750,6 +4395,9 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (compile_shaders(ec))
 		return -1;
 
+	/* Debug keys: S toggles the shader debug tint, F the triangle fan
+	 * outlines and M logs the SHM texture budget.  T (timeline) and R
+	 * (pixman repaint debug) are taken elsewhere. */
 	gr->fragment_binding =
 		weston_compositor_add_debug_binding(ec, KEY_S,
 						    fragment_debug_binding,
@@ -3758,6 +4406,13 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		weston_compositor_add_debug_binding(ec, KEY_F,
 						    fan_debug_repaint_binding,
 						    ec);
+	gr->texture_stats_binding =
+		weston_compositor_add_debug_binding(ec, KEY_M,
+						    texture_stats_binding,
+						    ec);
+
+	gr->texture_budget = ec->texture_budget;
+	wl_list_init(&gr->texture_lru);
 
 	gr->output_destroy_listener.notify = output_handle_destroy;
 	wl_signal_add(&ec->output_destroyed_signal,
@@ -3768,8 +4423,17 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm mipmaps: %s\n",
+			    gr->has_npot_mipmap ? "yes" : "no");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
+	if (gr->texture_budget)
+		weston_log_continue(STAMP_SPACE "wl_shm texture budget: "
+				    "%" PRIu64 " KiB\n",
+				    gr->texture_budget / 1024);
+	else
+		weston_log_continue(STAMP_SPACE "wl_shm texture budget: "
+				    "unlimited\n");
 
 
 	return 0;
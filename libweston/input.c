@@ -3012,6 +3012,46 @@ weston_seat_update_keymap(struct weston_seat *seat, struct xkb_keymap *keymap)
 		update_keymap(seat);
 }
 
+/** Change the key repeat rate and delay
+ *
+ * \param ec The compositor.
+ * \param rate Repeated keys per second, 0 to disable key repeat.
+ * \param delay Delay in milliseconds before a held key starts repeating.
+ *
+ * Keyboards bound before the change are sent the new values too.
+ */
+WL_EXPORT void
+weston_compositor_set_kb_repeat_info(struct weston_compositor *ec,
+				     int32_t rate, int32_t delay)
+{
+	struct weston_seat *seat;
+	struct weston_keyboard *keyboard;
+	struct wl_resource *resource;
+
+	if (ec->kb_repeat_rate == rate && ec->kb_repeat_delay == delay)
+		return;
+
+	ec->kb_repeat_rate = rate;
+	ec->kb_repeat_delay = delay;
+
+	wl_list_for_each(seat, &ec->seat_list, link) {
+		keyboard = weston_seat_get_keyboard(seat);
+		if (!keyboard)
+			continue;
+
+		wl_resource_for_each(resource, &keyboard->resource_list)
+			if (wl_resource_get_version(resource) >=
+			    WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION)
+				wl_keyboard_send_repeat_info(resource,
+							     rate, delay);
+		wl_resource_for_each(resource, &keyboard->focus_resource_list)
+			if (wl_resource_get_version(resource) >=
+			    WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION)
+				wl_keyboard_send_repeat_info(resource,
+							     rate, delay);
+	}
+}
+
 WL_EXPORT int
 weston_seat_init_keyboard(struct weston_seat *seat, struct xkb_keymap *keymap)
 {
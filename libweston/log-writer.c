@@ -0,0 +1,528 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "compositor.h"
+
+/* Log and debug output is handed to a writer thread through a ring
+ * buffer, so a slow terminal, disk or debug client never stalls the
+ * compositor.  weston_log() is also called from helper threads, so
+ * producers serialize on a mutex; the writer thread only ever advances
+ * the tail.
+ *
+ * Every record is a header followed by its payload, padded so that
+ * headers stay aligned and never wrap around the end of the ring.
+ */
+
+#define LOG_RING_SIZE (1 << 20)
+#define LOG_RECORD_MAX (LOG_RING_SIZE / 8)
+#define LOG_RECORD_ALIGN(n) (((n) + 15) & ~15u)
+
+/* A non-blocking stream that takes longer than this to accept more
+ * data is considered stalled, and its output is dropped until it is
+ * closed. */
+#define LOG_WRITE_TIMEOUT_MS 200
+#define LOG_STALLED_MAX 16
+
+/* Output dropped because the ring was full is counted per fd, so the
+ * note about it ends up where the output was meant to go. */
+#define LOG_DROPPED_MAX 16
+
+enum log_record_type {
+	LOG_RECORD_DATA,
+	LOG_RECORD_CLOSE,	/* close fd once everything before is out */
+	LOG_RECORD_SKIP,	/* padding up to the end of the ring */
+};
+
+struct log_record {
+	uint32_t type;
+	uint32_t len;
+	int32_t fd;
+	uint32_t pad;
+};
+
+struct log_dropped {
+	int fd;
+	unsigned int count;
+};
+
+/* A close that did not fit into the ring; done by the writer thread
+ * once the tail has passed everything queued before it. */
+struct log_deferred_close {
+	struct log_deferred_close *next;
+	uint64_t head;
+	int fd;
+};
+
+static struct {
+	char *data;
+	uint64_t head;		/* written by producers, under lock */
+	uint64_t tail;		/* written by the writer thread */
+	int sleeping;
+	int quit;
+	int wake_fd;
+	pthread_t thread;
+	bool running;
+	struct log_dropped dropped[LOG_DROPPED_MAX];
+	int dropped_count;
+	unsigned int dropped_untracked;	/* no slot was left */
+	pthread_mutex_t lock;
+	struct log_deferred_close *closes;
+	int closes_pending;
+
+	/* only used by the writer thread */
+	int stalled[LOG_STALLED_MAX];
+	int stalled_count;
+} log_ring = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Returns false with errno set to EAGAIN if a non-blocking fd stopped
+ * accepting data, or false with another errno on a write error. */
+static bool
+write_all(int fd, const char *data, size_t len)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, data, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno == EAGAIN) {
+			ret = poll(&pfd, 1, LOG_WRITE_TIMEOUT_MS);
+			if (ret == 0)
+				errno = EAGAIN;
+			if (ret == 0 || (ret < 0 && errno != EINTR))
+				return false;
+			continue;
+		}
+		if (ret <= 0)
+			return false;
+
+		data += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+static int
+log_stalled_find(int fd)
+{
+	int i;
+
+	for (i = 0; i < log_ring.stalled_count; i++)
+		if (log_ring.stalled[i] == fd)
+			return i;
+
+	return -1;
+}
+
+static void
+log_writer_close(int fd)
+{
+	int i = log_stalled_find(fd);
+
+	if (i >= 0)
+		log_ring.stalled[i] =
+			log_ring.stalled[--log_ring.stalled_count];
+	close(fd);
+}
+
+static void
+log_ring_process(const struct log_record *record)
+{
+	switch (record->type) {
+	case LOG_RECORD_DATA:
+		if (log_stalled_find(record->fd) >= 0)
+			break;
+		if (!write_all(record->fd, (const char *) (record + 1),
+			       record->len) &&
+		    errno == EAGAIN &&
+		    log_ring.stalled_count < LOG_STALLED_MAX)
+			log_ring.stalled[log_ring.stalled_count++] = record->fd;
+		break;
+	case LOG_RECORD_CLOSE:
+		log_writer_close(record->fd);
+		break;
+	case LOG_RECORD_SKIP:
+		break;
+	}
+}
+
+static void
+log_ring_process_closes(uint64_t tail, bool all)
+{
+	struct log_deferred_close **link, *close_req;
+
+	pthread_mutex_lock(&log_ring.lock);
+	link = &log_ring.closes;
+	while (*link) {
+		close_req = *link;
+		if (!all && (int64_t) (tail - close_req->head) < 0) {
+			link = &close_req->next;
+			continue;
+		}
+
+		*link = close_req->next;
+		log_writer_close(close_req->fd);
+		free(close_req);
+		__atomic_sub_fetch(&log_ring.closes_pending, 1,
+				   __ATOMIC_SEQ_CST);
+	}
+	pthread_mutex_unlock(&log_ring.lock);
+}
+
+static void *
+log_writer_thread(void *data)
+{
+	const struct log_record *record;
+	uint64_t head, tail, value;
+
+	tail = log_ring.tail;
+	for (;;) {
+		head = __atomic_load_n(&log_ring.head, __ATOMIC_ACQUIRE);
+		while (tail != head) {
+			record = (const struct log_record *)
+				(log_ring.data + (tail & (LOG_RING_SIZE - 1)));
+			log_ring_process(record);
+			tail += sizeof *record + LOG_RECORD_ALIGN(record->len);
+			__atomic_store_n(&log_ring.tail, tail,
+					 __ATOMIC_RELEASE);
+		}
+
+		if (__atomic_load_n(&log_ring.closes_pending,
+				    __ATOMIC_SEQ_CST))
+			log_ring_process_closes(tail, false);
+
+		if (__atomic_load_n(&log_ring.quit, __ATOMIC_ACQUIRE) &&
+		    __atomic_load_n(&log_ring.head, __ATOMIC_ACQUIRE) == tail)
+			break;
+
+		/* Announce that we are going to sleep, then look again:
+		 * either we see the new head or the producer sees the
+		 * flag and kicks the eventfd. */
+		__atomic_store_n(&log_ring.sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&log_ring.head, __ATOMIC_SEQ_CST) == tail &&
+		    !__atomic_load_n(&log_ring.closes_pending,
+				     __ATOMIC_SEQ_CST) &&
+		    !__atomic_load_n(&log_ring.quit, __ATOMIC_SEQ_CST)) {
+			while (read(log_ring.wake_fd, &value,
+				    sizeof value) < 0 && errno == EINTR)
+				;
+		}
+		__atomic_store_n(&log_ring.sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+
+	return NULL;
+}
+
+static void
+log_ring_wake(void)
+{
+	uint64_t value = 1;
+
+	if (__atomic_exchange_n(&log_ring.sleeping, 0, __ATOMIC_SEQ_CST))
+		while (write(log_ring.wake_fd, &value, sizeof value) < 0 &&
+		       errno == EINTR)
+			;
+}
+
+/* Called with log_ring.lock held */
+static struct log_dropped *
+log_dropped_find(int fd)
+{
+	int i;
+
+	for (i = 0; i < log_ring.dropped_count; i++)
+		if (log_ring.dropped[i].fd == fd)
+			return &log_ring.dropped[i];
+
+	return NULL;
+}
+
+/* Called with log_ring.lock held */
+static void
+log_dropped_add(int fd)
+{
+	struct log_dropped *dropped = log_dropped_find(fd);
+
+	if (!dropped && log_ring.dropped_count < LOG_DROPPED_MAX) {
+		dropped = &log_ring.dropped[log_ring.dropped_count++];
+		dropped->fd = fd;
+		dropped->count = 0;
+	}
+
+	if (dropped)
+		dropped->count++;
+	else
+		log_ring.dropped_untracked++;
+}
+
+/* Called with log_ring.lock held */
+static void
+log_dropped_forget(struct log_dropped *dropped)
+{
+	*dropped = log_ring.dropped[--log_ring.dropped_count];
+}
+
+/* Called with log_ring.lock held */
+static int
+log_ring_push(enum log_record_type type, int fd, const char *data,
+	      size_t len)
+{
+	struct log_record *record;
+	uint64_t head = log_ring.head;
+	uint64_t tail = __atomic_load_n(&log_ring.tail, __ATOMIC_ACQUIRE);
+	size_t size = sizeof *record + LOG_RECORD_ALIGN(len);
+	size_t offset = head & (LOG_RING_SIZE - 1);
+	size_t contiguous = LOG_RING_SIZE - offset;
+	size_t needed = size + (contiguous < size ? contiguous : 0);
+
+	if (LOG_RING_SIZE - (head - tail) < needed)
+		return -1;
+
+	if (contiguous < size) {
+		record = (struct log_record *) (log_ring.data + offset);
+		record->type = LOG_RECORD_SKIP;
+		record->len = contiguous - sizeof *record;
+		head += contiguous;
+		offset = 0;
+	}
+
+	record = (struct log_record *) (log_ring.data + offset);
+	record->type = type;
+	record->len = len;
+	record->fd = fd;
+	if (len)
+		memcpy(record + 1, data, len);
+	head += size;
+
+	__atomic_store_n(&log_ring.head, head, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&log_ring.sleeping, __ATOMIC_SEQ_CST))
+		log_ring_wake();
+
+	return 0;
+}
+
+/** Write log or debug output to a file descriptor
+ *
+ * \param fd The destination.
+ * \param data The bytes to write.
+ * \param len The number of bytes.
+ *
+ * Once weston_log_writer_start() has been called the data is copied
+ * into a ring buffer and written by a background thread, in the order
+ * it was queued; before that, or after weston_log_writer_stop(), it is
+ * written right away.  When the ring is full the output is dropped
+ * rather than blocking the caller, and a note says how much was lost.
+ * May be called from any thread.
+ */
+WL_EXPORT void
+weston_log_write(int fd, const char *data, size_t len)
+{
+	struct log_dropped *dropped;
+	char note[64];
+	size_t chunk;
+	int n;
+
+	pthread_mutex_lock(&log_ring.lock);
+
+	if (!log_ring.running) {
+		write_all(fd, data, len);
+		goto out;
+	}
+
+	dropped = log_dropped_find(fd);
+	if (dropped) {
+		n = snprintf(note, sizeof note,
+			     "[%u log messages dropped]\n", dropped->count);
+		if (log_ring_push(LOG_RECORD_DATA, fd, note, n) < 0) {
+			dropped->count++;
+			goto out;
+		}
+		log_dropped_forget(dropped);
+	}
+
+	while (len > 0) {
+		chunk = len < LOG_RECORD_MAX ? len : LOG_RECORD_MAX;
+		if (log_ring_push(LOG_RECORD_DATA, fd, data, chunk) < 0) {
+			log_dropped_add(fd);
+			goto out;
+		}
+		data += chunk;
+		len -= chunk;
+	}
+
+out:
+	pthread_mutex_unlock(&log_ring.lock);
+}
+
+/** Close a file descriptor after its queued output has been written
+ *
+ * \param fd The file descriptor previously passed to weston_log_write().
+ */
+WL_EXPORT void
+weston_log_write_close(int fd)
+{
+	struct log_deferred_close *close_req;
+	struct log_dropped *dropped;
+
+	pthread_mutex_lock(&log_ring.lock);
+
+	/* The fd number may be reused, don't report drops to its
+	 * next owner. */
+	dropped = log_dropped_find(fd);
+	if (dropped)
+		log_dropped_forget(dropped);
+
+	if (!log_ring.running) {
+		close(fd);
+	} else if (log_ring_push(LOG_RECORD_CLOSE, fd, NULL, 0) < 0) {
+		/* Never wait for room, and never drop a close either. */
+		close_req = malloc(sizeof *close_req);
+		if (close_req) {
+			close_req->fd = fd;
+			close_req->head = log_ring.head;
+			close_req->next = log_ring.closes;
+			log_ring.closes = close_req;
+			__atomic_add_fetch(&log_ring.closes_pending, 1,
+					   __ATOMIC_SEQ_CST);
+			log_ring_wake();
+		}
+	}
+
+	pthread_mutex_unlock(&log_ring.lock);
+}
+
+/** Start writing log output from a background thread
+ *
+ * \return 0 on success, -1 if the thread could not be started, in
+ * which case output keeps being written synchronously.
+ */
+WL_EXPORT int
+weston_log_writer_start(void)
+{
+	sigset_t set, old;
+	int ret;
+
+	if (log_ring.running)
+		return 0;
+
+	log_ring.data = malloc(LOG_RING_SIZE);
+	if (!log_ring.data)
+		return -1;
+
+	log_ring.wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (log_ring.wake_fd < 0)
+		goto err_data;
+
+	log_ring.head = 0;
+	log_ring.tail = 0;
+	log_ring.sleeping = 0;
+	log_ring.quit = 0;
+	log_ring.stalled_count = 0;
+	log_ring.dropped_count = 0;
+	log_ring.dropped_untracked = 0;
+
+	/* Signals belong to the compositor's event loop.  Blocking
+	 * them here also turns SIGPIPE from a vanished debug client
+	 * into a plain EPIPE. */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	ret = pthread_create(&log_ring.thread, NULL, log_writer_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0)
+		goto err_fd;
+
+	pthread_mutex_lock(&log_ring.lock);
+	log_ring.running = true;
+	pthread_mutex_unlock(&log_ring.lock);
+
+	return 0;
+
+err_fd:
+	close(log_ring.wake_fd);
+err_data:
+	free(log_ring.data);
+	log_ring.data = NULL;
+
+	return -1;
+}
+
+/** Flush queued log output and stop the writer thread
+ *
+ * Output written afterwards goes out synchronously again.
+ */
+WL_EXPORT void
+weston_log_writer_stop(void)
+{
+	uint64_t value = 1;
+	unsigned int dropped;
+	int i;
+
+	if (!log_ring.running)
+		return;
+
+	/* From here on producers write synchronously again, so nothing
+	 * is queued behind the final drain. */
+	pthread_mutex_lock(&log_ring.lock);
+	log_ring.running = false;
+	__atomic_store_n(&log_ring.quit, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&log_ring.lock);
+
+	while (write(log_ring.wake_fd, &value, sizeof value) < 0 &&
+	       errno == EINTR)
+		;
+	pthread_join(log_ring.thread, NULL);
+	log_ring_process_closes(log_ring.tail, true);
+
+	close(log_ring.wake_fd);
+	free(log_ring.data);
+	log_ring.data = NULL;
+
+	pthread_mutex_lock(&log_ring.lock);
+	dropped = log_ring.dropped_untracked;
+	for (i = 0; i < log_ring.dropped_count; i++)
+		dropped += log_ring.dropped[i].count;
+	log_ring.dropped_count = 0;
+	log_ring.dropped_untracked = 0;
+	pthread_mutex_unlock(&log_ring.lock);
+
+	if (dropped)
+		fprintf(stderr, "[%u log messages dropped]\n", dropped);
+}
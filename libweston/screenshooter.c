@@ -28,17 +28,29 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
 #include <string.h>
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/uio.h>
 
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include "compositor.h"
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 
 #include "wcap/wcap-decode.h"
+#include "wcap/wcap-rle.h"
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
@@ -213,41 +225,304 @@ struct weston_recorder {
 	struct weston_output *output;
 	uint32_t *frame, *rect;
 	uint32_t *tmpbuf;
-	uint32_t total;
+	uint32_t *delta;
+	uint64_t total;
 	int fd;
 	struct wl_listener frame_listener;
 	int count, destroying;
+	/* Seekable v2 stream: keyframe interval and frame index */
+	int version;
+	uint32_t keyframe_interval;
+	struct wl_array index;
+
+	/* With compression enabled, frames are assembled into jobs and
+	 * compressed and written out by the worker thread.  The file, the
+	 * index and the statistics belong to the worker until it has been
+	 * joined. */
+	enum weston_recorder_compression compression;
+	struct weston_recorder_job *job;
+	pthread_t worker_thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t queue_cond;
+	struct wl_list queue;
+	int queue_length;
+	int stopping;
+	/* Frames skipped while the queue was full; their damage is
+	 * carried over into the next recorded frame. */
+	pixman_region32_t skipped_damage;
+	uint32_t dropped;
+	bool force_keyframe;
+	void *compressed;
+	size_t compressed_alloc;
+	uint64_t raw_bytes, compressed_bytes;
+	struct timespec worker_time;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *zstd;
+#endif
 };
 
-static uint32_t *
-output_run(uint32_t *p, uint32_t delta, int run)
+struct weston_recorder_job {
+	struct wl_list link;
+	struct wcap_frame_header_v2 header;
+	struct wl_array payload;
+};
+
+/* Frames the compositor may get ahead of the worker thread before
+ * further frames are skipped until it catches up. */
+#define WESTON_RECORDER_MAX_QUEUE 8
+
+static const char *
+weston_recorder_compression_name(enum weston_recorder_compression compression)
+{
+	switch (compression) {
+	case WESTON_RECORDER_COMPRESSION_LZ4:
+		return "lz4";
+	case WESTON_RECORDER_COMPRESSION_ZSTD:
+		return "zstd";
+	default:
+		return "none";
+	}
+}
+
+static void
+weston_recorder_add_index(struct weston_recorder *recorder, uint64_t offset,
+			  const struct wcap_frame_header_v2 *header)
+{
+	struct wcap_index_entry *entry;
+
+	entry = wl_array_add(&recorder->index, sizeof *entry);
+	if (entry) {
+		entry->offset = offset;
+		entry->msecs = header->msecs;
+		entry->flags = header->flags;
+	}
+}
+
+static bool
+weston_recorder_compress(struct weston_recorder *recorder,
+			 struct weston_recorder_job *job, size_t *size)
+{
+	size_t bound = 0, len = 0;
+	bool ok = false;
+
+	switch (recorder->compression) {
+#ifdef HAVE_LZ4
+	case WESTON_RECORDER_COMPRESSION_LZ4:
+		bound = LZ4_compressBound(job->payload.size);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case WESTON_RECORDER_COMPRESSION_ZSTD:
+		bound = ZSTD_compressBound(job->payload.size);
+		break;
+#endif
+	default:
+		return false;
+	}
+
+	if (bound > recorder->compressed_alloc) {
+		free(recorder->compressed);
+		recorder->compressed = malloc(bound);
+		recorder->compressed_alloc = recorder->compressed ? bound : 0;
+		if (recorder->compressed == NULL)
+			return false;
+	}
+
+	switch (recorder->compression) {
+#ifdef HAVE_LZ4
+	case WESTON_RECORDER_COMPRESSION_LZ4:
+		len = LZ4_compress_default(job->payload.data,
+					   recorder->compressed,
+					   job->payload.size, bound);
+		ok = len > 0;
+		job->header.flags |= WCAP_FRAME_LZ4;
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case WESTON_RECORDER_COMPRESSION_ZSTD:
+		len = ZSTD_compressCCtx(recorder->zstd, recorder->compressed,
+					bound, job->payload.data,
+					job->payload.size, 1);
+		ok = !ZSTD_isError(len);
+		job->header.flags |= WCAP_FRAME_ZSTD;
+		break;
+#endif
+	default:
+		break;
+	}
+
+	/* Store frames that don't compress as they are. */
+	if (!ok || len + sizeof(uint32_t) >= job->payload.size) {
+		job->header.flags &= ~WCAP_FRAME_COMPRESSED;
+		return false;
+	}
+
+	*size = len;
+
+	return true;
+}
+
+static void
+weston_recorder_write_job(struct weston_recorder *recorder,
+			  struct weston_recorder_job *job)
+{
+	uint32_t raw_size = job->payload.size;
+	uint64_t offset = recorder->total;
+	struct iovec v[3];
+	size_t len;
+
+	v[0].iov_base = &job->header;
+	v[0].iov_len = sizeof job->header;
+	if (weston_recorder_compress(recorder, job, &len)) {
+		v[1].iov_base = &raw_size;
+		v[1].iov_len = sizeof raw_size;
+		v[2].iov_base = recorder->compressed;
+		v[2].iov_len = len;
+		job->header.size = sizeof raw_size + len;
+	} else {
+		v[1].iov_base = job->payload.data;
+		v[1].iov_len = job->payload.size;
+		v[2].iov_base = NULL;
+		v[2].iov_len = 0;
+		job->header.size = job->payload.size;
+	}
+
+	recorder->total += writev(recorder->fd, v, 3);
+	recorder->raw_bytes += raw_size;
+	recorder->compressed_bytes += job->header.size;
+	weston_recorder_add_index(recorder, offset, &job->header);
+}
+
+static void *
+weston_recorder_worker(void *data)
 {
-	int i;
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_job *job;
+
+	pthread_mutex_lock(&recorder->mutex);
+
+	while (true) {
+		while (wl_list_empty(&recorder->queue) && !recorder->stopping)
+			pthread_cond_wait(&recorder->queue_cond,
+					  &recorder->mutex);
 
-	while (run > 0) {
-		if (run <= 0xe0) {
-			*p++ = delta | ((run - 1) << 24);
+		/* Drain the queue before stopping. */
+		if (wl_list_empty(&recorder->queue))
 			break;
-		}
 
-		i = 24 - __builtin_clz(run);
-		*p++ = delta | ((i + 0xe0) << 24);
-		run -= 1 << (7 + i);
+		job = container_of(recorder->queue.next,
+				   struct weston_recorder_job, link);
+		wl_list_remove(&job->link);
+		pthread_mutex_unlock(&recorder->mutex);
+
+		weston_recorder_write_job(recorder, job);
+		wl_array_release(&job->payload);
+		free(job);
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->queue_length--;
+	}
+
+	pthread_mutex_unlock(&recorder->mutex);
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &recorder->worker_time);
+
+	return NULL;
+}
+
+static bool
+weston_recorder_queue_full(struct weston_recorder *recorder)
+{
+	bool full;
+
+	pthread_mutex_lock(&recorder->mutex);
+	full = recorder->queue_length >= WESTON_RECORDER_MAX_QUEUE;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	return full;
+}
+
+static void
+weston_recorder_queue_job(struct weston_recorder *recorder)
+{
+	pthread_mutex_lock(&recorder->mutex);
+
+	wl_list_insert(recorder->queue.prev, &recorder->job->link);
+	recorder->queue_length++;
+	recorder->job = NULL;
+	pthread_cond_signal(&recorder->queue_cond);
+
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+static int
+weston_recorder_start_worker(struct weston_recorder *recorder)
+{
+#ifdef HAVE_ZSTD
+	if (recorder->compression == WESTON_RECORDER_COMPRESSION_ZSTD) {
+		recorder->zstd = ZSTD_createCCtx();
+		if (recorder->zstd == NULL)
+			return -1;
+	}
+#endif
+
+	wl_list_init(&recorder->queue);
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->queue_cond, NULL);
+	if (pthread_create(&recorder->worker_thread, NULL,
+			   weston_recorder_worker, recorder) != 0) {
+		pthread_mutex_destroy(&recorder->mutex);
+		pthread_cond_destroy(&recorder->queue_cond);
+		return -1;
 	}
 
-	return p;
+	return 0;
+}
+
+static void
+weston_recorder_stop_worker(struct weston_recorder *recorder)
+{
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->stopping = 1;
+	pthread_cond_signal(&recorder->queue_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+
+	pthread_join(recorder->worker_thread, NULL);
+
+	pthread_mutex_destroy(&recorder->mutex);
+	pthread_cond_destroy(&recorder->queue_cond);
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+/* Write to the file directly, or append to the job being assembled for
+ * the worker thread.  Returns -1 if the job could not be grown. */
+static int
+weston_recorder_emit(struct weston_recorder *recorder,
+		     const void *data, size_t size)
 {
-	unsigned char dr, dg, db;
+	void *p;
+
+	if (recorder->job) {
+		p = wl_array_add(&recorder->job->payload, size);
+		if (p == NULL)
+			return -1;
+		memcpy(p, data, size);
+	} else {
+		recorder->total += write(recorder->fd, data, size);
+	}
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+	return 0;
+}
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+/* Throw away a partially assembled frame.  recorder->frame already
+ * holds some of its pixels, so the next frame must not be a delta. */
+static void
+weston_recorder_drop_job(struct weston_recorder *recorder)
+{
+	wl_array_release(&recorder->job->payload);
+	free(recorder->job);
+	recorder->job = NULL;
+	recorder->force_keyframe = true;
+	recorder->dropped++;
 }
 
 static void
@@ -263,16 +538,17 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	uint32_t msecs = timespec_to_msec(&output->frame_time);
 	pixman_box32_t *r;
 	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
+	int i, j, n, width, height, stride;
+	uint32_t *d, *s, *p;
+	struct wcap_rle_encoder enc;
+	struct wcap_frame_header_v2 header;
 	struct iovec v[2];
 	int do_yflip;
 	int y_orig;
 	uint32_t *outbuf;
+	uint64_t offset = 0;
+	bool keyframe;
+	int ret = 0;
 
 	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 	if (do_yflip)
@@ -290,22 +566,74 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 				 &damage, &transformed_damage);
 	pixman_region32_fini(&damage);
 
+	if (recorder->compression != WESTON_RECORDER_COMPRESSION_NONE) {
+		/* Never stall the repaint on the worker: skip the frame
+		 * and record its damage with the next one instead. */
+		if (weston_recorder_queue_full(recorder)) {
+			pixman_region32_union(&recorder->skipped_damage,
+					      &recorder->skipped_damage,
+					      &transformed_damage);
+			pixman_region32_fini(&transformed_damage);
+			recorder->dropped++;
+			goto out;
+		}
+		pixman_region32_union(&transformed_damage, &transformed_damage,
+				      &recorder->skipped_damage);
+		pixman_region32_clear(&recorder->skipped_damage);
+	}
+
 	r = pixman_region32_rectangles(&transformed_damage, &n);
-	if (n == 0) {
+	if (n == 0 && !recorder->force_keyframe) {
 		pixman_region32_fini(&transformed_damage);
-		return;
+		goto out;
+	}
+
+	if (recorder->compression != WESTON_RECORDER_COMPRESSION_NONE) {
+		recorder->job = zalloc(sizeof *recorder->job);
+		if (recorder->job == NULL) {
+			weston_log("%s: out of memory\n", __func__);
+			pixman_region32_fini(&transformed_damage);
+			goto out;
+		}
+		wl_array_init(&recorder->job->payload);
+	}
+
+	/* A keyframe covers the whole output and is encoded against an
+	 * all zero frame, so decoding can start from it. */
+	keyframe = recorder->version == 2 &&
+		   (recorder->count == 0 || recorder->force_keyframe ||
+		    (recorder->keyframe_interval > 0 &&
+		     recorder->count % recorder->keyframe_interval == 0));
+	if (keyframe) {
+		pixman_region32_fini(&transformed_damage);
+		pixman_region32_init_rect(&transformed_damage, 0, 0,
+					  output->current_mode->width,
+					  output->current_mode->height);
+		r = pixman_region32_rectangles(&transformed_damage, &n);
+		memset(recorder->frame, 0, output->current_mode->width * 4 *
+		       output->current_mode->height);
+		recorder->force_keyframe = false;
 	}
 
 	header.msecs = msecs;
 	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
+	header.flags = keyframe ? WCAP_FRAME_KEYFRAME : 0;
+	header.size = 0;
+	if (recorder->job) {
+		recorder->job->header = header;
+		ret = weston_recorder_emit(recorder, r, n * sizeof *r);
+	} else {
+		offset = recorder->total;
+		v[0].iov_base = &header;
+		v[0].iov_len = recorder->version == 2 ?
+			sizeof header : sizeof(struct wcap_frame_header);
+		v[1].iov_base = r;
+		v[1].iov_len = n * sizeof *r;
+		recorder->total += writev(recorder->fd, v, 2);
+	}
 	stride = output->current_mode->width;
 
-	for (i = 0; i < n; i++) {
+	for (i = 0; i < n && ret == 0; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
@@ -319,7 +647,7 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 				r[i].x1, y_orig, width, height);
 
 		p = outbuf;
-		run = prev = 0; /* quiet gcc */
+		wcap_rle_encoder_init(&enc);
 		for (j = 0; j < height; j++) {
 			if (do_yflip)
 				s = recorder->rect + width * j;
@@ -328,24 +656,13 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 			y_orig = r[i].y2 - j - 1;
 			d = recorder->frame + stride * y_orig + r[i].x1;
 
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
+			wcap_rle_delta(recorder->delta, d, s, width);
+			p = wcap_rle_encode(&enc, p, recorder->delta, width);
 		}
 
-		p = output_run(p, prev, run);
+		p = wcap_rle_encoder_finish(&enc, p);
 
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+		ret = weston_recorder_emit(recorder, outbuf, (p - outbuf) * 4);
 
 #if 0
 		fprintf(stderr,
@@ -353,13 +670,35 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 			width, height, r[i].x1, r[i].y1,
 			width * height * 4, (int) (p - outbuf) * 4,
 			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
+			(int) (recorder->total / 1024 / 1024));
 #endif
 	}
 
 	pixman_region32_fini(&transformed_damage);
+
+	if (ret < 0) {
+		weston_log("recorder: out of memory, dropping frame\n");
+		weston_recorder_drop_job(recorder);
+		goto out;
+	}
+
 	recorder->count++;
 
+	if (recorder->job) {
+		weston_recorder_queue_job(recorder);
+	} else if (recorder->version == 2) {
+		header.size = recorder->total - offset - sizeof header;
+		if (pwrite(recorder->fd, &header.size, sizeof header.size,
+			   offset + offsetof(struct wcap_frame_header_v2,
+					     size)) < 0)
+			weston_log("recorder: failed to write frame size: %m\n");
+
+		weston_recorder_add_index(recorder, offset, &header);
+	}
+
+out:
+	/* weston_recorder_stop() only schedules a single repaint, so the
+	 * recorder has to go away on that frame even if it was skipped. */
 	if (recorder->destroying)
 		weston_recorder_destroy(recorder);
 }
@@ -370,14 +709,22 @@ weston_recorder_free(struct weston_recorder *recorder)
 	if (recorder == NULL)
 		return;
 
+	wl_array_release(&recorder->index);
+	pixman_region32_fini(&recorder->skipped_damage);
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(recorder->zstd);
+#endif
+	free(recorder->compressed);
 	free(recorder->tmpbuf);
+	free(recorder->delta);
 	free(recorder->rect);
 	free(recorder->frame);
 	free(recorder);
 }
 
 static struct weston_recorder *
-weston_recorder_create(struct weston_output *output, const char *filename)
+weston_recorder_create(struct weston_output *output, const char *filename,
+		       const struct weston_recorder_options *options)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
@@ -393,13 +740,46 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		return NULL;
 	}
 
+	wl_array_init(&recorder->index);
+	pixman_region32_init(&recorder->skipped_damage);
+	recorder->keyframe_interval = options->keyframe_interval;
+	recorder->compression = options->compression;
+
+	switch (recorder->compression) {
+	case WESTON_RECORDER_COMPRESSION_NONE:
+		break;
+#ifdef HAVE_LZ4
+	case WESTON_RECORDER_COMPRESSION_LZ4:
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case WESTON_RECORDER_COMPRESSION_ZSTD:
+		break;
+#endif
+	default:
+		weston_log("recorder: %s compression not supported, "
+			   "recording uncompressed\n",
+			   weston_recorder_compression_name(recorder->compression));
+		recorder->compression = WESTON_RECORDER_COMPRESSION_NONE;
+		break;
+	}
+
+	/* Compressed frames need the v2 frame header */
+	if (recorder->keyframe_interval > 0 ||
+	    recorder->compression != WESTON_RECORDER_COMPRESSION_NONE)
+		recorder->version = 2;
+	else
+		recorder->version = 1;
+
 	stride = output->current_mode->width;
 	size = stride * 4 * output->current_mode->height;
 	recorder->frame = zalloc(size);
 	recorder->rect = malloc(size);
+	recorder->delta = malloc(stride * 4);
 	recorder->output = output;
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	if ((recorder->frame == NULL) || (recorder->rect == NULL) ||
+	    (recorder->delta == NULL)) {
 		weston_log("%s: out of memory\n", __func__);
 		goto err_recorder;
 	}
@@ -412,7 +792,10 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		}
 	}
 
-	header.magic = WCAP_HEADER_MAGIC;
+	if (recorder->version == 2)
+		header.magic = WCAP_HEADER_MAGIC_V2;
+	else
+		header.magic = WCAP_HEADER_MAGIC;
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -439,6 +822,13 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	header.height = output->current_mode->height;
 	recorder->total += write(recorder->fd, &header, sizeof header);
 
+	if (recorder->compression != WESTON_RECORDER_COMPRESSION_NONE &&
+	    weston_recorder_start_worker(recorder) < 0) {
+		weston_log("recorder: failed to start worker thread\n");
+		close(recorder->fd);
+		goto err_recorder;
+	}
+
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
 	output->disable_planes++;
@@ -451,17 +841,65 @@ err_recorder:
 	return NULL;
 }
 
+static void
+weston_recorder_write_index(struct weston_recorder *recorder)
+{
+	struct wcap_index_footer footer;
+	struct iovec v[2];
+
+	footer.magic = WCAP_INDEX_MAGIC;
+	footer.count = recorder->index.size / sizeof(struct wcap_index_entry);
+	footer.offset = recorder->total;
+	v[0].iov_base = recorder->index.data;
+	v[0].iov_len = recorder->index.size;
+	v[1].iov_base = &footer;
+	v[1].iov_len = sizeof footer;
+	recorder->total += writev(recorder->fd, v, 2);
+}
+
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
+	if (recorder->compression != WESTON_RECORDER_COMPRESSION_NONE)
+		weston_recorder_stop_worker(recorder);
+	if (recorder->version == 2)
+		weston_recorder_write_index(recorder);
 	close(recorder->fd);
+
+	weston_log("stopped recorder, total file size %" PRIu64 "M, "
+		   "%d frames\n",
+		   recorder->total / (1024 * 1024), recorder->count);
+	if (recorder->dropped > 0)
+		weston_log("recorder: dropped %u frames\n", recorder->dropped);
+	if (recorder->compression != WESTON_RECORDER_COMPRESSION_NONE &&
+	    recorder->raw_bytes > 0)
+		weston_log("recorder: %s compressed %" PRIu64 "K of frame "
+			   "data to %" PRIu64 "K (%.1f%%) using %.3f s of "
+			   "worker CPU time\n",
+			   weston_recorder_compression_name(recorder->compression),
+			   recorder->raw_bytes / 1024,
+			   recorder->compressed_bytes / 1024,
+			   100.0 * recorder->compressed_bytes /
+			   recorder->raw_bytes,
+			   recorder->worker_time.tv_sec +
+			   recorder->worker_time.tv_nsec / 1e9);
+
 	recorder->output->disable_planes--;
 	weston_recorder_free(recorder);
 }
 
+/** Start recording an output to a WCAP file
+ *
+ * \param output The output to record.
+ * \param filename The file to write to.
+ * \param options Recording options, see struct weston_recorder_options.
+ * \return The recorder, or NULL on failure.
+ */
 WL_EXPORT struct weston_recorder *
-weston_recorder_start(struct weston_output *output, const char *filename)
+weston_recorder_start_with_options(struct weston_output *output,
+				   const char *filename,
+				   const struct weston_recorder_options *options)
 {
 	struct wl_listener *listener;
 
@@ -475,14 +913,21 @@ weston_recorder_start(struct weston_output *output, const char *filename)
 
 	weston_log("starting recorder for output %s, file %s\n",
 		   output->name, filename);
-	return weston_recorder_create(output, filename);
+	return weston_recorder_create(output, filename, options);
+}
+
+WL_EXPORT struct weston_recorder *
+weston_recorder_start(struct weston_output *output, const char *filename)
+{
+	struct weston_recorder_options options = { 0 };
+
+	return weston_recorder_start_with_options(output, filename, &options);
 }
 
 WL_EXPORT void
 weston_recorder_stop(struct weston_recorder *recorder)
 {
-	weston_log("stopping recorder, total file size %dM, %d frames\n",
-		   recorder->total / (1024 * 1024), recorder->count);
+	weston_log("stopping recorder after %d frames\n", recorder->count);
 
 	recorder->destroying = 1;
 	weston_output_schedule_repaint(recorder->output);
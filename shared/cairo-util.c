@@ -391,6 +391,7 @@ theme_create(void)
 	if (t == NULL)
 		return NULL;
 
+	memset(t->border, 0, sizeof t->border);
 	t->margin = 32;
 	t->width = 6;
 	t->titlebar_height = 27;
@@ -446,9 +447,18 @@ theme_create(void)
 	return NULL;
 }
 
+static void
+theme_border_destroy(struct theme_border *border);
+
 void
 theme_destroy(struct theme *t)
 {
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(t->border); i++)
+		if (t->border[i])
+			theme_border_destroy(t->border[i]);
+
 	cairo_surface_destroy(t->active_frame);
 	cairo_surface_destroy(t->inactive_frame);
 	cairo_surface_destroy(t->shadow);
@@ -477,23 +487,111 @@ create_layout(cairo_t *cr, const char *title)
 }
 #endif
 
+/* Title text laid out for a title area of a given width, ready to be
+ * shown on any cairo context. */
+struct title_text {
 #ifdef HAVE_PANGO
-#define SHOW_TEXT(cr) \
-	pango_cairo_show_layout(cr, title_layout)
+	PangoLayout *layout;
+#endif
+	const char *title;
+	int width, height;
+	/* width the text would take without being ellipsized, 0 if it
+	 * is never ellipsized */
+	int natural_width;
+};
+
+static void
+title_text_layout(cairo_t *cr, struct title_text *text,
+		  const char *title, int max_width)
+{
+	text->title = title;
+
+#ifdef HAVE_PANGO
+	PangoRectangle logical;
+
+	text->layout = create_layout(cr, title);
+
+	pango_layout_get_pixel_extents(text->layout, NULL, &logical);
+	text->width = MIN(max_width, logical.width);
+	text->height = logical.height;
+	text->natural_width = logical.width;
+	if (text->width < logical.width)
+		pango_layout_set_width(text->layout, text->width * PANGO_SCALE);
 #else
-#define SHOW_TEXT(cr) \
-	cairo_show_text(cr, title)
+	cairo_text_extents_t extents;
+	cairo_font_extents_t font_extents;
+
+	cairo_select_font_face(cr, "sans",
+			       CAIRO_FONT_SLANT_NORMAL,
+			       CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cr, 14);
+	cairo_text_extents(cr, title, &extents);
+	cairo_font_extents (cr, &font_extents);
+	text->width = extents.width;
+	text->height = font_extents.descent - font_extents.ascent;
+	text->natural_width = 0;
 #endif
+}
 
-void
-theme_render_frame(struct theme *t,
-		   cairo_t *cr, int width, int height,
-		   const char *title, cairo_rectangle_int_t *title_rect,
-		   struct wl_list *buttons, uint32_t flags)
+static void
+title_text_show_at(cairo_t *cr, struct title_text *text, int x, int y)
+{
+	cairo_move_to(cr, x, y);
+#ifdef HAVE_PANGO
+	pango_cairo_update_layout(cr, text->layout);
+	pango_cairo_show_layout(cr, text->layout);
+#else
+	cairo_select_font_face(cr, "sans",
+			       CAIRO_FONT_SLANT_NORMAL,
+			       CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cr, 14);
+	cairo_show_text(cr, text->title);
+#endif
+}
+
+static void
+title_text_show(cairo_t *cr, struct title_text *text,
+		int x, int y, uint32_t flags)
+{
+	if (flags & THEME_FRAME_ACTIVE) {
+		cairo_set_source_rgb(cr, 1, 1, 1);
+		title_text_show_at(cr, text, x + 1, y + 1);
+		cairo_set_source_rgb(cr, 0, 0, 0);
+		title_text_show_at(cr, text, x, y);
+	} else {
+		cairo_set_source_rgb(cr, 0.4, 0.4, 0.4);
+		title_text_show_at(cr, text, x, y);
+	}
+}
+
+static void
+title_text_fini(struct title_text *text)
+{
+#ifdef HAVE_PANGO
+	g_object_unref(text->layout);
+#endif
+}
+
+static int
+title_text_get_x(int text_width, int width, cairo_rectangle_int_t *title_rect)
+{
+	int x;
+
+	x = (width - text_width) / 2;
+	if (x < title_rect->x)
+		x = title_rect->x;
+	else if (x + text_width > (title_rect->x + title_rect->width))
+		x = (title_rect->x + title_rect->width) - text_width;
+
+	return x;
+}
+
+static void
+theme_render_border_direct(struct theme *t, cairo_t *cr,
+			   int width, int height, uint32_t flags)
 {
 	cairo_surface_t *source;
-	int x, y, margin, top_margin;
-	int text_width, text_height;
+	int margin, top_margin;
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_set_source_rgba(cr, 0, 0, 0, 0);
@@ -508,20 +606,46 @@ theme_render_frame(struct theme *t,
 		margin = t->margin;
 	}
 
+	if (flags & THEME_FRAME_SHADOW_ONLY)
+		return;
+
 	if (flags & THEME_FRAME_ACTIVE)
 		source = t->active_frame;
 	else
 		source = t->inactive_frame;
 
-	if (title || !wl_list_empty(buttons))
-		top_margin = t->titlebar_height;
-	else
+	if (flags & THEME_FRAME_NO_TITLE)
 		top_margin = t->width;
+	else
+		top_margin = t->titlebar_height;
 
 	tile_source(cr, source,
 		    margin, margin,
 		    width - margin * 2, height - margin * 2,
 		    t->width, top_margin);
+}
+
+void
+theme_render_frame(struct theme *t,
+		   cairo_t *cr, int width, int height,
+		   const char *title, cairo_rectangle_int_t *title_rect,
+		   struct wl_list *buttons, uint32_t flags)
+{
+	struct title_text text;
+	int x, y, margin;
+
+	if (title || !wl_list_empty(buttons))
+		flags &= ~THEME_FRAME_NO_TITLE;
+	else
+		flags |= THEME_FRAME_NO_TITLE;
+
+	theme_render_border_direct(t, cr, width, height,
+				   flags & ~THEME_FRAME_SHADOW_ONLY);
+
+	if (flags & THEME_FRAME_MAXIMIZED)
+		margin = 0;
+	else
+		margin = t->margin;
 
 	if (title || !wl_list_empty(buttons)) {
 
@@ -530,52 +654,246 @@ theme_render_frame(struct theme *t,
 		cairo_clip(cr);
 		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
-#ifdef HAVE_PANGO
-		PangoLayout *title_layout;
-		PangoRectangle logical;
+		title_text_layout(cr, &text, title, title_rect->width);
 
-		title_layout = create_layout(cr, title);
+		x = title_text_get_x(text.width, width, title_rect);
+		y = margin + (t->titlebar_height - text.height) / 2;
 
-		pango_layout_get_pixel_extents (title_layout, NULL, &logical);
-		text_width = MIN(title_rect->width, logical.width);
-		text_height = logical.height;
-		if (text_width < logical.width)
-		  pango_layout_set_width (title_layout, text_width * PANGO_SCALE);
-		
-#else
-		cairo_text_extents_t extents;
-		cairo_font_extents_t font_extents;
-
-		cairo_select_font_face(cr, "sans",
-				       CAIRO_FONT_SLANT_NORMAL,
-				       CAIRO_FONT_WEIGHT_BOLD);
-		cairo_set_font_size(cr, 14);
-		cairo_text_extents(cr, title, &extents);
-		cairo_font_extents (cr, &font_extents);
-		text_width = extents.width;
-		text_height = font_extents.descent - font_extents.ascent;
-#endif
+		title_text_show(cr, &text, x, y, flags);
+		title_text_fini(&text);
+	}
+}
 
-		x = (width - text_width) / 2;
-		y = margin + (t->titlebar_height - text_height) / 2;
-		if (x < title_rect->x)
-			x = title_rect->x;
-		else if (x + text_width > (title_rect->x + title_rect->width))
-			x = (title_rect->x + title_rect->width) - text_width;
-
-		if (flags & THEME_FRAME_ACTIVE) {
-			cairo_move_to(cr, x + 1, y  + 1);
-			cairo_set_source_rgb(cr, 1, 1, 1);
-			SHOW_TEXT(cr);
-			cairo_move_to(cr, x, y);
-			cairo_set_source_rgb(cr, 0, 0, 0);
-			SHOW_TEXT(cr);
-		} else {
-			cairo_move_to(cr, x, y);
-			cairo_set_source_rgb(cr, 0.4, 0.4, 0.4);
-			SHOW_TEXT(cr);
-		}
+/* The shadow corners reach 2 + 64 pixels into the surface, see the
+ * render_shadow() call in theme_render_border_direct(), and cover the
+ * frame corners and the title bar height.  Everything between two
+ * corners is the same all along the edge. */
+#define THEME_BORDER_CORNER 66
+#define THEME_BORDER_SIZE (2 * THEME_BORDER_CORNER + 1)
+
+struct theme_border {
+	/* the border rendered for THEME_BORDER_SIZE squared */
+	cairo_surface_t *corners;
+	/* the middle column and row of it, repeated along the edges */
+	cairo_surface_t *horizontal;
+	cairo_surface_t *vertical;
+};
+
+static void
+theme_border_destroy(struct theme_border *border)
+{
+	if (border->corners)
+		cairo_surface_destroy(border->corners);
+	if (border->horizontal)
+		cairo_surface_destroy(border->horizontal);
+	if (border->vertical)
+		cairo_surface_destroy(border->vertical);
+	free(border);
+}
+
+static cairo_surface_t *
+theme_border_slice(cairo_surface_t *corners, int x, int y,
+		   int width, int height)
+{
+	cairo_surface_t *slice;
+	cairo_t *cr;
+
+	slice = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	cr = cairo_create(slice);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, corners, -x, -y);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+
+	return slice;
+}
+
+static struct theme_border *
+theme_get_border(struct theme *t, uint32_t flags)
+{
+	struct theme_border *border;
+	cairo_t *cr;
+	uint32_t index = flags & THEME_BORDER_FLAGS;
+
+	if (t->border[index])
+		return t->border[index];
+
+	border = calloc(1, sizeof *border);
+	if (border == NULL)
+		return NULL;
+
+	border->corners = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						     THEME_BORDER_SIZE,
+						     THEME_BORDER_SIZE);
+	cr = cairo_create(border->corners);
+	theme_render_border_direct(t, cr,
+				   THEME_BORDER_SIZE, THEME_BORDER_SIZE, index);
+	cairo_destroy(cr);
+
+	border->horizontal =
+		theme_border_slice(border->corners, THEME_BORDER_CORNER, 0,
+				   1, THEME_BORDER_SIZE);
+	border->vertical =
+		theme_border_slice(border->corners, 0, THEME_BORDER_CORNER,
+				   THEME_BORDER_SIZE, 1);
+
+	if (cairo_surface_status(border->corners) != CAIRO_STATUS_SUCCESS ||
+	    cairo_surface_status(border->horizontal) != CAIRO_STATUS_SUCCESS ||
+	    cairo_surface_status(border->vertical) != CAIRO_STATUS_SUCCESS) {
+		theme_border_destroy(border);
+		return NULL;
 	}
+
+	t->border[index] = border;
+
+	return border;
+}
+
+static void
+theme_border_paint(cairo_t *cr, cairo_surface_t *source, int sx, int sy,
+		   int x, int y, int width, int height)
+{
+	cairo_set_source_surface(cr, source, sx, sy);
+	cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_REPEAT);
+	cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+	cairo_rectangle(cr, x, y, width, height);
+	cairo_fill(cr);
+}
+
+void
+theme_render_border(struct theme *t, cairo_t *cr,
+		    int width, int height, uint32_t flags)
+{
+	struct theme_border *border;
+	const int c = THEME_BORDER_CORNER;
+	const int s = THEME_BORDER_SIZE;
+
+	border = NULL;
+	if (width >= s && height >= s)
+		border = theme_get_border(t, flags);
+
+	if (border == NULL) {
+		cairo_save(cr);
+		theme_render_border_direct(t, cr, width, height, flags);
+		cairo_restore(cr);
+		return;
+	}
+
+	cairo_save(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+
+	theme_border_paint(cr, border->corners, 0, 0, 0, 0, c, c);
+	theme_border_paint(cr, border->corners, width - s, 0,
+			   width - c, 0, c, c);
+	theme_border_paint(cr, border->corners, 0, height - s,
+			   0, height - c, c, c);
+	theme_border_paint(cr, border->corners, width - s, height - s,
+			   width - c, height - c, c, c);
+
+	theme_border_paint(cr, border->horizontal, 0, 0,
+			   c, 0, width - 2 * c, c);
+	theme_border_paint(cr, border->horizontal, 0, height - s,
+			   c, height - c, width - 2 * c, c);
+	theme_border_paint(cr, border->vertical, 0, 0,
+			   0, c, c, height - 2 * c);
+	theme_border_paint(cr, border->vertical, width - s, 0,
+			   width - c, c, c, height - 2 * c);
+
+	cairo_restore(cr);
+}
+
+/* The title is rendered THEME_TITLE_PADDING pixels into the cached
+ * surface, so the shadow of active titles and glyphs reaching past the
+ * logical extents are kept. */
+#define THEME_TITLE_PADDING 4
+
+void
+theme_title_cache_release(struct theme_title_cache *cache)
+{
+	if (cache->surface)
+		cairo_surface_destroy(cache->surface);
+	memset(cache, 0, sizeof *cache);
+}
+
+static void
+theme_title_cache_update(struct theme *t, struct theme_title_cache *cache,
+			 const char *title, int max_width, uint32_t flags)
+{
+	cairo_surface_t *scratch;
+	struct title_text text;
+	cairo_t *cr;
+
+	theme_title_cache_release(cache);
+
+	scratch = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+	cr = cairo_create(scratch);
+	title_text_layout(cr, &text, title, max_width);
+	cairo_destroy(cr);
+	cairo_surface_destroy(scratch);
+
+	cache->surface =
+		cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+					   text.width + 2 * THEME_TITLE_PADDING,
+					   t->titlebar_height + 1);
+	cr = cairo_create(cache->surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	title_text_show(cr, &text, THEME_TITLE_PADDING,
+			(t->titlebar_height - text.height) / 2, flags);
+	cairo_destroy(cr);
+
+	cache->flags = flags & THEME_FRAME_ACTIVE;
+	cache->text_width = text.width;
+	if (text.natural_width > max_width) {
+		/* ellipsized for exactly this width */
+		cache->min_width = max_width;
+		cache->max_width = max_width;
+	} else {
+		cache->min_width = text.natural_width;
+		cache->max_width = INT32_MAX;
+	}
+
+	title_text_fini(&text);
+
+	if (cairo_surface_status(cache->surface) != CAIRO_STATUS_SUCCESS)
+		theme_title_cache_release(cache);
+}
+
+void
+theme_render_title_cached(struct theme *t, cairo_t *cr,
+			  struct theme_title_cache *cache, int width,
+			  const char *title, cairo_rectangle_int_t *title_rect,
+			  uint32_t flags)
+{
+	int x, margin;
+
+	if (!title)
+		return;
+
+	if (!cache->surface ||
+	    cache->flags != (flags & THEME_FRAME_ACTIVE) ||
+	    title_rect->width < cache->min_width ||
+	    title_rect->width > cache->max_width)
+		theme_title_cache_update(t, cache, title,
+					 title_rect->width, flags);
+	if (!cache->surface)
+		return;
+
+	if (flags & THEME_FRAME_MAXIMIZED)
+		margin = 0;
+	else
+		margin = t->margin;
+
+	x = title_text_get_x(cache->text_width, width, title_rect);
+
+	cairo_save(cr);
+	cairo_rectangle(cr, title_rect->x, title_rect->y,
+			title_rect->width, title_rect->height);
+	cairo_clip(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_surface(cr, cache->surface,
+				 x - THEME_TITLE_PADDING, margin);
+	cairo_paint(cr);
+	cairo_restore(cr);
 }
 
 enum theme_location
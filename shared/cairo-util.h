@@ -49,6 +49,8 @@ rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius);
 cairo_surface_t *
 load_cairo_surface(const char *filename);
 
+struct theme_border;
+
 struct theme {
 	cairo_surface_t *active_frame;
 	cairo_surface_t *inactive_frame;
@@ -57,6 +59,9 @@ struct theme {
 	int margin;
 	int width;
 	int titlebar_height;
+
+	/* pre-rendered borders, indexed by THEME_BORDER_FLAGS */
+	struct theme_border *border[16];
 };
 
 struct theme *
@@ -67,7 +72,22 @@ theme_destroy(struct theme *t);
 enum {
 	THEME_FRAME_ACTIVE = 1,
 	THEME_FRAME_MAXIMIZED = 2,
-	THEME_FRAME_NO_TITLE = 4
+	THEME_FRAME_NO_TITLE = 4,
+	THEME_FRAME_SHADOW_ONLY = 8
+};
+
+#define THEME_BORDER_FLAGS \
+	(THEME_FRAME_ACTIVE | THEME_FRAME_MAXIMIZED | \
+	 THEME_FRAME_NO_TITLE | THEME_FRAME_SHADOW_ONLY)
+
+/* Title text rendered once and reused as long as the string, the
+ * THEME_FRAME_ACTIVE flag and, for ellipsized titles, the width of the
+ * title area stay the same. */
+struct theme_title_cache {
+	cairo_surface_t *surface;
+	uint32_t flags;
+	int text_width;
+	int min_width, max_width;
 };
 
 void
@@ -78,6 +98,22 @@ theme_render_frame(struct theme *t,
 		   const char *title, cairo_rectangle_int_t *title_rect,
 		   struct wl_list *buttons, uint32_t flags);
 
+/* Paints the shadow and the frame border like theme_render_frame(),
+ * from pieces rendered once per theme and flags.  Unless the surface
+ * is too small for the cached pieces, the middle of it (well inside
+ * the frame interior) is left untouched. */
+void
+theme_render_border(struct theme *t, cairo_t *cr,
+		    int width, int height, uint32_t flags);
+
+void
+theme_render_title_cached(struct theme *t, cairo_t *cr,
+			  struct theme_title_cache *cache, int width,
+			  const char *title, cairo_rectangle_int_t *title_rect,
+			  uint32_t flags);
+void
+theme_title_cache_release(struct theme_title_cache *cache);
+
 enum theme_location {
 	THEME_LOCATION_INTERIOR = 0,
 	THEME_LOCATION_RESIZING_TOP = 1,
@@ -230,4 +266,15 @@ frame_double_touch_up(struct frame *frame, void *data, int32_t id);
 void
 frame_repaint(struct frame *frame, cairo_t *cr);
 
+/* Like frame_repaint(), but draws from pieces cached in the theme and
+ * the frame.  If neither the size nor the flags changed since the last
+ * call, only the title bar is redrawn, so @cr must still hold what the
+ * previous call painted; call frame_repaint_invalidate() when it does
+ * not. */
+void
+frame_repaint_cached(struct frame *frame, cairo_t *cr);
+
+void
+frame_repaint_invalidate(struct frame *frame);
+
 #endif
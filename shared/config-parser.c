@@ -27,6 +27,8 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -34,6 +36,8 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -43,23 +47,196 @@
 #include "helpers.h"
 #include "string-helpers.h"
 
+/* Generated configurations can carry hundreds of sections that are
+ * queried over and over, so sections and keys are indexed in chained
+ * hash tables next to the lists that keep file order. */
+struct config_hash_node {
+	uint32_t hash;
+	struct config_hash_node *next;
+};
+
+struct config_hash {
+	struct config_hash_node **buckets;
+	uint32_t size;		/* always a power of two */
+	uint32_t count;
+};
+
 struct weston_config_entry {
 	char *key;
 	char *value;
+	struct weston_config_section *section;
+	struct config_hash_node key_node;	/* weston_config::keys */
+	struct config_hash_node value_node;	/* weston_config::values */
 	struct wl_list link;
 };
 
 struct weston_config_section {
 	char *name;
+	struct weston_config *config;
+	struct config_hash_node node;		/* weston_config::sections */
+	/* further sections with the same name, in file order */
+	struct weston_config_section *next_same;
+	struct weston_config_section *last_same;
 	struct wl_list entry_list;
 	struct wl_list link;
 };
 
 struct weston_config {
 	struct wl_list section_list;
+	/* first section of each name */
+	struct config_hash sections;
+	/* first entry of each key, per section */
+	struct config_hash keys;
+	/* first section per (section name, key, value) */
+	struct config_hash values;
+	struct wl_list listener_list;	/* weston_config_listener::link */
+	int watch_fd;
 	char path[PATH_MAX];
 };
 
+#define CONFIG_HASH_INITIAL_SIZE 16
+
+/* FNV-1a, continued from @hash so that tuples can be hashed by
+ * chaining; the terminating NUL is included to separate fields. */
+static uint32_t
+config_hash_string(uint32_t hash, const char *s)
+{
+	do {
+		hash ^= (unsigned char) *s;
+		hash *= 16777619u;
+	} while (*s++);
+
+	return hash;
+}
+
+#define CONFIG_HASH_SEED 2166136261u
+
+static void
+config_hash_release(struct config_hash *table)
+{
+	free(table->buckets);
+	table->buckets = NULL;
+	table->size = 0;
+	table->count = 0;
+}
+
+static int
+config_hash_grow(struct config_hash *table)
+{
+	struct config_hash_node **buckets, *node, *next;
+	uint32_t size, i;
+
+	size = table->size ? table->size * 2 : CONFIG_HASH_INITIAL_SIZE;
+	buckets = calloc(size, sizeof *buckets);
+	if (buckets == NULL)
+		return -1;
+
+	for (i = 0; i < table->size; i++) {
+		for (node = table->buckets[i]; node; node = next) {
+			next = node->next;
+			node->next = buckets[node->hash & (size - 1)];
+			buckets[node->hash & (size - 1)] = node;
+		}
+	}
+
+	free(table->buckets);
+	table->buckets = buckets;
+	table->size = size;
+
+	return 0;
+}
+
+static int
+config_hash_insert(struct config_hash *table, struct config_hash_node *node,
+		   uint32_t hash)
+{
+	struct config_hash_node **bucket;
+
+	if (table->count >= table->size && config_hash_grow(table) < 0)
+		return -1;
+
+	bucket = &table->buckets[hash & (table->size - 1)];
+	node->hash = hash;
+	node->next = *bucket;
+	*bucket = node;
+	table->count++;
+
+	return 0;
+}
+
+static struct config_hash_node *
+config_hash_first(struct config_hash *table, uint32_t hash)
+{
+	if (table->size == 0)
+		return NULL;
+
+	return table->buckets[hash & (table->size - 1)];
+}
+
+static uint32_t
+section_hash(const char *name)
+{
+	return config_hash_string(CONFIG_HASH_SEED, name);
+}
+
+static uint32_t
+key_hash(struct weston_config_section *section, const char *key)
+{
+	uint64_t p = (uintptr_t) section;
+
+	return config_hash_string(CONFIG_HASH_SEED ^ (uint32_t) (p ^ (p >> 32)),
+				  key);
+}
+
+static uint32_t
+value_hash(const char *section, const char *key, const char *value)
+{
+	uint32_t hash;
+
+	hash = config_hash_string(CONFIG_HASH_SEED, section);
+	hash = config_hash_string(hash, key);
+
+	return config_hash_string(hash, value);
+}
+
+static struct weston_config_section *
+config_find_section(struct weston_config *config, const char *name)
+{
+	struct config_hash_node *node;
+	struct weston_config_section *s;
+	uint32_t hash = section_hash(name);
+
+	for (node = config_hash_first(&config->sections, hash);
+	     node; node = node->next) {
+		s = container_of(node, struct weston_config_section, node);
+		if (node->hash == hash && strcmp(s->name, name) == 0)
+			return s;
+	}
+
+	return NULL;
+}
+
+static struct weston_config_entry *
+config_find_value(struct weston_config *config, const char *section,
+		  const char *key, const char *value)
+{
+	struct config_hash_node *node;
+	struct weston_config_entry *e;
+	uint32_t hash = value_hash(section, key, value);
+
+	for (node = config_hash_first(&config->values, hash);
+	     node; node = node->next) {
+		e = container_of(node, struct weston_config_entry, value_node);
+		if (node->hash == hash &&
+		    strcmp(e->value, value) == 0 &&
+		    strcmp(e->key, key) == 0 &&
+		    strcmp(e->section->name, section) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
 static int
 open_config_file(struct weston_config *c, const char *name)
 {
@@ -121,13 +298,21 @@ static struct weston_config_entry *
 config_section_get_entry(struct weston_config_section *section,
 			 const char *key)
 {
+	struct config_hash_node *node;
 	struct weston_config_entry *e;
+	uint32_t hash;
 
 	if (section == NULL)
 		return NULL;
-	wl_list_for_each(e, &section->entry_list, link)
-		if (strcmp(e->key, key) == 0)
+
+	hash = key_hash(section, key);
+	for (node = config_hash_first(&section->config->keys, hash);
+	     node; node = node->next) {
+		e = container_of(node, struct weston_config_entry, key_node);
+		if (node->hash == hash && e->section == section &&
+		    strcmp(e->key, key) == 0)
 			return e;
+	}
 
 	return NULL;
 }
@@ -137,22 +322,16 @@ struct weston_config_section *
 weston_config_get_section(struct weston_config *config, const char *section,
 			  const char *key, const char *value)
 {
-	struct weston_config_section *s;
 	struct weston_config_entry *e;
 
 	if (config == NULL)
 		return NULL;
-	wl_list_for_each(s, &config->section_list, link) {
-		if (strcmp(s->name, section) != 0)
-			continue;
-		if (key == NULL)
-			return s;
-		e = config_section_get_entry(s, key);
-		if (e && strcmp(e->value, value) == 0)
-			return s;
-	}
+	if (key == NULL)
+		return config_find_section(config, section);
 
-	return NULL;
+	e = config_find_value(config, section, key, value);
+
+	return e ? e->section : NULL;
 }
 
 WL_EXPORT
@@ -355,20 +534,34 @@ weston_config_get_name_from_env(void)
 }
 
 static struct weston_config_section *
-config_add_section(struct weston_config *config, const char *name)
+config_add_section(struct weston_config *config, const char *name, size_t len)
 {
-	struct weston_config_section *section;
+	struct weston_config_section *section, *first;
 
-	section = malloc(sizeof *section);
+	section = calloc(1, sizeof *section);
 	if (section == NULL)
 		return NULL;
 
-	section->name = strdup(name);
+	section->name = strndup(name, len);
 	if (section->name == NULL) {
 		free(section);
 		return NULL;
 	}
 
+	section->config = config;
+	first = config_find_section(config, section->name);
+	if (first) {
+		first->last_same->next_same = section;
+		first->last_same = section;
+	} else if (config_hash_insert(&config->sections, &section->node,
+				      section_hash(section->name)) < 0) {
+		free(section->name);
+		free(section);
+		return NULL;
+	} else {
+		section->last_same = section;
+	}
+
 	wl_list_init(&section->entry_list);
 	wl_list_insert(config->section_list.prev, &section->link);
 
@@ -377,47 +570,195 @@ config_add_section(struct weston_config *config, const char *name)
 
 static struct weston_config_entry *
 section_add_entry(struct weston_config_section *section,
-		  const char *key, const char *value)
+		  const char *key, size_t key_len,
+		  const char *value, size_t value_len)
 {
+	struct weston_config *config = section->config;
 	struct weston_config_entry *entry;
 
-	entry = malloc(sizeof *entry);
+	entry = calloc(1, sizeof *entry);
 	if (entry == NULL)
 		return NULL;
 
-	entry->key = strdup(key);
+	entry->key = strndup(key, key_len);
 	if (entry->key == NULL) {
 		free(entry);
 		return NULL;
 	}
 
-	entry->value = strdup(value);
+	entry->value = strndup(value, value_len);
 	if (entry->value == NULL) {
 		free(entry->key);
 		free(entry);
 		return NULL;
 	}
 
+	entry->section = section;
+
+	/* Only the first occurrence of a key in a section is visible,
+	 * and only the first section matching a name, key and value
+	 * pair is returned by weston_config_get_section(). */
+	if (config_section_get_entry(section, entry->key) == NULL) {
+		if (config_hash_insert(&config->keys, &entry->key_node,
+				       key_hash(section, entry->key)) < 0)
+			goto err_hash;
+
+		if (!config_find_value(config, section->name,
+				       entry->key, entry->value) &&
+		    config_hash_insert(&config->values, &entry->value_node,
+				       value_hash(section->name, entry->key,
+						  entry->value)) < 0)
+			goto err_hash;
+	}
+
 	wl_list_insert(section->entry_list.prev, &entry->link);
 
 	return entry;
+
+err_hash:
+	/* This fails the whole parse; the tables are then freed without
+	 * being walked, so a stale node left in one is harmless. */
+	free(entry->key);
+	free(entry->value);
+	free(entry);
+
+	return NULL;
+}
+
+static void
+config_init(struct weston_config *config)
+{
+	memset(config, 0, offsetof(struct weston_config, path));
+	wl_list_init(&config->section_list);
+	wl_list_init(&config->listener_list);
+	config->watch_fd = -1;
+}
+
+static void
+config_release(struct weston_config *config)
+{
+	struct weston_config_section *s, *next_s;
+	struct weston_config_entry *e, *next_e;
+
+	wl_list_for_each_safe(s, next_s, &config->section_list, link) {
+		wl_list_for_each_safe(e, next_e, &s->entry_list, link) {
+			free(e->key);
+			free(e->value);
+			free(e);
+		}
+		free(s->name);
+		free(s);
+	}
+	wl_list_init(&config->section_list);
+
+	config_hash_release(&config->sections);
+	config_hash_release(&config->keys);
+	config_hash_release(&config->values);
+}
+
+static const char *
+skip_space(const char *p, const char *end)
+{
+	while (p < end && isspace(*p))
+		p++;
+
+	return p;
+}
+
+/* Parses the whole file in one pass straight out of the mapping; no
+ * line is copied except for the strings that end up in the config. */
+static int
+config_parse_buffer(struct weston_config *config,
+		    const char *buffer, size_t size)
+{
+	struct weston_config_section *section = NULL;
+	const char *line, *end, *next, *eq, *p, *q;
+	const char *buffer_end = buffer + size;
+
+	for (line = buffer; line < buffer_end; line = next) {
+		end = memchr(line, '\n', buffer_end - line);
+		if (end) {
+			next = end + 1;
+		} else {
+			end = buffer_end;
+			next = buffer_end;
+		}
+
+		switch (line[0]) {
+		case '#':
+		case '\n':
+			continue;
+		case '[':
+			p = memchr(line + 1, ']', end - line - 1);
+			if (!p || p + 1 != end || next == end) {
+				fprintf(stderr, "malformed "
+					"section header: %.*s\n",
+					(int) (end - line), line);
+				return -1;
+			}
+			section = config_add_section(config, line + 1,
+						     p - line - 1);
+			if (section == NULL)
+				return -1;
+			continue;
+		default:
+			eq = memchr(line, '=', end - line);
+			if (!eq || eq == line || !section) {
+				fprintf(stderr, "malformed "
+					"config line: %.*s\n",
+					(int) (end - line), line);
+				return -1;
+			}
+
+			p = skip_space(eq + 1, end);
+			q = end;
+			while (q > p && isspace(q[-1]))
+				q--;
+			if (!section_add_entry(section, line, eq - line,
+					       p, q - p))
+				return -1;
+			continue;
+		}
+	}
+
+	return 0;
+}
+
+static int
+config_parse_fd(struct weston_config *config, int fd)
+{
+	struct stat filestat;
+	void *map;
+	int ret;
+
+	if (fstat(fd, &filestat) < 0 ||
+	    !S_ISREG(filestat.st_mode))
+		return -1;
+
+	if (filestat.st_size == 0)
+		return 0;
+
+	map = mmap(NULL, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	ret = config_parse_buffer(config, map, filestat.st_size);
+	munmap(map, filestat.st_size);
+
+	return ret;
 }
 
 struct weston_config *
 weston_config_parse(const char *name)
 {
-	FILE *fp;
-	char line[512], *p;
-	struct stat filestat;
 	struct weston_config *config;
-	struct weston_config_section *section = NULL;
-	int i, fd;
+	int fd, ret;
 
 	config = malloc(sizeof *config);
 	if (config == NULL)
 		return NULL;
 
-	wl_list_init(&config->section_list);
+	config_init(config);
 
 	fd = open_config_file(config, name);
 	if (fd == -1) {
@@ -425,63 +766,258 @@ weston_config_parse(const char *name)
 		return NULL;
 	}
 
-	if (fstat(fd, &filestat) < 0 ||
-	    !S_ISREG(filestat.st_mode)) {
-		close(fd);
-		free(config);
+	ret = config_parse_fd(config, fd);
+	close(fd);
+	if (ret < 0) {
+		weston_config_destroy(config);
 		return NULL;
 	}
 
-	fp = fdopen(fd, "r");
-	if (fp == NULL) {
-		free(config);
-		return NULL;
+	return config;
+}
+
+static void
+config_notify(struct weston_config *config,
+	      const struct weston_config_change *change)
+{
+	struct weston_config_listener *listener, *next;
+
+	wl_list_for_each_safe(listener, next, &config->listener_list, link)
+		listener->changed(listener, config, change);
+}
+
+/* Reports every key that differs between two instances of the same
+ * section, either of which may be NULL. */
+static int
+config_diff_section(struct weston_config *config,
+		    struct weston_config_section *old,
+		    struct weston_config_section *new)
+{
+	struct weston_config_change change;
+	struct weston_config_entry *e, *other;
+	int count = 0;
+
+	change.section_name = new ? new->name : old->name;
+
+	if (new) {
+		change.section = new;
+		wl_list_for_each(e, &new->entry_list, link) {
+			if (config_section_get_entry(new, e->key) != e)
+				continue;
+
+			other = config_section_get_entry(old, e->key);
+			if (other && strcmp(other->value, e->value) == 0)
+				continue;
+
+			change.key = e->key;
+			change.old_value = other ? other->value : NULL;
+			change.new_value = e->value;
+			config_notify(config, &change);
+			count++;
+		}
 	}
 
-	while (fgets(line, sizeof line, fp)) {
-		switch (line[0]) {
-		case '#':
-		case '\n':
-			continue;
-		case '[':
-			p = strchr(&line[1], ']');
-			if (!p || p[1] != '\n') {
-				fprintf(stderr, "malformed "
-					"section header: %s\n", line);
-				fclose(fp);
-				weston_config_destroy(config);
-				return NULL;
-			}
-			p[0] = '\0';
-			section = config_add_section(config, &line[1]);
+	if (old) {
+		change.section = new ? new : old;
+		wl_list_for_each(e, &old->entry_list, link) {
+			if (config_section_get_entry(old, e->key) != e ||
+			    config_section_get_entry(new, e->key))
+				continue;
+
+			change.key = e->key;
+			change.old_value = e->value;
+			change.new_value = NULL;
+			config_notify(config, &change);
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/* Sections are matched by name and by their position among the
+ * sections of that name, so the third [output] is compared with the
+ * third [output]. */
+static int
+config_diff(struct weston_config *config, struct weston_config *old)
+{
+	struct weston_config_section *s, *a, *b;
+	int count = 0;
+
+	wl_list_for_each(s, &config->section_list, link) {
+		if (s->last_same == NULL)
 			continue;
-		default:
-			p = strchr(line, '=');
-			if (!p || p == line || !section) {
-				fprintf(stderr, "malformed "
-					"config line: %s\n", line);
-				fclose(fp);
-				weston_config_destroy(config);
-				return NULL;
-			}
 
-			p[0] = '\0';
-			p++;
-			while (isspace(*p))
-				p++;
-			i = strlen(p);
-			while (i > 0 && isspace(p[i - 1])) {
-				p[i - 1] = '\0';
-				i--;
-			}
-			section_add_entry(section, line, p);
+		a = config_find_section(old, s->name);
+		for (b = s; a || b; ) {
+			count += config_diff_section(config, a, b);
+			a = a ? a->next_same : NULL;
+			b = b ? b->next_same : NULL;
+		}
+	}
+
+	wl_list_for_each(s, &old->section_list, link) {
+		if (s->last_same == NULL ||
+		    config_find_section(config, s->name))
 			continue;
+
+		for (a = s; a; a = a->next_same)
+			count += config_diff_section(config, a, NULL);
+	}
+
+	return count;
+}
+
+static void
+config_move(struct weston_config *dst, struct weston_config *src)
+{
+	wl_list_init(&dst->section_list);
+	wl_list_insert_list(&dst->section_list, &src->section_list);
+	wl_list_init(&src->section_list);
+
+	dst->sections = src->sections;
+	dst->keys = src->keys;
+	dst->values = src->values;
+	memset(&src->sections, 0, sizeof src->sections);
+	memset(&src->keys, 0, sizeof src->keys);
+	memset(&src->values, 0, sizeof src->values);
+}
+
+static void
+config_set_owner(struct weston_config *config)
+{
+	struct weston_config_section *s;
+
+	wl_list_for_each(s, &config->section_list, link)
+		s->config = config;
+}
+
+WL_EXPORT
+int
+weston_config_reload(struct weston_config *config)
+{
+	struct weston_config new, old;
+	int fd, ret;
+
+	if (config == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	config_init(&new);
+	fd = open(config->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	ret = config_parse_fd(&new, fd);
+	close(fd);
+	if (ret < 0) {
+		/* keep running with what we had */
+		config_release(&new);
+		return -1;
+	}
+
+	/* Swap the contents in place so the weston_config pointer held
+	 * by everyone stays valid; the old sections are kept alive
+	 * until the listeners have seen the changes. */
+	config_init(&old);
+	config_move(&old, config);
+	config_set_owner(&old);
+	config_move(config, &new);
+	config_set_owner(config);
+
+	ret = config_diff(config, &old);
+	config_release(&old);
+
+	return ret;
+}
+
+WL_EXPORT
+void
+weston_config_add_listener(struct weston_config *config,
+			   struct weston_config_listener *listener)
+{
+	wl_list_insert(config->listener_list.prev, &listener->link);
+}
+
+static const char *
+config_path_basename(struct weston_config *config)
+{
+	const char *p = strrchr(config->path, '/');
+
+	return p ? p + 1 : config->path;
+}
+
+WL_EXPORT
+int
+weston_config_watch(struct weston_config *config)
+{
+	char dir[PATH_MAX];
+	const char *base;
+	int fd;
+
+	if (config == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (config->watch_fd >= 0)
+		return config->watch_fd;
+
+	/* Editors usually replace the file instead of rewriting it, so
+	 * watch the directory and filter on the name. */
+	base = config_path_basename(config);
+	if (base == config->path)
+		snprintf(dir, sizeof dir, ".");
+	else
+		snprintf(dir, sizeof dir, "%.*s",
+			 (int) (base - config->path), config->path);
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	config->watch_fd = fd;
+
+	return fd;
+}
+
+WL_EXPORT
+int
+weston_config_dispatch_watch(struct weston_config *config)
+{
+	char buffer[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	const char *base = config_path_basename(config);
+	bool changed = false;
+	ssize_t len;
+	char *p;
+
+	if (config->watch_fd < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while ((len = read(config->watch_fd, buffer, sizeof buffer)) > 0) {
+		for (p = buffer; p < buffer + len;
+		     p += sizeof *event + event->len) {
+			event = (const struct inotify_event *) p;
+			if (event->mask & IN_Q_OVERFLOW)
+				changed = true;
+			else if (event->len && strcmp(event->name, base) == 0)
+				changed = true;
 		}
 	}
 
-	fclose(fp);
+	if (!changed)
+		return 0;
 
-	return config;
+	return weston_config_reload(config);
 }
 
 const char *
@@ -517,21 +1053,12 @@ weston_config_next_section(struct weston_config *config,
 void
 weston_config_destroy(struct weston_config *config)
 {
-	struct weston_config_section *s, *next_s;
-	struct weston_config_entry *e, *next_e;
-
 	if (config == NULL)
 		return;
 
-	wl_list_for_each_safe(s, next_s, &config->section_list, link) {
-		wl_list_for_each_safe(e, next_e, &s->entry_list, link) {
-			free(e->key);
-			free(e->value);
-			free(e);
-		}
-		free(s->name);
-		free(s);
-	}
+	config_release(config);
+	if (config->watch_fd >= 0)
+		close(config->watch_fd);
 
 	free(config);
 }
@@ -31,6 +31,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <wayland-util.h>
 
 #define WESTON_CONFIG_FILE_ENV_VAR "WESTON_CONFIG_FILE"
 
@@ -122,6 +123,41 @@ int weston_config_next_section(struct weston_config *config,
 			       struct weston_config_section **section,
 			       const char **name);
 
+/** One key that differs after weston_config_reload().
+ *
+ * \c section is the section in the reloaded config, or the old one
+ * when the whole section is gone; either way it is only valid during
+ * the callback.  Section pointers looked up before a reload must not
+ * be used after it.
+ */
+struct weston_config_change {
+	const char *section_name;
+	struct weston_config_section *section;
+	const char *key;
+	const char *old_value;	/* NULL if the key was added */
+	const char *new_value;	/* NULL if the key was removed */
+};
+
+struct weston_config_listener {
+	struct wl_list link;
+	void (*changed)(struct weston_config_listener *listener,
+			struct weston_config *config,
+			const struct weston_config_change *change);
+};
+
+void
+weston_config_add_listener(struct weston_config *config,
+			   struct weston_config_listener *listener);
+
+int
+weston_config_reload(struct weston_config *config);
+
+int
+weston_config_watch(struct weston_config *config);
+
+int
+weston_config_dispatch_watch(struct weston_config *config);
+
 
 #ifdef  __cplusplus
 }
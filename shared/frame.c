@@ -100,6 +100,14 @@ struct frame {
 	int geometry_dirty;
 
 	cairo_rectangle_int_t title_rect;
+	struct theme_title_cache title_cache;
+
+	/* what frame_repaint_cached() painted last */
+	struct {
+		int valid;
+		int32_t width, height;
+		uint32_t flags;
+	} painted;
 
 	uint32_t status;
 
@@ -319,6 +327,7 @@ frame_destroy(struct frame *frame)
 	wl_list_for_each_safe(pointer, next_pointer, &frame->pointers, link)
 		frame_pointer_destroy(pointer);
 
+	theme_title_cache_release(&frame->title_cache);
 	free(frame->title);
 	free(frame);
 }
@@ -433,6 +442,10 @@ frame_set_title(struct frame *frame, const char *title)
 {
 	char *dup = NULL;
 
+	if (title == frame->title ||
+	    (title && frame->title && strcmp(title, frame->title) == 0))
+		return 0;
+
 	if (title) {
 		dup = strdup(title);
 		if (!dup)
@@ -441,6 +454,7 @@ frame_set_title(struct frame *frame, const char *title)
 
 	free(frame->title);
 	frame->title = dup;
+	theme_title_cache_release(&frame->title_cache);
 
 	frame->geometry_dirty = 1;
 	frame->status |= FRAME_STATUS_REPAINT;
@@ -994,20 +1008,30 @@ frame_double_touch_up(struct frame *frame, void *data, int32_t id)
 	}
 }
 
-void
-frame_repaint(struct frame *frame, cairo_t *cr)
+static uint32_t
+frame_get_theme_flags(struct frame *frame)
 {
-	struct frame_button *button;
 	uint32_t flags = 0;
 
-	frame_refresh_geometry(frame);
-
 	if (frame->flags & FRAME_FLAG_MAXIMIZED)
 		flags |= THEME_FRAME_MAXIMIZED;
 
 	if (frame->flags & FRAME_FLAG_ACTIVE)
 		flags |= THEME_FRAME_ACTIVE;
 
+	return flags;
+}
+
+void
+frame_repaint(struct frame *frame, cairo_t *cr)
+{
+	struct frame_button *button;
+	uint32_t flags;
+
+	frame_refresh_geometry(frame);
+
+	flags = frame_get_theme_flags(frame);
+
 	cairo_save(cr);
 	theme_render_frame(frame->theme, cr, frame->width, frame->height,
 			   frame->title, &frame->title_rect,
@@ -1019,3 +1043,54 @@ frame_repaint(struct frame *frame, cairo_t *cr)
 
 	frame_status_clear(frame, FRAME_STATUS_REPAINT);
 }
+
+void
+frame_repaint_cached(struct frame *frame, cairo_t *cr)
+{
+	struct frame_button *button;
+	uint32_t flags;
+
+	frame_refresh_geometry(frame);
+
+	flags = frame_get_theme_flags(frame);
+	if (!frame->title && wl_list_empty(&frame->buttons))
+		flags |= THEME_FRAME_NO_TITLE;
+
+	cairo_save(cr);
+
+	if (frame->painted.valid &&
+	    frame->painted.width == frame->width &&
+	    frame->painted.height == frame->height &&
+	    frame->painted.flags == flags) {
+		/* Only the title and the button states can have changed,
+		 * the rest is still there from last time. */
+		cairo_rectangle(cr, frame->interior.x, frame->shadow_margin,
+				frame->interior.width,
+				frame->interior.y - frame->shadow_margin);
+		cairo_clip(cr);
+	}
+
+	theme_render_border(frame->theme, cr,
+			    frame->width, frame->height, flags);
+	theme_render_title_cached(frame->theme, cr, &frame->title_cache,
+				  frame->width, frame->title,
+				  &frame->title_rect, flags);
+
+	wl_list_for_each(button, &frame->buttons, link)
+		frame_button_repaint(button, cr);
+
+	cairo_restore(cr);
+
+	frame->painted.valid = 1;
+	frame->painted.width = frame->width;
+	frame->painted.height = frame->height;
+	frame->painted.flags = flags;
+
+	frame_status_clear(frame, FRAME_STATUS_REPAINT);
+}
+
+void
+frame_repaint_invalidate(struct frame *frame)
+{
+	frame->painted.valid = 0;
+}
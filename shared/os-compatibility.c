@@ -33,6 +33,9 @@
 #include <sys/epoll.h>
 #include <string.h>
 #include <stdlib.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 
 #include "os-compatibility.h"
 
@@ -147,6 +150,9 @@ create_tmpfile_cloexec(char *tmpname)
  * given size. If disk space is insufficient, errno is set to ENOSPC.
  * If posix_fallocate() is not supported, program may receive
  * SIGBUS on accessing mmap()'ed file contents instead.
+ *
+ * If memfd_create() is available, the file is a memfd created with
+ * MFD_ALLOW_SEALING, so the caller may add seals with F_ADD_SEALS.
  */
 int
 os_create_anonymous_file(off_t size)
@@ -155,7 +161,19 @@ os_create_anonymous_file(off_t size)
 	const char *path;
 	char *name;
 	int fd;
-	int ret;
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("weston-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0) {
+		if (os_resize_anonymous_file(fd, size) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+	/* Fall back to XDG_RUNTIME_DIR on kernels without memfd. */
+#endif
 
 	path = getenv("XDG_RUNTIME_DIR");
 	if (!path) {
@@ -177,12 +195,28 @@ os_create_anonymous_file(off_t size)
 	if (fd < 0)
 		return -1;
 
+	if (os_resize_anonymous_file(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Grow a file created by os_create_anonymous_file() to @size bytes,
+ * with the same guarantees as at creation.
+ */
+int
+os_resize_anonymous_file(int fd, off_t size)
+{
+	int ret;
+
 #ifdef HAVE_POSIX_FALLOCATE
 	do {
 		ret = posix_fallocate(fd, 0, size);
 	} while (ret == EINTR);
 	if (ret != 0) {
-		close(fd);
 		errno = ret;
 		return -1;
 	}
@@ -190,13 +224,11 @@ os_create_anonymous_file(off_t size)
 	do {
 		ret = ftruncate(fd, size);
 	} while (ret < 0 && errno == EINTR);
-	if (ret < 0) {
-		close(fd);
+	if (ret < 0)
 		return -1;
-	}
 #endif
 
-	return fd;
+	return 0;
 }
 
 #ifndef HAVE_STRCHRNUL
@@ -0,0 +1,296 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Compare two result files written by the benchmark suite, e.g.
+ *
+ *   make benchmark && cp logs/benchmark.json baseline.json
+ *   ... rebuild with the change ...
+ *   make benchmark && ./bench-compare baseline.json logs/benchmark.json
+ *
+ * Exits with 1 if any metric got worse by more than the threshold, so
+ * that it can gate a CI job. All metrics are times, lower is better.
+ * If a file holds several runs of the same benchmark, e.g. from
+ * running "make benchmark" repeatedly without cleaning, the best run is
+ * used, which filters out most of the scheduling noise.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared/config-parser.h"
+#include "shared/helpers.h"
+
+struct result {
+	char benchmark[64];
+	char metric[32];
+	double value;
+	bool matched;
+};
+
+struct result_set {
+	struct result *results;
+	int count;
+	int alloc;
+};
+
+static const char * const stat_names[] = {
+	"min", "median", "p95", "p99", "max", "mean"
+};
+
+/* The result files hold one flat JSON object per line, as written by
+ * bench_finish(); this is not a general JSON parser. */
+static const char *
+json_find_value(const char *line, const char *key)
+{
+	char pattern[64];
+	const char *p;
+
+	snprintf(pattern, sizeof pattern, "\"%s\":", key);
+	p = strstr(line, pattern);
+	if (!p)
+		return NULL;
+
+	p += strlen(pattern);
+	while (*p == ' ')
+		p++;
+
+	return p;
+}
+
+static bool
+json_get_string(const char *line, const char *key, char *out, size_t len)
+{
+	const char *p, *end;
+
+	p = json_find_value(line, key);
+	if (!p || *p != '"')
+		return false;
+
+	p++;
+	end = strchr(p, '"');
+	if (!end || (size_t)(end - p) >= len)
+		return false;
+
+	memcpy(out, p, end - p);
+	out[end - p] = '\0';
+
+	return true;
+}
+
+static bool
+json_get_number(const char *line, const char *key, double *out)
+{
+	const char *p;
+	char *end;
+
+	p = json_find_value(line, key);
+	if (!p)
+		return false;
+
+	*out = strtod(p, &end);
+
+	return end != p;
+}
+
+static struct result *
+result_set_find(struct result_set *set, const char *benchmark,
+		const char *metric)
+{
+	int i;
+
+	for (i = 0; i < set->count; i++) {
+		if (strcmp(set->results[i].benchmark, benchmark) == 0 &&
+		    strcmp(set->results[i].metric, metric) == 0)
+			return &set->results[i];
+	}
+
+	return NULL;
+}
+
+static int
+result_set_load(struct result_set *set, const char *path, const char *stat)
+{
+	struct result r = { 0 }, *found;
+	char *line = NULL;
+	size_t n = 0;
+	int lineno = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "cannot open %s: %m\n", path);
+		return -1;
+	}
+
+	while (getline(&line, &n, fp) != -1) {
+		lineno++;
+		if (strspn(line, " \t\n") == strlen(line))
+			continue;
+
+		if (!json_get_string(line, "benchmark", r.benchmark,
+				     sizeof r.benchmark) ||
+		    !json_get_string(line, "metric", r.metric,
+				     sizeof r.metric) ||
+		    !json_get_number(line, stat, &r.value)) {
+			fprintf(stderr, "%s:%d: not a benchmark result, "
+				"ignored\n", path, lineno);
+			continue;
+		}
+
+		found = result_set_find(set, r.benchmark, r.metric);
+		if (found) {
+			if (r.value < found->value)
+				found->value = r.value;
+			continue;
+		}
+
+		if (set->count == set->alloc) {
+			set->alloc = set->alloc ? set->alloc * 2 : 32;
+			set->results = realloc(set->results,
+					       set->alloc * sizeof r);
+			if (!set->results) {
+				fprintf(stderr, "out of memory\n");
+				exit(2);
+			}
+		}
+		set->results[set->count++] = r;
+	}
+
+	free(line);
+	fclose(fp);
+
+	return 0;
+}
+
+static void
+usage(const char *name, int status)
+{
+	fprintf(status == EXIT_SUCCESS ? stdout : stderr,
+		"Usage: %s [options] BASELINE CANDIDATE\n"
+		"\n"
+		"Compare benchmark results of two builds.\n"
+		"\n"
+		"  --stat=STAT\t\tstatistic to compare: min, median, p95, p99,\n"
+		"\t\t\tmax or mean (default: median)\n"
+		"  --threshold=PERCENT\tslowdown reported as a regression "
+		"(default: 10)\n"
+		"  -h, --help\t\tThis help text\n", name);
+	exit(status);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct result_set baseline = { 0 }, candidate = { 0 };
+	struct result *base, *cand;
+	char *stat = NULL;
+	int threshold = 10;
+	int help = 0;
+	int regressions = 0;
+	double change;
+	const char *verdict;
+	unsigned i;
+	int j;
+
+	const struct weston_option options[] = {
+		{ WESTON_OPTION_STRING, "stat", 0, &stat },
+		{ WESTON_OPTION_INTEGER, "threshold", 0, &threshold },
+		{ WESTON_OPTION_BOOLEAN, "help", 'h', &help },
+	};
+
+	if (parse_options(options, ARRAY_LENGTH(options), &argc, argv) != 3)
+		usage(argv[0], help ? EXIT_SUCCESS : 2);
+	if (help)
+		usage(argv[0], EXIT_SUCCESS);
+
+	if (!stat)
+		stat = strdup("median");
+	for (i = 0; i < ARRAY_LENGTH(stat_names); i++)
+		if (strcmp(stat, stat_names[i]) == 0)
+			break;
+	if (i == ARRAY_LENGTH(stat_names) || threshold < 0) {
+		fprintf(stderr, "invalid --stat or --threshold\n");
+		usage(argv[0], 2);
+	}
+
+	if (result_set_load(&baseline, argv[1], stat) < 0 ||
+	    result_set_load(&candidate, argv[2], stat) < 0)
+		return 2;
+
+	printf("%-24s %-12s %14s %14s %9s\n", "benchmark", "metric",
+	       "baseline", "candidate", stat);
+
+	for (j = 0; j < candidate.count; j++) {
+		cand = &candidate.results[j];
+		base = result_set_find(&baseline, cand->benchmark,
+				       cand->metric);
+		if (!base) {
+			printf("%-24s %-12s %14s %14.0f %9s\n",
+			       cand->benchmark, cand->metric, "-",
+			       cand->value, "new");
+			continue;
+		}
+		base->matched = true;
+
+		if (base->value > 0)
+			change = 100.0 * (cand->value - base->value) /
+				 base->value;
+		else
+			change = cand->value > 0 ? 100.0 : 0.0;
+
+		if (change > threshold) {
+			verdict = "  REGRESSION";
+			regressions++;
+		} else if (change < -threshold) {
+			verdict = "  improved";
+		} else {
+			verdict = "";
+		}
+
+		printf("%-24s %-12s %14.0f %14.0f %+8.1f%%%s\n",
+		       cand->benchmark, cand->metric, base->value,
+		       cand->value, change, verdict);
+	}
+
+	for (j = 0; j < baseline.count; j++) {
+		base = &baseline.results[j];
+		if (!base->matched)
+			printf("%-24s %-12s %14.0f %14s %9s\n",
+			       base->benchmark, base->metric, base->value,
+			       "-", "missing");
+	}
+
+	if (regressions)
+		printf("\n%d metric(s) regressed by more than %d%% in %s\n",
+		       regressions, threshold, stat);
+
+	free(baseline.results);
+	free(candidate.results);
+	free(stat);
+
+	return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
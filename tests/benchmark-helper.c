@@ -0,0 +1,372 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "presentation-time-client-protocol.h"
+#include "benchmark-helper.h"
+
+struct bench {
+	struct client *client;
+	char *name;
+	struct wp_presentation *presentation;
+	clockid_t clk_id;
+	struct wl_list feedback_list;
+	struct wl_array latencies; /* int64_t nsec */
+	uint32_t discarded;
+};
+
+struct bench_feedback {
+	struct bench *bench;
+	struct wp_presentation_feedback *obj;
+	struct timespec commit_time;
+	struct wl_list link;
+};
+
+struct bench_stats {
+	size_t count;
+	int64_t min;
+	int64_t median;
+	int64_t p95;
+	int64_t p99;
+	int64_t max;
+	double mean;
+};
+
+int
+bench_frame_count(void)
+{
+	const char *env;
+	char *end;
+	long frames;
+
+	env = getenv("WESTON_BENCH_FRAMES");
+	if (!env)
+		return 300;
+
+	frames = strtol(env, &end, 10);
+	assert(*env != '\0' && *end == '\0' && "bad WESTON_BENCH_FRAMES");
+	assert(frames > 0 && frames <= 100000);
+
+	return frames;
+}
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct bench *bench = data;
+
+	bench->clk_id = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
+static void
+bench_feedback_destroy(struct bench_feedback *fb)
+{
+	wp_presentation_feedback_destroy(fb->obj);
+	wl_list_remove(&fb->link);
+	free(fb);
+}
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi,
+		   uint32_t tv_sec_lo,
+		   uint32_t tv_nsec,
+		   uint32_t refresh_nsec,
+		   uint32_t seq_hi,
+		   uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct bench_feedback *fb = data;
+	struct timespec present;
+	int64_t *latency;
+
+	timespec_from_proto(&present, tv_sec_hi, tv_sec_lo, tv_nsec);
+
+	latency = wl_array_add(&fb->bench->latencies, sizeof *latency);
+	assert(latency);
+	*latency = timespec_sub_to_nsec(&present, &fb->commit_time);
+
+	bench_feedback_destroy(fb);
+}
+
+static void
+feedback_discarded(void *data,
+		   struct wp_presentation_feedback *presentation_feedback)
+{
+	struct bench_feedback *fb = data;
+
+	fb->bench->discarded++;
+	bench_feedback_destroy(fb);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+struct bench *
+bench_create(struct client *client, const char *name)
+{
+	struct bench *bench;
+	struct global *g;
+
+	bench = xzalloc(sizeof *bench);
+	bench->client = client;
+	bench->name = strdup(name);
+	assert(bench->name);
+	bench->clk_id = -1;
+	wl_list_init(&bench->feedback_list);
+	wl_array_init(&bench->latencies);
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, wp_presentation_interface.name) == 0)
+			break;
+	}
+	assert(&g->link != &client->global_list &&
+	       "no presentation found");
+
+	bench->presentation = wl_registry_bind(client->wl_registry, g->name,
+					       &wp_presentation_interface, 1);
+	assert(bench->presentation);
+	wp_presentation_add_listener(bench->presentation,
+				     &presentation_listener, bench);
+	client_roundtrip(client);
+	assert(bench->clk_id != (clockid_t) -1);
+
+	return bench;
+}
+
+void
+bench_start(struct bench *bench)
+{
+	struct test *test = bench->client->test;
+
+	wl_array_release(&test->perf_samples);
+	wl_array_init(&test->perf_samples);
+	test->perf_done = 0;
+
+	weston_test_perf_start(test->weston_test);
+	client_roundtrip(bench->client);
+}
+
+void
+bench_commit(struct bench *bench, struct wl_surface *surface)
+{
+	struct bench_feedback *fb;
+
+	fb = xzalloc(sizeof *fb);
+	fb->bench = bench;
+	fb->obj = wp_presentation_feedback(bench->presentation, surface);
+	wp_presentation_feedback_add_listener(fb->obj, &feedback_listener, fb);
+	wl_list_insert(&bench->feedback_list, &fb->link);
+
+	clock_gettime(bench->clk_id, &fb->commit_time);
+	wl_surface_commit(surface);
+}
+
+static int
+compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a;
+	int64_t y = *(const int64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted values, p in percent. */
+static int64_t
+percentile(const int64_t *sorted, size_t count, unsigned p)
+{
+	size_t rank = (count * p + 99) / 100;
+
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void
+bench_stats_compute(struct bench_stats *stats, int64_t *values, size_t count)
+{
+	double sum = 0.0;
+	size_t i;
+
+	memset(stats, 0, sizeof *stats);
+	stats->count = count;
+	if (count == 0)
+		return;
+
+	qsort(values, count, sizeof *values, compare_int64);
+	for (i = 0; i < count; i++)
+		sum += values[i];
+
+	stats->min = values[0];
+	stats->median = percentile(values, count, 50);
+	stats->p95 = percentile(values, count, 95);
+	stats->p99 = percentile(values, count, 99);
+	stats->max = values[count - 1];
+	stats->mean = sum / count;
+}
+
+static void
+bench_report_metric(struct bench *bench, FILE *fp, const char *metric,
+		    int64_t *values, size_t count)
+{
+	struct bench_stats stats;
+
+	bench_stats_compute(&stats, values, count);
+
+	fprintf(fp, "{\"benchmark\": \"%s\", \"metric\": \"%s\", "
+		"\"samples\": %zu, \"min\": %" PRId64 ", "
+		"\"median\": %" PRId64 ", \"p95\": %" PRId64 ", "
+		"\"p99\": %" PRId64 ", \"max\": %" PRId64 ", "
+		"\"mean\": %.0f}\n",
+		bench->name, metric, stats.count, stats.min, stats.median,
+		stats.p95, stats.p99, stats.max, stats.mean);
+}
+
+void
+bench_finish(struct bench *bench)
+{
+	struct client *client = bench->client;
+	struct test *test = client->test;
+	struct perf_sample *sample;
+	struct bench_feedback *fb, *tmp;
+	const char *path;
+	int64_t *repaint, *cpu;
+	size_t count, i = 0;
+	FILE *fp;
+
+	/* Every commit gets presented or discarded eventually, as long as
+	 * the surfaces stay mapped. */
+	while (!wl_list_empty(&bench->feedback_list))
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+
+	weston_test_perf_stop(test->weston_test);
+	while (!test->perf_done)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+
+	count = test->perf_samples.size / sizeof *sample;
+	repaint = xzalloc((count + 1) * sizeof *repaint);
+	cpu = xzalloc((count + 1) * sizeof *cpu);
+	wl_array_for_each(sample, &test->perf_samples) {
+		repaint[i] = sample->repaint_nsec;
+		cpu[i] = sample->cpu_nsec;
+		i++;
+	}
+
+	path = getenv("WESTON_BENCH_OUTPUT");
+	if (path) {
+		fp = fopen(path, "a");
+		assert(fp && "cannot open WESTON_BENCH_OUTPUT");
+	} else {
+		fp = stdout;
+	}
+
+	bench_report_metric(bench, fp, "repaint_ns", repaint, count);
+	bench_report_metric(bench, fp, "cpu_ns", cpu, count);
+	bench_report_metric(bench, fp, "latency_ns", bench->latencies.data,
+			    bench->latencies.size / sizeof(int64_t));
+
+	if (fp != stdout)
+		fclose(fp);
+	else
+		fflush(fp);
+
+	fprintf(stderr, "benchmark %s: %zu repaints, %zu presented, "
+		"%u discarded, %u repaints not recorded\n", bench->name,
+		count, bench->latencies.size / sizeof(int64_t),
+		bench->discarded, test->perf_dropped);
+
+	free(repaint);
+	free(cpu);
+
+	wl_list_for_each_safe(fb, tmp, &bench->feedback_list, link)
+		bench_feedback_destroy(fb);
+	wp_presentation_destroy(bench->presentation);
+	wl_array_release(&bench->latencies);
+	free(bench->name);
+	free(bench);
+}
+
+struct surface *
+bench_create_surface(struct client *client, int x, int y,
+		     int width, int height)
+{
+	struct surface *surface;
+
+	surface = create_test_surface(client);
+	surface->x = x;
+	surface->y = y;
+	surface->width = width;
+	surface->height = height;
+	surface->buffer = create_shm_buffer_a8r8g8b8(client, width, height);
+	bench_fill(surface->buffer, 0, 0, width, height, 0xff404040);
+
+	weston_test_move_surface(client->test->weston_test,
+				 surface->wl_surface, x, y);
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0, width, height);
+	wl_surface_commit(surface->wl_surface);
+
+	return surface;
+}
+
+void
+bench_fill(struct buffer *buffer, int x, int y, int width, int height,
+	   uint32_t color)
+{
+	pixman_color_t pcolor = {
+		.alpha = ((color >> 24) & 0xff) * 0x101,
+		.red = ((color >> 16) & 0xff) * 0x101,
+		.green = ((color >> 8) & 0xff) * 0x101,
+		.blue = (color & 0xff) * 0x101,
+	};
+	pixman_rectangle16_t rect = { x, y, width, height };
+
+	pixman_image_fill_rectangles(PIXMAN_OP_SRC, buffer->image,
+				     &pcolor, 1, &rect);
+}
@@ -0,0 +1,84 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BENCHMARK_HELPER_H
+#define BENCHMARK_HELPER_H
+
+#include "config.h"
+
+#include <stdint.h>
+
+struct client;
+struct buffer;
+struct surface;
+struct wl_surface;
+struct bench;
+
+/** Number of measured frames per benchmark
+ *
+ * 300 by default, or the value of the WESTON_BENCH_FRAMES environment
+ * variable.
+ */
+int
+bench_frame_count(void);
+
+/** Start a named benchmark on a client
+ *
+ * Binds wp_presentation to measure commit-to-present latency. Nothing
+ * is recorded until bench_start().
+ */
+struct bench *
+bench_create(struct client *client, const char *name);
+
+/** Start recording compositor repaint statistics
+ *
+ * Call this after the workload has been set up and warmed up, so that
+ * setup costs do not end up in the results.
+ */
+void
+bench_start(struct bench *bench);
+
+/** Commit a surface and measure its commit-to-present latency */
+void
+bench_commit(struct bench *bench, struct wl_surface *surface);
+
+/** Stop recording, write the results and destroy the benchmark
+ *
+ * Waits for all outstanding presentation feedback, then writes one JSON
+ * object per line for each metric (repaint_ns, cpu_ns, latency_ns) to
+ * the file named by WESTON_BENCH_OUTPUT, or to stdout if that is unset.
+ */
+void
+bench_finish(struct bench *bench);
+
+/** Create a mapped surface with a solid SHM buffer at x, y */
+struct surface *
+bench_create_surface(struct client *client, int x, int y,
+		     int width, int height);
+
+/** Fill a rectangle of an SHM buffer with an a8r8g8b8 color */
+void
+bench_fill(struct buffer *buffer, int x, int y, int width, int height,
+	   uint32_t color);
+
+#endif /* BENCHMARK_HELPER_H */
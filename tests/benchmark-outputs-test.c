@@ -0,0 +1,92 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "shared/helpers.h"
+#include "weston-test-client-helper.h"
+#include "benchmark-helper.h"
+
+/* Outputs are laid out left to right, OUTPUT_WIDTH apart. */
+#define OUTPUT_COUNT 4
+#define OUTPUT_WIDTH 640
+#define OUTPUT_HEIGHT 480
+
+char *server_parameters = "--use-pixman --width=640 --height=480 "
+			  "--output-count=4";
+
+#define WARMUP_FRAMES 10
+
+/* One surface in the middle of every output and one across every
+ * boundary between two outputs, all updated every frame. */
+TEST(many_outputs)
+{
+	struct client *client;
+	struct surface *surfaces[2 * OUTPUT_COUNT - 1];
+	struct bench *bench;
+	int frames = bench_frame_count();
+	int n = 0;
+	int frame, i, done;
+
+	client = create_client();
+	bench = bench_create(client, "many-outputs-4");
+
+	for (i = 0; i < OUTPUT_COUNT; i++)
+		surfaces[n++] = bench_create_surface(client,
+						     i * OUTPUT_WIDTH + 192,
+						     112, 256, 256);
+	for (i = 1; i < OUTPUT_COUNT; i++)
+		surfaces[n++] = bench_create_surface(client,
+						     i * OUTPUT_WIDTH - 160,
+						     OUTPUT_HEIGHT - 200,
+						     320, 160);
+	client_roundtrip(client);
+
+	for (frame = -WARMUP_FRAMES; frame < frames; frame++) {
+		if (frame == 0)
+			bench_start(bench);
+
+		for (i = 0; i < n; i++) {
+			struct surface *s = surfaces[i];
+			int x = ((frame + WARMUP_FRAMES) * 4) % (s->width - 32);
+
+			bench_fill(s->buffer, x, 0, 32, s->height,
+				   0xff000000 | (frame * 0x030201));
+			wl_surface_attach(s->wl_surface, s->buffer->proxy,
+					  0, 0);
+			wl_surface_damage(s->wl_surface, x, 0, 32, s->height);
+			if (i == 0)
+				frame_callback_set(s->wl_surface, &done);
+			if (frame >= 0)
+				bench_commit(bench, s->wl_surface);
+			else
+				wl_surface_commit(s->wl_surface);
+		}
+		frame_callback_wait(client, &done);
+	}
+
+	bench_finish(bench);
+}
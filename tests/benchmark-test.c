@@ -0,0 +1,325 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "benchmark-helper.h"
+
+/* Synthetic client workloads for measuring compositor performance, run
+ * with "make benchmark" rather than "make check". Each test renders
+ * WARMUP_FRAMES unmeasured frames and then bench_frame_count() measured
+ * ones, paced by frame callbacks.
+ */
+
+char *server_parameters = "--use-pixman --width=1280 --height=720";
+
+#define WARMUP_FRAMES 10
+
+static void
+commit(struct bench *bench, struct wl_surface *surface, int frame)
+{
+	if (frame >= 0)
+		bench_commit(bench, surface);
+	else
+		wl_surface_commit(surface);
+}
+
+/* Animate a small square in the surface and damage only that. */
+static void
+damage_square(struct surface *surface, int frame)
+{
+	int size = MIN(16, MIN(surface->width, surface->height));
+	int x = ((frame + WARMUP_FRAMES) * 4) % (surface->width - size + 1);
+	int y = (surface->height - size) / 2;
+
+	bench_fill(surface->buffer, x, y, size, size,
+		   0xff000000 | (frame * 0x010203));
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, x, y, size, size);
+}
+
+static const int shm_damage_counts[] = { 1, 16, 64 };
+
+TEST_P(shm_damage, shm_damage_counts)
+{
+	const int *count = data;
+	struct client *client;
+	struct surface **surfaces;
+	struct bench *bench;
+	char name[64];
+	int frames = bench_frame_count();
+	int frame, i, done;
+
+	client = create_client();
+	snprintf(name, sizeof name, "shm-damage-%d", *count);
+	bench = bench_create(client, name);
+
+	surfaces = xzalloc(*count * sizeof *surfaces);
+	for (i = 0; i < *count; i++)
+		surfaces[i] = bench_create_surface(client,
+						   16 + (i % 16) * 76,
+						   16 + (i / 16) * 76,
+						   64, 64);
+	client_roundtrip(client);
+
+	for (frame = -WARMUP_FRAMES; frame < frames; frame++) {
+		if (frame == 0)
+			bench_start(bench);
+
+		for (i = 0; i < *count; i++) {
+			damage_square(surfaces[i], frame);
+			if (i == 0)
+				frame_callback_set(surfaces[i]->wl_surface,
+						   &done);
+			commit(bench, surfaces[i]->wl_surface, frame);
+		}
+		frame_callback_wait(client, &done);
+	}
+
+	bench_finish(bench);
+	free(surfaces);
+}
+
+struct tree_node {
+	struct surface *surface;
+	struct wl_subsurface *wl_subsurface;
+};
+
+#define TREE_FANOUT 4
+#define TREE_DEPTH 3
+
+static struct wl_subcompositor *
+get_subcompositor(struct client *client)
+{
+	struct global *g;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, "wl_subcompositor") == 0)
+			return wl_registry_bind(client->wl_registry, g->name,
+						&wl_subcompositor_interface,
+						1);
+	}
+
+	assert(0 && "no wl_subcompositor found");
+	return NULL;
+}
+
+/* Add the children of node to nodes[], breadth first, and return the
+ * number of nodes added. */
+static int
+tree_add_children(struct client *client, struct wl_subcompositor *subco,
+		  struct tree_node *nodes, int parent, int next, int level)
+{
+	struct surface *ps = nodes[parent].surface;
+	int size = ps->width / 2 - 8;
+	int i;
+
+	for (i = 0; i < TREE_FANOUT; i++) {
+		struct tree_node *node = &nodes[next + i];
+		struct surface *surface;
+
+		surface = create_test_surface(client);
+		surface->width = size;
+		surface->height = size;
+		surface->buffer = create_shm_buffer_a8r8g8b8(client, size, size);
+		bench_fill(surface->buffer, 0, 0, size, size,
+			   0xff000000 | (0x303030 * level));
+		node->surface = surface;
+
+		node->wl_subsurface =
+			wl_subcompositor_get_subsurface(subco,
+							surface->wl_surface,
+							ps->wl_surface);
+		wl_subsurface_set_position(node->wl_subsurface,
+					   4 + (i % 2) * (size + 8),
+					   4 + (i / 2) * (size + 8));
+
+		wl_surface_attach(surface->wl_surface,
+				  surface->buffer->proxy, 0, 0);
+		wl_surface_damage(surface->wl_surface, 0, 0, size, size);
+		wl_surface_commit(surface->wl_surface);
+	}
+
+	return TREE_FANOUT;
+}
+
+TEST(subsurface_tree)
+{
+	struct client *client;
+	struct wl_subcompositor *subco;
+	struct tree_node *nodes;
+	struct surface *root;
+	struct bench *bench;
+	int frames = bench_frame_count();
+	int n_nodes = 1, level_start = 0, level_end = 1;
+	int frame, level, i, done;
+
+	client = create_client();
+	bench = bench_create(client, "subsurface-tree");
+	subco = get_subcompositor(client);
+
+	/* 1 + 4 + 16 + 64 surfaces */
+	nodes = xzalloc(85 * sizeof *nodes);
+	root = bench_create_surface(client, 64, 64, 520, 520);
+	nodes[0].surface = root;
+
+	for (level = 1; level <= TREE_DEPTH; level++) {
+		for (i = level_start; i < level_end; i++)
+			n_nodes += tree_add_children(client, subco, nodes, i,
+						     n_nodes, level);
+		level_start = level_end;
+		level_end = n_nodes;
+	}
+	assert(n_nodes == 85);
+
+	wl_surface_commit(root->wl_surface);
+	client_roundtrip(client);
+
+	/* The leaves are synchronized, so their updates reach the screen
+	 * when the root is committed. */
+	for (frame = -WARMUP_FRAMES; frame < frames; frame++) {
+		if (frame == 0)
+			bench_start(bench);
+
+		for (i = level_start; i < level_end; i++) {
+			damage_square(nodes[i].surface, frame);
+			wl_surface_commit(nodes[i].surface->wl_surface);
+		}
+
+		frame_callback_set(root->wl_surface, &done);
+		commit(bench, root->wl_surface, frame);
+		frame_callback_wait(client, &done);
+	}
+
+	bench_finish(bench);
+
+	for (i = n_nodes - 1; i > 0; i--) {
+		wl_subsurface_destroy(nodes[i].wl_subsurface);
+		wl_surface_destroy(nodes[i].surface->wl_surface);
+		buffer_destroy(nodes[i].surface->buffer);
+		free(nodes[i].surface);
+	}
+	wl_subcompositor_destroy(subco);
+	free(nodes);
+}
+
+#define RESIZE_STEPS 8
+
+TEST(rapid_resize)
+{
+	struct client *client;
+	struct surface *surface;
+	struct buffer *buffers[RESIZE_STEPS];
+	struct bench *bench;
+	int frames = bench_frame_count();
+	int frame, i, w, h, done;
+
+	client = create_client();
+	bench = bench_create(client, "rapid-resize");
+	surface = bench_create_surface(client, 32, 32, 200, 150);
+
+	for (i = 0; i < RESIZE_STEPS; i++) {
+		w = 200 + 100 * i;
+		h = 150 + 70 * i;
+		buffers[i] = create_shm_buffer_a8r8g8b8(client, w, h);
+		bench_fill(buffers[i], 0, 0, w, h, 0xff000000 | (0x1f * i));
+	}
+	client_roundtrip(client);
+
+	/* A new size every frame: the whole surface is damaged and the
+	 * view geometry recomputed each time. */
+	for (frame = -WARMUP_FRAMES; frame < frames; frame++) {
+		struct buffer *buffer;
+
+		if (frame == 0)
+			bench_start(bench);
+
+		buffer = buffers[(frame + WARMUP_FRAMES) % RESIZE_STEPS];
+		w = pixman_image_get_width(buffer->image);
+		h = pixman_image_get_height(buffer->image);
+
+		wl_surface_attach(surface->wl_surface, buffer->proxy, 0, 0);
+		wl_surface_damage(surface->wl_surface, 0, 0, w, h);
+		frame_callback_set(surface->wl_surface, &done);
+		commit(bench, surface->wl_surface, frame);
+		frame_callback_wait(client, &done);
+	}
+
+	bench_finish(bench);
+
+	for (i = 0; i < RESIZE_STEPS; i++)
+		buffer_destroy(buffers[i]);
+}
+
+#define POINTER_EVENTS_PER_FRAME 100
+
+TEST(pointer_flood)
+{
+	struct client *client;
+	struct surface *surface;
+	struct bench *bench;
+	struct timespec time;
+	uint32_t tv_sec_hi, tv_sec_lo, tv_nsec;
+	int frames = bench_frame_count();
+	int frame, i, done;
+
+	client = create_client();
+	bench = bench_create(client, "pointer-flood");
+	surface = bench_create_surface(client, 0, 0, 640, 480);
+	client_roundtrip(client);
+
+	for (frame = -WARMUP_FRAMES; frame < frames; frame++) {
+		if (frame == 0)
+			bench_start(bench);
+
+		/* Sweep the pointer over the surface, with motion events
+		 * delivered to this client. */
+		for (i = 0; i < POINTER_EVENTS_PER_FRAME; i++) {
+			clock_gettime(CLOCK_MONOTONIC, &time);
+			timespec_to_proto(&time, &tv_sec_hi, &tv_sec_lo,
+					  &tv_nsec);
+			weston_test_move_pointer(client->test->weston_test,
+						 tv_sec_hi, tv_sec_lo, tv_nsec,
+						 (i * 6) % 640,
+						 (frame + WARMUP_FRAMES +
+						  i) % 480);
+		}
+
+		damage_square(surface, frame);
+		frame_callback_set(surface->wl_surface, &done);
+		commit(bench, surface->wl_surface, frame);
+		frame_callback_wait(client, &done);
+	}
+
+	bench_finish(bench);
+}
@@ -639,3 +639,87 @@ ZUC_TEST(config_test, section_from_null)
 	section = weston_config_get_section(NULL, "bucket", NULL, NULL);
 	ZUC_ASSERT_NULL(section);
 }
+
+struct reload_listener {
+	struct weston_config_listener base;
+	int added, changed, removed;
+};
+
+static void
+reload_changed(struct weston_config_listener *listener,
+	       struct weston_config *config,
+	       const struct weston_config_change *change)
+{
+	struct reload_listener *l =
+		container_of(listener, struct reload_listener, base);
+
+	if (change->old_value == NULL)
+		l->added++;
+	else if (change->new_value == NULL)
+		l->removed++;
+	else
+		l->changed++;
+}
+
+static int
+write_config_file(const char *file, const char *text)
+{
+	FILE *fp = fopen(file, "w");
+
+	if (fp == NULL)
+		return -1;
+	fputs(text, fp);
+
+	return fclose(fp);
+}
+
+ZUC_TEST(config_test, reload)
+{
+	char file[] = "/tmp/weston-config-parser-test-XXXXXX";
+	struct reload_listener listener = { { .changed = reload_changed } };
+	struct weston_config_section *section;
+	struct weston_config *config;
+	int fd, r;
+	int32_t n;
+
+	fd = mkstemp(file);
+	ZUC_ASSERT_NE(-1, fd);
+	close(fd);
+
+	ZUC_ASSERTG_EQ(0, write_config_file(file,
+		"[output]\nname=A\nmode=1\n"
+		"[output]\nname=B\nmode=2\n"
+		"[keyboard]\nrepeat-rate=40\n"), out);
+	config = weston_config_parse(file);
+	ZUC_ASSERTG_NOT_NULL(config, out);
+	weston_config_add_listener(config, &listener.base);
+
+	ZUC_ASSERTG_EQ(0, write_config_file(file,
+		"[output]\nname=A\nmode=1\n"
+		"[output]\nname=B\nmode=3\nscale=2\n"), out_config);
+	r = weston_config_reload(config);
+
+	/* mode changed, scale added, repeat-rate removed */
+	ZUC_ASSERTG_EQ(3, r, out_config);
+	ZUC_ASSERTG_EQ(1, listener.added, out_config);
+	ZUC_ASSERTG_EQ(1, listener.changed, out_config);
+	ZUC_ASSERTG_EQ(1, listener.removed, out_config);
+
+	section = weston_config_get_section(config, "output", "name", "B");
+	ZUC_ASSERTG_NOT_NULL(section, out_config);
+	weston_config_section_get_int(section, "mode", &n, 0);
+	ZUC_ASSERTG_EQ(3, n, out_config);
+	section = weston_config_get_section(config, "keyboard", NULL, NULL);
+	ZUC_ASSERTG_NULL(section, out_config);
+
+	/* a broken file keeps the current contents */
+	ZUC_ASSERTG_EQ(0, write_config_file(file, "[output\n"), out_config);
+	ZUC_ASSERTG_EQ(-1, weston_config_reload(config), out_config);
+	section = weston_config_get_section(config, "output", "name", "A");
+	ZUC_ASSERTG_NOT_NULL(section, out_config);
+
+out_config:
+	weston_config_destroy(config);
+out:
+	unlink(file);
+}
@@ -39,4 +39,6 @@
 #define IVI_TEST_SURFACE_COUNT (3)
 #define IVI_TEST_LAYER_COUNT (3)
 
+#define IVI_TEST_BENCHMARK_SURFACE_COUNT (64)
+
 #endif /* IVI_TEST_H */
@@ -28,10 +28,12 @@
 #include "config.h"
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include "compositor.h"
 #include "compositor/weston.h"
@@ -39,6 +41,7 @@
 #include "ivi-test.h"
 #include "ivi-shell/ivi-layout-export.h"
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 
 struct test_context;
 
@@ -82,6 +85,7 @@ struct test_launcher {
 };
 
 struct test_context {
+	struct weston_compositor *compositor;
 	const struct ivi_layout_interface *layout_interface;
 	struct wl_resource *runner_resource;
 	uint32_t user_flags;
@@ -121,6 +125,7 @@ runner_run_handler(struct wl_client *client, struct wl_resource *resource,
 	       static_context.runner_resource == resource);
 
 	launcher = wl_resource_get_user_data(resource);
+	static_context.compositor = launcher->compositor;
 	static_context.layout_interface = launcher->layout_interface;
 	static_context.runner_resource = resource;
 
@@ -707,6 +712,73 @@ RUNNER_TEST(layer_render_order)
 	lyt->layer_destroy(ivilayer);
 }
 
+RUNNER_TEST(layer_render_order_iterators)
+{
+	const struct ivi_layout_interface *lyt = ctx->layout_interface;
+	struct ivi_layout_layer *ivilayer;
+	struct ivi_layout_surface *ivisurfs[IVI_TEST_SURFACE_COUNT] = {};
+	struct ivi_layout_surface *snapshot[IVI_TEST_SURFACE_COUNT] = {};
+	struct ivi_layout_surface *ivisurf;
+	uint32_t i;
+
+	ivilayer = lyt->layer_create_with_dimension(IVI_TEST_LAYER_ID(0), 200, 300);
+
+	for (i = 0; i < IVI_TEST_SURFACE_COUNT; i++)
+		ivisurfs[i] = lyt->get_surface_from_id(IVI_TEST_SURFACE_ID(i));
+
+	runner_assert(lyt->layer_set_render_order(
+		      ivilayer, ivisurfs, IVI_TEST_SURFACE_COUNT) == IVI_SUCCEEDED);
+
+	/* nothing to iterate before the commit */
+	runner_assert(lyt->get_next_surface_on_layer(ivilayer, NULL) == NULL);
+	runner_assert(lyt->get_next_layer_under_surface(ivisurfs[0],
+							NULL) == NULL);
+
+	lyt->commit_changes();
+
+	i = 0;
+	for (ivisurf = lyt->get_next_surface_on_layer(ivilayer, NULL);
+	     ivisurf != NULL;
+	     ivisurf = lyt->get_next_surface_on_layer(ivilayer, ivisurf)) {
+		runner_assert_or_return(i < IVI_TEST_SURFACE_COUNT);
+		runner_assert(ivisurf == ivisurfs[i]);
+		i++;
+	}
+	runner_assert(i == IVI_TEST_SURFACE_COUNT);
+
+	runner_assert(lyt->get_next_layer_under_surface(ivisurfs[0],
+							NULL) == ivilayer);
+	runner_assert(lyt->get_next_layer_under_surface(ivisurfs[0],
+							ivilayer) == NULL);
+	runner_assert(lyt->get_layers_under_surface_snapshot(
+		      ivisurfs[0], NULL, 0) == 1);
+	runner_assert(lyt->get_layers_under_surface_snapshot(
+		      NULL, NULL, 0) == IVI_FAILED);
+
+	/* not added to any screen */
+	runner_assert(lyt->get_screens_under_layer_snapshot(
+		      ivilayer, NULL, 0) == 0);
+
+	/* a short snapshot still reports the full count */
+	runner_assert(lyt->get_surfaces_on_layer_snapshot(
+		      ivilayer, NULL, 0) == IVI_TEST_SURFACE_COUNT);
+	runner_assert(lyt->get_surfaces_on_layer_snapshot(
+		      ivilayer, snapshot, 1) == IVI_TEST_SURFACE_COUNT);
+	runner_assert(snapshot[0] == ivisurfs[0] && snapshot[1] == NULL);
+	runner_assert(lyt->get_surfaces_on_layer_snapshot(
+		      ivilayer, snapshot,
+		      IVI_TEST_SURFACE_COUNT) == IVI_TEST_SURFACE_COUNT);
+	for (i = 0; i < IVI_TEST_SURFACE_COUNT; i++)
+		runner_assert(snapshot[i] == ivisurfs[i]);
+
+	runner_assert(lyt->get_surfaces_on_layer_snapshot(
+		      NULL, snapshot, 1) == IVI_FAILED);
+	runner_assert(lyt->get_surfaces_on_layer_snapshot(
+		      ivilayer, NULL, 1) == IVI_FAILED);
+
+	lyt->layer_destroy(ivilayer);
+}
+
 RUNNER_TEST(test_layer_render_order_destroy_one_surface_p1)
 {
 	const struct ivi_layout_interface *lyt = ctx->layout_interface;
@@ -860,6 +932,86 @@ RUNNER_TEST(commit_changes_after_render_order_set_surface_destroy)
 		      ivilayer, ivisurfs, IVI_TEST_SURFACE_COUNT) == IVI_SUCCEEDED);
 }
 
+#define COMMIT_BENCHMARK_ITERATIONS 1000
+
+/*
+ * Moves one surface out of IVI_TEST_BENCHMARK_SURFACE_COUNT on screen and
+ * commits after every move. Only the moved surface is dirty, so the cost
+ * per commit should not depend on the number of surfaces in the scene.
+ */
+RUNNER_TEST(commit_changes_benchmark)
+{
+	const struct ivi_layout_interface *lyt = ctx->layout_interface;
+	struct ivi_layout_surface *ivisurfs[IVI_TEST_BENCHMARK_SURFACE_COUNT];
+	const struct ivi_layout_surface_properties *prop;
+	struct ivi_layout_layer *ivilayer;
+	struct weston_output *output;
+	struct timespec begin, end;
+	int64_t elapsed;
+	uint32_t i;
+
+	runner_assert_or_return(!wl_list_empty(&ctx->compositor->output_list));
+	output = wl_container_of(ctx->compositor->output_list.next,
+				 output, link);
+
+	ivilayer = lyt->layer_create_with_dimension(IVI_TEST_LAYER_ID(0),
+						    200, 300);
+	runner_assert_or_return(ivilayer != NULL);
+
+	for (i = 0; i < IVI_TEST_BENCHMARK_SURFACE_COUNT; i++) {
+		ivisurfs[i] = lyt->get_surface_from_id(IVI_TEST_SURFACE_ID(i));
+		runner_assert_or_return(ivisurfs[i] != NULL);
+
+		runner_assert(lyt->surface_set_source_rectangle(
+			      ivisurfs[i], 0, 0, 100, 100) == IVI_SUCCEEDED);
+		runner_assert(lyt->surface_set_destination_rectangle(
+			      ivisurfs[i], 0, 0, 100, 100) == IVI_SUCCEEDED);
+		runner_assert(lyt->surface_set_visibility(
+			      ivisurfs[i], true) == IVI_SUCCEEDED);
+	}
+
+	runner_assert(lyt->layer_set_render_order(
+		      ivilayer, ivisurfs,
+		      IVI_TEST_BENCHMARK_SURFACE_COUNT) == IVI_SUCCEEDED);
+	runner_assert(lyt->layer_set_visibility(
+		      ivilayer, true) == IVI_SUCCEEDED);
+	runner_assert(lyt->screen_add_layer(output, ivilayer) == IVI_SUCCEEDED);
+
+	lyt->commit_changes();
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	for (i = 0; i < COMMIT_BENCHMARK_ITERATIONS; i++) {
+		lyt->surface_set_destination_rectangle(ivisurfs[0],
+						       i % 100, 0, 100, 100);
+		lyt->commit_changes();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = timespec_sub_to_nsec(&end, &begin);
+
+	weston_log("commit_changes_benchmark: %d surfaces, %d commits, "
+		   "%" PRId64 " ns per commit\n",
+		   IVI_TEST_BENCHMARK_SURFACE_COUNT,
+		   COMMIT_BENCHMARK_ITERATIONS,
+		   elapsed / COMMIT_BENCHMARK_ITERATIONS);
+
+	/* the moved surface is committed, the others are left alone */
+	prop = lyt->get_properties_of_surface(ivisurfs[0]);
+	runner_assert(prop->dest_x == (COMMIT_BENCHMARK_ITERATIONS - 1) % 100);
+	runner_assert(prop->event_mask == 0);
+
+	prop = lyt->get_properties_of_surface(
+			ivisurfs[IVI_TEST_BENCHMARK_SURFACE_COUNT - 1]);
+	runner_assert(prop->dest_x == 0);
+	runner_assert(prop->visibility == true);
+
+	runner_assert(lyt->screen_remove_layer(output, ivilayer) ==
+		      IVI_SUCCEEDED);
+	lyt->commit_changes();
+	lyt->layer_destroy(ivilayer);
+}
+
 RUNNER_TEST(cleanup_layer)
 {
 	const struct ivi_layout_interface *lyt = ctx->layout_interface;
@@ -213,6 +213,7 @@ const char * const render_order_test_names[] = {
 	"layer_render_order",
 	"layer_bad_render_order",
 	"layer_add_surfaces",
+	"layer_render_order_iterators",
 };
 
 TEST_P(ivi_layout_runner, basic_test_names)
@@ -390,6 +391,27 @@ TEST(commit_changes_after_render_order_set_surface_destroy)
 	runner_destroy(runner);
 }
 
+TEST(ivi_layout_commit_changes_benchmark)
+{
+	struct client *client;
+	struct runner *runner;
+	struct ivi_window *winds[IVI_TEST_BENCHMARK_SURFACE_COUNT];
+	int i;
+
+	client = create_client();
+	runner = client_create_runner(client);
+
+	for (i = 0; i < IVI_TEST_BENCHMARK_SURFACE_COUNT; i++)
+		winds[i] = client_create_ivi_window(client,
+						    IVI_TEST_SURFACE_ID(i));
+
+	runner_run(runner, "commit_changes_benchmark");
+
+	for (i = 0; i < IVI_TEST_BENCHMARK_SURFACE_COUNT; i++)
+		ivi_window_destroy(winds[i]);
+	runner_destroy(runner);
+}
+
 TEST(ivi_layout_surface_configure_notification)
 {
 	struct client *client;
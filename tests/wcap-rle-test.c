@@ -0,0 +1,148 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wcap/wcap-rle.h"
+#include "shared/helpers.h"
+#include "zunitc/zunitc.h"
+
+/* Odd sizes so that every vector loop also runs its scalar tail. */
+#define N 1021
+
+static void
+fill(uint32_t *p, int n, unsigned int seed, int runs)
+{
+	uint32_t v = 0;
+	int i;
+
+	srand(seed);
+	for (i = 0; i < n; i++) {
+		if (!runs || rand() % 16 == 0)
+			v = rand() ^ (rand() << 16);
+		p[i] = v;
+	}
+}
+
+ZUC_TEST(wcap_rle_test, delta_matches_generic)
+{
+	static uint32_t src[N], frame[2][N], delta[2][N];
+
+	fill(src, N, 1, 0);
+	fill(frame[0], N, 2, 0);
+	memcpy(frame[1], frame[0], sizeof frame[0]);
+
+	wcap_rle_delta_generic(delta[0], frame[0], src, N);
+	wcap_rle_delta(delta[1], frame[1], src, N);
+
+	ZUC_ASSERT_EQ(0, memcmp(delta[0], delta[1], sizeof delta[0]));
+	ZUC_ASSERT_EQ(0, memcmp(frame[0], src, sizeof src));
+	ZUC_ASSERT_EQ(0, memcmp(frame[1], src, sizeof src));
+}
+
+ZUC_TEST(wcap_rle_test, span_matches_generic)
+{
+	static uint32_t delta[N];
+	int i;
+
+	fill(delta, N, 3, 1);
+	for (i = 0; i < N; i++)
+		ZUC_ASSERT_EQ(wcap_rle_span_generic(delta + i, N - i, delta[i]),
+			      wcap_rle_span(delta + i, N - i, delta[i]));
+
+	ZUC_ASSERT_EQ(0, wcap_rle_span(delta, N, ~delta[0]));
+}
+
+ZUC_TEST(wcap_rle_test, apply_matches_generic)
+{
+	static uint32_t d[2][N];
+	int i;
+
+	fill(d[0], N, 4, 0);
+	memcpy(d[1], d[0], sizeof d[0]);
+
+	for (i = 1; i < 64; i++) {
+		/* The run length bits of the word must be ignored. */
+		wcap_rle_apply_generic(d[0] + i, N - i, 0xe3804020 * i);
+		wcap_rle_apply(d[1] + i, N - i, 0xe3804020 * i);
+	}
+
+	ZUC_ASSERT_EQ(0, memcmp(d[0], d[1], sizeof d[0]));
+}
+
+ZUC_TEST(wcap_rle_test, encode_round_trip)
+{
+	static uint32_t prev[N], next[N], frame[N], delta[N], stream[N];
+	struct wcap_rle_encoder enc;
+	uint32_t *p, *q;
+	int i, j, count = 0;
+
+	fill(prev, N, 5, 1);
+	fill(next, N, 6, 1);
+	memcpy(frame, prev, sizeof prev);
+
+	/* Encode in uneven rows so that runs continue across rows. */
+	wcap_rle_encoder_init(&enc);
+	p = stream;
+	for (i = 0; i < N; i += 100) {
+		j = MIN(100, N - i);
+		wcap_rle_delta(delta, frame + i, next + i, j);
+		p = wcap_rle_encode(&enc, p, delta, j);
+	}
+	p = wcap_rle_encoder_finish(&enc, p);
+	ZUC_ASSERT_EQ(0, memcmp(frame, next, sizeof next));
+
+	for (q = stream; q < p; q++) {
+		j = wcap_rle_run_length(*q);
+		ZUC_ASSERT_LE(count + j, N);
+		wcap_rle_apply(prev + count, j, *q);
+		count += j;
+	}
+	ZUC_ASSERT_EQ(N, count);
+
+	for (i = 0; i < N; i++)
+		ZUC_ASSERT_EQ(next[i] & WCAP_RLE_COLOR_MASK,
+			      prev[i] & WCAP_RLE_COLOR_MASK);
+}
+
+ZUC_TEST(wcap_rle_test, long_runs)
+{
+	static uint32_t stream[16];
+	uint32_t *p;
+	int count = 0;
+
+	/* 0xe0 is the longest run expressible with a plain count, longer
+	 * runs are split into power-of-two chunks. */
+	p = wcap_rle_output_run(stream, 0x10203, 0xe0);
+	ZUC_ASSERT_EQ(1, p - stream);
+	ZUC_ASSERT_EQ(0xe0, wcap_rle_run_length(stream[0]));
+
+	p = wcap_rle_output_run(stream, 0x10203, 1000);
+	while (p > stream)
+		count += wcap_rle_run_length(*--p);
+	ZUC_ASSERT_EQ(1000, count);
+}
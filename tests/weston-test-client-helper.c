@@ -35,6 +35,7 @@
 #include <cairo.h>
 
 #include "shared/os-compatibility.h"
+#include "shared/timespec-util.h"
 #include "shared/xalloc.h"
 #include "shared/zalloc.h"
 #include "weston-test-client-helper.h"
@@ -549,9 +550,38 @@ test_handle_capture_screenshot_done(void *data, struct weston_test *weston_test)
 	test->buffer_copy_done = 1;
 }
 
+static void
+test_handle_perf_sample(void *data, struct weston_test *weston_test,
+			uint32_t output_id, uint32_t tv_sec_hi,
+			uint32_t tv_sec_lo, uint32_t tv_nsec,
+			uint32_t repaint_nsec, uint32_t cpu_nsec)
+{
+	struct test *test = data;
+	struct perf_sample *sample;
+
+	sample = wl_array_add(&test->perf_samples, sizeof *sample);
+	assert(sample);
+	sample->output_id = output_id;
+	timespec_from_proto(&sample->start, tv_sec_hi, tv_sec_lo, tv_nsec);
+	sample->repaint_nsec = repaint_nsec;
+	sample->cpu_nsec = cpu_nsec;
+}
+
+static void
+test_handle_perf_done(void *data, struct weston_test *weston_test,
+		      uint32_t dropped)
+{
+	struct test *test = data;
+
+	test->perf_dropped = dropped;
+	test->perf_done = 1;
+}
+
 static const struct weston_test_listener test_listener = {
 	test_handle_pointer_position,
 	test_handle_capture_screenshot_done,
+	test_handle_perf_sample,
+	test_handle_perf_done,
 };
 
 static void
@@ -776,6 +806,7 @@ handle_global(void *data, struct wl_registry *registry,
 		test->weston_test =
 			wl_registry_bind(registry, id,
 					 &weston_test_interface, version);
+		wl_array_init(&test->perf_samples);
 		weston_test_add_listener(test->weston_test, &test_listener, test);
 		client->test = test;
 	} else if (strcmp(interface, "wl_drm") == 0) {
@@ -72,6 +72,16 @@ struct test {
 	int pointer_y;
 	uint32_t n_egl_buffers;
 	int buffer_copy_done;
+	struct wl_array perf_samples; /* struct perf_sample */
+	uint32_t perf_dropped;
+	int perf_done;
+};
+
+struct perf_sample {
+	uint32_t output_id;
+	struct timespec start;
+	uint32_t repaint_nsec;
+	uint32_t cpu_nsec;
 };
 
 struct input {
@@ -31,6 +31,7 @@
 #include <signal.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 #include "compositor.h"
 #include "compositor/weston.h"
@@ -45,12 +46,40 @@
 #include "shared/helpers.h"
 #include "shared/timespec-util.h"
 
+/* Upper bound of recorded repaints, about 18 minutes of 60 Hz on one
+ * output, or 4.5 minutes on four. */
+#define PERF_MAX_SAMPLES 65536
+
 struct weston_test {
 	struct weston_compositor *compositor;
 	struct weston_layer layer;
 	struct weston_process process;
 	struct weston_seat seat;
 	bool is_seat_initialized;
+
+	struct wl_list perf_output_list;
+	struct wl_listener output_created_listener;
+	struct wl_listener output_destroyed_listener;
+	bool perf_recording;
+	struct wl_array perf_samples; /* struct test_perf_sample */
+	uint32_t perf_dropped;
+	struct timespec perf_cpu_last;
+};
+
+struct test_perf_sample {
+	uint32_t output_id;
+	struct timespec start;
+	uint32_t repaint_nsec;
+	uint32_t cpu_nsec;
+};
+
+/* An output whose repaint hook is wrapped to time it. */
+struct test_perf_output {
+	struct weston_output *output;
+	int (*repaint)(struct weston_output *output,
+		       pixman_region32_t *damage,
+		       void *repaint_data);
+	struct wl_list link;
 };
 
 struct weston_test_surface {
@@ -566,6 +595,176 @@ send_touch(struct wl_client *client, struct wl_resource *resource,
 		     wl_fixed_to_double(y), touch_type);
 }
 
+static void
+test_output_created(struct wl_listener *listener, void *data);
+
+static struct weston_test *
+test_from_compositor(struct weston_compositor *compositor)
+{
+	struct wl_listener *listener;
+
+	listener = wl_signal_get(&compositor->output_created_signal,
+				 test_output_created);
+	assert(listener);
+
+	return container_of(listener, struct weston_test,
+			    output_created_listener);
+}
+
+static struct test_perf_output *
+test_perf_output_find(struct weston_test *test, struct weston_output *output)
+{
+	struct test_perf_output *po;
+
+	wl_list_for_each(po, &test->perf_output_list, link)
+		if (po->output == output)
+			return po;
+
+	return NULL;
+}
+
+static uint32_t
+clamp_nsec(int64_t nsec)
+{
+	if (nsec < 0)
+		return 0;
+	if (nsec > UINT32_MAX)
+		return UINT32_MAX;
+	return nsec;
+}
+
+static int
+test_perf_output_repaint(struct weston_output *output,
+			 pixman_region32_t *damage, void *repaint_data)
+{
+	struct weston_test *test = test_from_compositor(output->compositor);
+	struct test_perf_output *po = test_perf_output_find(test, output);
+	struct test_perf_sample *sample;
+	struct timespec start, end, cpu;
+	int ret;
+
+	assert(po);
+
+	if (!test->perf_recording)
+		return po->repaint(output, damage, repaint_data);
+
+	weston_compositor_read_presentation_clock(output->compositor, &start);
+	ret = po->repaint(output, damage, repaint_data);
+	weston_compositor_read_presentation_clock(output->compositor, &end);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+
+	if (test->perf_samples.size <
+	    PERF_MAX_SAMPLES * sizeof(struct test_perf_sample))
+		sample = wl_array_add(&test->perf_samples, sizeof *sample);
+	else
+		sample = NULL;
+
+	if (sample) {
+		sample->output_id = output->id;
+		sample->start = start;
+		sample->repaint_nsec =
+			clamp_nsec(timespec_sub_to_nsec(&end, &start));
+		sample->cpu_nsec =
+			clamp_nsec(timespec_sub_to_nsec(&cpu,
+							&test->perf_cpu_last));
+	} else {
+		test->perf_dropped++;
+	}
+
+	test->perf_cpu_last = cpu;
+
+	return ret;
+}
+
+static void
+test_perf_output_add(struct weston_test *test, struct weston_output *output)
+{
+	struct test_perf_output *po;
+
+	/* The backend may only set up its repaint hook when the output is
+	 * enabled, so this runs from output_created_signal. */
+	if (test_perf_output_find(test, output))
+		return;
+
+	po = zalloc(sizeof *po);
+	if (!po) {
+		weston_log("weston-test: out of memory, repaints of output "
+			   "%s are not timed\n", output->name);
+		return;
+	}
+
+	po->output = output;
+	po->repaint = output->repaint;
+	output->repaint = test_perf_output_repaint;
+	wl_list_insert(&test->perf_output_list, &po->link);
+}
+
+static void
+test_perf_output_remove(struct test_perf_output *po)
+{
+	po->output->repaint = po->repaint;
+	wl_list_remove(&po->link);
+	free(po);
+}
+
+static void
+test_output_created(struct wl_listener *listener, void *data)
+{
+	struct weston_test *test =
+		container_of(listener, struct weston_test,
+			     output_created_listener);
+
+	test_perf_output_add(test, data);
+}
+
+static void
+test_output_destroyed(struct wl_listener *listener, void *data)
+{
+	struct weston_test *test =
+		container_of(listener, struct weston_test,
+			     output_destroyed_listener);
+	struct test_perf_output *po;
+
+	po = test_perf_output_find(test, data);
+	if (po)
+		test_perf_output_remove(po);
+}
+
+static void
+perf_start(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+
+	wl_array_release(&test->perf_samples);
+	wl_array_init(&test->perf_samples);
+	test->perf_dropped = 0;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &test->perf_cpu_last);
+	test->perf_recording = true;
+}
+
+static void
+perf_stop(struct wl_client *client, struct wl_resource *resource)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	struct test_perf_sample *sample;
+	uint32_t tv_sec_hi, tv_sec_lo, tv_nsec;
+
+	test->perf_recording = false;
+
+	wl_array_for_each(sample, &test->perf_samples) {
+		timespec_to_proto(&sample->start,
+				  &tv_sec_hi, &tv_sec_lo, &tv_nsec);
+		weston_test_send_perf_sample(resource, sample->output_id,
+					     tv_sec_hi, tv_sec_lo, tv_nsec,
+					     sample->repaint_nsec,
+					     sample->cpu_nsec);
+	}
+	weston_test_send_perf_done(resource, test->perf_dropped);
+
+	wl_array_release(&test->perf_samples);
+	wl_array_init(&test->perf_samples);
+}
+
 static const struct weston_test_interface test_implementation = {
 	move_surface,
 	move_pointer,
@@ -577,6 +776,8 @@ static const struct weston_test_interface test_implementation = {
 	device_add,
 	capture_screenshot,
 	send_touch,
+	perf_start,
+	perf_stop,
 };
 
 static void
@@ -629,6 +830,7 @@ wet_module_init(struct weston_compositor *ec,
 		int *argc, char *argv[])
 {
 	struct weston_test *test;
+	struct weston_output *output;
 	struct wl_event_loop *loop;
 
 	test = zalloc(sizeof *test);
@@ -636,6 +838,18 @@ wet_module_init(struct weston_compositor *ec,
 		return -1;
 
 	test->compositor = ec;
+	wl_list_init(&test->perf_output_list);
+	wl_array_init(&test->perf_samples);
+
+	test->output_created_listener.notify = test_output_created;
+	wl_signal_add(&ec->output_created_signal,
+		      &test->output_created_listener);
+	test->output_destroyed_listener.notify = test_output_destroyed;
+	wl_signal_add(&ec->output_destroyed_signal,
+		      &test->output_destroyed_listener);
+	wl_list_for_each(output, &ec->output_list, link)
+		test_perf_output_add(test, output);
+
 	weston_layer_init(&test->layer, ec);
 	weston_layer_set_position(&test->layer, WESTON_LAYER_POSITION_CURSOR - 1);
 
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <sys/mman.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -36,10 +37,13 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
+#include "wcap-rle.h"
 
 static void
 write_png(struct wcap_decoder *decoder, const char *filename)
@@ -193,17 +197,357 @@ output_yuv_frame(struct wcap_decoder *decoder, int depth)
 	fwrite(out, 1, size, stdout);
 }
 
+struct benchmark {
+	uint32_t *ref, *delta, *stream[2], *check;
+	double decode, encode[2], apply[2];
+	uint64_t pixels;
+	int mismatch;
+};
+
+static double
+elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* The original one-pixel-at-a-time encoder, kept as the reference the
+ * vectorized path is checked and timed against. */
+static uint32_t *
+encode_generic(uint32_t *p, uint32_t *delta, uint32_t *ref,
+	       const uint32_t *frame, int n)
+{
+	uint32_t prev = 0;
+	int k, run = 0;
+
+	wcap_rle_delta_generic(delta, ref, frame, n);
+	for (k = 0; k < n; k++) {
+		if (run == 0 || delta[k] == prev) {
+			run++;
+		} else {
+			p = wcap_rle_output_run(p, prev, run);
+			run = 1;
+		}
+		prev = delta[k];
+	}
+
+	return wcap_rle_output_run(p, prev, run);
+}
+
+static uint32_t *
+encode_vector(uint32_t *p, uint32_t *delta, uint32_t *ref,
+	      const uint32_t *frame, int n)
+{
+	struct wcap_rle_encoder enc;
+
+	wcap_rle_encoder_init(&enc);
+	wcap_rle_delta(delta, ref, frame, n);
+	p = wcap_rle_encode(&enc, p, delta, n);
+
+	return wcap_rle_encoder_finish(&enc, p);
+}
+
+static void
+apply_stream(uint32_t *d, const uint32_t *p, const uint32_t *end, int vector)
+{
+	int j;
+
+	for (; p < end; p++) {
+		j = wcap_rle_run_length(*p);
+		if (vector)
+			wcap_rle_apply(d, j, *p);
+		else
+			wcap_rle_apply_generic(d, j, *p);
+		d += j;
+	}
+}
+
+static void
+benchmark_frame(struct benchmark *b, struct wcap_decoder *decoder)
+{
+	int i, k, n = decoder->width * decoder->height;
+	size_t size = n * sizeof(uint32_t);
+	uint32_t *end[2];
+	struct timespec start;
+
+	/* Full frame re-encode against the previous frame with both
+	 * implementations, which must produce identical streams. */
+	for (i = 0; i < 2; i++) {
+		memcpy(b->check, b->ref, size);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (i == 0)
+			end[i] = encode_generic(b->stream[i], b->delta,
+						b->check, decoder->frame, n);
+		else
+			end[i] = encode_vector(b->stream[i], b->delta,
+					       b->check, decoder->frame, n);
+		b->encode[i] += elapsed(&start);
+	}
+
+	if (end[0] - b->stream[0] != end[1] - b->stream[1] ||
+	    memcmp(b->stream[0], b->stream[1],
+		   (end[0] - b->stream[0]) * sizeof(uint32_t)) != 0)
+		b->mismatch++;
+
+	/* And decode that stream back on top of the previous frame. */
+	for (i = 0; i < 2; i++) {
+		memcpy(b->check, b->ref, size);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		apply_stream(b->check, b->stream[1], end[1], i);
+		b->apply[i] += elapsed(&start);
+
+		for (k = 0; k < n; k++) {
+			if ((b->check[k] ^ decoder->frame[k]) &
+			    WCAP_RLE_COLOR_MASK) {
+				b->mismatch++;
+				break;
+			}
+		}
+	}
+
+	memcpy(b->ref, decoder->frame, size);
+	b->pixels += n;
+}
+
+static void
+report(const char *name, double generic, double vector, uint64_t pixels)
+{
+	fprintf(stderr, "%-8s generic %8.1f Mpix/s, %s %8.1f Mpix/s (%.2fx)\n",
+		name, pixels / generic / 1e6, WCAP_RLE_IMPL,
+		pixels / vector / 1e6, generic / vector);
+}
+
+static int
+benchmark(struct wcap_decoder *decoder)
+{
+	struct benchmark b;
+	struct timespec start;
+	size_t size = decoder->width * decoder->height * sizeof(uint32_t);
+	int frames = 0, has_frame;
+
+	memset(&b, 0, sizeof b);
+	b.ref = calloc(1, size);
+	b.delta = malloc(size);
+	b.check = malloc(size);
+	/* Worst case is one run-length word per pixel. */
+	b.stream[0] = malloc(size);
+	b.stream[1] = malloc(size);
+	if (!b.ref || !b.delta || !b.check || !b.stream[0] || !b.stream[1]) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		has_frame = wcap_decoder_get_frame(decoder);
+		b.decode += elapsed(&start);
+		if (has_frame) {
+			benchmark_frame(&b, decoder);
+			frames++;
+		}
+	} while (has_frame);
+
+	fprintf(stderr, "decoded %d frames, %zu bytes in %.3f s (%.1f MB/s)\n",
+		frames, decoder->size, b.decode,
+		decoder->size / b.decode / (1024 * 1024));
+	if (decoder->compressed_bytes > 0)
+		fprintf(stderr, "%" PRIu64 " bytes of frame data stored as "
+			"%" PRIu64 " bytes (%.1f%%)\n",
+			decoder->uncompressed_bytes, decoder->compressed_bytes,
+			100.0 * decoder->compressed_bytes /
+			decoder->uncompressed_bytes);
+	if (frames > 0) {
+		report("encode", b.encode[0], b.encode[1], b.pixels);
+		report("decode", b.apply[0], b.apply[1], b.pixels);
+	}
+	if (b.mismatch)
+		fprintf(stderr, "%d mismatches between generic and %s\n",
+			b.mismatch, WCAP_RLE_IMPL);
+
+	free(b.ref);
+	free(b.delta);
+	free(b.check);
+	free(b.stream[0]);
+	free(b.stream[1]);
+
+	return b.mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Map the frame numbers at the replay rate to the recorded frames the
+ * same way the sequential decode loop in main() does, using only the
+ * timestamps from the frame index.
+ */
+static uint32_t *
+build_schedule(struct wcap_decoder *decoder, uint32_t frame_time, int *count)
+{
+	uint32_t *schedule = NULL, *s, msecs, k = 0;
+	int n = 0, alloc = 0, has_frame = decoder->nframes > 0;
+
+	if (has_frame)
+		msecs = decoder->index[0].msecs;
+	while (has_frame) {
+		if (n == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			s = realloc(schedule, alloc * sizeof *s);
+			if (s == NULL) {
+				free(schedule);
+				return NULL;
+			}
+			schedule = s;
+		}
+		schedule[n++] = k;
+
+		msecs += frame_time;
+		while (decoder->index[k].msecs < msecs && has_frame) {
+			if (k + 1 < decoder->nframes)
+				k++;
+			else
+				has_frame = 0;
+		}
+	}
+
+	*count = n;
+
+	return schedule;
+}
+
+struct job {
+	pthread_t thread;
+	const char *path;
+	const uint32_t *schedule, *gop;
+	int count, id, njobs;
+	int ret;
+};
+
+/* Each job decodes every njobs'th group of pictures, that is a
+ * keyframe and the frames depending on it, with its own decoder. */
+static void *
+decode_job(void *data)
+{
+	struct job *job = data;
+	struct wcap_decoder *decoder;
+	char filename[200];
+	uint32_t frame;
+	int i;
+
+	decoder = wcap_decoder_create(job->path);
+	if (decoder == NULL) {
+		job->ret = -1;
+		return NULL;
+	}
+
+	for (i = 0; i < job->count; i++) {
+		frame = job->schedule[i];
+		if (job->gop[frame] % job->njobs != (uint32_t) job->id)
+			continue;
+		if (!wcap_decoder_seek(decoder, frame)) {
+			job->ret = -1;
+			break;
+		}
+
+		snprintf(filename, sizeof filename, "wcap-frame-%d.png", i);
+		write_png(decoder, filename);
+		fprintf(stderr, "wrote %s\n", filename);
+	}
+
+	wcap_decoder_destroy(decoder);
+
+	return NULL;
+}
+
+static int
+decode_indexed(struct wcap_decoder *decoder, const char *path,
+	       uint32_t frame_time, int output_frame, int all, int njobs)
+{
+	struct job *jobs;
+	uint32_t *schedule, *gop, k, g = 0;
+	char filename[200];
+	int i, count = 0, ret = 0;
+
+	schedule = build_schedule(decoder, frame_time, &count);
+	gop = malloc((decoder->nframes + 1) * sizeof *gop);
+	if ((schedule == NULL && decoder->nframes > 0) || gop == NULL) {
+		free(schedule);
+		free(gop);
+		return -1;
+	}
+
+	for (k = 0; k < decoder->nframes; k++) {
+		if (k > 0 && (decoder->index[k].flags & WCAP_FRAME_KEYFRAME))
+			g++;
+		gop[k] = g;
+	}
+
+	if (output_frame >= 0 && output_frame < count && !all) {
+		if (wcap_decoder_seek(decoder, schedule[output_frame])) {
+			snprintf(filename, sizeof filename,
+				 "wcap-frame-%d.png", output_frame);
+			write_png(decoder, filename);
+			fprintf(stderr, "wrote %s\n", filename);
+		} else {
+			ret = -1;
+		}
+	}
+
+	if (all && count > 0) {
+		jobs = calloc(njobs, sizeof *jobs);
+		if (jobs == NULL) {
+			free(gop);
+			free(schedule);
+			return -1;
+		}
+
+		for (i = 0; i < njobs; i++) {
+			jobs[i].path = path;
+			jobs[i].schedule = schedule;
+			jobs[i].gop = gop;
+			jobs[i].count = count;
+			jobs[i].id = i;
+			jobs[i].njobs = njobs;
+			if (pthread_create(&jobs[i].thread, NULL,
+					   decode_job, &jobs[i]) != 0) {
+				njobs = i;
+				ret = -1;
+				break;
+			}
+		}
+
+		for (i = 0; i < njobs; i++) {
+			pthread_join(jobs[i].thread, NULL);
+			if (jobs[i].ret < 0)
+				ret = -1;
+		}
+
+		free(jobs);
+	}
+
+	free(gop);
+	free(schedule);
+
+	fprintf(stderr, "wcap file: size %dx%d, %d frames, %d keyframes\n",
+		decoder->width, decoder->height, count,
+		decoder->nframes > 0 ? g + 1 : 0);
+
+	return ret;
+}
+
 static void
 usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
 		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"\t[--jobs=<n>] [--benchmark] [--rate=<num:denom>] <wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
+		"\t--jobs=<n>\t\tdecode seekable files with n threads\n"
+		"\t--benchmark\t\tmeasure decode and re-encode throughput\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
 		"\t\t\t\tspecified as an integer fraction\n\n");
 
@@ -214,6 +558,7 @@ int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
+	int bench = 0, ret, jobs = 0;
 	int num = 30, denom = 1;
 	char filename[200];
 	char *mode;
@@ -228,6 +573,10 @@ int main(int argc, char *argv[])
 			usage(EXIT_SUCCESS);
 		} else if (strcmp(argv[i], "--all") == 0) {
 			all = 1;
+		} else if (sscanf(argv[i], "--jobs=%d", &jobs) == 1) {
+			;
+		} else if (strcmp(argv[i], "--benchmark") == 0) {
+			bench = 1;
 		} else if (sscanf(argv[i], "--frame=%d", &output_frame) == 1) {
 			;
 		} else if (sscanf(argv[i], "--rate=%d", &num) == 1) {
@@ -259,6 +608,29 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (bench) {
+		ret = benchmark(decoder);
+		wcap_decoder_destroy(decoder);
+		return ret;
+	}
+
+	frame_time = 1000 * denom / num;
+	if (frame_time == 0)
+		frame_time = 1;
+
+	/* Seekable files don't need to be decoded from the start to
+	 * extract frames. */
+	if (decoder->index && !yuv4mpeg2) {
+		if (jobs <= 0)
+			jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (jobs <= 0)
+			jobs = 1;
+		ret = decode_indexed(decoder, argv[1], frame_time,
+				     output_frame, all, jobs);
+		wcap_decoder_destroy(decoder);
+		return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 	if (yuv4mpeg2 && isatty(1)) {
 		fprintf(stderr, "Not dumping yuv4mpeg2 data to terminal.  Pipe output to a file or a process.\n");
 		fprintf(stderr, "For example, to encode to webm, use something like\n\n");
@@ -282,7 +654,6 @@ int main(int argc, char *argv[])
 	i = 0;
 	has_frame = wcap_decoder_get_frame(decoder);
 	msecs = decoder->msecs;
-	frame_time = 1000 * denom / num;
 	while (has_frame) {
 		if (all || i == output_frame) {
 			snprintf(filename, sizeof filename,
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
 #include <sys/mman.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -38,73 +39,399 @@
 
 #include <cairo.h>
 
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include "wcap-decode.h"
+#include "wcap-rle.h"
 
-static void
+/* Bytes left between p and end, 0 if p is already past end. */
+static size_t
+bytes_left(const void *p, const void *end)
+{
+	return p < end ? (size_t) ((const char *) end - (const char *) p) : 0;
+}
+
+static int
+wcap_decoder_check_rectangle(struct wcap_decoder *decoder,
+			     const struct wcap_rectangle *rect)
+{
+	return rect->x1 >= 0 && rect->x1 <= rect->x2 &&
+	       rect->x2 <= decoder->width &&
+	       rect->y1 >= 0 && rect->y1 <= rect->y2 &&
+	       rect->y2 <= decoder->height;
+}
+
+/* Decode the run-length data of one rectangle, which must end before
+ * 'end'.  Returns -1 if the data is truncated or doesn't match the size
+ * of the rectangle.
+ */
+static int
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+			      struct wcap_rectangle *rect, const void *end)
 {
 	uint32_t v, *p = decoder->p, *d;
 	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
-	unsigned char r, g, b, dr, dg, db;
+	int x, i, j, l, count = width * height;
+
+	if (count == 0)
+		return 0;
 
 	d = decoder->frame + (rect->y2 - 1) * decoder->width;
 	x = rect->x1;
 	i = 0;
 	while (i < count) {
+		if (bytes_left(p, end) < sizeof *p) {
+			fprintf(stderr, "rle data truncated\n");
+			return -1;
+		}
 		v = *p++;
-		l = v >> 24;
-		if (l < 0xe0) {
-			j = l + 1;
-		} else {
-			j = 1 << (l - 0xe0 + 7);
+
+		/* Longer runs can't be encoded and would overflow. */
+		if ((v >> 24) > 0xe0 + 23) {
+			fprintf(stderr, "invalid rle run length\n");
+			return -1;
 		}
+		j = wcap_rle_run_length(v);
+		if (j > count - i) {
+			fprintf(stderr, "rle encoding longer than expected "
+				"(%d expected %d)\n", i + j, count);
+			return -1;
+		}
+		i += j;
 
-		dr = (v >> 16);
-		dg = (v >>  8);
-		db = (v >>  0);
-		for (k = 0; k < j; k++) {
-			r = (d[x] >> 16) + dr;
-			g = (d[x] >>  8) + dg;
-			b = (d[x] >>  0) + db;
-			d[x] = 0xff000000 | (r << 16) | (g << 8) | b;
-			x++;
+		/* A run may span several rows of the rectangle, apply it
+		 * one row segment at a time. */
+		while (j > 0) {
+			l = rect->x2 - x;
+			if (l > j)
+				l = j;
+			wcap_rle_apply(d + x, l, v);
+			x += l;
+			j -= l;
 			if (x == rect->x2) {
 				x = rect->x1;
 				d -= decoder->width;
 			}
 		}
-		i += j;
 	}
 
-	if (i != count)
-		printf("rle encoding longer than expected (%d expected %d)\n",
-		       i, count);
-
 	decoder->p = p;
+
+	return 0;
+}
+
+/* Upper bound for the decompressed size of a frame, to not let a
+ * corrupt size allocate arbitrary amounts of memory. */
+#define WCAP_MAX_PAYLOAD (1u << 30)
+
+static void *
+wcap_decoder_ensure_payload(struct wcap_decoder *decoder, size_t size)
+{
+	void *payload;
+
+	if (size > decoder->payload_size) {
+		payload = realloc(decoder->payload, size);
+		if (payload == NULL)
+			return NULL;
+		decoder->payload = payload;
+		decoder->payload_size = size;
+	}
+
+	return decoder->payload;
+}
+
+/* Compressed frames store the size of the rectangles and run-length
+ * data followed by the compressed data. */
+static void *
+wcap_decoder_decompress(struct wcap_decoder *decoder,
+			const struct wcap_frame_header_v2 *header,
+			const void *data, uint32_t *size)
+{
+	uint32_t raw_size;
+	size_t len;
+	const void *src = (const char *) data + sizeof raw_size;
+	int ok = 0;
+
+	if (header->size < sizeof raw_size) {
+		fprintf(stderr, "invalid compressed frame\n");
+		return NULL;
+	}
+	memcpy(&raw_size, data, sizeof raw_size);
+	len = header->size - sizeof raw_size;
+
+	if (raw_size > WCAP_MAX_PAYLOAD) {
+		fprintf(stderr, "invalid compressed frame\n");
+		return NULL;
+	}
+	if (!wcap_decoder_ensure_payload(decoder, raw_size ? raw_size : 1))
+		return NULL;
+
+	switch (header->flags & WCAP_FRAME_COMPRESSED) {
+#ifdef HAVE_LZ4
+	case WCAP_FRAME_LZ4:
+		ok = len <= INT_MAX && raw_size <= INT_MAX &&
+		     LZ4_decompress_safe(src, decoder->payload, len,
+					 raw_size) == (int) raw_size;
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case WCAP_FRAME_ZSTD:
+		ok = ZSTD_decompress(decoder->payload, raw_size,
+				     src, len) == raw_size;
+		break;
+#endif
+	default:
+		fprintf(stderr, "frame compression not supported\n");
+		return NULL;
+	}
+
+	if (!ok) {
+		fprintf(stderr, "failed to decompress frame\n");
+		return NULL;
+	}
+
+	decoder->compressed_bytes += header->size;
+	decoder->uncompressed_bytes += raw_size;
+	*size = raw_size;
+
+	return decoder->payload;
 }
 
 int
 wcap_decoder_get_frame(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
-	struct wcap_frame_header *header;
-	uint32_t i;
+	struct wcap_frame_header header;
+	struct wcap_frame_header_v2 header_v2;
+	void *next = NULL, *end, *data;
+	uint32_t i, nrects, size;
 
-	if (decoder->p == decoder->end)
+	if (decoder->p >= decoder->end)
 		return 0;
 
-	header = decoder->p;
-	decoder->msecs = header->msecs;
+	if (decoder->version == 2) {
+		/* Compressed frames have arbitrary sizes, so frame headers
+		 * and data aren't necessarily 32 bit aligned. */
+		if (bytes_left(decoder->p, decoder->end) < sizeof header_v2)
+			goto corrupt;
+		memcpy(&header_v2, decoder->p, sizeof header_v2);
+		data = (char *) decoder->p + sizeof header_v2;
+		if (bytes_left(data, decoder->end) < header_v2.size)
+			goto corrupt;
+
+		decoder->msecs = header_v2.msecs;
+		nrects = header_v2.nrects;
+		next = (char *) data + header_v2.size;
+
+		if (header_v2.flags & WCAP_FRAME_COMPRESSED) {
+			rects = wcap_decoder_decompress(decoder, &header_v2,
+							data, &size);
+		} else if ((uintptr_t) data % 4 != 0) {
+			size = header_v2.size;
+			rects = wcap_decoder_ensure_payload(decoder,
+							    size ? size : 1);
+			if (rects)
+				memcpy(rects, data, size);
+		} else {
+			size = header_v2.size;
+			rects = data;
+		}
+		if (rects == NULL)
+			goto corrupt;
+		end = (char *) rects + size;
+
+		/* Keyframes are encoded against an all zero frame. */
+		if (header_v2.flags & WCAP_FRAME_KEYFRAME)
+			memset(decoder->frame, 0,
+			       decoder->width * decoder->height * 4);
+	} else {
+		if (bytes_left(decoder->p, decoder->end) < sizeof header)
+			goto corrupt;
+		memcpy(&header, decoder->p, sizeof header);
+
+		decoder->msecs = header.msecs;
+		nrects = header.nrects;
+		rects = (void *) ((char *) decoder->p + sizeof header);
+		end = decoder->end;
+	}
+
+	if (nrects > bytes_left(rects, end) / sizeof *rects)
+		goto corrupt;
+	for (i = 0; i < nrects; i++)
+		if (!wcap_decoder_check_rectangle(decoder, &rects[i]))
+			goto corrupt;
+
 	decoder->count++;
 
-	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++)
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+	decoder->p = (uint32_t *) (rects + nrects);
+	for (i = 0; i < nrects; i++)
+		if (wcap_decoder_decode_rectangle(decoder, &rects[i], end) < 0)
+			goto corrupt;
+
+	if (next)
+		decoder->p = next;
 
 	return 1;
+
+corrupt:
+	fprintf(stderr, "corrupt frame %u, stopping\n", decoder->count);
+	decoder->p = decoder->end;
+
+	return 0;
+}
+
+static void
+wcap_decoder_seek_start(struct wcap_decoder *decoder)
+{
+	decoder->p = (struct wcap_header *) decoder->map + 1;
+	decoder->count = 0;
+	memset(decoder->frame, 0, decoder->width * decoder->height * 4);
+}
+
+/* Decode frames until the given frame number (counting from 0) is in
+ * decoder->frame.  With a frame index this starts from the closest
+ * keyframe, otherwise from the current frame or the start of the file.
+ * Returns 1 on success or 0 if the file has fewer frames.
+ */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame)
+{
+	uint32_t key;
+
+	if (decoder->index) {
+		if (frame >= decoder->nframes)
+			return 0;
+
+		for (key = frame; key > 0; key--)
+			if (decoder->index[key].flags & WCAP_FRAME_KEYFRAME)
+				break;
+
+		/* Only jump if the current frame can't be used to decode
+		 * forward from. */
+		if (decoder->count > frame + 1 || decoder->count < key + 1) {
+			if (key == 0) {
+				wcap_decoder_seek_start(decoder);
+			} else {
+				decoder->p = decoder->map +
+					decoder->index[key].offset;
+				decoder->count = key;
+			}
+		}
+	} else if (decoder->count > frame + 1) {
+		wcap_decoder_seek_start(decoder);
+	}
+
+	while (decoder->count < frame + 1)
+		if (!wcap_decoder_get_frame(decoder))
+			return 0;
+
+	return 1;
+}
+
+/* Every index entry must point at a complete frame between the file
+ * header and the index, in increasing order. */
+static int
+wcap_decoder_check_index(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header_v2 header;
+	size_t start = sizeof(struct wcap_header);
+	size_t end = (char *) decoder->end - (char *) decoder->map;
+	uint64_t prev = 0;
+	uint32_t i;
+
+	for (i = 0; i < decoder->nframes; i++) {
+		uint64_t offset = decoder->index[i].offset;
+
+		if (offset < start || offset < prev ||
+		    offset > end || end - offset < sizeof header)
+			return -1;
+
+		memcpy(&header, decoder->map + offset, sizeof header);
+		if (end - offset - sizeof header < header.size)
+			return -1;
+
+		prev = offset + sizeof header + header.size;
+	}
+
+	return 0;
+}
+
+/* Load the frame index from the end of a v2 file.  Without one, for
+ * example when the recording was interrupted, rebuild it by walking the
+ * frame headers and drop a truncated last frame.
+ */
+static int
+wcap_decoder_load_index(struct wcap_decoder *decoder)
+{
+	struct wcap_index_footer footer;
+	struct wcap_frame_header_v2 header;
+	struct wcap_index_entry *entry;
+	uint32_t alloc = 0;
+	size_t size, avail;
+	void *p;
+
+	decoder->index = NULL;
+	decoder->nframes = 0;
+
+	if (decoder->size >= sizeof(struct wcap_header) + sizeof footer) {
+		/* The footer isn't necessarily 64 bit aligned either. */
+		memcpy(&footer, decoder->map + decoder->size - sizeof footer,
+		       sizeof footer);
+		avail = decoder->size - sizeof(struct wcap_header) -
+			sizeof footer;
+		size = (size_t) footer.count * sizeof *entry;
+		if (footer.magic == WCAP_INDEX_MAGIC &&
+		    footer.count <= avail / sizeof *entry &&
+		    footer.offset == decoder->size - sizeof footer - size) {
+			/* The index isn't necessarily 64 bit aligned. */
+			decoder->index = malloc(size ? size : 1);
+			if (decoder->index == NULL)
+				return -1;
+			memcpy(decoder->index, decoder->map + footer.offset,
+			       size);
+			decoder->nframes = footer.count;
+			decoder->end = decoder->map + footer.offset;
+			if (wcap_decoder_check_index(decoder) == 0)
+				return 0;
+
+			fprintf(stderr, "invalid frame index, rebuilding\n");
+			free(decoder->index);
+			decoder->index = NULL;
+			decoder->nframes = 0;
+			decoder->end = decoder->map + decoder->size;
+		}
+	}
+
+	p = decoder->p;
+	while (bytes_left(p, decoder->end) >= sizeof header) {
+		memcpy(&header, p, sizeof header);
+		if (bytes_left(p + sizeof header, decoder->end) < header.size)
+			break;
+
+		if (decoder->nframes == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			entry = realloc(decoder->index,
+					alloc * sizeof *entry);
+			if (entry == NULL)
+				return -1;
+			decoder->index = entry;
+		}
+
+		entry = &decoder->index[decoder->nframes++];
+		entry->offset = p - decoder->map;
+		entry->msecs = header.msecs;
+		entry->flags = header.flags;
+
+		p += sizeof header + header.size;
+	}
+	decoder->end = p;
+
+	return 0;
 }
 
 struct wcap_decoder *
@@ -125,7 +452,13 @@ wcap_decoder_create(const char *filename)
 		return NULL;
 	}
 
-	fstat(decoder->fd, &buf);
+	if (fstat(decoder->fd, &buf) < 0 ||
+	    (size_t) buf.st_size < sizeof *header) {
+		fprintf(stderr, "not a wcap file\n");
+		close(decoder->fd);
+		free(decoder);
+		return NULL;
+	}
 	decoder->size = buf.st_size;
 	decoder->map = mmap(NULL, decoder->size,
 			    PROT_READ, MAP_PRIVATE, decoder->fd, 0);
@@ -137,18 +470,55 @@ wcap_decoder_create(const char *filename)
 	}
 
 	header = decoder->map;
+	switch (header->magic) {
+	case WCAP_HEADER_MAGIC:
+		decoder->version = 1;
+		break;
+	case WCAP_HEADER_MAGIC_V2:
+		decoder->version = 2;
+		break;
+	default:
+		fprintf(stderr, "not a wcap file\n");
+		munmap(decoder->map, decoder->size);
+		close(decoder->fd);
+		free(decoder);
+		return NULL;
+	}
+
+	if (header->width == 0 || header->height == 0 ||
+	    header->width > INT_MAX / 4 / header->height) {
+		fprintf(stderr, "invalid frame size %ux%u\n",
+			header->width, header->height);
+		munmap(decoder->map, decoder->size);
+		close(decoder->fd);
+		free(decoder);
+		return NULL;
+	}
+
 	decoder->format = header->format;
 	decoder->count = 0;
 	decoder->width = header->width;
 	decoder->height = header->height;
 	decoder->p = header + 1;
 	decoder->end = decoder->map + decoder->size;
+	decoder->index = NULL;
+	decoder->nframes = 0;
+	decoder->frame = NULL;
+	decoder->payload = NULL;
+	decoder->payload_size = 0;
+	decoder->compressed_bytes = 0;
+	decoder->uncompressed_bytes = 0;
+
+	if (decoder->version == 2 && wcap_decoder_load_index(decoder) < 0) {
+		fprintf(stderr, "failed to load frame index\n");
+		wcap_decoder_destroy(decoder);
+		return NULL;
+	}
 
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
 	if (decoder->frame == NULL) {
-		close(decoder->fd);
-		free(decoder);
+		wcap_decoder_destroy(decoder);
 		return NULL;
 	}
 	memset(decoder->frame, 0, frame_size);
@@ -161,6 +531,8 @@ wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
 	munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	free(decoder->index);
+	free(decoder->payload);
 	free(decoder->frame);
 	free(decoder);
 }
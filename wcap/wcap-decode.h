@@ -29,6 +29,8 @@
 #include <stdint.h>
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57494458
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -46,10 +48,34 @@ struct wcap_frame_header {
 	uint32_t nrects;
 };
 
+#define WCAP_FRAME_KEYFRAME	(1 << 0)
+#define WCAP_FRAME_LZ4		(1 << 1)
+#define WCAP_FRAME_ZSTD		(1 << 2)
+#define WCAP_FRAME_COMPRESSED	(WCAP_FRAME_LZ4 | WCAP_FRAME_ZSTD)
+
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+	uint32_t size;
+};
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+struct wcap_index_entry {
+	uint64_t offset;
+	uint32_t msecs;
+	uint32_t flags;
+};
+
+struct wcap_index_footer {
+	uint32_t magic;
+	uint32_t count;
+	uint64_t offset;
+};
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
@@ -59,9 +85,18 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+	int version;
+	/* Only set for v2 files, one entry per frame. */
+	struct wcap_index_entry *index;
+	uint32_t nframes;
+	/* Decompressed frame payload */
+	void *payload;
+	size_t payload_size;
+	uint64_t compressed_bytes, uncompressed_bytes;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t frame);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
@@ -0,0 +1,389 @@
+/*
+ * Copyright © 2008-2011 Kristian Høgsberg
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_RLE_
+#define _WCAP_RLE_
+
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define WCAP_RLE_IMPL "avx2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define WCAP_RLE_IMPL "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WCAP_RLE_NEON 1
+#define WCAP_RLE_IMPL "neon"
+#else
+#define WCAP_RLE_IMPL "generic"
+#endif
+
+/* Helpers shared by the recorder in libweston and by wcap-decode for
+ * the run-length encoded delta format described in wcap/README.
+ *
+ * Deltas are component-wise (per byte) differences of the three color
+ * channels, the 'X' channel is used for the run length.  All of this
+ * maps directly onto byte-wise vector arithmetic, so each helper comes
+ * in a portable *_generic variant and, where the target supports it,
+ * a vectorized one.  Both produce identical results; the unsuffixed
+ * names pick the best variant available at compile time.
+ */
+
+#define WCAP_RLE_COLOR_MASK	0x00ffffff
+#define WCAP_RLE_ALPHA		0xff000000
+
+/* Compute the delta between src and frame for n pixels, store it in
+ * delta and update frame with the new contents from src.
+ */
+static inline void
+wcap_rle_delta_generic(uint32_t *delta, uint32_t *frame,
+		       const uint32_t *src, int n)
+{
+	unsigned char dr, dg, db;
+	uint32_t next, prev;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		next = src[i];
+		prev = frame[i];
+		dr = (next >> 16) - (prev >> 16);
+		dg = (next >>  8) - (prev >>  8);
+		db = (next >>  0) - (prev >>  0);
+		delta[i] = (dr << 16) | (dg << 8) | (db << 0);
+		frame[i] = next;
+	}
+}
+
+/* Return the number of leading entries in delta[0..n) that are equal
+ * to value.
+ */
+static inline int
+wcap_rle_span_generic(const uint32_t *delta, int n, uint32_t value)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (delta[i] != value)
+			break;
+
+	return i;
+}
+
+/* Apply a single delta to n consecutive destination pixels. */
+static inline void
+wcap_rle_apply_generic(uint32_t *d, int n, uint32_t delta)
+{
+	unsigned char r, g, b, dr, dg, db;
+	int i;
+
+	dr = (delta >> 16);
+	dg = (delta >>  8);
+	db = (delta >>  0);
+	for (i = 0; i < n; i++) {
+		r = (d[i] >> 16) + dr;
+		g = (d[i] >>  8) + dg;
+		b = (d[i] >>  0) + db;
+		d[i] = WCAP_RLE_ALPHA | (r << 16) | (g << 8) | b;
+	}
+}
+
+#if defined(__AVX2__)
+
+static inline void
+wcap_rle_delta(uint32_t *delta, uint32_t *frame, const uint32_t *src, int n)
+{
+	const __m256i mask = _mm256_set1_epi32(WCAP_RLE_COLOR_MASK);
+	__m256i s, f;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		s = _mm256_loadu_si256((const __m256i *) (src + i));
+		f = _mm256_loadu_si256((const __m256i *) (frame + i));
+		_mm256_storeu_si256((__m256i *) (delta + i),
+				    _mm256_and_si256(_mm256_sub_epi8(s, f),
+						     mask));
+		_mm256_storeu_si256((__m256i *) (frame + i), s);
+	}
+
+	wcap_rle_delta_generic(delta + i, frame + i, src + i, n - i);
+}
+
+static inline int
+wcap_rle_span(const uint32_t *delta, int n, uint32_t value)
+{
+	const __m256i v = _mm256_set1_epi32(value);
+	unsigned int mask;
+	__m256i c;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		c = _mm256_cmpeq_epi32(v,
+			_mm256_loadu_si256((const __m256i *) (delta + i)));
+		mask = ~(unsigned int) _mm256_movemask_epi8(c);
+		if (mask)
+			return i + __builtin_ctz(mask) / 4;
+	}
+
+	return i + wcap_rle_span_generic(delta + i, n - i, value);
+}
+
+static inline void
+wcap_rle_apply(uint32_t *d, int n, uint32_t delta)
+{
+	const __m256i v = _mm256_set1_epi32(delta & WCAP_RLE_COLOR_MASK);
+	const __m256i alpha = _mm256_set1_epi32(WCAP_RLE_ALPHA);
+	__m256i p;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		p = _mm256_loadu_si256((const __m256i *) (d + i));
+		p = _mm256_or_si256(_mm256_add_epi8(p, v), alpha);
+		_mm256_storeu_si256((__m256i *) (d + i), p);
+	}
+
+	wcap_rle_apply_generic(d + i, n - i, delta);
+}
+
+#elif defined(__SSE2__)
+
+static inline void
+wcap_rle_delta(uint32_t *delta, uint32_t *frame, const uint32_t *src, int n)
+{
+	const __m128i mask = _mm_set1_epi32(WCAP_RLE_COLOR_MASK);
+	__m128i s, f;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		s = _mm_loadu_si128((const __m128i *) (src + i));
+		f = _mm_loadu_si128((const __m128i *) (frame + i));
+		_mm_storeu_si128((__m128i *) (delta + i),
+				 _mm_and_si128(_mm_sub_epi8(s, f), mask));
+		_mm_storeu_si128((__m128i *) (frame + i), s);
+	}
+
+	wcap_rle_delta_generic(delta + i, frame + i, src + i, n - i);
+}
+
+static inline int
+wcap_rle_span(const uint32_t *delta, int n, uint32_t value)
+{
+	const __m128i v = _mm_set1_epi32(value);
+	unsigned int mask;
+	__m128i c;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		c = _mm_cmpeq_epi32(v,
+			_mm_loadu_si128((const __m128i *) (delta + i)));
+		mask = ~_mm_movemask_epi8(c) & 0xffff;
+		if (mask)
+			return i + __builtin_ctz(mask) / 4;
+	}
+
+	return i + wcap_rle_span_generic(delta + i, n - i, value);
+}
+
+static inline void
+wcap_rle_apply(uint32_t *d, int n, uint32_t delta)
+{
+	const __m128i v = _mm_set1_epi32(delta & WCAP_RLE_COLOR_MASK);
+	const __m128i alpha = _mm_set1_epi32(WCAP_RLE_ALPHA);
+	__m128i p;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		p = _mm_loadu_si128((const __m128i *) (d + i));
+		p = _mm_or_si128(_mm_add_epi8(p, v), alpha);
+		_mm_storeu_si128((__m128i *) (d + i), p);
+	}
+
+	wcap_rle_apply_generic(d + i, n - i, delta);
+}
+
+#elif defined(WCAP_RLE_NEON)
+
+static inline void
+wcap_rle_delta(uint32_t *delta, uint32_t *frame, const uint32_t *src, int n)
+{
+	const uint32x4_t mask = vdupq_n_u32(WCAP_RLE_COLOR_MASK);
+	uint8x16_t s, f;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		s = vld1q_u8((const uint8_t *) (src + i));
+		f = vld1q_u8((const uint8_t *) (frame + i));
+		vst1q_u32(delta + i,
+			  vandq_u32(vreinterpretq_u32_u8(vsubq_u8(s, f)),
+				    mask));
+		vst1q_u8((uint8_t *) (frame + i), s);
+	}
+
+	wcap_rle_delta_generic(delta + i, frame + i, src + i, n - i);
+}
+
+static inline int
+wcap_rle_span(const uint32_t *delta, int n, uint32_t value)
+{
+	const uint32x4_t v = vdupq_n_u32(value);
+	uint32x4_t c;
+	uint64x2_t c64;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		c = vceqq_u32(v, vld1q_u32(delta + i));
+		c64 = vreinterpretq_u64_u32(c);
+		if ((vgetq_lane_u64(c64, 0) & vgetq_lane_u64(c64, 1)) !=
+		    UINT64_MAX)
+			break;
+	}
+
+	return i + wcap_rle_span_generic(delta + i, n - i, value);
+}
+
+static inline void
+wcap_rle_apply(uint32_t *d, int n, uint32_t delta)
+{
+	const uint8x16_t v =
+		vreinterpretq_u8_u32(vdupq_n_u32(delta & WCAP_RLE_COLOR_MASK));
+	const uint32x4_t alpha = vdupq_n_u32(WCAP_RLE_ALPHA);
+	uint8x16_t p;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		p = vaddq_u8(vld1q_u8((const uint8_t *) (d + i)), v);
+		vst1q_u32(d + i, vorrq_u32(vreinterpretq_u32_u8(p), alpha));
+	}
+
+	wcap_rle_apply_generic(d + i, n - i, delta);
+}
+
+#else
+
+static inline void
+wcap_rle_delta(uint32_t *delta, uint32_t *frame, const uint32_t *src, int n)
+{
+	wcap_rle_delta_generic(delta, frame, src, n);
+}
+
+static inline int
+wcap_rle_span(const uint32_t *delta, int n, uint32_t value)
+{
+	return wcap_rle_span_generic(delta, n, value);
+}
+
+static inline void
+wcap_rle_apply(uint32_t *d, int n, uint32_t delta)
+{
+	wcap_rle_apply_generic(d, n, delta);
+}
+
+#endif
+
+/* Emit a run of 'run' pixels that all differ by 'delta', splitting it
+ * into as many run-length words as needed.
+ */
+static inline uint32_t *
+wcap_rle_output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+/* Decode the length of the run stored in a run-length word. */
+static inline int
+wcap_rle_run_length(uint32_t v)
+{
+	uint32_t l = v >> 24;
+
+	if (l < 0xe0)
+		return l + 1;
+	else
+		return 1 << (l - 0xe0 + 7);
+}
+
+/* Run state carried across the rows of a rectangle. */
+struct wcap_rle_encoder {
+	uint32_t prev;
+	int run;
+};
+
+static inline void
+wcap_rle_encoder_init(struct wcap_rle_encoder *enc)
+{
+	enc->prev = 0;
+	enc->run = 0;
+}
+
+/* Append n deltas to the run-length stream at p, returns the new end
+ * of the stream.  The last run is kept pending until
+ * wcap_rle_encoder_finish() is called, so runs continue across rows.
+ */
+static inline uint32_t *
+wcap_rle_encode(struct wcap_rle_encoder *enc, uint32_t *p,
+		const uint32_t *delta, int n)
+{
+	uint32_t v;
+	int k, span;
+
+	for (k = 0; k < n; k += span) {
+		v = delta[k];
+		if (enc->run > 0 && v != enc->prev) {
+			p = wcap_rle_output_run(p, enc->prev, enc->run);
+			enc->run = 0;
+		}
+
+		span = wcap_rle_span(delta + k, n - k, v);
+		enc->run += span;
+		enc->prev = v;
+	}
+
+	return p;
+}
+
+static inline uint32_t *
+wcap_rle_encoder_finish(struct wcap_rle_encoder *enc, uint32_t *p)
+{
+	p = wcap_rle_output_run(p, enc->prev, enc->run);
+	enc->run = 0;
+
+	return p;
+}
+
+#endif
@@ -38,6 +38,7 @@
 
 #include "xwayland.h"
 #include "xwayland-api.h"
+#include "weston-debug.h"
 #include "shared/helpers.h"
 #include "shared/string-helpers.h"
 #include "compositor/weston.h"
@@ -229,6 +230,8 @@ weston_xserver_destroy(struct wl_listener *l, void *data)
 	if (wxs->loop)
 		weston_xserver_shutdown(wxs);
 
+	weston_debug_scope_destroy(wxs->wm_debug);
+
 	free(wxs);
 }
 
@@ -388,6 +391,13 @@ weston_module_init(struct weston_compositor *compositor)
 		return -1;
 	}
 
+	/* The scope outlives the X server and its window manager, so a
+	 * subscription survives Xwayland being restarted. */
+	wxs->wm_debug =
+		weston_compositor_add_debug_scope(compositor, "xwm-wm",
+			"X11 window manager actions and X events\n",
+			NULL, NULL);
+
 	wxs->destroy_listener.notify = weston_xserver_destroy;
 	wl_signal_add(&compositor->destroy_signal, &wxs->destroy_listener);
 
@@ -30,54 +30,184 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #include "xwayland.h"
 #include "shared/helpers.h"
 
+/* Properties are read at most selection_chunk_size bytes at a time,
+ * and the next slice is only requested once the previous one has been
+ * written to the target fd.  A slow reader thus holds back the
+ * transfer instead of making us buffer the whole payload.
+ */
+static xcb_get_property_cookie_t
+weston_wm_send_get_selection_slice(struct weston_wm *wm, uint32_t offset)
+{
+	return xcb_get_property(wm->conn,
+				0, /* delete */
+				wm->selection_window,
+				wm->atom.wl_selection,
+				XCB_GET_PROPERTY_TYPE_ANY,
+				offset, /* in 32-bit units */
+				wm->selection_chunk_size / 4);
+}
+
+/* The first slice, read in response to an X event */
+static xcb_get_property_reply_t *
+weston_wm_get_selection_slice(struct weston_wm *wm, uint32_t offset)
+{
+	xcb_get_property_cookie_t cookie;
+	xcb_get_property_reply_t *reply;
+
+	cookie = weston_wm_send_get_selection_slice(wm, offset);
+	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	weston_wm_schedule_dispatch(wm);
+
+	return reply;
+}
+
+/* No more slices to write: request the next INCR chunk or finish. */
+static void
+weston_wm_end_property_slices(struct weston_wm *wm, uint32_t total)
+{
+	if (wm->property_source)
+		wl_event_source_remove(wm->property_source);
+	wm->property_source = NULL;
+
+	/* For INCR, deleting the property asks the owner for the next
+	 * chunk. */
+	xcb_delete_property(wm->conn,
+			    wm->selection_window,
+			    wm->atom.wl_selection);
+	xcb_flush(wm->conn);
+
+	if (!wm->incr) {
+		weston_log("transfer complete, %u bytes\n", total);
+		close(wm->data_source_fd);
+		wm->data_source_fd = -1;
+	}
+}
+
+static void
+weston_wm_handle_selection_slice(struct weston_wm_window *window,
+				 void *reply, void *data)
+{
+	struct weston_wm *wm = data;
+
+	/* The target went away while this was in flight.  Replies come
+	 * in order, so this one is from the abandoned transfer and any
+	 * slice requested since is still pending. */
+	if (wm->property_stale_replies > 0) {
+		wm->property_stale_replies--;
+		free(reply);
+		return;
+	}
+
+	wm->property_requested = false;
+
+	if (reply == NULL) {
+		weston_log("failed to read selection property at %u\n",
+			   wm->property_offset * 4);
+		weston_wm_end_property_slices(wm, wm->property_offset * 4);
+		return;
+	}
+
+	wm->property_reply = reply;
+	wm->property_start = 0;
+	if (wm->property_source)
+		wl_event_source_fd_update(wm->property_source,
+					  WL_EVENT_WRITABLE);
+}
+
+/* Stop waiting for the target fd to become writable until the slice at
+ * offset has arrived, see weston_wm_handle_selection_slice(). */
+static void
+weston_wm_request_selection_slice(struct weston_wm *wm, uint32_t offset)
+{
+	xcb_get_property_cookie_t cookie;
+
+	if (wm->property_source)
+		wl_event_source_fd_update(wm->property_source, 0);
+
+	wm->property_offset = offset;
+	wm->property_requested = true;
+	cookie = weston_wm_send_get_selection_slice(wm, offset);
+	xcb_flush(wm->conn);
+	weston_wm_expect_reply(wm, NULL, cookie.sequence,
+			       weston_wm_handle_selection_slice, wm);
+}
+
+/* The target hung up or failed: stop writing, but still delete the
+ * property so an INCR owner can go on and finish, see
+ * weston_wm_get_incr_chunk(). */
+static void
+weston_wm_abandon_property_slices(struct weston_wm *wm, int fd)
+{
+	if (wm->property_source)
+		wl_event_source_remove(wm->property_source);
+	wm->property_source = NULL;
+	close(fd);
+	wm->data_source_fd = -1;
+
+	xcb_delete_property(wm->conn,
+			    wm->selection_window,
+			    wm->atom.wl_selection);
+	xcb_flush(wm->conn);
+}
+
 static int
 writable_callback(int fd, uint32_t mask, void *data)
 {
 	struct weston_wm *wm = data;
+	xcb_get_property_reply_t *reply = wm->property_reply;
 	unsigned char *property;
-	int len, remainder;
+	int len, remainder, more;
+	uint32_t offset, total;
 
-	property = xcb_get_property_value(wm->property_reply);
-	remainder = xcb_get_property_value_length(wm->property_reply) -
+	/* While the next slice is in flight only a hangup or error of
+	 * the target gets us here. */
+	if (reply == NULL) {
+		if (wm->property_requested) {
+			wm->property_requested = false;
+			wm->property_stale_replies++;
+		}
+		weston_wm_abandon_property_slices(wm, fd);
+		weston_log("target fd closed during selection transfer\n");
+		return 1;
+	}
+
+	property = xcb_get_property_value(reply);
+	remainder = xcb_get_property_value_length(reply) -
 		wm->property_start;
 
 	len = write(fd, property + wm->property_start, remainder);
+	if (len == -1 && errno == EAGAIN)
+		return 1;
 	if (len == -1) {
+		weston_log("write error to target fd: %m\n");
 		free(wm->property_reply);
 		wm->property_reply = NULL;
-		if (wm->property_source)
-			wl_event_source_remove(wm->property_source);
-		wm->property_source = NULL;
-		close(fd);
-		weston_log("write error to target fd: %m\n");
+		weston_wm_abandon_property_slices(wm, fd);
 		return 1;
 	}
 
-	weston_log("wrote %d (chunk size %d) of %d bytes\n",
-		wm->property_start + len,
-		len, xcb_get_property_value_length(wm->property_reply));
-
 	wm->property_start += len;
-	if (len == remainder) {
-		free(wm->property_reply);
-		wm->property_reply = NULL;
-		if (wm->property_source)
-			wl_event_source_remove(wm->property_source);
-		wm->property_source = NULL;
+	if (len < remainder)
+		return 1;
 
-		if (wm->incr) {
-			xcb_delete_property(wm->conn,
-					    wm->selection_window,
-					    wm->atom.wl_selection);
-		} else {
-			weston_log("transfer complete\n");
-			close(fd);
-		}
-	}
+	/* The slice is out, fetch the next one if there is more. */
+	more = reply->bytes_after > 0;
+	offset = wm->property_offset +
+		xcb_get_property_value_length(reply) / 4;
+	total = wm->property_offset * 4 +
+		xcb_get_property_value_length(reply);
+	free(reply);
+	wm->property_reply = NULL;
+
+	if (more)
+		weston_wm_request_selection_slice(wm, offset);
+	else
+		weston_wm_end_property_slices(wm, total);
 
 	return 1;
 }
@@ -86,45 +216,47 @@ static void
 weston_wm_write_property(struct weston_wm *wm, xcb_get_property_reply_t *reply)
 {
 	wm->property_start = 0;
+	wm->property_offset = 0;
 	wm->property_reply = reply;
 	writable_callback(wm->data_source_fd, WL_EVENT_WRITABLE, wm);
 
-	if (wm->property_reply)
+	if (wm->property_reply || wm->property_requested)
 		wm->property_source =
 			wl_event_loop_add_fd(wm->server->loop,
 					     wm->data_source_fd,
-					     WL_EVENT_WRITABLE,
+					     wm->property_reply ?
+					     WL_EVENT_WRITABLE : 0,
 					     writable_callback, wm);
 }
 
 static void
 weston_wm_get_incr_chunk(struct weston_wm *wm)
 {
-	xcb_get_property_cookie_t cookie;
 	xcb_get_property_reply_t *reply;
 
-	cookie = xcb_get_property(wm->conn,
-				  0, /* delete */
-				  wm->selection_window,
-				  wm->atom.wl_selection,
-				  XCB_GET_PROPERTY_TYPE_ANY,
-				  0, /* offset */
-				  0x1fffffff /* length */);
-
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	reply = weston_wm_get_selection_slice(wm, 0);
 	if (reply == NULL)
 		return;
 
 	dump_property(wm, wm->atom.wl_selection, reply);
 
-	if (xcb_get_property_value_length(reply) > 0) {
+	if (xcb_get_property_value_length(reply) == 0) {
+		weston_log("transfer complete\n");
+		if (wm->data_source_fd >= 0)
+			close(wm->data_source_fd);
+		wm->data_source_fd = -1;
+		free(reply);
+	} else if (wm->data_source_fd < 0) {
+		/* The target is gone, drain the remaining chunks. */
+		free(reply);
+		xcb_delete_property(wm->conn,
+				    wm->selection_window,
+				    wm->atom.wl_selection);
+		xcb_flush(wm->conn);
+	} else {
 		/* reply's ownership is transferred to wm, which is responsible
 		 * for freeing it */
 		weston_wm_write_property(wm, reply);
-	} else {
-		weston_log("transfer complete\n");
-		close(wm->data_source_fd);
-		free(reply);
 	}
 }
 
@@ -188,6 +320,7 @@ weston_wm_get_selection_targets(struct weston_wm *wm)
 				  4096 /* length */);
 
 	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	weston_wm_schedule_dispatch(wm);
 	if (reply == NULL)
 		return;
 
@@ -230,26 +363,21 @@ weston_wm_get_selection_targets(struct weston_wm *wm)
 static void
 weston_wm_get_selection_data(struct weston_wm *wm)
 {
-	xcb_get_property_cookie_t cookie;
 	xcb_get_property_reply_t *reply;
 
-	cookie = xcb_get_property(wm->conn,
-				  1, /* delete */
-				  wm->selection_window,
-				  wm->atom.wl_selection,
-				  XCB_GET_PROPERTY_TYPE_ANY,
-				  0, /* offset */
-				  0x1fffffff /* length */);
-
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	reply = weston_wm_get_selection_slice(wm, 0);
 
 	dump_property(wm, wm->atom.wl_selection, reply);
 
 	if (reply == NULL) {
 		return;
 	} else if (reply->type == wm->atom.incr) {
+		/* Deleting the INCR property starts the transfer. */
 		wm->incr = 1;
 		free(reply);
+		xcb_delete_property(wm->conn,
+				    wm->selection_window,
+				    wm->atom.wl_selection);
 	} else {
 		wm->incr = 0;
 		/* reply's ownership is transferred to wm, which is responsible
@@ -274,8 +402,6 @@ weston_wm_handle_selection_notify(struct weston_wm *wm,
 	}
 }
 
-static const size_t incr_chunk_size = 64 * 1024;
-
 static void
 weston_wm_send_selection_notify(struct weston_wm *wm, xcb_atom_t property)
 {
@@ -352,46 +478,68 @@ weston_wm_flush_source_data(struct weston_wm *wm)
 	return length;
 }
 
+static void
+weston_wm_abort_data_source(struct weston_wm *wm, int fd)
+{
+	weston_wm_send_selection_notify(wm, XCB_ATOM_NONE);
+	wl_event_source_remove(wm->property_source);
+	wm->property_source = NULL;
+	close(fd);
+	wl_array_release(&wm->source_data);
+	wl_array_init(&wm->source_data);
+}
+
 static int
 weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 {
 	struct weston_wm *wm = data;
 	int len, current, available;
+	uint32_t incr_size;
 	void *p;
 
+	/* Never buffer more than one chunk: once it is full we stop
+	 * reading until the requestor has consumed the property, so the
+	 * source is throttled to the speed of the X client. */
 	current = wm->source_data.size;
-	if (wm->source_data.size < incr_chunk_size)
-		p = wl_array_add(&wm->source_data, incr_chunk_size);
-	else
-		p = (char *) wm->source_data.data + wm->source_data.size;
-	available = wm->source_data.alloc - current;
+	if (wm->source_data.alloc < wm->selection_chunk_size) {
+		if (!wl_array_add(&wm->source_data,
+				  wm->selection_chunk_size - current)) {
+			weston_log("failed to allocate selection buffer\n");
+			weston_wm_abort_data_source(wm, fd);
+			return 1;
+		}
+		wm->source_data.size = current;
+	}
+	p = (char *) wm->source_data.data + current;
+	available = wm->selection_chunk_size - current;
 
 	len = read(fd, p, available);
+	if (len == -1 && errno == EAGAIN)
+		return 1;
 	if (len == -1) {
 		weston_log("read error from data source: %m\n");
-		weston_wm_send_selection_notify(wm, XCB_ATOM_NONE);
-		wl_event_source_remove(wm->property_source);
-		wm->property_source = NULL;
-		close(fd);
-		wl_array_release(&wm->source_data);
+		weston_wm_abort_data_source(wm, fd);
+		return 1;
 	}
 
-	weston_log("read %d (available %d, mask 0x%x) bytes: \"%.*s\"\n",
-		len, available, mask, len, (char *) p);
+	weston_log("read %d (available %d, mask 0x%x) bytes\n",
+		len, available, mask);
 
 	wm->source_data.size = current + len;
-	if (wm->source_data.size >= incr_chunk_size) {
+	if (wm->source_data.size >= wm->selection_chunk_size) {
 		if (!wm->incr) {
 			weston_log("got %zu bytes, starting incr\n",
 				wm->source_data.size);
 			wm->incr = 1;
+			/* lower bound of the total size */
+			incr_size = wm->selection_chunk_size;
 			xcb_change_property(wm->conn,
 					    XCB_PROP_MODE_REPLACE,
 					    wm->selection_request.requestor,
 					    wm->selection_request.property,
 					    wm->atom.incr,
 					    32, /* format */
-					    1, &incr_chunk_size);
+					    1, &incr_size);
 			wm->selection_property_set = 1;
 			wm->flush_property_on_delete = 1;
 			wl_event_source_remove(wm->property_source);
@@ -675,6 +823,30 @@ weston_wm_set_selection(struct wl_listener *listener, void *data)
 				XCB_TIME_CURRENT_TIME);
 }
 
+/* Upper bound for a single selection property.  Large enough that
+ * images and big texts go in a handful of round-trips, small enough
+ * that holding one chunk in memory does not matter. */
+#define SELECTION_CHUNK_MAX (1024 * 1024)
+
+static uint32_t
+weston_wm_get_selection_chunk_size(struct weston_wm *wm)
+{
+	const uint32_t header = sizeof(xcb_change_property_request_t);
+	uint32_t max_request;
+
+	/* xcb reports the limit in 4-byte units and it covers the whole
+	 * ChangeProperty request, header included.  With BIG-REQUESTS it
+	 * is typically far beyond what we want to buffer. */
+	max_request = xcb_get_maximum_request_length(wm->conn);
+	if (max_request >= (SELECTION_CHUNK_MAX + header) / 4)
+		return SELECTION_CHUNK_MAX;
+	if (max_request * 4 <= header)
+		return 64 * 1024;	/* broken connection, whatever */
+
+	/* Slices are fetched at 32-bit offsets. */
+	return (max_request * 4 - header) & ~3u;
+}
+
 void
 weston_wm_selection_init(struct weston_wm *wm)
 {
@@ -684,6 +856,10 @@ weston_wm_selection_init(struct weston_wm *wm)
 	wl_list_init(&wm->selection_listener.link);
 
 	wm->selection_request.requestor = XCB_NONE;
+	wl_array_init(&wm->source_data);
+	wm->selection_chunk_size = weston_wm_get_selection_chunk_size(wm);
+	weston_log("xwm: selection transfers in chunks of %u bytes\n",
+		   wm->selection_chunk_size);
 
 	values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE;
 	wm->selection_window = xcb_generate_id(wm->conn);
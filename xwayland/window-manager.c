@@ -37,10 +37,12 @@
 #include <signal.h>
 #include <limits.h>
 #include <assert.h>
+#include <xcb/xcbext.h>
 #include <X11/Xcursor/Xcursor.h>
 #include <linux/input.h>
 
 #include "compositor.h"
+#include "weston-debug.h"
 #include "xwayland.h"
 #include "xwayland-internal-interface.h"
 
@@ -48,6 +50,10 @@
 #include "hash.h"
 #include "shared/helpers.h"
 
+#ifndef static_assert
+#define static_assert(cond, msg)
+#endif
+
 struct wm_size_hints {
 	uint32_t flags;
 	int32_t x, y;
@@ -132,6 +138,8 @@ struct weston_output_weak_ref {
 	struct wl_listener destroy_listener;
 };
 
+#define WM_WINDOW_PROPERTY_COUNT 11
+
 struct weston_wm_window {
 	struct weston_wm *wm;
 	xcb_window_t id;
@@ -145,6 +153,10 @@ struct weston_wm_window {
 	struct wl_event_source *repaint_source;
 	struct wl_event_source *configure_source;
 	int properties_dirty;
+	bool properties_fetching;
+	bool shell_map_pending;
+	int pending_replies;
+	xcb_get_property_reply_t *property_reply[WM_WINDOW_PROPERTY_COUNT];
 	int pid;
 	char *machine;
 	char *class;
@@ -192,38 +204,49 @@ static void
 xserver_map_shell_surface(struct weston_wm_window *window,
 			  struct weston_surface *surface);
 
-static int __attribute__ ((format (printf, 1, 2)))
-wm_log(const char *fmt, ...)
+static int __attribute__ ((format (printf, 2, 3)))
+wm_log(struct weston_wm *wm, const char *fmt, ...)
 {
-#ifdef WM_DEBUG
-	int l;
+	struct weston_debug_scope *scope = wm->server->wm_debug;
+	char timestr[128];
 	va_list argp;
 
+	if (!weston_debug_scope_is_enabled(scope))
+		return 0;
+
+	weston_debug_scope_printf(scope, "%s ",
+				  weston_debug_scope_timestamp(scope, timestr,
+							       sizeof timestr));
+
 	va_start(argp, fmt);
-	l = weston_vlog(fmt, argp);
+	weston_debug_scope_vprintf(scope, fmt, argp);
 	va_end(argp);
 
-	return l;
-#else
-	return 0;
-#endif
+	return 1;
 }
 
-static int __attribute__ ((format (printf, 1, 2)))
-wm_log_continue(const char *fmt, ...)
+static int __attribute__ ((format (printf, 2, 3)))
+wm_log_continue(struct weston_wm *wm, const char *fmt, ...)
 {
-#ifdef WM_DEBUG
-	int l;
+	struct weston_debug_scope *scope = wm->server->wm_debug;
+	char buf[256];
 	va_list argp;
+	int l;
+
+	if (!weston_debug_scope_is_enabled(scope))
+		return 0;
 
+	/* The return value feeds the line wrapping in dump_property(). */
 	va_start(argp, fmt);
-	l = weston_vlog_continue(fmt, argp);
+	l = vsnprintf(buf, sizeof buf, fmt, argp);
 	va_end(argp);
 
+	if (l >= (int) sizeof buf)
+		l = sizeof buf - 1;
+	if (l > 0)
+		weston_debug_scope_write(scope, buf, l);
+
 	return l;
-#else
-	return 0;
-#endif
 }
 
 static void
@@ -277,6 +300,114 @@ wm_lookup_window(struct weston_wm *wm, xcb_window_t hash,
 	return false;
 }
 
+/* Replies the window manager needs are never waited for.  The cookie
+ * is queued here instead and the handler runs from
+ * weston_wm_handle_event() once the X server has answered, so a slow
+ * or busy client never stalls the compositor on a round-trip.
+ */
+struct weston_wm_pending_reply {
+	struct wl_list link; /* weston_wm::pending_reply_list */
+	unsigned int sequence;
+	struct weston_wm_window *window; /* NULL if not for a window */
+	void (*handler)(struct weston_wm_window *window, void *reply,
+			void *data);
+	void *data;
+};
+
+void
+weston_wm_expect_reply(struct weston_wm *wm, struct weston_wm_window *window,
+		       unsigned int sequence,
+		       void (*handler)(struct weston_wm_window *window,
+				       void *reply, void *data),
+		       void *data)
+{
+	struct weston_wm_pending_reply *pending;
+
+	pending = zalloc(sizeof *pending);
+	if (pending == NULL) {
+		/* Treat it like a failed request, same as a BadWindow. */
+		xcb_discard_reply(wm->conn, sequence);
+		handler(window, NULL, data);
+		return;
+	}
+
+	pending->sequence = sequence;
+	pending->window = window;
+	pending->handler = handler;
+	pending->data = data;
+	wl_list_insert(wm->pending_reply_list.prev, &pending->link);
+	if (window)
+		window->pending_replies++;
+}
+
+static void
+weston_wm_window_expect_reply(struct weston_wm_window *window,
+			      unsigned int sequence,
+			      void (*handler)(struct weston_wm_window *window,
+					      void *reply, void *data),
+			      void *data)
+{
+	weston_wm_expect_reply(window->wm, window, sequence, handler, data);
+}
+
+static int
+weston_wm_dispatch_replies(struct weston_wm *wm)
+{
+	struct weston_wm_pending_reply *pending;
+	xcb_generic_error_t *error;
+	void *reply;
+	int count = 0;
+
+	/* Replies arrive in request order, so stop at the first one
+	 * that is not there yet. */
+	while (!wl_list_empty(&wm->pending_reply_list)) {
+		pending = wl_container_of(wm->pending_reply_list.next,
+					  pending, link);
+		reply = NULL;
+		error = NULL;
+		if (!xcb_poll_for_reply(wm->conn, pending->sequence,
+					&reply, &error))
+			break;
+
+		free(error);
+		wl_list_remove(&pending->link);
+		if (pending->window)
+			pending->window->pending_replies--;
+		pending->handler(pending->window, reply, pending->data);
+		free(pending);
+		count++;
+	}
+
+	return count;
+}
+
+static void
+weston_wm_window_cancel_replies(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_pending_reply *pending, *tmp;
+	unsigned int i;
+
+	wl_list_for_each_safe(pending, tmp, &wm->pending_reply_list, link) {
+		if (pending->window != window)
+			continue;
+
+		xcb_discard_reply(wm->conn, pending->sequence);
+		wl_list_remove(&pending->link);
+		free(pending);
+	}
+	window->pending_replies = 0;
+
+	for (i = 0; i < ARRAY_LENGTH(window->property_reply); i++) {
+		free(window->property_reply[i]);
+		window->property_reply[i] = NULL;
+	}
+	window->properties_fetching = false;
+}
+
+/* Debugging aid only; anything its round-trip leaves queued is picked
+ * up by the post-dispatch check of the X event source, see
+ * weston_wm_create(). */
 const char *
 get_atom_name(xcb_connection_t *c, xcb_atom_t atom)
 {
@@ -387,13 +518,17 @@ dump_property(struct weston_wm *wm,
 	int width, len;
 	uint32_t i;
 
-	width = wm_log_continue("%s: ", get_atom_name(wm->conn, property));
+	/* Don't pay for the atom name round-trips just to log nothing. */
+	if (!weston_debug_scope_is_enabled(wm->server->wm_debug))
+		return;
+
+	width = wm_log_continue(wm, "%s: ", get_atom_name(wm->conn, property));
 	if (reply == NULL) {
-		wm_log_continue("(no reply)\n");
+		wm_log_continue(wm, "(no reply)\n");
 		return;
 	}
 
-	width += wm_log_continue("%s/%d, length %d (value_len %d): ",
+	width += wm_log_continue(wm, "%s/%d, length %d (value_len %d): ",
 				 get_atom_name(wm->conn, reply->type),
 				 reply->format,
 				 xcb_get_property_value_length(reply),
@@ -401,7 +536,7 @@ dump_property(struct weston_wm *wm,
 
 	if (reply->type == wm->atom.incr) {
 		incr_value = xcb_get_property_value(reply);
-		wm_log_continue("%d\n", *incr_value);
+		wm_log_continue(wm, "%d\n", *incr_value);
 	} else if (reply->type == wm->atom.utf8_string ||
 	      reply->type == wm->atom.string) {
 		text_value = xcb_get_property_value(reply);
@@ -409,62 +544,73 @@ dump_property(struct weston_wm *wm,
 			len = 40;
 		else
 			len = reply->value_len;
-		wm_log_continue("\"%.*s\"\n", len, text_value);
+		wm_log_continue(wm, "\"%.*s\"\n", len, text_value);
 	} else if (reply->type == XCB_ATOM_ATOM) {
 		atom_value = xcb_get_property_value(reply);
 		for (i = 0; i < reply->value_len; i++) {
 			name = get_atom_name(wm->conn, atom_value[i]);
 			if (width + strlen(name) + 2 > 78) {
-				wm_log_continue("\n    ");
+				wm_log_continue(wm, "\n    ");
 				width = 4;
 			} else if (i > 0) {
-				width +=  wm_log_continue(", ");
+				width +=  wm_log_continue(wm, ", ");
 			}
 
-			width +=  wm_log_continue("%s", name);
+			width +=  wm_log_continue(wm, "%s", name);
 		}
-		wm_log_continue("\n");
+		wm_log_continue(wm, "\n");
 	} else {
-		wm_log_continue("huh?\n");
+		wm_log_continue(wm, "huh?\n");
 	}
 }
 
 static void
-read_and_dump_property(struct weston_wm *wm,
-		       xcb_window_t window, xcb_atom_t property)
+dump_property_reply(struct weston_wm_window *window, void *reply, void *data)
 {
-	xcb_get_property_reply_t *reply;
-	xcb_get_property_cookie_t cookie;
+	xcb_atom_t property = (uintptr_t) data;
 
-	cookie = xcb_get_property(wm->conn, 0, window,
-				  property, XCB_ATOM_ANY, 0, 2048);
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
-
-	dump_property(wm, property, reply);
+	wm_log(window->wm, "XCB_PROPERTY_NOTIFY: window %d, ", window->id);
+	dump_property(window->wm, property, reply);
 
 	free(reply);
 }
 
+static void
+read_and_dump_property(struct weston_wm_window *window, xcb_atom_t property)
+{
+	struct weston_wm *wm = window->wm;
+	xcb_get_property_cookie_t cookie;
+
+	cookie = xcb_get_property(wm->conn, 0, window->id,
+				  property, XCB_ATOM_ANY, 0, 2048);
+	weston_wm_window_expect_reply(window, cookie.sequence,
+				      dump_property_reply,
+				      (void *) (uintptr_t) property);
+}
+
 /* We reuse some predefined, but otherwise useles atoms
  * as local type placeholders that never touch the X11 server,
- * to make weston_wm_window_read_properties() less exceptional.
+ * to make weston_wm_window_apply_properties() less exceptional.
  */
 #define TYPE_WM_PROTOCOLS	XCB_ATOM_CUT_BUFFER0
 #define TYPE_MOTIF_WM_HINTS	XCB_ATOM_CUT_BUFFER1
 #define TYPE_NET_WM_STATE	XCB_ATOM_CUT_BUFFER2
 #define TYPE_WM_NORMAL_HINTS	XCB_ATOM_CUT_BUFFER3
 
+struct weston_wm_property_info {
+	xcb_atom_t atom;
+	xcb_atom_t type;
+	void *ptr;
+};
+
 static void
-weston_wm_window_read_properties(struct weston_wm_window *window)
+weston_wm_window_get_property_info(struct weston_wm_window *window,
+				   struct weston_wm_property_info *info)
 {
 	struct weston_wm *wm = window->wm;
 
 #define F(field) (&window->field)
-	const struct {
-		xcb_atom_t atom;
-		xcb_atom_t type;
-		void *ptr;
-	} props[] = {
+	const struct weston_wm_property_info props[] = {
 		{ XCB_ATOM_WM_CLASS,           XCB_ATOM_STRING,            F(class) },
 		{ XCB_ATOM_WM_NAME,            XCB_ATOM_STRING,            F(name) },
 		{ XCB_ATOM_WM_TRANSIENT_FOR,   XCB_ATOM_WINDOW,            F(transient_for) },
@@ -479,24 +625,49 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	};
 #undef F
 
-	xcb_get_property_cookie_t cookie[ARRAY_LENGTH(props)];
+	static_assert(ARRAY_LENGTH(props) == WM_WINDOW_PROPERTY_COUNT,
+		      "property table and reply slots out of sync");
+
+	memcpy(info, props, sizeof props);
+}
+
+static bool
+weston_wm_window_is_tracked_property(struct weston_wm_window *window,
+				     xcb_atom_t atom)
+{
+	struct weston_wm_property_info props[WM_WINDOW_PROPERTY_COUNT];
+	unsigned int i;
+
+	weston_wm_window_get_property_info(window, props);
+	for (i = 0; i < ARRAY_LENGTH(props); i++)
+		if (props[i].atom == atom)
+			return true;
+
+	return false;
+}
+
+static void
+weston_wm_window_fetch_properties(struct weston_wm_window *window);
+
+static void
+weston_wm_window_map_shell_surface(struct weston_wm_window *window);
+
+static void
+weston_wm_window_schedule_repaint(struct weston_wm_window *window);
+
+static void
+weston_wm_window_apply_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_property_info props[WM_WINDOW_PROPERTY_COUNT];
 	xcb_get_property_reply_t *reply;
 	void *p;
 	uint32_t *xid;
 	xcb_atom_t *atom;
-	uint32_t i;
+	uint32_t i, j;
 	char name[1024];
 
-	if (!window->properties_dirty)
-		return;
-	window->properties_dirty = 0;
-
-	for (i = 0; i < ARRAY_LENGTH(props); i++)
-		cookie[i] = xcb_get_property(wm->conn,
-					     0, /* delete */
-					     window->id,
-					     props[i].atom,
-					     XCB_ATOM_ANY, 0, 2048);
+	weston_wm_window_get_property_info(window, props);
 
 	window->decorate = window->override_redirect ? 0 : MWM_DECOR_EVERYTHING;
 	window->size_hints.flags = 0;
@@ -504,7 +675,8 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	window->delete_window = 0;
 
 	for (i = 0; i < ARRAY_LENGTH(props); i++)  {
-		reply = xcb_get_property_reply(wm->conn, cookie[i], NULL);
+		reply = window->property_reply[i];
+		window->property_reply[i] = NULL;
 		if (!reply)
 			/* Bad window, typically */
 			continue;
@@ -541,8 +713,8 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 			break;
 		case TYPE_WM_PROTOCOLS:
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.wm_delete_window) {
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.wm_delete_window) {
 					window->delete_window = 1;
 					break;
 				}
@@ -555,12 +727,12 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		case TYPE_NET_WM_STATE:
 			window->fullscreen = 0;
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++) {
-				if (atom[i] == wm->atom.net_wm_state_fullscreen)
+			for (j = 0; j < reply->value_len; j++) {
+				if (atom[j] == wm->atom.net_wm_state_fullscreen)
 					window->fullscreen = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_vert)
+				if (atom[j] == wm->atom.net_wm_state_maximized_vert)
 					window->maximized_vert = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_horz)
+				if (atom[j] == wm->atom.net_wm_state_maximized_horz)
 					window->maximized_horz = 1;
 			}
 			break;
@@ -599,6 +771,73 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		if (!window->machine || strcmp(window->machine, name))
 			window->pid = 0;
 	}
+
+	window->properties_fetching = false;
+
+	/* Something changed while the replies were in flight, the values
+	 * we just parsed may already be stale. */
+	if (window->properties_dirty) {
+		weston_wm_window_fetch_properties(window);
+		return;
+	}
+
+	if (window->shell_map_pending) {
+		window->shell_map_pending = false;
+		if (window->surface && !window->shsurf) {
+			weston_wm_window_map_shell_surface(window);
+			return;
+		}
+	}
+
+	if (window->frame_id != XCB_WINDOW_NONE || window->surface)
+		weston_wm_window_schedule_repaint(window);
+}
+
+static void
+weston_wm_window_handle_property_reply(struct weston_wm_window *window,
+				       void *reply, void *data)
+{
+	uintptr_t i = (uintptr_t) data;
+
+	window->property_reply[i] = reply;
+
+	/* Replies come back in request order, the last one completes
+	 * the set. */
+	if (i == WM_WINDOW_PROPERTY_COUNT - 1)
+		weston_wm_window_apply_properties(window);
+}
+
+/* Issue GetProperty for everything we track in one batch.  The
+ * replies are collected by weston_wm_window_handle_property_reply()
+ * and parsed together, so the window never sees a half-updated set.
+ */
+static void
+weston_wm_window_fetch_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_property_info props[WM_WINDOW_PROPERTY_COUNT];
+	xcb_get_property_cookie_t cookie;
+	uintptr_t i;
+
+	if (window->properties_fetching) {
+		window->properties_dirty = 1;
+		return;
+	}
+
+	window->properties_dirty = 0;
+	window->properties_fetching = true;
+
+	weston_wm_window_get_property_info(window, props);
+	for (i = 0; i < ARRAY_LENGTH(props); i++) {
+		cookie = xcb_get_property(wm->conn,
+					  0, /* delete */
+					  window->id,
+					  props[i].atom,
+					  XCB_ATOM_ANY, 0, 2048);
+		weston_wm_window_expect_reply(window, cookie.sequence,
+					      weston_wm_window_handle_property_reply,
+					      (void *) i);
+	}
 }
 
 #undef TYPE_WM_PROTOCOLS
@@ -676,7 +915,7 @@ weston_wm_handle_configure_request(struct weston_wm *wm, xcb_generic_event_t *ev
 	uint32_t mask, values[16];
 	int x, y, width, height, i = 0;
 
-	wm_log("XCB_CONFIGURE_REQUEST (window %d) %d,%d @ %dx%d\n",
+	wm_log(wm, "XCB_CONFIGURE_REQUEST (window %d) %d,%d @ %dx%d\n",
 	       configure_request->window,
 	       configure_request->x, configure_request->y,
 	       configure_request->width, configure_request->height);
@@ -745,7 +984,7 @@ weston_wm_handle_configure_notify(struct weston_wm *wm, xcb_generic_event_t *eve
 		wm->server->compositor->xwayland_interface;
 	struct weston_wm_window *window;
 
-	wm_log("XCB_CONFIGURE_NOTIFY (window %d) %d,%d @ %dx%d%s\n",
+	wm_log(wm, "XCB_CONFIGURE_NOTIFY (window %d) %d,%d @ %dx%d%s\n",
 	       configure_notify->window,
 	       configure_notify->x, configure_notify->y,
 	       configure_notify->width, configure_notify->height,
@@ -798,7 +1037,7 @@ weston_wm_create_surface(struct wl_listener *listener, void *data)
 	if (wl_resource_get_client(surface->resource) != wm->server->client)
 		return;
 
-	wm_log("XWM: create weston_surface %p\n", surface);
+	wm_log(wm, "XWM: create weston_surface %p\n", surface);
 
 	wl_list_for_each(window, &wm->unpaired_window_list, link)
 		if (window->surface_id ==
@@ -1055,7 +1294,7 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 	struct weston_output *output;
 
 	if (our_resource(wm, map_request->window)) {
-		wm_log("XCB_MAP_REQUEST (window %d, ours)\n",
+		wm_log(wm, "XCB_MAP_REQUEST (window %d, ours)\n",
 		       map_request->window);
 		return;
 	}
@@ -1063,7 +1302,9 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 	if (!wm_lookup_window(wm, map_request->window, &window))
 		return;
 
-	weston_wm_window_read_properties(window);
+	/* weston_wm_handle_event() holds MapRequest back until the
+	 * property replies for the window are in, so the values used
+	 * here are up to date. */
 
 	/* For a new Window, MapRequest happens before the Window is realized
 	 * in Xwayland. We do the real xcb_map_window() here as a response to
@@ -1085,7 +1326,10 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 		weston_wm_window_create_frame(window); /* sets frame_id */
 	assert(window->frame_id != XCB_WINDOW_NONE);
 
-	wm_log("XCB_MAP_REQUEST (window %d, %p, frame %d, %dx%d @ %d,%d)\n",
+	/* The frame window lost its contents while it was unmapped. */
+	frame_repaint_invalidate(window->frame);
+
+	wm_log(wm, "XCB_MAP_REQUEST (window %d, %p, frame %d, %dx%d @ %d,%d)\n",
 	       window->id, window, window->frame_id,
 	       window->width, window->height,
 	       window->map_request_x, window->map_request_y);
@@ -1116,12 +1360,12 @@ weston_wm_handle_map_notify(struct weston_wm *wm, xcb_generic_event_t *event)
 	xcb_map_notify_event_t *map_notify = (xcb_map_notify_event_t *) event;
 
 	if (our_resource(wm, map_notify->window)) {
-		wm_log("XCB_MAP_NOTIFY (window %d, ours)\n",
+		wm_log(wm, "XCB_MAP_NOTIFY (window %d, ours)\n",
 		       map_notify->window);
 			return;
 	}
 
-	wm_log("XCB_MAP_NOTIFY (window %d%s)\n", map_notify->window,
+	wm_log(wm, "XCB_MAP_NOTIFY (window %d%s)\n", map_notify->window,
 	       map_notify->override_redirect ? ", override" : "");
 }
 
@@ -1132,7 +1376,7 @@ weston_wm_handle_unmap_notify(struct weston_wm *wm, xcb_generic_event_t *event)
 		(xcb_unmap_notify_event_t *) event;
 	struct weston_wm_window *window;
 
-	wm_log("XCB_UNMAP_NOTIFY (window %d, event %d%s)\n",
+	wm_log(wm, "XCB_UNMAP_NOTIFY (window %d, event %d%s)\n",
 	       unmap_notify->window,
 	       unmap_notify->event,
 	       our_resource(wm, unmap_notify->window) ? ", ours" : "");
@@ -1162,6 +1406,7 @@ weston_wm_handle_unmap_notify(struct weston_wm *wm, xcb_generic_event_t *event)
 		wl_list_remove(&window->surface_destroy_listener.link);
 	window->surface = NULL;
 	window->shsurf = NULL;
+	window->shell_map_pending = false;
 
 	weston_wm_window_set_wm_state(window, ICCCM_WITHDRAWN_STATE);
 	weston_wm_window_set_virtual_desktop(window, -1);
@@ -1175,7 +1420,7 @@ weston_wm_window_draw_decoration(struct weston_wm_window *window)
 	cairo_t *cr;
 	int width, height;
 
-	wm_log("XWM: draw decoration, win %d\n", window->id);
+	wm_log(window->wm, "XWM: draw decoration, win %d\n", window->id);
 
 	weston_wm_window_get_frame_size(window, &width, &height);
 
@@ -1184,16 +1429,14 @@ weston_wm_window_draw_decoration(struct weston_wm_window *window)
 
 	if (window->fullscreen) {
 		/* nothing */
+		frame_repaint_invalidate(window->frame);
 	} else if (window->decorate) {
 		frame_set_title(window->frame, window->name);
-		frame_repaint(window->frame, cr);
+		frame_repaint_cached(window->frame, cr);
 	} else {
-		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-		cairo_set_source_rgba(cr, 0, 0, 0, 0);
-		cairo_paint(cr);
-
-		render_shadow(cr, window->wm->theme->shadow,
-			      2, 2, width + 8, height + 8, 64, 64);
+		theme_render_border(window->wm->theme, cr, width, height,
+				    THEME_FRAME_SHADOW_ONLY);
+		frame_repaint_invalidate(window->frame);
 	}
 
 	cairo_destroy(cr);
@@ -1238,7 +1481,7 @@ weston_wm_window_set_pending_state(struct weston_wm_window *window)
 		input_h = height;
 	}
 
-	wm_log("XWM: win %d geometry: %d,%d %dx%d\n",
+	wm_log(window->wm, "XWM: win %d geometry: %d,%d %dx%d\n",
 	       window->id, input_x, input_y, input_w, input_h);
 
 	pixman_region32_fini(&window->surface->pending.input);
@@ -1261,8 +1504,6 @@ weston_wm_window_do_repaint(void *data)
 
 	window->repaint_source = NULL;
 
-	weston_wm_window_read_properties(window);
-
 	weston_wm_window_draw_decoration(window);
 	weston_wm_window_set_pending_state(window);
 }
@@ -1306,7 +1547,7 @@ weston_wm_window_schedule_repaint(struct weston_wm_window *window)
 	if (window->repaint_source)
 		return;
 
-	wm_log("XWM: schedule repaint, win %d\n", window->id);
+	wm_log(wm, "XWM: schedule repaint, win %d\n", window->id);
 
 	window->repaint_source =
 		wl_event_loop_add_idle(wm->server->loop,
@@ -1323,19 +1564,34 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 	if (!wm_lookup_window(wm, property_notify->window, &window))
 		return;
 
-	window->properties_dirty = 1;
-
-	wm_log("XCB_PROPERTY_NOTIFY: window %d, ", property_notify->window);
-	if (property_notify->state == XCB_PROPERTY_DELETE)
-		wm_log_continue("deleted %s\n",
+	if (!weston_debug_scope_is_enabled(wm->server->wm_debug)) {
+		/* nothing to trace */
+	} else if (property_notify->state == XCB_PROPERTY_DELETE) {
+		wm_log(wm, "XCB_PROPERTY_NOTIFY: window %d, ",
+		       property_notify->window);
+		wm_log_continue(wm, "deleted %s\n",
 				get_atom_name(wm->conn, property_notify->atom));
-	else
-		read_and_dump_property(wm, property_notify->window,
-				       property_notify->atom);
+	} else {
+		read_and_dump_property(window, property_notify->atom);
+	}
 
-	if (property_notify->atom == wm->atom.net_wm_name ||
-	    property_notify->atom == XCB_ATOM_WM_NAME)
-		weston_wm_window_schedule_repaint(window);
+	/* The repaint is scheduled once the new values have arrived. */
+	if (weston_wm_window_is_tracked_property(window,
+						 property_notify->atom))
+		weston_wm_window_fetch_properties(window);
+}
+
+static void
+weston_wm_window_handle_geometry_reply(struct weston_wm_window *window,
+				       void *reply, void *data)
+{
+	xcb_get_geometry_reply_t *geometry_reply = reply;
+
+	/* technically we should use XRender and check the visual format's
+	alpha_mask, but checking depth is simpler and works in all known cases */
+	if (geometry_reply != NULL)
+		window->has_alpha = geometry_reply->depth == 32;
+	free(geometry_reply);
 }
 
 static void
@@ -1345,23 +1601,19 @@ weston_wm_window_create(struct weston_wm *wm,
 	struct weston_wm_window *window;
 	uint32_t values[1];
 	xcb_get_geometry_cookie_t geometry_cookie;
-	xcb_get_geometry_reply_t *geometry_reply;
 
 	window = zalloc(sizeof *window);
 	if (window == NULL) {
-		wm_log("failed to allocate window\n");
+		wm_log(wm, "failed to allocate window\n");
 		return;
 	}
 
-	geometry_cookie = xcb_get_geometry(wm->conn, id);
-
 	values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE |
                     XCB_EVENT_MASK_FOCUS_CHANGE;
 	xcb_change_window_attributes(wm->conn, id, XCB_CW_EVENT_MASK, values);
 
 	window->wm = wm;
 	window->id = id;
-	window->properties_dirty = 1;
 	window->override_redirect = override;
 	window->width = width;
 	window->height = height;
@@ -1372,12 +1624,14 @@ weston_wm_window_create(struct weston_wm *wm,
 	window->map_request_y = INT_MIN; /* out of range for valid positions */
 	weston_output_weak_ref_init(&window->legacy_fullscreen_output);
 
-	geometry_reply = xcb_get_geometry_reply(wm->conn, geometry_cookie, NULL);
-	/* technically we should use XRender and check the visual format's
-	alpha_mask, but checking depth is simpler and works in all known cases */
-	if (geometry_reply != NULL)
-		window->has_alpha = geometry_reply->depth == 32;
-	free(geometry_reply);
+	/* Start reading everything we need right away, by the time the
+	 * client asks for the window to be mapped the replies are
+	 * usually in. */
+	geometry_cookie = xcb_get_geometry(wm->conn, id);
+	weston_wm_window_expect_reply(window, geometry_cookie.sequence,
+				      weston_wm_window_handle_geometry_reply,
+				      NULL);
+	weston_wm_window_fetch_properties(window);
 
 	hash_table_insert(wm->window_hash, id, window);
 }
@@ -1387,6 +1641,7 @@ weston_wm_window_destroy(struct weston_wm_window *window)
 {
 	struct weston_wm *wm = window->wm;
 
+	weston_wm_window_cancel_replies(window);
 	weston_output_weak_ref_clear(&window->legacy_fullscreen_output);
 
 	if (window->repaint_source)
@@ -1422,7 +1677,7 @@ weston_wm_handle_create_notify(struct weston_wm *wm, xcb_generic_event_t *event)
 	xcb_create_notify_event_t *create_notify =
 		(xcb_create_notify_event_t *) event;
 
-	wm_log("XCB_CREATE_NOTIFY (window %d, at (%d, %d), width %d, height %d%s%s)\n",
+	wm_log(wm, "XCB_CREATE_NOTIFY (window %d, at (%d, %d), width %d, height %d%s%s)\n",
 	       create_notify->window,
 	       create_notify->x, create_notify->y,
 	       create_notify->width, create_notify->height,
@@ -1445,7 +1700,7 @@ weston_wm_handle_destroy_notify(struct weston_wm *wm, xcb_generic_event_t *event
 		(xcb_destroy_notify_event_t *) event;
 	struct weston_wm_window *window;
 
-	wm_log("XCB_DESTROY_NOTIFY, win %d, event %d%s\n",
+	wm_log(wm, "XCB_DESTROY_NOTIFY, win %d, event %d%s\n",
 	       destroy_notify->window,
 	       destroy_notify->event,
 	       our_resource(wm, destroy_notify->window) ? ", ours" : "");
@@ -1466,7 +1721,7 @@ weston_wm_handle_reparent_notify(struct weston_wm *wm, xcb_generic_event_t *even
 		(xcb_reparent_notify_event_t *) event;
 	struct weston_wm_window *window;
 
-	wm_log("XCB_REPARENT_NOTIFY (window %d, parent %d, event %d%s)\n",
+	wm_log(wm, "XCB_REPARENT_NOTIFY (window %d, parent %d, event %d%s)\n",
 	       reparent_notify->window,
 	       reparent_notify->parent,
 	       reparent_notify->event,
@@ -1677,7 +1932,7 @@ surface_destroy(struct wl_listener *listener, void *data)
 		container_of(listener,
 			     struct weston_wm_window, surface_destroy_listener);
 
-	wm_log("surface for xid %d destroyed\n", window->id);
+	wm_log(window->wm, "surface for xid %d destroyed\n", window->id);
 
 	/* This should have been freed by the shell.
 	 * Don't try to use it later. */
@@ -1693,7 +1948,7 @@ weston_wm_window_handle_surface_id(struct weston_wm_window *window,
 	struct wl_resource *resource;
 
 	if (window->surface_id != 0) {
-		wm_log("already have surface id for window %d\n", window->id);
+		wm_log(wm, "already have surface id for window %d\n", window->id);
 		return;
 	}
 
@@ -1725,7 +1980,7 @@ weston_wm_handle_client_message(struct weston_wm *wm,
 		(xcb_client_message_event_t *) event;
 	struct weston_wm_window *window;
 
-	wm_log("XCB_CLIENT_MESSAGE (%s %d %d %d %d %d win %d)\n",
+	wm_log(wm, "XCB_CLIENT_MESSAGE (%s %d %d %d %d %d win %d)\n",
 	       get_atom_name(wm->conn, client_message->type),
 	       client_message->data.data32[0],
 	       client_message->data.data32[1],
@@ -1950,7 +2205,7 @@ weston_wm_handle_button(struct weston_wm *wm, xcb_generic_event_t *event)
 	uint32_t button_id;
 	uint32_t double_click = 0;
 
-	wm_log("XCB_BUTTON_%s (detail %d)\n",
+	wm_log(wm, "XCB_BUTTON_%s (detail %d)\n",
 	       button->response_type == XCB_BUTTON_PRESS ?
 	       "PRESS" : "RELEASE", button->detail);
 
@@ -2105,6 +2360,53 @@ weston_wm_handle_focus_in(struct weston_wm *wm, xcb_generic_event_t *event)
 		weston_wm_send_focus_window(wm, wm->focus_window);
 }
 
+static bool
+weston_wm_event_needs_replies(struct weston_wm *wm, xcb_generic_event_t *event)
+{
+	xcb_map_request_event_t *map_request;
+	struct weston_wm_window *window;
+
+	if (EVENT_TYPE(event) != XCB_MAP_REQUEST)
+		return false;
+
+	map_request = (xcb_map_request_event_t *) event;
+	if (our_resource(wm, map_request->window) ||
+	    !wm_lookup_window(wm, map_request->window, &window))
+		return false;
+
+	return window->pending_replies > 0;
+}
+
+/* Returns the next event to handle, or NULL if there is none or the
+ * next one has to wait for outstanding replies.  A held back event
+ * blocks everything behind it so events are still handled in order.
+ */
+static xcb_generic_event_t *
+weston_wm_next_event(struct weston_wm *wm, int *count)
+{
+	xcb_generic_event_t *event;
+
+	*count += weston_wm_dispatch_replies(wm);
+
+	if (wm->stalled_event) {
+		event = wm->stalled_event;
+		wm->stalled_event = NULL;
+	} else {
+		event = xcb_poll_for_event(wm->conn);
+		if (event == NULL)
+			return NULL;
+		/* Reading the event may have read replies as well. */
+		*count += weston_wm_dispatch_replies(wm);
+	}
+
+	if (weston_wm_event_needs_replies(wm, event)) {
+		wm->stalled_event = event;
+		return NULL;
+	}
+
+	return event;
+}
+
 static int
 weston_wm_handle_event(int fd, uint32_t mask, void *data)
 {
@@ -2112,7 +2414,7 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 	xcb_generic_event_t *event;
 	int count = 0;
 
-	while (event = xcb_poll_for_event(wm->conn), event != NULL) {
+	while (event = weston_wm_next_event(wm, &count), event != NULL) {
 		if (weston_wm_handle_selection_event(wm, event)) {
 			free(event);
 			count++;
@@ -2164,7 +2466,7 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 			weston_wm_handle_destroy_notify(wm, event);
 			break;
 		case XCB_MAPPING_NOTIFY:
-			wm_log("XCB_MAPPING_NOTIFY\n");
+			wm_log(wm, "XCB_MAPPING_NOTIFY\n");
 			break;
 		case XCB_PROPERTY_NOTIFY:
 			weston_wm_handle_property_notify(wm, event);
@@ -2187,6 +2489,32 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 	return count;
 }
 
+static void
+weston_wm_dispatch_idle(void *data)
+{
+	struct weston_wm *wm = data;
+
+	wm->dispatch_idle = NULL;
+	weston_wm_handle_event(-1, 0, wm);
+}
+
+/* A synchronous xcb_*_reply() reads everything the X server has sent so
+ * far, including replies in pending_reply_list and the events behind
+ * them, into xcb's queues.  The X fd then does not become readable for
+ * them again, so call this after such a call to have them handled from
+ * an idle callback instead of waiting for the next X traffic.
+ */
+void
+weston_wm_schedule_dispatch(struct weston_wm *wm)
+{
+	if (wm->dispatch_idle || wl_list_empty(&wm->pending_reply_list))
+		return;
+
+	wm->dispatch_idle =
+		wl_event_loop_add_idle(wm->server->loop,
+				       weston_wm_dispatch_idle, wm);
+}
+
 static void
 weston_wm_set_net_active_window(struct weston_wm *wm, xcb_window_t window) {
 	xcb_change_property(wm->conn, XCB_PROP_MODE_REPLACE,
@@ -2432,6 +2760,7 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 		return NULL;
 
 	wm->server = wxs;
+	wl_list_init(&wm->pending_reply_list);
 	wm->window_hash = hash_table_create();
 	if (wm->window_hash == NULL) {
 		free(wm);
@@ -2456,6 +2785,8 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 		wl_event_loop_add_fd(loop, fd,
 				     WL_EVENT_READABLE,
 				     weston_wm_handle_event, wm);
+	/* Run weston_wm_handle_event() after every event loop iteration
+	 * too, for replies and events already read into xcb's queues. */
 	wl_event_source_check(wm->source);
 
 	weston_wm_get_resources(wm);
@@ -2521,6 +2852,14 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 void
 weston_wm_destroy(struct weston_wm *wm)
 {
+	struct weston_wm_pending_reply *pending, *tmp;
+
+	wl_list_for_each_safe(pending, tmp, &wm->pending_reply_list, link)
+		free(pending);
+	free(wm->stalled_event);
+	if (wm->dispatch_idle)
+		wl_event_source_remove(wm->dispatch_idle);
+
 	/* FIXME: Free windows in hash. */
 	hash_table_destroy(wm->window_hash);
 	weston_wm_destroy_cursors(wm);
@@ -2736,24 +3075,6 @@ static void
 xserver_map_shell_surface(struct weston_wm_window *window,
 			  struct weston_surface *surface)
 {
-	struct weston_wm *wm = window->wm;
-	struct weston_desktop_xwayland *xwayland =
-		wm->server->compositor->xwayland;
-	const struct weston_desktop_xwayland_interface *xwayland_interface =
-		wm->server->compositor->xwayland_interface;
-	struct weston_wm_window *parent;
-
-	/* This should be necessary only for override-redirected windows,
-	 * because otherwise MapRequest handler would have already updated
-	 * the properties. However, if X11 clients set properties after
-	 * sending MapWindow, here we can still process them. The decorations
-	 * have already been drawn once with the old property values, so if the
-	 * app changes something affecting decor after MapWindow, we glitch.
-	 * We only hit xserver_map_shell_surface() once per MapWindow and
-	 * wl_surface, so better ensure we get the window type right.
-	 */
-	weston_wm_window_read_properties(window);
-
 	/* A weston_wm_window may have many different surfaces assigned
 	 * throughout its life, so we must make sure to remove the listener
 	 * from the old surface signal list. */
@@ -2765,6 +3086,31 @@ xserver_map_shell_surface(struct weston_wm_window *window,
 	wl_signal_add(&window->surface->destroy_signal,
 		      &window->surface_destroy_listener);
 
+	/* Override-redirect windows never go through MapRequest, and
+	 * X11 clients may also set properties after sending MapWindow.
+	 * We only hit xserver_map_shell_surface() once per MapWindow and
+	 * wl_surface, so if a property update is still in flight wait for
+	 * it to get the window type right;
+	 * weston_wm_window_apply_properties() finishes the job.
+	 */
+	if (window->properties_fetching) {
+		window->shell_map_pending = true;
+		return;
+	}
+
+	weston_wm_window_map_shell_surface(window);
+}
+
+static void
+weston_wm_window_map_shell_surface(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_desktop_xwayland *xwayland =
+		wm->server->compositor->xwayland;
+	const struct weston_desktop_xwayland_interface *xwayland_interface =
+		wm->server->compositor->xwayland_interface;
+	struct weston_wm_window *parent;
+
 	if (!xwayland_interface)
 		return;
 
@@ -2780,7 +3126,7 @@ xserver_map_shell_surface(struct weston_wm_window *window,
 						   window->surface,
 						   &shell_client);
 
-	wm_log("XWM: map shell surface, win %d, weston_surface %p, xwayland surface %p\n",
+	wm_log(wm, "XWM: map shell surface, win %d, weston_surface %p, xwayland surface %p\n",
 	       window->id, window->surface, window->shsurf);
 
 	if (window->name)
@@ -51,6 +51,8 @@ struct weston_xserver {
 	struct wl_listener destroy_listener;
 	weston_xwayland_spawn_xserver_func_t spawn_func;
 	void *user_data;
+
+	struct weston_debug_scope *wm_debug;
 };
 
 struct weston_wm {
@@ -72,6 +74,9 @@ struct weston_wm {
 	struct wl_listener activate_listener;
 	struct wl_listener kill_listener;
 	struct wl_list unpaired_window_list;
+	struct wl_list pending_reply_list;
+	xcb_generic_event_t *stalled_event;
+	struct wl_event_source *dispatch_idle;
 
 	xcb_window_t selection_window;
 	xcb_window_t selection_owner;
@@ -80,6 +85,12 @@ struct weston_wm {
 	struct wl_event_source *property_source;
 	xcb_get_property_reply_t *property_reply;
 	int property_start;
+	uint32_t property_offset;
+	/* A GetProperty for the next slice is in flight */
+	bool property_requested;
+	/* Replies still to come for transfers that were aborted */
+	int property_stale_replies;
+	uint32_t selection_chunk_size;
 	struct wl_array source_data;
 	xcb_selection_request_event_t selection_request;
 	xcb_atom_t selection_target;
@@ -171,6 +182,17 @@ int
 weston_wm_handle_selection_event(struct weston_wm *wm,
 				 xcb_generic_event_t *event);
 
+struct weston_wm_window;
+
+void
+weston_wm_expect_reply(struct weston_wm *wm, struct weston_wm_window *window,
+		       unsigned int sequence,
+		       void (*handler)(struct weston_wm_window *window,
+				       void *reply, void *data),
+		       void *data);
+void
+weston_wm_schedule_dispatch(struct weston_wm *wm);
+
 struct weston_wm *
 weston_wm_create(struct weston_xserver *wxs, int fd);
 void